@@ -0,0 +1,193 @@
+# embedded static assets
+#
+# included: defines ws_embed_assets(target dir urlPrefix), the files below dir (recursively) are served by target
+# under urlPrefix (e.g. "/static", "" for the root), a dir/index.html is also served as dir/
+# run with -P: generates wsAssets.h (included by webserver.c with WS_ASSETS defined) from DIR, PREFIX, OUT & GZIP
+#
+# every asset carries its bytes, a sha1 based ETag, a gzip variant (if gzip is found and it's smaller) with an ETag
+# of its own and the status line & header fields of the 200 & 304 responses of both serialized as for static routes
+# the table is sorted by path, lookups are a binary search without any startup work
+
+if(NOT CMAKE_SCRIPT_MODE_FILE)
+  set(WS_EMBED_ASSETS_SCRIPT "${CMAKE_CURRENT_LIST_FILE}")
+
+  # files added to dir require a cmake re-run, modified ones are picked up by the build
+  function(ws_embed_assets target dir urlPrefix)
+    get_filename_component(dir "${dir}" ABSOLUTE)
+    file(GLOB_RECURSE assets "${dir}/*")
+    find_program(WS_GZIP gzip)
+    # per target, the binary & the library embed the assets each
+    set(outDir "${CMAKE_CURRENT_BINARY_DIR}/wsAssets/${target}")
+    add_custom_command(OUTPUT "${outDir}/wsAssets.h"
+      COMMAND "${CMAKE_COMMAND}" "-DDIR=${dir}" "-DPREFIX=${urlPrefix}" "-DOUT=${outDir}/wsAssets.h" "-DGZIP=${WS_GZIP}" -P "${WS_EMBED_ASSETS_SCRIPT}"
+      DEPENDS ${assets} "${WS_EMBED_ASSETS_SCRIPT}"
+      COMMENT "Embedding the assets of ${dir}"
+      VERBATIM)
+    target_sources(${target} PRIVATE "${outDir}/wsAssets.h")
+    target_include_directories(${target} PRIVATE "${outDir}")
+    target_compile_definitions(${target} PRIVATE WS_ASSETS)
+  endfunction()
+  return()
+endif()
+
+string(ASCII 13 CR)
+string(ASCII 10 LF)
+set(CRLF "${CR}${LF}")
+
+# content type by file extension
+function(wsAssetContentType file outVar)
+  get_filename_component(ext "${file}" EXT)
+  string(TOLOWER "${ext}" ext)
+  string(REGEX REPLACE "^.*\\." "" ext "${ext}")
+  set(types
+    html "text/html" htm "text/html" css "text/css" js "text/javascript" mjs "text/javascript" json "application/json"
+    txt "text/plain" xml "application/xml" svg "image/svg+xml" png "image/png" jpg "image/jpeg" jpeg "image/jpeg"
+    gif "image/gif" webp "image/webp" ico "image/x-icon" wasm "application/wasm" woff "font/woff" woff2 "font/woff2"
+    pdf "application/pdf" map "application/json")
+  set(type "application/octet-stream")
+  list(FIND types "${ext}" index)
+  if(index GREATER -1 AND ext)
+    math(EXPR index "${index} + 1")
+    list(GET types ${index} type)
+  endif()
+  set(${outVar} "${type}" PARENT_SCOPE)
+endfunction()
+
+# C string literal of value
+function(wsCString value outVar)
+  string(REPLACE "\\" "\\\\" value "${value}")
+  string(REPLACE "\"" "\\\"" value "${value}")
+  string(REPLACE "${CR}" "\\r" value "${value}")
+  string(REPLACE "${LF}" "\\n" value "${value}")
+  set(${outVar} "\"${value}\"" PARENT_SCOPE)
+endfunction()
+
+# C array initializer & size of the file content
+function(wsCArray file outVar outSize)
+  file(READ "${file}" hex HEX)
+  string(LENGTH "${hex}" size)
+  math(EXPR size "${size} / 2")
+  if(size EQUAL 0)
+    set(${outVar} "0" PARENT_SCOPE)
+  else()
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    # 16 bytes per line
+    string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n  " bytes "${bytes}")
+    set(${outVar} "${bytes}" PARENT_SCOPE)
+  endif()
+  set(${outSize} ${size} PARENT_SCOPE)
+endfunction()
+
+# wsAssetVariant initializer, the header as serializeHeader writes it (status line, Content-type, Content-length,
+# Connection, further fields, empty line) per keepAlive
+function(wsAssetVariant statusLine statusCode contentType size fields data outVar)
+  set(framing "")
+  if(contentType)
+    set(framing "Content-type: ${contentType}${CRLF}")
+  endif()
+  if(size GREATER -1)
+    set(framing "${framing}Content-length: ${size}${CRLF}")
+  else()
+    set(size 0)
+  endif()
+  set(close "${statusLine}${CRLF}${framing}Connection: close${CRLF}${fields}${CRLF}")
+  set(keepAlive "${statusLine}${CRLF}${framing}Connection: keep-alive${CRLF}${fields}${CRLF}")
+  string(LENGTH "${close}" closeSize)
+  string(LENGTH "${keepAlive}" keepAliveSize)
+  string(LENGTH "${fields}" fieldsSize)
+  wsCString("${close}" close)
+  wsCString("${keepAlive}" keepAlive)
+  wsCString("${fields}" fields)
+  set(${outVar} "{.statusCode = ${statusCode}, .header = {${close}, ${keepAlive}}, .headerSize = {${closeSize}, ${keepAliveSize}},\n    .fields = ${fields}, .fieldsSize = ${fieldsSize}, .body = ${data}, .bodySize = ${size}}" PARENT_SCOPE)
+endfunction()
+
+file(GLOB_RECURSE files RELATIVE "${DIR}" "${DIR}/*")
+list(SORT files)
+set(urls "")
+foreach(file IN LISTS files)
+  list(APPEND urls "${PREFIX}/${file}")
+  if(file MATCHES "(^|/)index\\.html$")
+    string(REGEX REPLACE "index\\.html$" "" dirUrl "${PREFIX}/${file}")
+    list(APPEND urls "${dirUrl}")
+  endif()
+endforeach()
+# bytewise, as compared by strcmp
+list(SORT urls)
+
+# per file (in the order of files): data & gzip array names, sizes (-1 without gzip variant) & ETags
+set(data "")
+set(sizes "")
+set(gzipSizes "")
+set(etags "")
+set(index 0)
+foreach(file IN LISTS files)
+  set(path "${DIR}/${file}")
+  wsCArray("${path}" bytes size)
+  string(APPEND data "static const unsigned char wsAssetData${index}[] = {\n  ${bytes}};\n")
+  list(APPEND sizes ${size})
+  file(SHA1 "${path}" sha)
+  string(SUBSTRING "${sha}" 0 20 sha)
+  list(APPEND etags "\"${sha}\"")
+  set(gzipSize -1)
+  if(GZIP AND size GREATER 0)
+    set(gzipFile "${OUT}.gz.tmp")
+    execute_process(COMMAND "${GZIP}" -9 -n -c "${path}" OUTPUT_FILE "${gzipFile}" RESULT_VARIABLE result)
+    if(result EQUAL 0)
+      wsCArray("${gzipFile}" gzipBytes compressedSize)
+      # only variants saving at least a tenth are kept
+      math(EXPR maxSize "${size} - ${size} / 10")
+      if(compressedSize LESS maxSize)
+        string(APPEND data "static const unsigned char wsAssetGzip${index}[] = {\n  ${gzipBytes}};\n")
+        set(gzipSize ${compressedSize})
+      endif()
+    endif()
+    file(REMOVE "${gzipFile}")
+  endif()
+  list(APPEND gzipSizes ${gzipSize})
+  math(EXPR index "${index} + 1")
+endforeach()
+
+set(table "")
+list(LENGTH urls nAssets)
+string(LENGTH "${PREFIX}/" prefixSize)
+foreach(url IN LISTS urls)
+  # the file of the url, dir/ is served from dir/index.html
+  string(SUBSTRING "${url}" ${prefixSize} -1 file)
+  if(url MATCHES "/$")
+    set(file "${file}index.html")
+  endif()
+  list(FIND files "${file}" index)
+  list(GET sizes ${index} size)
+  list(GET gzipSizes ${index} gzipSize)
+  list(GET etags ${index} etag)
+  wsAssetContentType("${file}" contentType)
+  set(fields "ETag: ${etag}${CRLF}")
+  set(gzipEtagLiteral "NULL")
+  set(gzip "{.header = {NULL, NULL}}")
+  set(gzipNotModified "{.header = {NULL, NULL}}")
+  if(gzipSize GREATER -1)
+    set(fields "${fields}Vary: Accept-Encoding${CRLF}")
+    # strong validators differ per content coding
+    string(REGEX REPLACE "\"$" "-gz\"" gzipEtag "${etag}")
+    set(gzipFields "ETag: ${gzipEtag}${CRLF}Vary: Accept-Encoding${CRLF}")
+    wsCString("${gzipEtag}" gzipEtagLiteral)
+    wsAssetVariant("HTTP/1.1 200 OK" 200 "${contentType}" ${gzipSize} "${gzipFields}Content-Encoding: gzip${CRLF}" "(const char*)wsAssetGzip${index}" gzip)
+    wsAssetVariant("HTTP/1.1 304 Not Modified" 304 "" -1 "${gzipFields}" "NULL" gzipNotModified)
+  endif()
+  wsAssetVariant("HTTP/1.1 200 OK" 200 "${contentType}" ${size} "${fields}" "(const char*)wsAssetData${index}" identity)
+  wsAssetVariant("HTTP/1.1 304 Not Modified" 304 "" -1 "${fields}" "NULL" notModified)
+  wsCString("${url}" urlLiteral)
+  wsCString("${etag}" etagLiteral)
+  wsCString("${contentType}" contentTypeLiteral)
+  string(LENGTH "${contentType}" contentTypeSize)
+  string(APPEND table "  {.path = ${urlLiteral}, .etag = {${etagLiteral}, ${gzipEtagLiteral}}, .contentType = ${contentTypeLiteral}, .contentTypeSize = ${contentTypeSize}, .variants = {\n    ${identity},\n    ${gzip},\n    ${notModified},\n    ${gzipNotModified}}},\n")
+endforeach()
+if(nAssets EQUAL 0)
+  # no empty initializers in C
+  set(table "  {.path = NULL}\n")
+endif()
+
+file(WRITE "${OUT}.tmp" "// generated by cmake/wsEmbedAssets.cmake from ${DIR}, do not edit\n\n${data}\n#define WS_N_ASSETS ${nAssets}\n\nstatic const struct wsAsset wsAssets[] = {\n${table}};\n")
+# unchanged output keeps webserver.c from being rebuilt
+execute_process(COMMAND "${CMAKE_COMMAND}" -E copy_if_different "${OUT}.tmp" "${OUT}")
+file(REMOVE "${OUT}.tmp")
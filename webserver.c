@@ -1,11 +1,65 @@
+// accept4, pipe2
+#define _GNU_SOURCE
+
 #include <netdb.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
-#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+#include "webserver.h"
+
+// coroutines switch stacks with a few instructions on x86_64 & aarch64, with ucontext on other platforms
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#include <ucontext.h>
+#endif
+// stack switches are announced to the address sanitizer, otherwise it reports false positives on coroutine stacks
+#if defined(__SANITIZE_ADDRESS__)
+#define WS_CO_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define WS_CO_ASAN 1
+#endif
+#endif
+#ifdef WS_CO_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#ifdef WS_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#endif
 
 // #define DEBUG 1
 
@@ -13,7 +67,8 @@
 /* webserver parameters */
 
 // defines version contained within the client reply
-#define HTTP_VERSION "1.0"
+#define HTTP_VERSION "1.1"
+#define WS_MAX_STATUS_CODE 599
 
 // defines used logstream
 #define LOG_STREAM stdout
@@ -21,6 +76,229 @@
 // webserver buffer size
 #define WS_BUFF_SIZE 1024
 
+// max body size of responses built by handler routes (the body buffer grows up to it)
+#define WS_MAX_RESP_BODY_SIZE (1024*1024)
+
+// size of the per connection scratch arena (e.g. percent-decoded parameters, form bodies), reset per request
+#define WS_SCRATCH_SIZE (WS_BUFF_SIZE*4)
+
+// default max request body size of a route (httpRoute.maxBodySize)
+#define WS_MAX_REQ_BODY_SIZE (1024*1024)
+
+/* parameter parsing parameters */
+
+// max number of query/ form parameters, further ones are ignored
+#define WS_MAX_PARAMS 32
+// open addressing index size, power of 2 and at least twice WS_MAX_PARAMS
+#define WS_PARAMS_INDEX_SIZE 64
+
+// max number of path parameters (:name and *name) captured by a route
+#define WS_MAX_PATH_PARAMS 8
+
+/* admission control parameters (defaults of the wsConfig struct) */
+
+// listen backlog of the server socket
+#define WS_LISTEN_BACKLOG 128
+// max number of concurrently served connections (= max number of client threads)
+#define WS_MAX_CONNS 256
+// max number of accepted connections waiting for a free client thread
+#define WS_MAX_QUEUED 1024
+// codel queue delay target and interval in ms
+#define WS_QUEUE_TARGET_MS 10
+#define WS_QUEUE_INTERVAL_MS 100
+// retry-after value of the shed (503) response in seconds
+#define WS_RETRY_AFTER_SEC 1
+
+/* timeout parameters (defaults of the wsConfig struct) */
+
+// max time from the first byte (or connect) to the complete request header
+#define WS_HEADER_TIMEOUT_MS 10000
+// max time for reading a complete request body
+#define WS_BODY_TIMEOUT_MS 30000
+// max idle time of a persistent connection between two requests
+#define WS_KEEP_ALIVE_TIMEOUT_MS 5000
+// max time for writing a complete response
+#define WS_WRITE_TIMEOUT_MS 30000
+
+// timer wheel resolution, all timeouts are rounded up to it
+#define WS_TIMER_TICK_MS 100
+
+// size of the "Date: <IMF-fixdate>\r\n" header field
+#define WS_DATE_HDR_SIZE 37
+// number of Date header field slots, readers never see a slot rewritten within WS_DATE_SLOTS-1 seconds
+#define WS_DATE_SLOTS 4
+
+/* tls parameters (WS_TLS builds) */
+
+// number of sessions kept in the server session cache shared by all connections (resumption by session id)
+#define WS_TLS_SESSION_CACHE_SIZE 20480
+// number of session tickets issued per full TLS 1.3 handshake (resumption by ticket)
+#define WS_TLS_NUM_TICKETS 1
+// max size of a TLS record, gathered buffers up to this size are encrypted as one record
+#define WS_TLS_RECORD_SIZE 16384
+
+/* http/2 parameters */
+
+// http/2 is served (h2c by prior knowledge & Upgrade, h2 by ALPN on tls listeners), default of the wsConfig struct
+#define WS_HTTP2 1
+// max number of concurrently open streams of a connection (SETTINGS_MAX_CONCURRENT_STREAMS)
+#define WS_H2_MAX_STREAMS 100
+// flow control window of request bodies per stream and per connection, replenished once half of it is consumed
+#define WS_H2_WINDOW_SIZE 65535
+// request bodies are buffered before the handler runs, up to the route limit but at most this size
+#define WS_H2_MAX_BODY_SIZE (8*1024*1024)
+// size of the hpack dynamic tables (SETTINGS_HEADER_TABLE_SIZE), strings of a header field are limited to it as well
+#define WS_H2_TABLE_SIZE 4096
+// max frame payload size that is received (SETTINGS_MAX_FRAME_SIZE), the protocol minimum
+#define WS_H2_MAX_FRAME_SIZE 16384
+// size of the batch buffer for frame headers, control frames & header blocks, response bodies are referenced
+#define WS_H2_OUT_SIZE 16384
+// max number of buffers of a batched write
+#define WS_H2_MAX_IOV 64
+
+/* reverse proxy parameters */
+
+// max number of upstream servers of a proxy
+#define WS_PROXY_MAX_UPSTREAMS 16
+// max number of idle persistent connections kept per upstream
+#define WS_PROXY_POOL_SIZE 32
+// consecutive failures (connect, io, timeout, 502-504 replies) after which an upstream is ejected
+#define WS_PROXY_MAX_FAILS 3
+// time an ejected upstream is skipped by the balancer
+#define WS_PROXY_EJECT_MS 10000
+// max time of connecting to an upstream and of every single read/write on an upstream connection
+#define WS_PROXY_TIMEOUT_MS 10000
+// points per upstream on the consistent hash ring
+#define WS_PROXY_RING_REPLICAS 64
+// max size of an upstream response header
+#define WS_PROXY_HEAD_SIZE 8192
+// size of the buffer response bodies are relayed through (if they can't be spliced)
+#define WS_PROXY_RELAY_SIZE 16384
+
+/* response cache parameters */
+
+// memory budget of the response cache shared by all cached routes (default of the wsConfig struct), 0 disables the cache
+#define WS_CACHE_SIZE (32*1024*1024)
+// number of independently locked shards, the memory budget is split evenly
+#define WS_CACHE_SHARDS 16
+// hash buckets per shard, power of 2
+#define WS_CACHE_BUCKETS 1024
+// max size of a cache key (path, sorted query & the values of the vary fields)
+#define WS_CACHE_KEY_SIZE (WS_BUFF_SIZE*2)
+// TinyLFU frequency sketch of a shard, rows & counters per row (power of 2)
+#define WS_CACHE_SKETCH_DEPTH 4
+#define WS_CACHE_SKETCH_WIDTH 4096
+// increments after which all sketch counters are halved, old popularity fades out
+#define WS_CACHE_SKETCH_SAMPLE (WS_CACHE_SKETCH_WIDTH*8)
+
+/* tcp tuning parameters (defaults of the wsConfig struct), 0 disables an option */
+
+// disables Nagle's algorithm on accepted connections, small responses are sent without waiting for outstanding acks
+#define WS_TCP_NODELAY 1
+// corks accepted connections while a response is written, header & body leave in full segments
+#define WS_TCP_CORK 0
+// seconds the kernel holds back accepted connections until their first data arrived (TCP_DEFER_ACCEPT)
+#define WS_DEFER_ACCEPT_SEC 0
+// TCP fast open queue length of the listening socket (requires the server bit of net.ipv4.tcp_fastopen)
+#define WS_FASTOPEN_QUEUE 0
+// SO_REUSEADDR on the listening socket, a restart does not fail on connections in TIME_WAIT
+#define WS_REUSE_ADDR 1
+// socket buffer sizes of accepted connections (inherited from the listening socket), 0 keeps the kernel defaults
+#define WS_SNDBUF_SIZE 0
+#define WS_RCVBUF_SIZE 0
+
+/* route snapshot parameters */
+
+// identifies route snapshot files (8 bytes, no \0) & their layout version, snapshots of other versions are recompiled
+#define WS_SNAPSHOT_MAGIC "WSROUTES"
+#define WS_SNAPSHOT_VERSION 1
+
+/* graceful shutdown & binary upgrade parameters */
+
+// max time in-flight connections are given to finish before they are shut down (default of the wsConfig struct)
+#define WS_DRAIN_TIMEOUT_MS 30000
+// max time the upgraded binary is given to take over the listening sockets
+#define WS_UPGRADE_TIMEOUT_MS 10000
+// environment variable through which the upgraded binary receives the handoff unix socket
+#define WS_UPGRADE_ENV "WS_UPGRADE_FD"
+// max number of listening sockets handed over on upgrade
+#define WS_MAX_HANDOFF_FDS 16
+
+/* event loop & coroutine parameters */
+
+// number of event loop threads serving connections as coroutines (default of the wsConfig struct)
+// 0 serves every connection on its own client thread
+#define WS_LOOPS 0
+// size of the mapping of a coroutine stack incl. its guard page, only touched pages are backed by memory
+#define WS_CO_STACK_SIZE (256*1024)
+// number of stacks of finished coroutines kept per event loop for reuse
+#define WS_CO_POOL_SIZE 256
+// max number of events handled per epoll_wait
+#define WS_LOOP_EVENTS 128
+
+/* tracing parameters */
+
+// 1 in WS_TRACE_SAMPLE requests is traced stage by stage (default of the wsConfig struct), 0 disables tracing
+#define WS_TRACE_SAMPLE 0
+// events per trace ring (power of 2), the oldest ones are overwritten
+#define WS_TRACE_RING_SIZE 4096
+// max number of trace rings, threads are assigned one round robin (threads beyond it share one)
+#define WS_TRACE_RINGS 64
+
+/* profiler parameters */
+
+// default & max duration in seconds of a profile taken by the /admin/profile route
+#define WS_PROF_SECONDS 10
+#define WS_PROF_MAX_SECONDS 60
+// samples per second of cpu time, not a divisor of common timer frequencies so periodic work isn't sampled in lockstep
+#define WS_PROF_HZ 99
+// max stack frames & samples of a profile (preallocated, 520 bytes each), further samples are dropped
+#define WS_PROF_DEPTH 64
+#define WS_PROF_MAX_SAMPLES 16384
+// frames of the signal handler & the signal trampoline on top of every sampled stack
+#define WS_PROF_SKIP_FRAMES 2
+// max size of a symbol name in the folded stacks
+#define WS_PROF_SYMBOL_SIZE 128
+
+/* rate limiting parameters */
+
+// requests per second & burst of the token bucket of every client address (defaults of the wsConfig struct), 0 disables it
+#define WS_RATE_LIMIT 0
+#define WS_RATE_BURST 50
+// slots of the token bucket table (power of 2)
+#define WS_RATE_TABLE_SIZE 16384
+// slots probed per lookup, a bucket without slot reuses the least recently refilled one of them
+#define WS_RATE_PROBES 8
+// key of a slot whose bucket is being (re)initialized, no client is keyed by it
+#define WS_RATE_CLAIMED UINT64_MAX
+
+/* blocking handler pool parameters */
+
+// threads running the handlers of blocking routes (routeSetBlocking) for connections served by coroutines (default of the wsConfig struct)
+#define WS_BLOCKING_THREADS 8
+// max number of blocking handler calls waiting for a thread (default of the wsConfig struct), further calls are rejected with 503
+#define WS_BLOCKING_QUEUE 256
+
+/* executor parameters */
+
+// capacity of the work-stealing deque of a worker (power of 2), forks beyond it are run inline
+#define WS_EXEC_DEQUE_SIZE 1024
+// rounds over all victims an idle worker tries to steal before it sleeps
+#define WS_EXEC_STEAL_ROUNDS 64
+
+/* timer wheel parameters */
+
+// 4 levels of 64 slots cover 2^24 ticks (~19 days at 100ms resolution)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// not defined on all platforms (e.g. macos), suppresses SIGPIPE on send
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 /* parsing parameter */
 
 // important string parsing literals
@@ -31,76 +309,970 @@
 // http request line length
 #define HTTP_REQ_LINE_LEN 3
 
+/* http/2 framing */
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_SIZE 24
+#define H2_FRAME_HEADER_SIZE 9
+
+// frame flags
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY 0x20
+
+// max number of dynamic table entries (each takes at least 32 bytes of the table size)
+#define HPACK_MAX_ENTRIES (WS_H2_TABLE_SIZE/32)
+
 /* testing functions */
 
 int testParsing();
 int testCreateRoute();
 int testWsInitAndFree();
 int testRespCraft();
+int testCodel();
+int testTimerWheel();
+int testRespBuilder();
+int testParams();
+int testChunkedBody();
+int testRouter();
+int testMethodRouting();
+int testSerializeHeader();
+int testDateHeader();
+int testListeners();
+int testHpack();
+int testHttp2();
+int testProxy();
+int testCache();
+int testSnapshot();
+int testCoroutines();
+int testExecutor();
+int testBlocking();
+int testRateLimit();
+int testTracing();
+int testProfiler();
+int testDrive();
+#ifdef WS_TLS
+int testTls();
+#endif
+#ifdef WS_ASSETS
+int testAssets();
+#endif
+int benchSerializeHeader();
+int benchRouter();
+int benchTcpTuning();
 
 /* declarations */
 
-typedef struct {
-  struct sockaddr_in server;
+// intrusive timer node, linked into a timer wheel slot while armed
+struct wsTimer {
+  struct wsTimer *next;
+  struct wsTimer *prev;
+  void *data;
+  uint64_t expires;
+};
+
+// hierarchical timing wheel (as in the classic linux kernel timers)
+// now is the next tick to be processed, slots are circular lists with the slot itself as sentinel
+struct timerWheel {
+  struct wsTimer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t now;
+};
+
+// codel state, for reference see https://queue.acm.org/detail.cfm?id=2209336
+struct codelState {
+  uint64_t firstAboveTime;
+  uint64_t dropNext;
+  uint32_t dropCount;
+  int dropping;
+};
+
+// accepted but not yet served connection
+struct pendingConn {
+  uint64_t acceptTime;
+  int socket;
+  int tls;
+};
+
+struct wsAdmission {
+  pthread_mutex_t lock;
+  struct codelState codel;
+  struct pendingConn *queue;
+  // pre-serialized 503 response which is sent to shed connections
+  char *shedResp;
+  int shedRespSize;
+
+  int queueHead;
+  int nQueued;
+  int nActive;
+  // set once the server stops accepting, persistent connections are closed after their current request
+  int draining;
+  unsigned long nShed;
+};
+
+// cached Date header field, a new slot is formatted once per second and published by swapping the current pointer
+// slots are "Date: <IMF-fixdate>\r\n\r\n", pre-serialized headers gather them as their last field incl. the empty line
+struct wsDate {
+  char slots[WS_DATE_SLOTS][WS_DATE_HDR_SIZE+3];
+  _Atomic(const char*) current;
+  time_t second;
+  int next;
+};
+
+// bump allocator on a fixed buffer, everything is freed at once by resetting used
+struct wsArena {
+  char *buff;
+  int size;
+  int used;
+};
+
+// key/value slices into the parsed (query/ form) string, values are percent-decoded on demand
+// index maps the key hash to the param index+1 (0 = empty slot)
+struct wsParams {
+  struct wsSlice keys[WS_MAX_PARAMS];
+  struct wsSlice values[WS_MAX_PARAMS];
+  uint8_t decoded[WS_MAX_PARAMS];
+  uint8_t index[WS_PARAMS_INDEX_SIZE];
+  int nParams;
+  int parsed;
+};
+
+// listening socket, the path of (non abstract) unix sockets is unlinked when the server stops
+struct wsListener {
+  int socket;
+  int type;
+  int tls;
+  char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+};
+
+// saved state of a suspended coroutine (or of the event loop which resumed it)
+#if defined(__x86_64__) || defined(__aarch64__)
+// the stack pointer, the callee-saved registers are pushed on the stack by coSwitch
+struct coContext {
+  void *sp;
+};
+#else
+struct coContext {
+  ucontext_t uc;
+};
+#endif
+
+// function which is started as coroutine on an event loop, submitted by other threads through the loop inbox
+// cancel is called (on the loop thread) instead if no coroutine could be created
+// tasks without fn resume the parked coroutine arg (see wsCompletion)
+struct coTask {
+  struct coTask *next;
+  void (*fn)(void *arg);
+  void (*cancel)(void *arg);
+  void *arg;
+};
+
+// completion a coroutine or thread waits for (complWait), signalled once by another thread (complSignal)
+// a parked coroutine is resumed by its own loop through the loop inbox, a thread is woken by the condition variable
+struct wsCompletion {
+  struct coTask wake;
+  struct wsCoroutine *co;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  atomic_int done;
+};
+
+// coroutine, placed at the top of its stack mapping whose lowest page is the guard page
+// coroutines stay on the event loop they have been started on
+struct wsCoroutine {
+  struct coContext ctx;
+  // deadline of a wait with timeout, armed in the timer wheel of the loop
+  struct wsTimer timer;
+  struct wsLoop *loop;
+  // next pooled coroutine
+  struct wsCoroutine *next;
+  void (*fn)(void *arg);
+  void *arg;
+  // base of the stack mapping
+  char *stack;
+  // connection socket the coroutine serves (see coBind), it stays in the epoll interest list between waits
+  int socket;
+  int registered;
+  int timedOut;
+  int done;
+#ifdef WS_CO_ASAN
+  void *fakeStack;
+#endif
+};
+
+// event loop thread, its coroutines park on the readiness of a socket in the epoll instance (one shot registrations)
+// and are resumed by the loop, which is the only thread touching them
+struct wsLoop {
+  // context of the loop thread while a coroutine runs
+  struct coContext ctx;
+  // deadlines of waits with timeout
+  struct timerWheel timers;
+  // tasks submitted by other threads (lock-free stack), the eventfd wakes the loop
+  _Atomic(struct coTask*) inbox;
+  struct wsCoroutine *current;
+  struct wsCoroutine *pool;
+  int nPooled;
+  int nTimed;
+  atomic_int nCoroutines;
+  atomic_int stopping;
+  int epollFd;
+  int wakeFd;
+  int running;
+  pthread_t thread;
+#ifdef WS_CO_ASAN
+  void *fakeStack;
+  const void *stackBottom;
+  size_t stackSize;
+#endif
+};
+
+// Chase-Lev work-stealing deque of fixed size, the owner pushes & takes at the bottom, thieves steal at the top
+// for reference see https://fzn.fr/readings/ppopp13.pdf
+struct execDeque {
+  atomic_llong top;
+  atomic_llong bottom;
+  _Atomic(struct wsTask*) tasks[WS_EXEC_DEQUE_SIZE];
+};
+
+// worker thread of an executor
+struct execWorker {
+  struct execDeque deque;
+  struct wsExecutor *executor;
+  pthread_t thread;
+  // xorshift state of the victim selection
+  uint32_t rand;
+  atomic_ulong executed;
+};
+
+// work-stealing executor for cpu heavy handler work, handlers submit tasks with execRun (passed as route ctx like a wsProxy)
+struct wsExecutor {
+  struct execWorker *workers;
+  int nWorkers;
+  // started worker threads
+  int nStarted;
+  // tasks submitted by other threads (lock-free stack), taken over as a whole by the first worker which finds it non-empty
+  _Atomic(struct wsTask*) inject;
+  // idle workers sleep on the condition variable
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  atomic_int sleepers;
+  atomic_int stopping;
+  atomic_ulong steals;
+};
+
+// task of execRun, signals the completion of its submitter once fn returned
+struct execRoot {
+  struct wsTask task;
+  struct wsCompletion completion;
+  void (*fn)(void *arg);
+  void *arg;
+};
+
+// handler call of a blocking route, queued by the coroutine serving the request which parks until it completed
+struct blockingJob {
+  struct httpRoute *route;
+  struct httpRequest *req;
+  struct respBuilder *rb;
+  struct wsCompletion completion;
+};
+
+// bounded thread pool running the handlers of blocking routes, so they don't stall the other connections of a loop
+// calls wait in a ring protected by lock, completions return to the loop of the parked coroutine through its inbox & eventfd
+struct wsBlockingPool {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct blockingJob **queue;
+  int queueSize;
+  int head;
+  int nQueued;
+  // max number of queued calls seen
+  int peakQueued;
+  int nRunning;
+  int stopping;
+  pthread_t *threads;
+  // started threads, 0 if blocking handlers run on the loops (or client threads)
+  int nThreads;
+  unsigned long completed;
+  unsigned long rejected;
+};
+
+// token bucket of a client address (& route), key 0 marks a free slot
+// state packs the tokens in thousandths (upper 32 bits) & the time of the last refill in ms (lower 32 bits, wrapping)
+struct rateSlot {
+  _Atomic uint64_t key;
+  _Atomic uint64_t state;
+};
+
+// lock-free open addressing table of token buckets keyed by client address (& route)
+// approximate: a reused slot isn't synchronized with late updates of its previous bucket
+struct wsRateLimiter {
+  struct rateSlot *slots;
+  // pre-serialized 429 responses by keepAlive, the Date field is gathered in place of the empty line
+  char *resp[2];
+  int respSize[2];
+  // rejected requests & connections closed right after accept
+  atomic_ulong limited;
+  atomic_ulong limitedConns;
+};
+
+// stages of a traced request, spans are recorded back to back from the first byte of the request on
+enum traceSpan {
+  spanRequest,
+  spanAccept,
+  spanRead,
+  spanParse,
+  spanLookup,
+  spanHandler,
+  spanProxy,
+  spanSend,
+  spanNStages
+};
+
+static const char *traceSpanNames[spanNStages] = {"request", "accept", "read", "parse", "lookup", "handler", "proxy", "send"};
+
+// span of a traced request (64 bytes), the request span carries the (truncated) path
+struct traceEvent {
+  uint64_t startNs;
+  uint64_t durNs;
+  uint32_t reqId;
+  int32_t tid;
+  uint8_t stage;
+  char path[39];
+};
+
+// ring of the trace events of the threads assigned to it, busy is held while an event is written or the ring is dumped
+struct traceRing {
+  atomic_int busy;
+  // total number of events written, the ring holds the last WS_TRACE_RING_SIZE of them
+  uint64_t written;
+  struct traceEvent events[WS_TRACE_RING_SIZE];
+};
+
+// sampled per request stage tracing, the rings are allocated on first use
+struct wsTracer {
+  _Atomic(struct traceRing*) rings[WS_TRACE_RINGS];
+  atomic_uint nextRing;
+  atomic_uint nRequests;
+  // events dropped since their ring was busy
+  atomic_ulong dropped;
+};
+
+// stack sampled by the SIGPROF handler, frames[0] is the innermost
+struct profSample {
+  int depth;
+  void *frames[WS_PROF_DEPTH];
+};
+
+// samples of a profile taken by profRun, nTaken counts the samples beyond capacity as well
+struct wsProfile {
+  struct profSample *samples;
+  int capacity;
+  atomic_int nTaken;
+  int hz;
+};
+
+// range of the primes counted by a task of the /primes/:n route
+struct primesRange {
+  struct wsExecutor *executor;
+  unsigned long from;
+  unsigned long to;
+  unsigned long count;
+};
+
+// route snapshot file header (see wsCompileRoutes), followed by the snapRoute array, the bucket index & the data
+// (paths, Allow values, serialized headers & bodies), offsets are relative to the file start & integers in host byte order
+struct snapHeader {
+  char magic[8];
+  uint32_t version;
+  // 0x01020304 as written by the compiling host
+  uint32_t byteOrder;
+  uint32_t nRoutes;
+  // power of 2, open addressing (linear probing) on the path hash, a bucket holds the route index+1 (0 = empty)
+  uint32_t nBuckets;
+  uint64_t routesOffset;
+  uint64_t bucketsOffset;
+  uint64_t size;
+};
+
+struct snapRoute {
+  uint32_t hash;
+  uint32_t method;
+  uint32_t statusCode;
+  uint32_t pathSize;
+  uint64_t pathOffset;
+  // \0 terminated Allow field value of the path
+  uint64_t allowOffset;
+  // status line & header fields serialized as for static routes (without Date), indexed by keepAlive
+  uint64_t headerOffset[2];
+  uint32_t headerSize[2];
+  uint64_t bodyOffset;
+  uint64_t bodySize;
+};
+
+// memory mapped route snapshot, base is NULL if none is loaded
+struct wsSnapshot {
+  char *base;
+  size_t size;
+  const struct snapHeader *header;
+  const struct snapRoute *routes;
+  const uint32_t *buckets;
+};
+
+// response of an embedded asset, status line & header fields serialized as for static routes (without Date)
+struct wsAssetVariant {
+  int statusCode;
+  // indexed by keepAlive, header[0] is NULL if the asset has no such variant
+  const char *header[2];
+  int headerSize[2];
+  // the header fields besides Content-type, Content-length & Connection (http/2)
+  const char *fields;
+  int fieldsSize;
+  const char *body;
+  int bodySize;
+};
+
+enum assetVariant {
+  assetIdentity,
+  // gzip content coding, only if it's smaller than the identity
+  assetGzip,
+  assetNotModified,
+  assetGzipNotModified,
+  assetNVariants
+};
+
+// static asset embedded at build time (cmake/wsEmbedAssets.cmake), the generated wsAssets table is sorted by path
+struct wsAsset {
+  const char *path;
+  // quoted ETags of the identity & gzip variant (NULL without), matched against If-None-Match
+  const char *etag[2];
+  const char *contentType;
+  int contentTypeSize;
+  struct wsAssetVariant variants[assetNVariants];
+};
+
+#ifdef WS_ASSETS
+// generated wsAssets table & WS_N_ASSETS
+#include "wsAssets.h"
+#endif
+
+typedef struct webserver {
   struct httpRoute **routes;
+  struct routeNode *routeTree;
+  // static routes of the route config, looked up if the route tree has no route for a request
+  struct wsSnapshot snapshot;
+  struct wsConfig config;
+  struct wsAdmission admission;
+  struct timerWheel timers;
+  // updated by the timer thread
+  struct wsDate date;
 
-  int wserverSocket;
+  // all listeners share the route table and admission control
+  struct wsListener listeners[WS_MAX_LISTENERS];
+  int nListeners;
   int nRoutes;
+  // allocated size of routes, grown geometrically
+  int routesCap;
+  // self pipe, commands (stop/upgrade) are written by signal handlers or wsStop and read by wsListen
+  int ctlPipe[2];
+  // handoff socket to the previous process which is acked once listening, -1 if not started by an upgrade
+  int upgradeFd;
+  // set to stop the timer thread, protected by the timerLock
+  int timersStopped;
+
+  char **argv;
+  char *exePath;
 
   pthread_mutex_t mutexLock;
+  // protects the timer wheel, held while expired connections are shut down
+  pthread_mutex_t timerLock;
   pthread_t clientThread;
+  pthread_t timerThread;
+  // port of the first tcp listener (the bound one if configured as 0)
   unsigned short port;
+  // response cache of the routes with a cache ttl, NULL if disabled
+  struct wsCache *cache;
+  // event loops of the connection coroutines, NULL if connections are served by client threads
+  struct wsLoop *loops;
+  // number of initialized loops
+  int nLoops;
+  // loop of the next accepted connection (round robin)
+  unsigned int nextLoop;
+  // runs the handlers of blocking routes for the loops
+  struct wsBlockingPool blocking;
+  // token buckets of the rate limited clients, slots is NULL if neither the server nor a route is limited
+  struct wsRateLimiter rate;
+  struct wsTracer tracer;
+  // application driven event loop (wsConfig.driven), fd is -1 until wsStart
+  struct {
+    // epoll instance of the loop, the listeners & the control pipe
+    int fd;
+    int draining;
+    int forced;
+    uint64_t deadline;
+  } drive;
+#ifdef WS_TLS
+  // shared by all tls listeners, holds the session cache & ticket keys
+  SSL_CTX *tlsCtx;
+  struct {
+    atomic_ulong handshakes;
+    atomic_ulong resumed;
+    atomic_ulong failed;
+    atomic_ulong ktls;
+    // cpu time spent in handshakes (of the handshaking threads)
+    atomic_ullong cpuNs;
+  } tlsStats;
+#endif
 } webserver;
 
+// client connection, buffers are owned by the serving client thread
+struct wsConn {
+  struct wsTimer timer;
+  char *readBuff;
+  char *respBuff;
+  // header fields & body appended by handler routes, the body buffer is allocated & grown on demand
+  char *hdrBuff;
+  char *bodyBuff;
+  int bodyBuffSize;
+  struct wsArena arena;
+
+  int socket;
+  // rate limiting key of the client address, 0 if the connection isn't limited (see ratePeerKey)
+  uint64_t peerKey;
+  // set if the connection is corked around responses (tcp connections with wsConfig.tcpCork)
+  int tcp;
+  // request being traced (see traceBegin), lastNs is the end of the last recorded stage
+  struct {
+    int sampled;
+    uint32_t reqId;
+    uint64_t startNs;
+    uint64_t lastNs;
+    // accept & start of serving of the connection, the accept span is part of its first traced request
+    uint64_t acceptNs;
+    uint64_t servedNs;
+  } trace;
+  // number of bytes buffered in readBuff
+  int readBuffSize;
+  int nRequests;
+  // set (protected by the timerLock) while waiting for the next request on a persistent connection
+  int idle;
+#ifdef WS_TLS
+  // NULL for plaintext connections
+  SSL *ssl;
+  // set if records are encrypted by the kernel (kTLS), plaintext is written to the socket directly
+  int ktlsSend;
+#endif
+};
+
 struct pthreadClientHandleArgs {
+  // submitted to an event loop if connections are served by coroutines
+  struct coTask task;
   webserver *wserver;
   int socket;
+  int tls;
+  // accept time if tracing is enabled (connections taken from the admission queue have none), otherwise 0
+  uint64_t acceptNs;
+};
+
+// request line tokens, in the order of enum httpMethod
+static const char *httpMethodNames[httpNMethods] = {"GET", "POST", "PUT", "HEAD", "OPTIONS", "DELETE", "PATCH"};
+
+// request body decoding states
+enum bodyState {
+  bodyNone,
+  bodyData,
+  bodyChunkSize,
+  bodyChunkData,
+  bodyChunkEnd,
+  bodyTrailer,
+  bodyDone
+};
+
+// http/2 frame types
+enum h2FrameType {
+  h2Data,
+  h2Headers,
+  h2Priority,
+  h2RstStream,
+  h2Settings,
+  h2PushPromise,
+  h2Ping,
+  h2Goaway,
+  h2WindowUpdate,
+  h2Continuation
+};
+
+// http/2 error codes (RST_STREAM & GOAWAY)
+enum h2ErrorCode {
+  h2NoError,
+  h2ProtocolError,
+  h2InternalError,
+  h2FlowControlError,
+  h2SettingsTimeout,
+  h2StreamClosed,
+  h2FrameSizeError,
+  h2RefusedStream,
+  h2Cancel,
+  h2CompressionError,
+  h2ConnectError,
+  h2EnhanceYourCalm
 };
 
-enum errReturnCode {
-  errOk,
-  errFailed,
-  errMemAlloc,
-  errSecCheck,
-  errInit,
-  errParse,
-  errNet,
-  errIO
+// http/2 setting identifiers
+enum h2Setting {
+  h2SettingTableSize = 1,
+  h2SettingEnablePush,
+  h2SettingMaxStreams,
+  h2SettingInitialWindow,
+  h2SettingMaxFrameSize,
+  h2SettingMaxHeaderList
 };
 
-enum httpMethod {
-  httpGet,
-  httpPost
+// http/2 stream states, closed streams are freed (idle slot)
+enum h2StreamState {
+  h2StreamIdle,
+  // request header received, the body is being received
+  h2StreamOpen,
+  // request complete (half-closed remote), the response is being sent
+  h2StreamHalfClosed
 };
 
+// either a static route with a fixed httpResp or a handler route (httpResp is NULL)
 struct httpRoute {
   char *path;
   int method;
   struct httpResponse *httpResp;
+  wsHandler handler;
+  void *handlerCtx;
+  // requests with a larger body are rejected with 413
+  long long maxBodySize;
+  // set for proxy routes (the handler is proxyHandler), http/1.x responses are relayed while they're received
+  struct wsProxy *proxy;
+  // the handler calls blocking apis, it's run on the blocking pool instead of the event loop (routeSetBlocking)
+  int blocking;
+  // served to connections of unix socket listeners only, hidden from others (routeSetAdmin)
+  int admin;
+  // token bucket of every client address for this route (requests per second & burst), 0 if not limited (routeSetRateLimit)
+  int rateLimit;
+  int rateBurst;
+  // responses to GET requests are cached for cacheTtlMs (0 disables caching) and served stale for cacheStaleMs more while refreshed
+  int cacheTtlMs;
+  int cacheStaleMs;
+  // \0 separated names of the request header fields which are part of the cache key
+  char *cacheVary;
+  int nCacheVary;
 };
 
-struct httpResponse {
-  int statusCode;
-  int isFile;
-  int contentSize;
-  char *reasonPhrase;
-  char *contentBuff;
+// compressed radix tree node, the prefix of static nodes is matched as a whole
+// param nodes (:name) match one path segment, wildcard nodes (*name) the rest of the path
+struct routeNode {
+  char *prefix;
+  // first prefix characters of the static children, in the order of children
+  char *indices;
+  struct routeNode **children;
+  struct routeNode *paramChild;
+  struct routeNode *wildcardChild;
+  // name of the captured parameter (param and wildcard nodes)
+  char *paramName;
+  // routes of the path by method, HEAD falls back to GET
+  struct httpRoute *routes[httpNMethods];
+  // comma separated methods of the path for the Allow header field (405 & OPTIONS)
+  char *allow;
+  int prefixSize;
+  int nChildren;
+};
+
+// streaming request body reader
+// the part of the connection readBuff behind the request header is used as staging area (base up to the buffered size)
+struct bodyReader {
+  webserver *wserver;
+  struct wsConn *conn;
+  // bytes left of the content-length or current chunk
+  long long remaining;
+  long long received;
+  long long limit;
+  int state;
+  // read position in the staging area
+  int pos;
+  int base;
+  int expectContinue;
+  int started;
+  int err;
 };
 
 struct httpRequest {
   float httpVersion;
   int reqMethod;
+  int keepAlive;
+  // path only, the query string is split off
   char *requestUri;
+  // query string without the '?' (NULL if there is none), parsed on the first getQueryParam
+  char *query;
+  int querySize;
+  struct wsParams queryParams;
+  // per request scratch memory of the connection
+  struct wsArena *arena;
+  // complete request header (request line included), can be searched with getHeader
+  char *header;
+  int headerSize;
+  // read by the handler with readBody (state is bodyNone if the request has no body)
+  struct bodyReader body;
+  struct wsParams formParams;
+  // captured path parameters, slices into requestUri, looked up with getPathParam
+  struct wsSlice pathParams[WS_MAX_PATH_PARAMS];
+  char *pathParamNames[WS_MAX_PATH_PARAMS];
+  int nPathParams;
+};
+
+// response of a handler route, the header fields and body are appended into connection owned buffers
+struct respBuilder {
+  struct wsConn *conn;
+  int statusCode;
+  int hdrSize;
+  int bodySize;
+  int hasContentType;
+  // set if appending failed (e.g. size limit), a 500 is sent instead
+  int err;
 };
 
 struct freeClientThreadArgs {
   struct httpRequest *httpReq;
-  struct httpResponse *httpResp;
   struct pthreadClientHandleArgs *clientHandleArgs;
+  struct wsConn *conn;
   char *readBuff;
   char *respBuff;
 };
 
+// hpack dynamic table entry, name & value are stored back to back in the table buffer
+struct hpackEntry {
+  int offset;
+  int nameSize;
+  int valueSize;
+};
+
+// hpack dynamic table (RFC 7541), entries are appended to the buffer (oldest first) which is compacted once its end is reached
+// the data of the live entries never exceeds the max size, so after compaction there is always room for a new entry
+struct hpackTable {
+  char buff[2*WS_H2_TABLE_SIZE];
+  // ring of the entries, index 0 of the protocol is the newest
+  struct hpackEntry entries[HPACK_MAX_ENTRIES];
+  int oldest;
+  int nEntries;
+  // used region of the buffer
+  int start;
+  int end;
+  // size as defined by the protocol (name + value + 32 per entry)
+  int size;
+  int maxSize;
+};
+
+struct hpackStaticEntry {
+  const char *name;
+  int nameSize;
+  const char *value;
+  int valueSize;
+};
+
+struct h2Stream {
+  uint32_t id;
+  int state;
+  // flow control windows, the send window may become negative by a SETTINGS_INITIAL_WINDOW_SIZE decrease
+  int64_t sendWindow;
+  int recvWindow;
+  // request body bytes received since the last WINDOW_UPDATE
+  int recvConsumed;
+  // synthesized request header, kept while the body is received
+  char *header;
+  int headerSize;
+  // buffered request body
+  char *body;
+  int bodySize;
+  int bodyBuffSize;
+  long long bodyLimit;
+  // the response has been sent before the request was complete (e.g. 413), further body data is discarded
+  int discard;
+  // response body still to be sent in DATA frames, either route content or owned by the stream
+  const char *data;
+  int dataSize;
+  int dataSent;
+  char *ownedData;
+};
+
+// http/2 connection, served by the client thread of the connection
+// streams are multiplexed: requests are answered in the order they complete, response bodies are interleaved by flow control
+struct h2Session {
+  webserver *wserver;
+  struct wsConn *conn;
+  struct httpRequest *req;
+  struct h2Stream streams[WS_H2_MAX_STREAMS];
+  int nStreams;
+  uint32_t lastStreamId;
+  // stream of a header block continued by CONTINUATION frames (0 if none) & the flags of its HEADERS frame
+  uint32_t continuedStream;
+  int continuedFlags;
+  int64_t sendWindow;
+  int recvWindow;
+  int recvConsumed;
+  // settings of the peer
+  int64_t peerInitialWindow;
+  int peerMaxFrameSize;
+  // hpack contexts of the request (decoder) & response (encoder) header blocks
+  struct hpackTable decoder;
+  struct hpackTable encoder;
+  // the encoder table size has been changed and is to be signaled at the start of the next header block
+  int encoderSizeUpdate;
+  int settingsReceived;
+  int goawaySent;
+  int peerGoaway;
+  // set on a connection error or a failed write, the connection is closed
+  int closing;
+  int writeFailed;
+  // staging view on the body of the dispatched stream for the body reader of the request
+  struct wsConn bodyView;
+  // frames are batched into out (frame headers, control frames & header blocks) & iov (which references response bodies)
+  struct iovec iov[WS_H2_MAX_IOV];
+  int iovCnt;
+  int outSize;
+  char out[WS_H2_OUT_SIZE];
+  int readBuffSize;
+  char readBuff[2*(H2_FRAME_HEADER_SIZE+WS_H2_MAX_FRAME_SIZE)];
+  // header block of HEADERS & CONTINUATION frames
+  int blockSize;
+  char block[WS_H2_MAX_FRAME_SIZE];
+  // name & value of the header field being decoded
+  char field[2*WS_H2_TABLE_SIZE];
+  // encoded response header block
+  char respBlock[2*WS_BUFF_SIZE+256];
+  // request header synthesized from the decoded header block (request line & fields in http/1.1 form)
+  char reqHeader[WS_BUFF_SIZE+1];
+};
+
+// framing of an upstream response body
+enum proxyFraming {
+  proxyNoBody,
+  proxyLength,
+  proxyChunked,
+  proxyUntilClose
+};
+
+// upstream server of a proxy, idle persistent connections are pooled
+struct proxyUpstream {
+  struct sockaddr_storage addr;
+  socklen_t addrSize;
+  pthread_mutex_t lock;
+  // protected by the lock
+  int idle[WS_PROXY_POOL_SIZE];
+  int nIdle;
+  int fails;
+  // monotonic time (ms) until which the upstream is ejected by the passive health check
+  atomic_ullong ejectedUntilMs;
+  atomic_int outstanding;
+  atomic_ulong requests;
+  atomic_ulong connects;
+  atomic_ulong failures;
+  atomic_ulong ejections;
+};
+
+struct proxyRingPoint {
+  uint32_t hash;
+  int upstream;
+};
+
+// upstream servers & balancing of proxy routes, owned by the caller (may be shared by several routes)
+struct wsProxy {
+  struct proxyUpstream upstreams[WS_PROXY_MAX_UPSTREAMS];
+  int nUpstreams;
+  int balance;
+  // key of the proxyBalanceHash balancing, the request path if NULL
+  char *hashHeader;
+  struct proxyRingPoint ring[WS_PROXY_MAX_UPSTREAMS*WS_PROXY_RING_REPLICAS];
+  int ringSize;
+  atomic_uint next;
+};
+
+// connection to an upstream, reused ones are taken from its pool
+struct proxyConn {
+  struct proxyUpstream *upstream;
+  int socket;
+  int reused;
+};
+
+// chunked framing scanner state (states of enum bodyState)
+struct proxyChunks {
+  int state;
+  long long remaining;
+  int digits;
+  int ext;
+  int lineSize;
+};
+
+// upstream response being received, the head & the body data received with it are staged in buff
+struct proxyResp {
+  struct proxyConn *pc;
+  int statusCode;
+  int headSize;
+  int framing;
+  // Content-Length of the response (-1 if there is none) & the body bytes left of it
+  long long contentLength;
+  long long remaining;
+  // set if the connection can be pooled once the body is received completely
+  int keepAlive;
+  int done;
+  struct proxyChunks chunks;
+  char *buff;
+  int buffSize;
+  int pos;
+  int size;
+};
+
+// cached response, the status line & header fields are serialized (without Date) per keepAlive as for static routes
+// key, headers & body are allocated with the entry
+struct cacheEntry {
+  // hash chain of the shard bucket
+  struct cacheEntry *next;
+  // LRU list of the shard, the least recently used entry is the head
+  struct cacheEntry *lruPrev;
+  struct cacheEntry *lruNext;
+  uint64_t hash;
+  uint64_t freshUntilMs;
+  uint64_t staleUntilMs;
+  // set while one request refreshes the stale entry, the others are served the stale one meanwhile
+  int refreshing;
+  // held by the shard (while linked) & by requests sending the entry, the last one frees it
+  atomic_int refs;
+  char *key;
+  int keySize;
+  char *header[2];
+  int headerSize[2];
+  char *body;
+  int bodySize;
+  size_t memSize;
+};
+
+struct cacheShard {
+  pthread_mutex_t lock;
+  struct cacheEntry *buckets[WS_CACHE_BUCKETS];
+  struct cacheEntry *lruHead;
+  struct cacheEntry *lruTail;
+  size_t used;
+  // TinyLFU count-min sketch of the key access frequencies (saturating at 15), decides which of candidate & LRU victim is kept
+  uint8_t sketch[WS_CACHE_SKETCH_DEPTH][WS_CACHE_SKETCH_WIDTH];
+  int sketchAdds;
+};
+
+// sharded response cache, keys are spread over the shards by hash
+struct wsCache {
+  struct cacheShard shards[WS_CACHE_SHARDS];
+  size_t shardBudget;
+  atomic_ulong hits;
+  atomic_ulong staleHits;
+  atomic_ulong misses;
+  atomic_ulong stores;
+  atomic_ulong evictions;
+  // candidates not admitted because they were less frequently requested than the LRU victim
+  atomic_ulong rejected;
+};
+
 // prints referenced error struct prefix+reason
 void printErr(int err) {
   if (err == errOk) {
@@ -128,7 +1300,7 @@ void printErr(int err) {
 void wsLog(const char* format, ...) {
   va_list argptr;
   va_start(argptr, format);
-  fprintf(LOG_STREAM, format, argptr); /* Flawfinder: ignore */ // ignored since format is defined as const
+  vfprintf(LOG_STREAM, format, argptr); /* Flawfinder: ignore */ // ignored since format is defined as const
   va_end(argptr);
   fflush(stdout);
 }
@@ -142,7 +1314,7 @@ struct httpRoute *createRoute(char *path, int method, struct httpResponse *resp,
     *err = errMemAlloc;
     return NULL;
   }
-  route->path = malloc(sizeof(char) * strlen(path));
+  route->path = malloc(sizeof(char) * (strlen(path)+1));
   if (route->path == NULL) {
     *err = errMemAlloc;
     return NULL;
@@ -151,645 +1323,10810 @@ struct httpRoute *createRoute(char *path, int method, struct httpResponse *resp,
 
   route->method = method;
   route->httpResp = resp;
+  route->handler = NULL;
+  route->handlerCtx = NULL;
+  route->maxBodySize = WS_MAX_REQ_BODY_SIZE;
+  route->proxy = NULL;
+  route->blocking = 0;
+  route->admin = 0;
+  route->rateLimit = 0;
+  route->rateBurst = 0;
+  route->cacheTtlMs = 0;
+  route->cacheStaleMs = 0;
+  route->cacheVary = NULL;
+  route->nCacheVary = 0;
 
+  *err = errOk;
   return route;
 }
 
-// frees all route structs attributes and struct itself from webserver struct
-void freeRoutes(webserver *ws) {
-  for (int i = 0; i < ws->nRoutes; i++) {
-    if (ws->routes[i]->httpResp->isFile) {
-      free(ws->routes[i]->httpResp->contentBuff);
-    }
-    free(ws->routes[i]->httpResp);
-    free(ws->routes[i]->path);
-    free(ws->routes[i]);
+// declares&inits handler route struct
+// handler is called with ctx for every request on the route, ctx is owned by the caller
+// returns reference to route struct
+struct httpRoute *createHandlerRoute(char *path, int method, wsHandler handler, void *ctx, int *err) {
+  struct httpRoute *route = createRoute(path, method, NULL, err);
+  if (route == NULL) {
+    return NULL;
   }
-  free(ws->routes);
+  route->handler = handler;
+  route->handlerCtx = ctx;
+
+  return route;
 }
 
-// adds route struct reference to webserver routes pointer arr
-// dynamically re/allocates memory
-void addRouteToWs(webserver *ws, struct httpRoute *route, int *err) {
-  if (ws->nRoutes == 0) {
-    ws->routes = malloc(sizeof *ws->routes);
-    if (ws->routes == NULL) {
-      *err = errMemAlloc;
-    }
-    ws->routes[ws->nRoutes] = route;
-  } else {
-    ws->routes = (struct httpRoute**)realloc(ws->routes, (ws->nRoutes+1)*sizeof(struct httpRoute**));
-    ws->routes[ws->nRoutes] = route;
+// allocates a route tree node with a copy of prefix
+struct routeNode *createRouteNode(const char *prefix, int prefixSize, int *err) {
+  struct routeNode *node = calloc(1, sizeof *node);
+  if (node == NULL) {
+    *err = errMemAlloc;
+    return NULL;
   }
-  ws->nRoutes++;
+  node->prefix = malloc(prefixSize+1);
+  if (node->prefix == NULL) {
+    free(node);
+    *err = errMemAlloc;
+    return NULL;
+  }
+  memcpy(node->prefix, prefix, prefixSize); /* Flawfinder: ignore */ // allocated above
+  node->prefix[prefixSize] = 0;
+  node->prefixSize = prefixSize;
   *err = errOk;
+  return node;
 }
 
-// removes space characters from given string ref
-void removeSpaces(char* str, int strle) {
-  int count = 0;
-  for (int i = 0; i <= strle; i++)
-      if (str[i] != ' ')
-          str[count++] = str[i];
+// frees the route tree node and all its children (not the routes)
+void freeRouteTree(struct routeNode *node) {
+  if (node == NULL) {
+    return;
+  }
+  for (int i = 0; i < node->nChildren; i++) {
+    freeRouteTree(node->children[i]);
+  }
+  freeRouteTree(node->paramChild);
+  freeRouteTree(node->wildcardChild);
+  free(node->children);
+  free(node->indices);
+  free(node->paramName);
+  free(node->allow);
+  free(node->prefix);
+  free(node);
 }
 
-// sends buffer on given socket
-// returns sent data size
-int sendBuffer(int sock, char *buff, int buffSize, int *err) {
-  int sendLeft = buffSize;
-  int dataSent = 0;
-  int rc;
-  while (sendLeft > 0) {
-    rc = send(sock, buff+(buffSize-sendLeft), sendLeft, 0);
-    if (rc == -1) {
-      *err = errNet;
-      return 0;
+// rebuilds the Allow header field value of node from its routes
+// HEAD is allowed along with GET, OPTIONS is answered for every path
+void routeNodeAllow(struct routeNode *node, int *err) {
+  char allow[64];
+  int size = 0;
+  for (int i = 0; i < httpNMethods; i++) {
+    if (node->routes[i] != NULL || (i == httpHead && node->routes[httpGet] != NULL) || i == httpOptions) {
+      size += sprintf(allow+size, "%s%s", size > 0 ? ", " : "", httpMethodNames[i]); /* Flawfinder: ignore */ // all method names fit into allow
     }
-    sendLeft -= rc;
-    dataSent += rc;
+  }
+  free(node->allow);
+  node->allow = strdup(allow);
+  if (node->allow == NULL) {
+    *err = errMemAlloc;
+    return;
   }
   *err = errOk;
-  return dataSent;
 }
 
-// prints & flushes buffer to stdout
-void printfBuffer(char *buff, int buffSize) {
-  fwrite(buff, buffSize, 1, stdout);
-  fflush(stdout);
+// appends child to the static children of node
+void addRouteNodeChild(struct routeNode *node, struct routeNode *child, int *err) {
+  struct routeNode **children = realloc(node->children, sizeof(struct routeNode*) * (node->nChildren+1));
+  if (children == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  node->children = children;
+  char *indices = realloc(node->indices, node->nChildren+2);
+  if (indices == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  node->indices = indices;
+  node->children[node->nChildren] = child;
+  node->indices[node->nChildren] = child->prefix[0];
+  node->indices[node->nChildren+1] = 0;
+  node->nChildren++;
+  *err = errOk;
 }
 
-// by https://stackoverflow.com/a/3464656, modified
-char *readFileToBuffer(char *filename, int *size, int *err) {
-  int stringSize, readSize;
-  FILE *handler = fopen(filename, "r"); /* Flawfinder: ignore */ // check for \0 terminateion and bufferoverflow checks are implemented below,
-  // since the system & files are developer handled and not meant to be modified during execution, race conditions are not considered
-  char *buffer;
-
-  if (handler) {
-    fseek(handler, 0, SEEK_END);
-    stringSize = ftell(handler);
-    rewind(handler);
-
-    buffer = malloc(sizeof(char) *stringSize+1);
-    if (buffer == NULL) {
-      *err = errMemAlloc;
-      return NULL;
+// inserts route with path pattern into the tree
+// ':name' captures a path segment, '*name' the rest of the path, both only directly after a '/'
+// a (method, path) pair which is already registered keeps its first route
+void routeInsert(struct routeNode *node, const char *path, struct httpRoute *route, int *err) {
+  *err = errOk;
+  if (route->method < 0 || route->method >= httpNMethods) {
+    *err = errInit;
+    return;
+  }
+  while (1) {
+    if (*path == 0) {
+      if (node->routes[route->method] == NULL) {
+        node->routes[route->method] = route;
+        routeNodeAllow(node, err);
+      }
+      return;
     }
-    readSize = fread(buffer, sizeof(char), stringSize, handler);
-    buffer[readSize] = 0;
 
-    if (stringSize != readSize) {
-      *err = errParse;
-      return NULL;
+    if (*path == ':' || *path == '*') {
+      int isWildcard = *path == '*';
+      int nameSize = strcspn(path+1, "/");
+      // a wildcard has to be the last segment
+      if (isWildcard && path[1+nameSize] != 0) {
+        *err = errInit;
+        return;
+      }
+      struct routeNode **child = isWildcard ? &node->wildcardChild : &node->paramChild;
+      if (*child == NULL) {
+        *child = createRouteNode("", 0, err);
+        if (*err != errOk) {
+          return;
+        }
+        (*child)->paramName = strndup(path+1, nameSize);
+        if ((*child)->paramName == NULL) {
+          *err = errMemAlloc;
+          return;
+        }
+      } else if (strlen((*child)->paramName) != (size_t)nameSize || strncmp((*child)->paramName, path+1, nameSize) != 0) { /* Flawfinder: ignore */ // \0 terminated by strndup
+        // the same segment can't be captured under different names
+        *err = errInit;
+        return;
+      }
+      node = *child;
+      path += 1+nameSize;
+      continue;
     }
 
-    // always remember to close the file
-    fclose(handler);
-  } else {
-    *err = errIO;
+    // static run up to the next param/ wildcard segment
+    int runSize = 0;
+    while (path[runSize] != 0 && !(runSize > 0 && path[runSize-1] == '/' && (path[runSize] == ':' || path[runSize] == '*'))) {
+      runSize++;
+    }
+
+    char *index = node->indices ? strchr(node->indices, path[0]) : NULL;
+    if (index == NULL) {
+      struct routeNode *child = createRouteNode(path, runSize, err);
+      if (*err != errOk) {
+        return;
+      }
+      addRouteNodeChild(node, child, err);
+      if (*err != errOk) {
+        freeRouteTree(child);
+        return;
+      }
+      node = child;
+      path += runSize;
+      continue;
+    }
+
+    struct routeNode *child = node->children[index - node->indices];
+    int common = 0;
+    while (common < runSize && common < child->prefixSize && path[common] == child->prefix[common]) {
+      common++;
+    }
+    // splitting the child at the common prefix
+    if (common < child->prefixSize) {
+      struct routeNode *split = createRouteNode(child->prefix, common, err);
+      if (*err != errOk) {
+        return;
+      }
+      memmove(child->prefix, child->prefix+common, child->prefixSize-common+1);
+      child->prefixSize -= common;
+      addRouteNodeChild(split, child, err);
+      if (*err != errOk) {
+        freeRouteTree(split);
+        return;
+      }
+      node->children[index - node->indices] = split;
+      child = split;
+    }
+    node = child;
+    path += common;
+  }
+}
+
+// returns the route of node serving method, a negative method returns any route of node
+struct httpRoute *routeNodeGet(struct routeNode *node, int method) {
+  if (method < 0) {
+    for (int i = 0; i < httpNMethods; i++) {
+      if (node->routes[i] != NULL) {
+        return node->routes[i];
+      }
+    }
     return NULL;
   }
-  *size = readSize;
+  if (node->routes[method] == NULL && method == httpHead) {
+    return node->routes[httpGet];
+  }
+  return node->routes[method];
+}
+
+// matches the remaining path below node (whose prefix is matched already) to a node with a route for method (any if negative)
+// static children take precedence over params which take precedence over wildcards, on a dead end the next alternative is tried
+// captures are put into req
+struct routeNode *routeMatch(struct routeNode *node, const char *path, int pathSize, int method, struct httpRequest *req) {
+  struct routeNode *match;
+
+  if (pathSize == 0 && routeNodeGet(node, method) != NULL) {
+    return node;
+  }
+
+  if (pathSize > 0 && node->indices != NULL) {
+    char *index = memchr(node->indices, path[0], node->nChildren);
+    if (index != NULL) {
+      struct routeNode *child = node->children[index - node->indices];
+      if (child->prefixSize <= pathSize && memcmp(child->prefix, path, child->prefixSize) == 0) {
+        match = routeMatch(child, path+child->prefixSize, pathSize-child->prefixSize, method, req);
+        if (match != NULL) {
+          return match;
+        }
+      }
+    }
+  }
+
+  if (node->paramChild != NULL && pathSize > 0 && path[0] != '/' && req->nPathParams < WS_MAX_PATH_PARAMS) {
+    int segmentSize = 0;
+    while (segmentSize < pathSize && path[segmentSize] != '/') {
+      segmentSize++;
+    }
+    int n = req->nPathParams++;
+    req->pathParamNames[n] = node->paramChild->paramName;
+    req->pathParams[n].data = (char*)path;
+    req->pathParams[n].size = segmentSize;
+    match = routeMatch(node->paramChild, path+segmentSize, pathSize-segmentSize, method, req);
+    if (match != NULL) {
+      return match;
+    }
+    req->nPathParams--;
+  }
+
+  if (node->wildcardChild != NULL && routeNodeGet(node->wildcardChild, method) != NULL && req->nPathParams < WS_MAX_PATH_PARAMS) {
+    int n = req->nPathParams++;
+    req->pathParamNames[n] = node->wildcardChild->paramName;
+    req->pathParams[n].data = (char*)path;
+    req->pathParams[n].size = pathSize;
+    return node->wildcardChild;
+  }
+  return NULL;
+}
+
+// looks up the route matching the request method & path, path parameters are captured into req
+// returns NULL if no route matches, node is set to the node matching the path with any method (405/ OPTIONS) or NULL (404)
+struct httpRoute *routeLookup(struct routeNode *root, const char *path, int method, struct httpRequest *req, struct routeNode **node) {
+  int pathSize = strlen(path); /* Flawfinder: ignore */ // \0 terminated by parseHttpRequest
+  req->nPathParams = 0;
+  *node = NULL;
+  if (root == NULL) {
+    return NULL;
+  }
+  // unknown methods (-1) are never routed
+  if (method >= 0) {
+    *node = routeMatch(root, path, pathSize, method, req);
+    if (*node != NULL) {
+      return routeNodeGet(*node, method);
+    }
+  }
+  req->nPathParams = 0;
+  *node = routeMatch(root, path, pathSize, -1, req);
+  return NULL;
+}
+
+// returns the method of the request (enum httpMethod)
+int getRequestMethod(struct httpRequest *req) {
+  return req->reqMethod;
+}
+
+// returns the path of the request (without query string)
+const char *getRequestPath(struct httpRequest *req) {
+  return req->requestUri;
+}
+
+// looks up the path parameter captured for name (without ':'/'*')
+// returns 1 if the parameter has been captured
+int getPathParam(struct httpRequest *req, const char *name, struct wsSlice *value) {
+  for (int i = 0; i < req->nPathParams; i++) {
+    if (strcmp(req->pathParamNames[i], name) == 0) {
+      *value = req->pathParams[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// complete status lines by status code, codes without a line are rejected
+struct wsStatusLine {
+  const char *line;
+  int size;
+};
+
+#define WS_STATUS_LINE(code, phrase) [code] = {"HTTP/" HTTP_VERSION " " #code " " phrase "\r\n", sizeof("HTTP/" HTTP_VERSION " " #code " " phrase "\r\n")-1}
+
+static const struct wsStatusLine wsStatusLines[WS_MAX_STATUS_CODE+1] = {
+  WS_STATUS_LINE(100, "Continue"),
+  WS_STATUS_LINE(101, "Switching Protocols"),
+  WS_STATUS_LINE(200, "OK"),
+  WS_STATUS_LINE(201, "Created"),
+  WS_STATUS_LINE(202, "Accepted"),
+  WS_STATUS_LINE(204, "No Content"),
+  WS_STATUS_LINE(206, "Partial Content"),
+  WS_STATUS_LINE(301, "Moved Permanently"),
+  WS_STATUS_LINE(302, "Found"),
+  WS_STATUS_LINE(303, "See Other"),
+  WS_STATUS_LINE(304, "Not Modified"),
+  WS_STATUS_LINE(307, "Temporary Redirect"),
+  WS_STATUS_LINE(308, "Permanent Redirect"),
+  WS_STATUS_LINE(400, "Bad Request"),
+  WS_STATUS_LINE(401, "Unauthorized"),
+  WS_STATUS_LINE(403, "Forbidden"),
+  WS_STATUS_LINE(404, "Not Found"),
+  WS_STATUS_LINE(405, "Method Not Allowed"),
+  WS_STATUS_LINE(408, "Request Timeout"),
+  WS_STATUS_LINE(409, "Conflict"),
+  WS_STATUS_LINE(410, "Gone"),
+  WS_STATUS_LINE(411, "Length Required"),
+  WS_STATUS_LINE(412, "Precondition Failed"),
+  WS_STATUS_LINE(413, "Payload Too Large"),
+  WS_STATUS_LINE(414, "URI Too Long"),
+  WS_STATUS_LINE(415, "Unsupported Media Type"),
+  WS_STATUS_LINE(416, "Range Not Satisfiable"),
+  WS_STATUS_LINE(417, "Expectation Failed"),
+  WS_STATUS_LINE(422, "Unprocessable Content"),
+  WS_STATUS_LINE(429, "Too Many Requests"),
+  WS_STATUS_LINE(431, "Request Header Fields Too Large"),
+  WS_STATUS_LINE(500, "Internal Server Error"),
+  WS_STATUS_LINE(501, "Not Implemented"),
+  WS_STATUS_LINE(502, "Bad Gateway"),
+  WS_STATUS_LINE(503, "Service Unavailable"),
+  WS_STATUS_LINE(504, "Gateway Timeout"),
+  WS_STATUS_LINE(505, "HTTP Version Not Supported")
+};
+
+// constant header fragments
+static const char wsHdrContentTypeHtml[] = "Content-type: text/html\r\n";
+static const char wsHdrContentTypeStatic[] = "Content-type: text/html, text, plain\r\n";
+static const char wsHdrContentLength[] = "Content-length: ";
+static const char wsHdrKeepAlive[] = "Connection: keep-alive\r\n";
+static const char wsHdrClose[] = "Connection: close\r\n";
+
+// two digit decimal strings of 0-99
+static const char wsDigitPairs[201] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+#define HPACK_STATIC(name, value) {name, sizeof(name)-1, value, sizeof(value)-1}
+
+// hpack static table (RFC 7541 appendix A), index 1 is at 0
+static const struct hpackStaticEntry hpackStaticTable[] = {
+  HPACK_STATIC(":authority", ""), HPACK_STATIC(":method", "GET"), HPACK_STATIC(":method", "POST"), HPACK_STATIC(":path", "/"),
+  HPACK_STATIC(":path", "/index.html"), HPACK_STATIC(":scheme", "http"), HPACK_STATIC(":scheme", "https"), HPACK_STATIC(":status", "200"),
+  HPACK_STATIC(":status", "204"), HPACK_STATIC(":status", "206"), HPACK_STATIC(":status", "304"), HPACK_STATIC(":status", "400"),
+  HPACK_STATIC(":status", "404"), HPACK_STATIC(":status", "500"), HPACK_STATIC("accept-charset", ""), HPACK_STATIC("accept-encoding", "gzip, deflate"),
+  HPACK_STATIC("accept-language", ""), HPACK_STATIC("accept-ranges", ""), HPACK_STATIC("accept", ""), HPACK_STATIC("access-control-allow-origin", ""),
+  HPACK_STATIC("age", ""), HPACK_STATIC("allow", ""), HPACK_STATIC("authorization", ""), HPACK_STATIC("cache-control", ""),
+  HPACK_STATIC("content-disposition", ""), HPACK_STATIC("content-encoding", ""), HPACK_STATIC("content-language", ""), HPACK_STATIC("content-length", ""),
+  HPACK_STATIC("content-location", ""), HPACK_STATIC("content-range", ""), HPACK_STATIC("content-type", ""), HPACK_STATIC("cookie", ""),
+  HPACK_STATIC("date", ""), HPACK_STATIC("etag", ""), HPACK_STATIC("expect", ""), HPACK_STATIC("expires", ""),
+  HPACK_STATIC("from", ""), HPACK_STATIC("host", ""), HPACK_STATIC("if-match", ""), HPACK_STATIC("if-modified-since", ""),
+  HPACK_STATIC("if-none-match", ""), HPACK_STATIC("if-range", ""), HPACK_STATIC("if-unmodified-since", ""), HPACK_STATIC("last-modified", ""),
+  HPACK_STATIC("link", ""), HPACK_STATIC("location", ""), HPACK_STATIC("max-forwards", ""), HPACK_STATIC("proxy-authenticate", ""),
+  HPACK_STATIC("proxy-authorization", ""), HPACK_STATIC("range", ""), HPACK_STATIC("referer", ""), HPACK_STATIC("refresh", ""),
+  HPACK_STATIC("retry-after", ""), HPACK_STATIC("server", ""), HPACK_STATIC("set-cookie", ""), HPACK_STATIC("strict-transport-security", ""),
+  HPACK_STATIC("transfer-encoding", ""), HPACK_STATIC("user-agent", ""), HPACK_STATIC("vary", ""), HPACK_STATIC("via", ""),
+  HPACK_STATIC("www-authenticate", "")
+};
+#define HPACK_STATIC_ENTRIES (int)(sizeof hpackStaticTable / sizeof hpackStaticTable[0])
+
+// the hpack huffman code (RFC 7541 appendix B) is canonical, so it's defined by the number of codes per length
+// and the symbols ordered by code, the EOS symbol (256) is the last one of length 30
+static const uint8_t hpackHuffCounts[31] = {0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4};
+static const uint8_t hpackHuffSymbols[256] = {
+  48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+  52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+  110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+  77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+  119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+  43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+  179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+  163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+  158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+  144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+  212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+  2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+  21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22
+};
+
+// returns the status line of statusCode or NULL if there is none
+const struct wsStatusLine *statusLine(int statusCode) {
+  if (statusCode < 0 || statusCode > WS_MAX_STATUS_CODE || wsStatusLines[statusCode].line == NULL) {
+    return NULL;
+  }
+  return &wsStatusLines[statusCode];
+}
+
+// returns the number of decimal digits of v
+int decDigits(uint64_t v) {
+  int n = 1;
+  while (1) {
+    if (v < 10) return n;
+    if (v < 100) return n+1;
+    if (v < 1000) return n+2;
+    if (v < 10000) return n+3;
+    v /= 10000;
+    n += 4;
+  }
+}
+
+// writes the decimal representation of v to out (not \0 terminated), two digits per step from the back
+// returns the number of digits written, at most 20
+int uintToDec(char *out, uint64_t v) {
+  int n = decDigits(v);
+  char *p = out+n;
+  while (v >= 100) {
+    int i = (v % 100) * 2;
+    v /= 100;
+    *--p = wsDigitPairs[i+1];
+    *--p = wsDigitPairs[i];
+  }
+  if (v >= 10) {
+    *--p = wsDigitPairs[v*2+1];
+    *--p = wsDigitPairs[v*2];
+  } else {
+    *--p = '0' + v;
+  }
+  return n;
+}
+
+// serializes the status line, the content type fragment (if not NULL), Content-length (if not negative), Connection,
+// the Date field (if not NULL, WS_DATE_HDR_SIZE bytes), the header fields in hdr and the empty line into out
+// the worst case size is checked before anything is written, returns the header size
+int serializeHeader(int statusCode, const char *contentType, int contentTypeSize, long long contentLength, int keepAlive, const char *date, const char *hdr, int hdrSize, char *out, int outSize, int *err) {
+  const struct wsStatusLine *status = statusLine(statusCode);
+  if (status == NULL) {
+    *err = errParse;
+    return 0;
+  }
+  // +22 for the Content-length digits and CRLF, +2 for the empty line
+  if (status->size + contentTypeSize + (int)sizeof(wsHdrContentLength)-1 + 22 + (int)sizeof(wsHdrKeepAlive)-1 + WS_DATE_HDR_SIZE + hdrSize + 2 > outSize) {
+    *err = errSecCheck;
+    return 0;
+  }
+
+  int size = status->size;
+  memcpy(out, status->line, status->size); /* Flawfinder: ignore */ // bounds checked above
+  if (contentType != NULL) {
+    memcpy(out+size, contentType, contentTypeSize); /* Flawfinder: ignore */ // bounds checked above
+    size += contentTypeSize;
+  }
+  if (contentLength >= 0) {
+    memcpy(out+size, wsHdrContentLength, sizeof(wsHdrContentLength)-1); /* Flawfinder: ignore */ // bounds checked above
+    size += sizeof(wsHdrContentLength)-1;
+    size += uintToDec(out+size, contentLength);
+    out[size++] = CR;
+    out[size++] = LF;
+  }
+  if (keepAlive) {
+    memcpy(out+size, wsHdrKeepAlive, sizeof(wsHdrKeepAlive)-1); /* Flawfinder: ignore */ // bounds checked above
+    size += sizeof(wsHdrKeepAlive)-1;
+  } else {
+    memcpy(out+size, wsHdrClose, sizeof(wsHdrClose)-1); /* Flawfinder: ignore */ // bounds checked above
+    size += sizeof(wsHdrClose)-1;
+  }
+  if (date != NULL) {
+    memcpy(out+size, date, WS_DATE_HDR_SIZE); /* Flawfinder: ignore */ // bounds checked above
+    size += WS_DATE_HDR_SIZE;
+  }
+  if (hdrSize > 0) {
+    memcpy(out+size, hdr, hdrSize); /* Flawfinder: ignore */ // bounds checked above
+    size += hdrSize;
+  }
+  out[size++] = CR;
+  out[size++] = LF;
+
   *err = errOk;
-  return buffer;
+  return size;
 }
 
 // crafts response with stat line, entity header and content from httpResponse struct
-// puts crafted response into the respBuff
-void craftResp(struct httpResponse *resp, char *respBuff, int respBuffSize, int *err) {
-  if (resp->statusCode < 100 || resp->statusCode > 511) {
-    *err = errParse;
+// puts the \0 terminated response into the respBuff, returns the response size
+int craftResp(struct httpResponse *resp, int keepAlive, char *respBuff, int respBuffSize, int *err) {
+  int size = serializeHeader(resp->statusCode, wsHdrContentTypeStatic, sizeof(wsHdrContentTypeStatic)-1, resp->contentSize, keepAlive, NULL, NULL, 0, respBuff, respBuffSize, err);
+  if (*err != errOk) {
+    return 0;
+  }
+  // +1 for the \0 termination
+  if (size + resp->contentSize + 1 > respBuffSize) {
+    *err = errSecCheck;
+    return 0;
+  }
+  memcpy(respBuff+size, resp->contentBuff, resp->contentSize); /* Flawfinder: ignore */ // bounds checked above
+  size += resp->contentSize;
+  respBuff[size] = 0;
+
+  *err = errOk;
+  return size;
+}
+
+// serializes the status line & header fields of the static response for both connection types
+// the Date field and the body are gathered with the header when sent
+void preSerializeResp(struct httpResponse *resp, int *err) {
+  char header[WS_BUFF_SIZE];
+
+  resp->header[0] = resp->header[1] = NULL;
+  for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+    resp->headerSize[keepAlive] = serializeHeader(resp->statusCode, wsHdrContentTypeStatic, sizeof(wsHdrContentTypeStatic)-1, resp->contentSize, keepAlive, NULL, NULL, 0, header, WS_BUFF_SIZE, err);
+    if (*err != errOk) {
+      return;
+    }
+    resp->header[keepAlive] = malloc(resp->headerSize[keepAlive]);
+    if (resp->header[keepAlive] == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+    memcpy(resp->header[keepAlive], header, resp->headerSize[keepAlive]); /* Flawfinder: ignore */ // allocated above
+  }
+}
+
+// frees all route structs attributes and struct itself from webserver struct
+void freeRoutes(webserver *ws) {
+  freeRouteTree(ws->routeTree);
+  for (int i = 0; i < ws->nRoutes; i++) {
+    if (ws->routes[i]->httpResp != NULL) {
+      if (ws->routes[i]->httpResp->isFile) {
+        free(ws->routes[i]->httpResp->contentBuff);
+      }
+      free(ws->routes[i]->httpResp->header[0]);
+      free(ws->routes[i]->httpResp->header[1]);
+    }
+    free(ws->routes[i]->httpResp);
+    free(ws->routes[i]->cacheVary);
+    free(ws->routes[i]->path);
+    free(ws->routes[i]);
+  }
+  free(ws->routes);
+}
+
+// adds route struct reference to webserver routes pointer arr and inserts it into the route tree
+// the header of static routes is serialized beforehand
+// dynamically re/allocates memory
+void addRouteToWs(webserver *ws, struct httpRoute *route, int *err) {
+  if (route->httpResp != NULL) {
+    preSerializeResp(route->httpResp, err);
+    if (*err != errOk) {
+      free(route->httpResp->header[0]);
+      free(route->httpResp->header[1]);
+      route->httpResp->header[0] = route->httpResp->header[1] = NULL;
+      return;
+    }
+  }
+  // doubling keeps adding n routes linear
+  if (ws->nRoutes == ws->routesCap) {
+    int routesCap = ws->routesCap ? ws->routesCap*2 : 16;
+    struct httpRoute **routes = (struct httpRoute**)realloc(ws->routes, routesCap*sizeof(struct httpRoute*));
+    if (routes == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+    ws->routes = routes;
+    ws->routesCap = routesCap;
+  }
+  ws->routes[ws->nRoutes++] = route;
+
+  if (ws->routeTree == NULL) {
+    ws->routeTree = createRouteNode("", 0, err);
+    if (*err != errOk) {
+      return;
+    }
+  }
+  routeInsert(ws->routeTree, route->path, route, err);
+}
+
+// removes space characters from given string ref
+void removeSpaces(char* str, int strle) {
+  int count = 0;
+  for (int i = 0; i <= strle; i++)
+      if (str[i] != ' ')
+          str[count++] = str[i];
+}
+
+// sends buffer on given socket
+// returns sent data size
+int sendBuffer(int sock, char *buff, int buffSize, int *err) {
+  int sendLeft = buffSize;
+  int dataSent = 0;
+  int rc;
+  while (sendLeft > 0) {
+    rc = send(sock, buff+(buffSize-sendLeft), sendLeft, MSG_NOSIGNAL);
+    if (rc == -1) {
+      *err = errNet;
+      return 0;
+    }
+    sendLeft -= rc;
+    dataSent += rc;
+  }
+  *err = errOk;
+  return dataSent;
+}
+
+// sends nFds file descriptors (SCM_RIGHTS) over unix socket sock, with one tag byte per fd as payload
+void sendFds(int sock, int *fds, char *tags, int nFds, int *err) {
+  char control[CMSG_SPACE(sizeof(int) * WS_MAX_HANDOFF_FDS)];
+  struct iovec iov = {.iov_base = tags, .iov_len = nFds};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = CMSG_SPACE(sizeof(int) * nFds)};
+
+  if (nFds < 1 || nFds > WS_MAX_HANDOFF_FDS) {
+    *err = errSecCheck;
+    return;
+  }
+  memset(control, 0, sizeof control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nFds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nFds); /* Flawfinder: ignore */ // bounds checked above
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != nFds) {
+    *err = errNet;
+    return;
+  }
+  *err = errOk;
+}
+
+// receives up to maxFds file descriptors (SCM_RIGHTS) and their tag bytes (maxFds bytes) from unix socket sock
+// returns the number of received fds
+int recvFds(int sock, int *fds, char *tags, int maxFds, int *err) {
+  char control[CMSG_SPACE(sizeof(int) * WS_MAX_HANDOFF_FDS)];
+  struct iovec iov = {.iov_base = tags, .iov_len = maxFds};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof control};
+  int nFds = 0;
+
+  if (maxFds > WS_MAX_HANDOFF_FDS || recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) < 1) {
+    *err = errNet;
+    return 0;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      nFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (nFds > maxFds) {
+        *err = errSecCheck;
+        return 0;
+      }
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nFds); /* Flawfinder: ignore */ // bounds checked above
+    }
+  }
+  *err = nFds > 0 ? errOk : errNet;
+  return nFds;
+}
+
+// returns monotonic clock time in ns
+uint64_t wsNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// trace ring index & thread id of the calling thread, -1 until it records its first event
+static __thread int wsTraceRing = -1;
+static __thread int wsTraceTid = 0;
+
+// records the span of stage [startNs, endNs) of the traced request reqId into the ring of the calling thread
+// the event is dropped if the ring is busy (shared with a thread writing or being dumped)
+void traceRecord(struct wsTracer *tracer, int stage, uint32_t reqId, uint64_t startNs, uint64_t endNs, const char *path) {
+  if (wsTraceRing == -1) {
+    wsTraceRing = atomic_fetch_add(&tracer->nextRing, 1) % WS_TRACE_RINGS;
+    wsTraceTid = (int)syscall(SYS_gettid);
+  }
+  struct traceRing *ring = atomic_load_explicit(&tracer->rings[wsTraceRing], memory_order_acquire);
+  if (ring == NULL) {
+    struct traceRing *newRing = calloc(1, sizeof *newRing);
+    if (newRing == NULL) {
+      atomic_fetch_add(&tracer->dropped, 1);
+      return;
+    }
+    // another thread of the ring may have been faster
+    if (!atomic_compare_exchange_strong(&tracer->rings[wsTraceRing], &ring, newRing)) {
+      free(newRing);
+    } else {
+      ring = newRing;
+    }
+  }
+  if (atomic_exchange_explicit(&ring->busy, 1, memory_order_acquire)) {
+    atomic_fetch_add(&tracer->dropped, 1);
+    return;
+  }
+  struct traceEvent *event = &ring->events[ring->written++ & (WS_TRACE_RING_SIZE - 1)];
+  event->startNs = startNs;
+  event->durNs = endNs - startNs;
+  event->reqId = reqId;
+  event->tid = wsTraceTid;
+  event->stage = stage;
+  event->path[0] = 0;
+  if (path != NULL) {
+    strncpy(event->path, path, sizeof event->path - 1); /* Flawfinder: ignore */ // \0 terminated below
+    event->path[sizeof event->path - 1] = 0;
+  }
+  atomic_store_explicit(&ring->busy, 0, memory_order_release);
+}
+
+// decides if the next request of conn is traced (1 in traceSample), idle connections start at the first byte (traceFirstByte)
+// called only if tracing is enabled
+void traceBegin(webserver *wserver, struct wsConn *conn, int idle) {
+  uint32_t n = atomic_fetch_add_explicit(&wserver->tracer.nRequests, 1, memory_order_relaxed);
+  if (conn->nRequests > 0) {
+    conn->trace.acceptNs = 0;
+  }
+  conn->trace.sampled = n % wserver->config.traceSample == 0;
+  if (!conn->trace.sampled) {
+    return;
+  }
+  conn->trace.reqId = n;
+  conn->trace.startNs = idle ? 0 : wsNowNs();
+  conn->trace.lastNs = conn->trace.startNs;
+}
+
+// starts the trace of a request which waited on an idle connection once its first byte arrived
+void traceFirstByte(struct wsConn *conn) {
+  if (conn->trace.sampled && conn->trace.startNs == 0) {
+    conn->trace.startNs = wsNowNs();
+    conn->trace.lastNs = conn->trace.startNs;
+  }
+}
+
+// records the stage of the traced request of conn which ended now, no op if it isn't traced
+void traceStage(webserver *wserver, struct wsConn *conn, int stage) {
+  if (!conn->trace.sampled || conn->trace.startNs == 0) {
+    return;
+  }
+  uint64_t now = wsNowNs();
+  traceRecord(&wserver->tracer, stage, conn->trace.reqId, conn->trace.lastNs, now, NULL);
+  conn->trace.lastNs = now;
+}
+
+// records the span of the whole traced request of conn (& the accept span if it's the first of the connection)
+void traceEnd(webserver *wserver, struct wsConn *conn, const char *path) {
+  if (!conn->trace.sampled || conn->trace.startNs == 0) {
+    conn->trace.sampled = 0;
+    return;
+  }
+  if (conn->trace.acceptNs != 0) {
+    traceRecord(&wserver->tracer, spanAccept, conn->trace.reqId, conn->trace.acceptNs, conn->trace.servedNs, NULL);
+  }
+  traceRecord(&wserver->tracer, spanRequest, conn->trace.reqId, conn->trace.startNs, wsNowNs(), path);
+  conn->trace.acceptNs = 0;
+  conn->trace.sampled = 0;
+}
+
+// formats the Date header field into the next slot and publishes it if the second changed
+// only called by one thread at a time (wsInit, then the timer thread)
+void wsDateUpdate(struct wsDate *date) {
+  struct tm tm;
+  time_t now = time(NULL);
+  if (now == date->second && atomic_load_explicit(&date->current, memory_order_relaxed) != NULL) {
     return;
   }
-  int size = 0;
+  char *slot = date->slots[date->next];
+  gmtime_r(&now, &tm);
+  strftime(slot, WS_DATE_HDR_SIZE+3, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n\r\n", &tm);
+  date->next = (date->next + 1) % WS_DATE_SLOTS;
+  date->second = now;
+  atomic_store_explicit(&date->current, slot, memory_order_release);
+}
+
+// returns the current Date header field (WS_DATE_HDR_SIZE bytes, followed by the empty line)
+const char *wsDateGet(struct wsDate *date) {
+  return atomic_load_explicit(&date->current, memory_order_acquire);
+}
+
+// integer square root (newton iteration), spares linking libm for the codel control law
+uint64_t isqrt(uint64_t n) {
+  if (n < 2) {
+    return n;
+  }
+  uint64_t x = n;
+  uint64_t y = (x + 1) / 2;
+  while (y < x) {
+    x = y;
+    y = (x + n / x) / 2;
+  }
+  return x;
+}
+
+// codel control law, next drop time is interval/sqrt(count) after t
+// sqrt is computed in 10 bit fixed point
+uint64_t codelControlLaw(uint64_t t, uint64_t interval, uint32_t count) {
+  return t + (interval << 10) / isqrt((uint64_t)count << 20);
+}
+
+// decides on dequeue whether the connection, which waited sojourn ns in the queue, is shed
+// returns 1 if the connection should be shed
+int codelShouldDrop(struct codelState *codel, uint64_t now, uint64_t sojourn, uint64_t target, uint64_t interval) {
+  int okToDrop = 0;
+
+  // the queue delay has to stay above target for at least one interval before shedding starts
+  if (sojourn < target) {
+    codel->firstAboveTime = 0;
+  } else if (codel->firstAboveTime == 0) {
+    codel->firstAboveTime = now + interval;
+  } else if (now >= codel->firstAboveTime) {
+    okToDrop = 1;
+  }
+
+  if (codel->dropping) {
+    if (!okToDrop) {
+      codel->dropping = 0;
+      return 0;
+    }
+    if (now >= codel->dropNext) {
+      codel->dropCount++;
+      codel->dropNext = codelControlLaw(codel->dropNext, interval, codel->dropCount);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (okToDrop) {
+    codel->dropping = 1;
+    // if the last dropping state was recent the drop rate is resumed instead of restarted
+    if (codel->dropCount > 2 && now - codel->dropNext < 8*interval) {
+      codel->dropCount -= 2;
+    } else {
+      codel->dropCount = 1;
+    }
+    codel->dropNext = codelControlLaw(now, interval, codel->dropCount);
+    return 1;
+  }
+  return 0;
+}
+
+// sends the pre-serialized response resp (plaintext connections) and closes the connection
+// the request is not read, only what already arrived is drained to prevent a reset on close
+void rejectConn(webserver *wserver, int socket, int tls, char *resp, int respSize) {
+  char drainBuff[WS_BUFF_SIZE];
+  // a plaintext response can't be read by a tls client, the connection is only closed
+  if (tls) {
+    close(socket);
+    return;
+  }
+  // the Date field is gathered in place of the empty line
+  struct iovec iov[2] = {{.iov_base = resp, .iov_len = respSize-2}, {.iov_base = (char*)wsDateGet(&wserver->date), .iov_len = WS_DATE_HDR_SIZE+2}};
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+  sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+  shutdown(socket, SHUT_WR);
+  recv(socket, drainBuff, WS_BUFF_SIZE, MSG_DONTWAIT); /* Flawfinder: ignore */ // content is discarded
+  close(socket);
+}
+
+// sends the pre-serialized 503 response (plaintext connections) and closes the connection
+void shedConn(webserver *wserver, int socket, int tls) {
+  rejectConn(wserver, socket, tls, wserver->admission.shedResp, wserver->admission.shedRespSize);
+}
+
+// admits a newly accepted connection
+// returns 1 if a new client thread has to be created for the socket, 0 if it has been queued or shed
+int admitConn(webserver *wserver, int socket, int tls) {
+  struct wsAdmission *adm = &wserver->admission;
+
+  pthread_mutex_lock(&adm->lock);
+  if (adm->nActive < wserver->config.maxConns) {
+    adm->nActive++;
+    pthread_mutex_unlock(&adm->lock);
+    return 1;
+  }
+  if (adm->nQueued < wserver->config.maxQueued) {
+    int tail = (adm->queueHead + adm->nQueued) % wserver->config.maxQueued;
+    adm->queue[tail].socket = socket;
+    adm->queue[tail].tls = tls;
+    adm->queue[tail].acceptTime = wsNowNs();
+    adm->nQueued++;
+    pthread_mutex_unlock(&adm->lock);
+    return 0;
+  }
+  adm->nShed++;
+  pthread_mutex_unlock(&adm->lock);
+
+  shedConn(wserver, socket, tls);
+  return 0;
+}
+
+// releases a connection slot without serving queued connections (used on client thread creation failure)
+void admissionRelease(webserver *wserver) {
+  pthread_mutex_lock(&wserver->admission.lock);
+  wserver->admission.nActive--;
+  pthread_mutex_unlock(&wserver->admission.lock);
+}
+
+// returns the next queued connection that is to be served by the calling client thread
+// connections which exceeded the codel queue delay are shed, returns -1 (and releases the thread slot) if the queue is empty
+// tls is set if the connection has been accepted by a tls listener
+int admissionNext(webserver *wserver, int *tls) {
+  struct wsAdmission *adm = &wserver->admission;
+  struct pendingConn shed[16];
+  int nShed = 0;
+  int socket = -1;
+
+  uint64_t target = (uint64_t)wserver->config.queueTargetMs * 1000000ULL;
+  uint64_t interval = (uint64_t)wserver->config.queueIntervalMs * 1000000ULL;
+
+  pthread_mutex_lock(&adm->lock);
+  while (adm->nQueued > 0) {
+    struct pendingConn conn = adm->queue[adm->queueHead];
+    adm->queueHead = (adm->queueHead + 1) % wserver->config.maxQueued;
+    adm->nQueued--;
+
+    uint64_t now = wsNowNs();
+    if (nShed < 16 && codelShouldDrop(&adm->codel, now, now - conn.acceptTime, target, interval)) {
+      shed[nShed++] = conn;
+      adm->nShed++;
+      continue;
+    }
+    socket = conn.socket;
+    *tls = conn.tls;
+    break;
+  }
+  if (socket == -1) {
+    adm->nActive--;
+  }
+  pthread_mutex_unlock(&adm->lock);
+
+  for (int i = 0; i < nShed; i++) {
+    shedConn(wserver, shed[i].socket, shed[i].tls);
+  }
+  return socket;
+}
+
+// inits all timer wheel slots as empty lists, starting at tick now
+void timerWheelInit(struct timerWheel *tw, uint64_t now) {
+  for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      tw->slots[l][i].next = &tw->slots[l][i];
+      tw->slots[l][i].prev = &tw->slots[l][i];
+    }
+  }
+  tw->now = now;
+}
+
+// links timer into the slot matching its expiry tick
+// expiry ticks which already passed are expired with the next processed tick
+void timerAdd(struct timerWheel *tw, struct wsTimer *timer, uint64_t expires) {
+  struct wsTimer *slot;
+  uint64_t delta;
+
+  if (expires < tw->now) {
+    expires = tw->now;
+  }
+  delta = expires - tw->now;
+  // clamping to the range of the wheel
+  if (delta >= (1ULL << (TIMER_WHEEL_LEVELS*TIMER_WHEEL_BITS))) {
+    delta = (1ULL << (TIMER_WHEEL_LEVELS*TIMER_WHEEL_BITS)) - 1;
+    expires = tw->now + delta;
+  }
+  timer->expires = expires;
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS-1 && delta >= (1ULL << ((level+1)*TIMER_WHEEL_BITS))) {
+    level++;
+  }
+  slot = &tw->slots[level][(expires >> (level*TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+
+  timer->prev = slot->prev;
+  timer->next = slot;
+  slot->prev->next = timer;
+  slot->prev = timer;
+}
+
+// unlinks timer from the wheel, no op if the timer is not armed
+void timerDel(struct wsTimer *timer) {
+  if (timer->next == NULL) {
+    return;
+  }
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+// re-adds all timers of a higher level slot to the lower levels
+// returns the slot index, a cascade of the next level is required if it's 0
+int timerCascade(struct timerWheel *tw, int level) {
+  int index = (tw->now >> (level*TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+  struct wsTimer *slot = &tw->slots[level][index];
+  struct wsTimer *timer = slot->next;
+
+  slot->next = slot;
+  slot->prev = slot;
+  while (timer != slot) {
+    struct wsTimer *next = timer->next;
+    timerAdd(tw, timer, timer->expires);
+    timer = next;
+  }
+  return index;
+}
+
+// advances the wheel up to and including tick target
+// expired timers are unlinked and returned as singly linked list (next) so they can be handled in one batch
+struct wsTimer *timerWheelAdvance(struct timerWheel *tw, uint64_t target) {
+  struct wsTimer *expired = NULL;
+
+  while (tw->now <= target) {
+    int index = tw->now & TIMER_WHEEL_MASK;
+    if (index == 0) {
+      for (int level = 1; level < TIMER_WHEEL_LEVELS && timerCascade(tw, level) == 0; level++);
+    }
+
+    struct wsTimer *slot = &tw->slots[0][index];
+    while (slot->next != slot) {
+      struct wsTimer *timer = slot->next;
+      timerDel(timer);
+      timer->next = expired;
+      expired = timer;
+    }
+    tw->now++;
+  }
+  return expired;
+}
+
+// returns the current tick of the webserver timer wheel clock
+uint64_t wsNowTicks() {
+  return wsNowNs() / (WS_TIMER_TICK_MS * 1000000ULL);
+}
+
+// (re)arms the connection timer to expire in timeoutMs
+// idle marks connections which wait for the next request and may be closed right away on shutdown
+void connArmTimer(webserver *wserver, struct wsConn *conn, int timeoutMs, int idle) {
+  pthread_mutex_lock(&wserver->timerLock);
+  conn->idle = idle;
+  timerDel(&conn->timer);
+  // +1 since the current tick is already partly elapsed
+  timerAdd(&wserver->timers, &conn->timer, wserver->timers.now + (timeoutMs + WS_TIMER_TICK_MS - 1) / WS_TIMER_TICK_MS + 1);
+  pthread_mutex_unlock(&wserver->timerLock);
+}
+
+// disarms the connection timer, has to be called before the connection socket is closed
+void connDisarmTimer(webserver *wserver, struct wsConn *conn) {
+  pthread_mutex_lock(&wserver->timerLock);
+  timerDel(&conn->timer);
+  pthread_mutex_unlock(&wserver->timerLock);
+}
+
+// shuts down the sockets of all connections with an armed timer (only the idle ones if idleOnly is set)
+// since every served connection has an armed timer, this covers all connections
+void connShutdownAll(webserver *wserver, int idleOnly) {
+  pthread_mutex_lock(&wserver->timerLock);
+  for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      struct wsTimer *slot = &wserver->timers.slots[l][i];
+      for (struct wsTimer *timer = slot->next; timer != slot; timer = timer->next) {
+        struct wsConn *conn = (struct wsConn*)timer->data;
+        if (!idleOnly || conn->idle) {
+          shutdown(conn->socket, SHUT_RDWR);
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock(&wserver->timerLock);
+}
+
+// updates the Date header field, advances the timer wheel & shuts down all expired connections in one batch (timerLock held)
+// the blocked read/send of the serving client thread (or the wait of the coroutine) returns and the connection is closed
+// returns the number of expired connections
+int wsTimerTick(webserver *wserver) {
+  int nExpired = 0;
+  wsDateUpdate(&wserver->date);
+  struct wsTimer *timer = timerWheelAdvance(&wserver->timers, wsNowTicks());
+  while (timer != NULL) {
+    struct wsTimer *next = timer->next;
+    timer->next = NULL;
+    shutdown(((struct wsConn*)timer->data)->socket, SHUT_RDWR);
+    nExpired++;
+    timer = next;
+  }
+  return nExpired;
+}
+
+// the timer thread ticks once per WS_TIMER_TICK_MS (wsTimerTick)
+void *timerThread(void *args) {
+  webserver *wserver = (webserver*)args;
+  struct timespec tick = {.tv_sec = WS_TIMER_TICK_MS / 1000, .tv_nsec = (WS_TIMER_TICK_MS % 1000) * 1000000L};
+
+  while (1) {
+    nanosleep(&tick, NULL);
+
+    pthread_mutex_lock(&wserver->timerLock);
+    if (wserver->timersStopped) {
+      pthread_mutex_unlock(&wserver->timerLock);
+      break;
+    }
+    int nExpired = wsTimerTick(wserver);
+    pthread_mutex_unlock(&wserver->timerLock);
+
+    if (nExpired > 0) {
+      wsLog("connection(s) timed out \n");
+    }
+  }
+  return NULL;
+}
+
+// event loop of the calling thread, NULL on other threads
+static __thread struct wsLoop *wsCurrentLoop = NULL;
+
+// the library only exports the api of webserver.h, the symbol of the assembly isn't hidden by -fvisibility
+#ifdef WS_LIBRARY
+#define CO_SWITCH_VISIBILITY ".hidden coSwitch\n"
+#else
+#define CO_SWITCH_VISIBILITY ""
+#endif
+
+// switches from the running context to the one saved in to, the running one is saved in from
+#if defined(__x86_64__)
+void coSwitch(struct coContext *from, struct coContext *to);
+// callee-saved registers, mxcsr & the x87 control word are saved on the stack of the suspended context
+__asm__(
+  ".text\n"
+  ".globl coSwitch\n"
+  CO_SWITCH_VISIBILITY
+  ".type coSwitch, @function\n"
+  "coSwitch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq (%rsi), %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size coSwitch, .-coSwitch\n"
+);
+#elif defined(__aarch64__)
+void coSwitch(struct coContext *from, struct coContext *to);
+// callee-saved registers x19-x30 & d8-d15 are saved on the stack of the suspended context
+__asm__(
+  ".text\n"
+  ".globl coSwitch\n"
+  CO_SWITCH_VISIBILITY
+  ".type coSwitch, %function\n"
+  "coSwitch:\n"
+  "  sub sp, sp, #160\n"
+  "  stp x19, x20, [sp, #0]\n"
+  "  stp x21, x22, [sp, #16]\n"
+  "  stp x23, x24, [sp, #32]\n"
+  "  stp x25, x26, [sp, #48]\n"
+  "  stp x27, x28, [sp, #64]\n"
+  "  stp x29, x30, [sp, #80]\n"
+  "  stp d8, d9, [sp, #96]\n"
+  "  stp d10, d11, [sp, #112]\n"
+  "  stp d12, d13, [sp, #128]\n"
+  "  stp d14, d15, [sp, #144]\n"
+  "  mov x9, sp\n"
+  "  str x9, [x0]\n"
+  "  ldr x9, [x1]\n"
+  "  mov sp, x9\n"
+  "  ldp x19, x20, [sp, #0]\n"
+  "  ldp x21, x22, [sp, #16]\n"
+  "  ldp x23, x24, [sp, #32]\n"
+  "  ldp x25, x26, [sp, #48]\n"
+  "  ldp x27, x28, [sp, #64]\n"
+  "  ldp x29, x30, [sp, #80]\n"
+  "  ldp d8, d9, [sp, #96]\n"
+  "  ldp d10, d11, [sp, #112]\n"
+  "  ldp d12, d13, [sp, #128]\n"
+  "  ldp d14, d15, [sp, #144]\n"
+  "  add sp, sp, #160\n"
+  "  ret\n"
+  ".size coSwitch, .-coSwitch\n"
+);
+#else
+#define coSwitch(from, to) swapcontext(&(from)->uc, &(to)->uc)
+#endif
+
+// switches from the running coroutine back to its loop, returns once the loop resumes it (never if it's done)
+void coSuspend(struct wsCoroutine *co) {
+  struct wsLoop *loop = co->loop;
+#ifdef WS_CO_ASAN
+  // the fake stack of a finished coroutine is released
+  __sanitizer_start_switch_fiber(co->done ? NULL : &co->fakeStack, loop->stackBottom, loop->stackSize);
+#endif
+  coSwitch(&co->ctx, &loop->ctx);
+#ifdef WS_CO_ASAN
+  __sanitizer_finish_switch_fiber(co->fakeStack, NULL, NULL);
+#endif
+}
+
+// first frame of every coroutine, runs its function & switches back to the loop for good
+void coEntry() {
+  struct wsLoop *loop = wsCurrentLoop;
+  struct wsCoroutine *co = loop->current;
+#ifdef WS_CO_ASAN
+  __sanitizer_finish_switch_fiber(NULL, &loop->stackBottom, &loop->stackSize);
+#endif
+  co->fn(co->arg);
+  co->done = 1;
+  coSuspend(co);
+}
+
+// prepares the context of co to start in coEntry on the stack below the coroutine struct
+void coInitContext(struct wsCoroutine *co) {
+#if defined(__x86_64__)
+  void **sp = (void**)co;
+  // return address of coEntry (which never returns), the stack is aligned as after a call once coSwitch returns to coEntry
+  *--sp = NULL;
+  *--sp = (void*)coEntry;
+  for (int i = 0; i < 6; i++) {
+    *--sp = NULL;
+  }
+  // default mxcsr & x87 control word
+  *--sp = (void*)(uintptr_t)(0x037FULL << 32 | 0x1F80);
+  co->ctx.sp = sp;
+#elif defined(__aarch64__)
+  void **sp = (void**)co - 20;
+  memset(sp, 0, 20 * sizeof(void*));
+  // x30, the link register coSwitch returns to
+  sp[11] = (void*)coEntry;
+  co->ctx.sp = sp;
+#else
+  long pageSize = sysconf(_SC_PAGESIZE);
+  getcontext(&co->ctx.uc);
+  co->ctx.uc.uc_stack.ss_sp = co->stack + pageSize;
+  co->ctx.uc.uc_stack.ss_size = (char*)co - (co->stack + pageSize);
+  co->ctx.uc.uc_link = NULL;
+  makecontext(&co->ctx.uc, coEntry, 0);
+#endif
+}
+
+// creates a coroutine running fn(arg) on loop (not started yet), its stack is taken from the loop pool or mapped
+// returns NULL on failure
+struct wsCoroutine *coCreate(struct wsLoop *loop, void (*fn)(void *arg), void *arg, int *err) {
+  struct wsCoroutine *co = loop->pool;
+  if (co != NULL) {
+    loop->pool = co->next;
+    loop->nPooled--;
+  } else {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *stack = mmap(NULL, WS_CO_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+      *err = errMemAlloc;
+      return NULL;
+    }
+    // guard page, a stack overflow faults instead of overwriting the memory below
+    if (mprotect(stack, pageSize, PROT_NONE) != 0) {
+      munmap(stack, WS_CO_STACK_SIZE);
+      *err = errMemAlloc;
+      return NULL;
+    }
+    co = (struct wsCoroutine*)(((uintptr_t)stack + WS_CO_STACK_SIZE - sizeof *co) & ~(uintptr_t)63);
+    co->stack = stack;
+  }
+  co->loop = loop;
+  co->next = NULL;
+  co->fn = fn;
+  co->arg = arg;
+  co->timer = (struct wsTimer){.data = co};
+  co->socket = -1;
+  co->registered = 0;
+  co->timedOut = 0;
+  co->done = 0;
+  coInitContext(co);
+  atomic_fetch_add(&loop->nCoroutines, 1);
+  *err = errOk;
+  return co;
+}
+
+// returns the stack of a finished coroutine to the loop pool, it's unmapped if the pool is full
+void coRelease(struct wsLoop *loop, struct wsCoroutine *co) {
+  atomic_fetch_sub(&loop->nCoroutines, 1);
+  if (loop->nPooled < WS_CO_POOL_SIZE) {
+    co->next = loop->pool;
+    loop->pool = co;
+    loop->nPooled++;
+    return;
+  }
+  munmap(co->stack, WS_CO_STACK_SIZE);
+}
+
+// runs co until it parks or finishes (called by the loop thread)
+void coResume(struct wsLoop *loop, struct wsCoroutine *co) {
+  loop->current = co;
+#ifdef WS_CO_ASAN
+  __sanitizer_start_switch_fiber(&loop->fakeStack, co->stack, (char*)co - co->stack);
+#endif
+  coSwitch(&loop->ctx, &co->ctx);
+#ifdef WS_CO_ASAN
+  __sanitizer_finish_switch_fiber(loop->fakeStack, NULL, NULL);
+#endif
+  loop->current = NULL;
+  if (co->done) {
+    coRelease(loop, co);
+  }
+}
+
+// returns the running coroutine, NULL outside of coroutines
+struct wsCoroutine *coCurrent() {
+  return wsCurrentLoop != NULL ? wsCurrentLoop->current : NULL;
+}
+
+// binds the running coroutine to the connection socket it serves, which then stays in the epoll interest list between waits
+// (until it's closed), no op outside of coroutines
+void coBind(int socket) {
+  struct wsCoroutine *co = coCurrent();
+  if (co != NULL) {
+    co->socket = socket;
+    co->registered = 0;
+  }
+}
+
+// parks the running coroutine until fd is ready for events (EPOLLIN/ EPOLLOUT) or timeoutMs passed (-1 waits without timeout)
+// handlers can wait on their own (non-blocking) sockets, connection timeouts wake waits on the connection socket (shut down)
+// outside of coroutines (e.g. blocking handlers on the blocking pool) a non-blocking fd is polled
+// returns 1 once fd is ready (or hung up), 0 on timeout, failure or if fd is blocking outside of coroutines
+int coWait(int fd, uint32_t events, int timeoutMs) {
+  struct wsCoroutine *co = coCurrent();
+  if (co == NULL) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || !(flags & O_NONBLOCK)) {
+      return 0;
+    }
+    struct pollfd pfd = {.fd = fd, .events = (events & EPOLLIN ? POLLIN : 0) | (events & EPOLLOUT ? POLLOUT : 0)};
+    int rc;
+    while ((rc = poll(&pfd, 1, timeoutMs)) == -1 && errno == EINTR);
+    return rc > 0;
+  }
+  struct wsLoop *loop = co->loop;
+  int bound = fd == co->socket;
+  struct epoll_event event = {.events = events | EPOLLONESHOT, .data.ptr = co};
+  if (epoll_ctl(loop->epollFd, bound && co->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0) {
+    return 0;
+  }
+  co->registered |= bound;
+  co->timedOut = 0;
+  if (timeoutMs >= 0) {
+    // the wheel of an idle loop lags behind, it's only advanced after epoll_wait
+    timerAdd(&loop->timers, &co->timer, wsNowTicks() + (timeoutMs + WS_TIMER_TICK_MS - 1) / WS_TIMER_TICK_MS + 1);
+    loop->nTimed++;
+  }
+
+  coSuspend(co);
+
+  if (timeoutMs >= 0) {
+    timerDel(&co->timer);
+    loop->nTimed--;
+  }
+  // a registration left armed would resume the coroutine while it waits for something else
+  if (!bound || co->timedOut) {
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    co->registered &= !bound;
+  }
+  return !co->timedOut;
+}
+
+// parks the running coroutine if the last call on fd failed since it would have blocked (EAGAIN)
+// returns 1 if the call has to be retried, 0 otherwise (errno is kept, EAGAIN if timeoutMs passed)
+int coWaitIo(int fd, uint32_t events, int timeoutMs) {
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    return 0;
+  }
+  if (coWait(fd, events, timeoutMs)) {
+    return 1;
+  }
+  errno = EAGAIN;
+  return 0;
+}
+
+// creates the epoll instance & the wake eventfd of the loop
+void loopInit(struct wsLoop *loop, int *err) {
+  memset(loop, 0, sizeof *loop);
+  loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  loop->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+  if (loop->epollFd == -1 || loop->wakeFd == -1 || epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event) != 0) {
+    if (loop->epollFd != -1) {
+      close(loop->epollFd);
+    }
+    if (loop->wakeFd != -1) {
+      close(loop->wakeFd);
+    }
+    *err = errInit;
+    return;
+  }
+  *err = errOk;
+}
+
+// closes the fds of a (stopped) loop
+void loopFree(struct wsLoop *loop) {
+  close(loop->epollFd);
+  close(loop->wakeFd);
+}
+
+// submits task to loop (from any thread), the loop starts it as coroutine
+void loopSubmit(struct wsLoop *loop, struct coTask *task) {
+  struct coTask *head = atomic_load(&loop->inbox);
+  do {
+    task->next = head;
+  } while (!atomic_compare_exchange_weak(&loop->inbox, &head, task));
+  // only the first task of an empty inbox has to wake the loop
+  uint64_t one = 1;
+  if (head == NULL && write(loop->wakeFd, &one, sizeof one) != sizeof one) {
+    // the counter can't overflow, the loop resets it on every wakeup
+  }
+}
+
+// starts the coroutines of all submitted tasks in submission order, tasks without fn resume their parked coroutine
+void loopStartTasks(struct wsLoop *loop) {
+  uint64_t value;
+  // reset before the inbox is taken, a task submitted meanwhile wakes the loop again
+  if (read(loop->wakeFd, &value, sizeof value) != sizeof value) {
+    // spurious wakeup
+  }
+  struct coTask *task = atomic_exchange(&loop->inbox, NULL);
+  struct coTask *ordered = NULL;
+  while (task != NULL) {
+    struct coTask *next = task->next;
+    task->next = ordered;
+    ordered = task;
+    task = next;
+  }
+
+  while (ordered != NULL) {
+    int err;
+    // the task may be freed by its coroutine
+    task = ordered;
+    ordered = ordered->next;
+    if (task->fn == NULL) {
+      coResume(loop, (struct wsCoroutine*)task->arg);
+      continue;
+    }
+    struct wsCoroutine *co = coCreate(loop, task->fn, task->arg, &err);
+    if (co == NULL) {
+      printErr(err);
+      task->cancel(task->arg);
+      continue;
+    }
+    coResume(loop, co);
+  }
+}
+
+// runs a round of the loop (called by the thread running it), waits up to timeoutMs (-1 without timeout) for ready fds
+// and resumes their coroutines & the ones whose wait timed out
+// returns 0 if waiting failed
+int loopStep(struct wsLoop *loop, int timeoutMs) {
+  struct epoll_event events[WS_LOOP_EVENTS];
+
+  int nEvents = epoll_wait(loop->epollFd, events, WS_LOOP_EVENTS, timeoutMs);
+  if (nEvents == -1) {
+    if (errno == EINTR) {
+      return 1;
+    }
+    printErr(errNet);
+    return 0;
+  }
+  // every coroutine has at most one armed (one shot) registration, so no event is stale
+  for (int i = 0; i < nEvents; i++) {
+    if (events[i].data.ptr == NULL) {
+      loopStartTasks(loop);
+    } else {
+      coResume(loop, (struct wsCoroutine*)events[i].data.ptr);
+    }
+  }
+  // waits which have been woken by an event disarmed their timer
+  struct wsTimer *timer = timerWheelAdvance(&loop->timers, wsNowTicks());
+  while (timer != NULL) {
+    struct wsTimer *next = timer->next;
+    struct wsCoroutine *co = (struct wsCoroutine*)timer->data;
+    timer->next = NULL;
+    co->timedOut = 1;
+    coResume(loop, co);
+    timer = next;
+  }
+  return 1;
+}
+
+// unmaps the pooled stacks of a loop whose coroutines all finished
+void loopReleaseStacks(struct wsLoop *loop) {
+  while (loop->pool != NULL) {
+    struct wsCoroutine *co = loop->pool;
+    loop->pool = co->next;
+    munmap(co->stack, WS_CO_STACK_SIZE);
+  }
+  loop->nPooled = 0;
+}
+
+// event loop thread, resumes the coroutines whose fd became ready or whose wait timed out
+// returns once the loop has been stopped (loopStop) and all its coroutines finished
+void *loopThread(void *args) {
+  struct wsLoop *loop = (struct wsLoop*)args;
+  wsCurrentLoop = loop;
+  timerWheelInit(&loop->timers, wsNowTicks());
+
+  while (!atomic_load(&loop->stopping) || atomic_load(&loop->nCoroutines) > 0) {
+    if (!loopStep(loop, loop->nTimed > 0 ? WS_TIMER_TICK_MS : -1)) {
+      break;
+    }
+  }
+
+  loopReleaseStacks(loop);
+  wsCurrentLoop = NULL;
+  return NULL;
+}
+
+// stops the loop once its coroutines finished & joins its thread
+void loopStop(struct wsLoop *loop) {
+  uint64_t one = 1;
+  atomic_store(&loop->stopping, 1);
+  if (write(loop->wakeFd, &one, sizeof one) != sizeof one) {
+    // the counter can't overflow, the loop resets it on every wakeup
+  }
+  pthread_join(loop->thread, NULL);
+  loop->running = 0;
+}
+
+// initializes a completion for the running coroutine, or for the calling thread outside of coroutines
+void complInit(struct wsCompletion *compl) {
+  memset(compl, 0, sizeof *compl);
+  compl->co = coCurrent();
+  if (compl->co == NULL) {
+    pthread_mutex_init(&compl->lock, NULL);
+    pthread_cond_init(&compl->cond, NULL);
+  }
+}
+
+// parks the coroutine (or blocks the thread) of compl until it's signalled, compl may be reused after complInit
+void complWait(struct wsCompletion *compl) {
+  if (compl->co != NULL) {
+    // parks even if compl is already signalled, complSignal touches compl until its wake task is submitted and only
+    // that task resumes the parked coroutine (it has no registration or timer)
+    do {
+      coSuspend(compl->co);
+    } while (!atomic_load_explicit(&compl->done, memory_order_acquire));
+    return;
+  }
+  pthread_mutex_lock(&compl->lock);
+  while (!compl->done) {
+    pthread_cond_wait(&compl->cond, &compl->lock);
+  }
+  pthread_mutex_unlock(&compl->lock);
+  pthread_mutex_destroy(&compl->lock);
+  pthread_cond_destroy(&compl->cond);
+}
+
+// signals compl (from any thread), the waiter may free it as soon as it returned from complWait
+void complSignal(struct wsCompletion *compl) {
+  struct wsCoroutine *co = compl->co;
+  if (co != NULL) {
+    struct wsLoop *loop = co->loop;
+    compl->wake = (struct coTask){.fn = NULL, .arg = co};
+    atomic_store_explicit(&compl->done, 1, memory_order_release);
+    // the loop resumes the coroutine on its own thread
+    loopSubmit(loop, &compl->wake);
+    return;
+  }
+  pthread_mutex_lock(&compl->lock);
+  compl->done = 1;
+  pthread_cond_signal(&compl->cond);
+  pthread_mutex_unlock(&compl->lock);
+}
+
+// worker of the calling thread, NULL on other threads
+static __thread struct execWorker *execCurrentWorker = NULL;
+
+// pushes task at the bottom of the deque (owner only)
+// returns 0 if the deque is full
+int dequePush(struct execDeque *deque, struct wsTask *task) {
+  long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (bottom - top >= WS_EXEC_DEQUE_SIZE) {
+    return 0;
+  }
+  atomic_store_explicit(&deque->tasks[bottom & (WS_EXEC_DEQUE_SIZE - 1)], task, memory_order_relaxed);
+  // publishes the task (& what it points to) to thieves
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+  return 1;
+}
+
+// takes the task pushed last from the bottom of the deque (owner only), it races thieves only for the last task
+// returns NULL if the deque is empty
+struct wsTask *dequeTake(struct execDeque *deque) {
+  long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+  struct wsTask *task = atomic_load_explicit(&deque->tasks[bottom & (WS_EXEC_DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (top == bottom) {
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      task = NULL;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+// steals the oldest task from the top of the deque (any thread)
+// returns NULL if the deque is empty or another thread took the task first
+struct wsTask *dequeSteal(struct execDeque *deque) {
+  long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return NULL;
+  }
+  // the slot isn't reused before top moved past it (the deque doesn't grow)
+  struct wsTask *task = atomic_load_explicit(&deque->tasks[top & (WS_EXEC_DEQUE_SIZE - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return task;
+}
+
+// pushes the list of tasks first..last (linked by next) on the inject stack
+void execInject(struct wsExecutor *executor, struct wsTask *first, struct wsTask *last) {
+  struct wsTask *head = atomic_load(&executor->inject);
+  do {
+    last->next = head;
+  } while (!atomic_compare_exchange_weak(&executor->inject, &head, first));
+}
+
+// wakes a sleeping worker if there is one, called after tasks have been made available
+void execNotify(struct wsExecutor *executor) {
+  // pairs with the sleepers increment before a worker checks for tasks a last time
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&executor->sleepers) > 0) {
+    pthread_mutex_lock(&executor->lock);
+    pthread_cond_signal(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+  }
+}
+
+// returns 1 if any task is waiting in the executor
+int execHasTasks(struct wsExecutor *executor) {
+  if (atomic_load(&executor->inject) != NULL) {
+    return 1;
+  }
+  for (int i = 0; i < executor->nWorkers; i++) {
+    struct execDeque *deque = &executor->workers[i].deque;
+    if (atomic_load(&deque->top) < atomic_load(&deque->bottom)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// finds the next task of worker: its own deque first, then the inject stack (moved to its deque), then other workers' deques
+// starting at a random victim
+// returns NULL if no task was found
+struct wsTask *execFind(struct execWorker *worker) {
+  struct wsExecutor *executor = worker->executor;
+  struct wsTask *task = dequeTake(&worker->deque);
+  if (task != NULL) {
+    return task;
+  }
+
+  if (atomic_load_explicit(&executor->inject, memory_order_relaxed) != NULL) {
+    task = atomic_exchange(&executor->inject, NULL);
+    if (task != NULL) {
+      struct wsTask *rest = task->next;
+      while (rest != NULL) {
+        struct wsTask *next = rest->next;
+        if (!dequePush(&worker->deque, rest)) {
+          // the deque is full, the remaining tasks go back
+          struct wsTask *last = rest;
+          while (last->next != NULL) {
+            last = last->next;
+          }
+          execInject(executor, rest, last);
+          break;
+        }
+        rest = next;
+      }
+      // thieves can take over the moved tasks
+      execNotify(executor);
+      return task;
+    }
+  }
+
+  worker->rand ^= worker->rand << 13;
+  worker->rand ^= worker->rand >> 17;
+  worker->rand ^= worker->rand << 5;
+  int start = worker->rand % executor->nWorkers;
+  for (int i = 0; i < executor->nWorkers; i++) {
+    struct execWorker *victim = &executor->workers[(start + i) % executor->nWorkers];
+    if (victim == worker) {
+      continue;
+    }
+    task = dequeSteal(&victim->deque);
+    if (task != NULL) {
+      atomic_fetch_add_explicit(&executor->steals, 1, memory_order_relaxed);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+// runs task on worker, completing it in its group is the last access to the task
+void execRunTask(struct execWorker *worker, struct wsTask *task) {
+  struct wsTaskGroup *group = task->group;
+  task->fn(task->arg);
+  atomic_fetch_add_explicit(&worker->executed, 1, memory_order_relaxed);
+  if (group != NULL) {
+    atomic_fetch_sub_explicit(&group->pending, 1, memory_order_release);
+  }
+}
+
+// worker thread, runs & steals tasks, sleeps once it didn't find any for WS_EXEC_STEAL_ROUNDS rounds
+void *execWorkerThread(void *args) {
+  struct execWorker *worker = (struct execWorker*)args;
+  struct wsExecutor *executor = worker->executor;
+  int idleRounds = 0;
+  execCurrentWorker = worker;
+
+  while (!atomic_load(&executor->stopping)) {
+    struct wsTask *task = execFind(worker);
+    if (task != NULL) {
+      execRunTask(worker, task);
+      idleRounds = 0;
+      continue;
+    }
+    if (++idleRounds < WS_EXEC_STEAL_ROUNDS) {
+      sched_yield();
+      continue;
+    }
+    pthread_mutex_lock(&executor->lock);
+    atomic_fetch_add(&executor->sleepers, 1);
+    // a task made available after this check finds the sleeper (execNotify) & signals under the lock
+    if (!atomic_load(&executor->stopping) && !execHasTasks(executor)) {
+      pthread_cond_wait(&executor->wake, &executor->lock);
+    }
+    atomic_fetch_sub(&executor->sleepers, 1);
+    pthread_mutex_unlock(&executor->lock);
+    idleRounds = 0;
+  }
+  execCurrentWorker = NULL;
+  return NULL;
+}
+
+// stops & joins the workers & frees the executor, tasks still waiting aren't run
+void freeExecutor(struct wsExecutor *executor) {
+  if (executor == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&executor->lock);
+  atomic_store(&executor->stopping, 1);
+  pthread_cond_broadcast(&executor->wake);
+  pthread_mutex_unlock(&executor->lock);
+  for (int i = 0; i < executor->nStarted; i++) {
+    pthread_join(executor->workers[i].thread, NULL);
+  }
+  pthread_mutex_destroy(&executor->lock);
+  pthread_cond_destroy(&executor->wake);
+  free(executor->workers);
+  free(executor);
+}
+
+// creates a work-stealing executor with nWorkers worker threads (one per online cpu if 0)
+// returns reference to the executor, freed with freeExecutor after the webserver
+struct wsExecutor *createExecutor(int nWorkers, int *err) {
+  if (nWorkers <= 0) {
+    nWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    nWorkers = nWorkers > 0 ? nWorkers : 1;
+  }
+  struct wsExecutor *executor = calloc(1, sizeof *executor);
+  if (executor == NULL) {
+    *err = errMemAlloc;
+    return NULL;
+  }
+  executor->workers = calloc(nWorkers, sizeof *executor->workers);
+  if (executor->workers == NULL) {
+    free(executor);
+    *err = errMemAlloc;
+    return NULL;
+  }
+  pthread_mutex_init(&executor->lock, NULL);
+  pthread_cond_init(&executor->wake, NULL);
+  // workers steal from all deques, including the ones of workers not started yet
+  executor->nWorkers = nWorkers;
+  for (int i = 0; i < nWorkers; i++) {
+    executor->workers[i].executor = executor;
+    executor->workers[i].rand = 2463534242u + i * 2654435761u;
+  }
+  for (int i = 0; i < nWorkers; i++) {
+    if (pthread_create(&executor->workers[i].thread, NULL, execWorkerThread, &executor->workers[i]) != 0) {
+      freeExecutor(executor);
+      *err = errInit;
+      return NULL;
+    }
+    executor->nStarted++;
+  }
+  *err = errOk;
+  return executor;
+}
+
+// forks task (fn & arg set) into group, it's run by the calling worker or stolen by an idle one, task has to stay valid until
+// it has been joined (execJoin), called by executor tasks (tasks forked by other threads are injected)
+void execFork(struct wsExecutor *executor, struct wsTaskGroup *group, struct wsTask *task) {
+  struct execWorker *worker = execCurrentWorker;
+  task->group = group;
+  atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+  if (worker == NULL || worker->executor != executor) {
+    task->next = NULL;
+    execInject(executor, task, task);
+  } else if (!dequePush(&worker->deque, task)) {
+    // the deque is full, enough parallelism is exposed already
+    execRunTask(worker, task);
+    return;
+  }
+  execNotify(executor);
+}
+
+// waits until all tasks forked into group finished, a worker runs other tasks (preferably the group's own) meanwhile
+void execJoin(struct wsExecutor *executor, struct wsTaskGroup *group) {
+  struct execWorker *worker = execCurrentWorker;
+  if (worker != NULL && worker->executor != executor) {
+    worker = NULL;
+  }
+  while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+    struct wsTask *task = worker != NULL ? execFind(worker) : NULL;
+    if (task != NULL) {
+      execRunTask(worker, task);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+// runs the function of an execRun & signals its submitter
+void execRootRun(void *arg) {
+  struct execRoot *root = (struct execRoot*)arg;
+  root->fn(root->arg);
+  complSignal(&root->completion);
+}
+
+// runs fn(arg) on the executor & returns once it finished, fn may fork & join tasks (execFork, execJoin)
+// a coroutine (handler) parks meanwhile, so its loop keeps serving other connections, a thread blocks
+void execRun(struct wsExecutor *executor, void (*fn)(void *arg), void *arg) {
+  struct execWorker *worker = execCurrentWorker;
+  if (worker != NULL && worker->executor == executor) {
+    fn(arg);
+    return;
+  }
+  struct execRoot root = {.task = {.fn = execRootRun, .arg = &root}, .fn = fn, .arg = arg};
+  complInit(&root.completion);
+  execInject(executor, &root.task, &root.task);
+  execNotify(executor);
+  complWait(&root.completion);
+}
+
+// number of tasks run by the workers of executor & how many of them have been stolen
+void execStats(struct wsExecutor *executor, unsigned long *executed, unsigned long *stolen) {
+  *executed = 0;
+  for (int i = 0; i < executor->nWorkers; i++) {
+    *executed += atomic_load_explicit(&executor->workers[i].executed, memory_order_relaxed);
+  }
+  *stolen = atomic_load_explicit(&executor->steals, memory_order_relaxed);
+}
+
+// allocates the call queue of the blocking pool (threads are started by blockingStart)
+void blockingInit(struct wsBlockingPool *pool, int queueSize, int *err) {
+  memset(pool, 0, sizeof *pool);
+  pool->queue = malloc(sizeof(struct blockingJob*) * queueSize);
+  if (pool->queue == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  pool->queueSize = queueSize;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  *err = errOk;
+}
+
+// blocking pool thread, runs the queued handler calls & completes them back to their loops
+void *blockingThread(void *args) {
+  struct wsBlockingPool *pool = (struct wsBlockingPool*)args;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (pool->nQueued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->nQueued == 0) {
+      break;
+    }
+    struct blockingJob *job = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % pool->queueSize;
+    pool->nQueued--;
+    pool->nRunning++;
+    pthread_mutex_unlock(&pool->lock);
+
+    job->route->handler(job->req, job->rb, job->route->handlerCtx);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->nRunning--;
+    pool->completed++;
+    // the job lives on the stack of the parked coroutine, it's not touched once signalled (see complSignal)
+    complSignal(&job->completion);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// starts the nThreads threads of the blocking pool
+void blockingStart(struct wsBlockingPool *pool, int nThreads, int *err) {
+  pool->threads = malloc(sizeof(pthread_t) * nThreads);
+  if (pool->threads == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  for (; pool->nThreads < nThreads; pool->nThreads++) {
+    if (pthread_create(&pool->threads[pool->nThreads], NULL, blockingThread, pool) != 0) {
+      *err = errInit;
+      return;
+    }
+  }
+  *err = errOk;
+}
+
+// runs the handler of the blocking route on the pool, the calling coroutine parks until it returned
+// returns 0 if the call has been rejected since the queue is full
+int blockingRun(struct wsBlockingPool *pool, struct httpRoute *route, struct httpRequest *req, struct respBuilder *rb) {
+  struct blockingJob job = {.route = route, .req = req, .rb = rb};
+  complInit(&job.completion);
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nQueued >= pool->queueSize || pool->stopping) {
+    pool->rejected++;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+  }
+  pool->queue[(pool->head + pool->nQueued) % pool->queueSize] = &job;
+  pool->nQueued++;
+  if (pool->nQueued > pool->peakQueued) {
+    pool->peakQueued = pool->nQueued;
+  }
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  complWait(&job.completion);
+  return 1;
+}
+
+// joins the threads of the blocking pool once the queued calls ran
+void blockingStop(struct wsBlockingPool *pool) {
+  if (pool->threads == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->nThreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  pool->threads = NULL;
+}
+
+// frees the queue of a (stopped) blocking pool
+void blockingFree(struct wsBlockingPool *pool) {
+  if (pool->queue == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->queue);
+  pool->queue = NULL;
+}
+
+// sends all buffers of the io vector on given socket (gathered, one syscall if the socket buffer allows it)
+// the io vector is modified
+// returns sent data size
+int sendBuffers(int sock, struct iovec *iov, int iovCnt, int *err) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovCnt};
+  int dataSent = 0;
+  ssize_t rc;
+
+  while (msg.msg_iovlen > 0) {
+    rc = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (rc == -1) {
+      if (errno == EINTR || coWaitIo(sock, EPOLLOUT, -1)) {
+        continue;
+      }
+      *err = errNet;
+      return 0;
+    }
+    dataSent += rc;
+    // skipping the completely sent buffers
+    while (msg.msg_iovlen > 0 && (size_t)rc >= msg.msg_iov->iov_len) {
+      rc -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + rc;
+      msg.msg_iov->iov_len -= rc;
+    }
+  }
+  *err = errOk;
+  return dataSent;
+}
+
+#ifdef WS_TLS
+// parks the running coroutine if the last tls operation on the connection failed with sslErr since it would have blocked
+// returns 1 if the operation has to be retried
+int connWaitTls(struct wsConn *conn, int sslErr) {
+  if (sslErr == SSL_ERROR_WANT_READ) {
+    return coWait(conn->socket, EPOLLIN, -1);
+  }
+  if (sslErr == SSL_ERROR_WANT_WRITE) {
+    return coWait(conn->socket, EPOLLOUT, -1);
+  }
+  return 0;
+}
+#endif
+
+// reads up to size bytes from the connection, decrypted if it's a tls connection
+// returns the read size, 0 if the connection has been closed and -1 on failure
+int connRead(struct wsConn *conn, char *buff, int size) {
+  int rc;
+#ifdef WS_TLS
+  if (conn->ssl != NULL) {
+    while ((rc = SSL_read(conn->ssl, buff, size)) <= 0) {
+      int sslErr = SSL_get_error(conn->ssl, rc);
+      if (!connWaitTls(conn, sslErr)) {
+        return sslErr == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+      }
+    }
+    return rc;
+  }
+#endif
+  while ((rc = read(conn->socket, buff, size)) == -1 && coWaitIo(conn->socket, EPOLLIN, -1)); /* Flawfinder: ignore */ // bounded by the caller
+  return rc;
+}
+
+// sends all buffers of the io vector on the connection, the io vector is modified
+// tls connections without kTLS gather buffers up to a record into one SSL_write, kTLS connections are written like plaintext ones
+// returns sent data size
+int connSendBuffers(struct wsConn *conn, struct iovec *iov, int iovCnt, int *err) {
+#ifdef WS_TLS
+  if (conn->ssl != NULL && !conn->ktlsSend) {
+    char record[WS_TLS_RECORD_SIZE];
+    int dataSent = 0;
+    int i = 0;
+    while (i < iovCnt) {
+      char *data = iov[i].iov_base;
+      int size = iov[i].iov_len;
+      if (size < WS_TLS_RECORD_SIZE) {
+        size = 0;
+        while (i < iovCnt && size + (int)iov[i].iov_len <= WS_TLS_RECORD_SIZE) {
+          memcpy(record+size, iov[i].iov_base, iov[i].iov_len); /* Flawfinder: ignore */ // bounds checked in the loop condition
+          size += iov[i].iov_len;
+          i++;
+        }
+        data = record;
+      } else {
+        i++;
+      }
+      // partial writes are disabled, SSL_write returns once all data is written (retried with the same arguments if it would block)
+      int rc = 1;
+      while (size > 0 && (rc = SSL_write(conn->ssl, data, size)) <= 0 && connWaitTls(conn, SSL_get_error(conn->ssl, rc)));
+      if (rc <= 0) {
+        *err = errNet;
+        return 0;
+      }
+      dataSent += size;
+    }
+    *err = errOk;
+    return dataSent;
+  }
+#endif
+  return sendBuffers(conn->socket, iov, iovCnt, err);
+}
+
+// prints & flushes buffer to stdout
+void printfBuffer(char *buff, int buffSize) {
+  fwrite(buff, buffSize, 1, stdout);
+  fflush(stdout);
+}
+
+// by https://stackoverflow.com/a/3464656, modified
+char *readFileToBuffer(char *filename, int *size, int *err) {
+  int stringSize, readSize;
+  FILE *handler = fopen(filename, "r"); /* Flawfinder: ignore */ // check for \0 terminateion and bufferoverflow checks are implemented below,
+  // since the system & files are developer handled and not meant to be modified during execution, race conditions are not considered
+  char *buffer;
+
+  if (handler) {
+    fseek(handler, 0, SEEK_END);
+    stringSize = ftell(handler);
+    rewind(handler);
+
+    buffer = malloc(sizeof(char) *stringSize+1);
+    if (buffer == NULL) {
+      *err = errMemAlloc;
+      return NULL;
+    }
+    readSize = fread(buffer, sizeof(char), stringSize, handler);
+    buffer[readSize] = 0;
+
+    if (stringSize != readSize) {
+      *err = errParse;
+      return NULL;
+    }
+
+    // always remember to close the file
+    fclose(handler);
+  } else {
+    *err = errIO;
+    return NULL;
+  }
+  *size = readSize;
+  *err = errOk;
+  return buffer;
+}
+
+// inits the response builder on the buffers of conn, the status defaults to 200
+void respInit(struct respBuilder *rb, struct wsConn *conn) {
+  rb->conn = conn;
+  rb->statusCode = 200;
+  rb->hdrSize = 0;
+  rb->bodySize = 0;
+  rb->hasContentType = 0;
+  rb->err = errOk;
+}
+
+// sets the response status, the status line is taken from the status line table
+void respSetStatus(struct respBuilder *rb, int statusCode) {
+  if (statusCode < 100 || statusLine(statusCode) == NULL) {
+    rb->err = errParse;
+    return;
+  }
+  rb->statusCode = statusCode;
+}
+
+// appends a header field to the response
+// Content-length and Connection are set by the webserver
+void respAddHeader(struct respBuilder *rb, const char *name, const char *value) {
+  int nameSize = strlen(name); /* Flawfinder: ignore */ // \0 termination expected from the handler
+  int valueSize = strlen(value); /* Flawfinder: ignore */ // \0 termination expected from the handler
+
+  // name: value\r\n
+  if (rb->hdrSize + nameSize + valueSize + 4 > WS_BUFF_SIZE) {
+    rb->err = errSecCheck;
+    return;
+  }
+  // crlf injection would allow handlers to forge headers from request data
+  if (strpbrk(name, "\r\n:") != NULL || strpbrk(value, "\r\n") != NULL) {
+    rb->err = errSecCheck;
+    return;
+  }
+  if (strcasecmp(name, "Content-type") == 0) {
+    rb->hasContentType = 1;
+  }
+
+  char *hdr = rb->conn->hdrBuff + rb->hdrSize;
+  memcpy(hdr, name, nameSize); /* Flawfinder: ignore */ // bounds checked above
+  hdr[nameSize] = ':';
+  hdr[nameSize+1] = SP;
+  memcpy(hdr+nameSize+2, value, valueSize); /* Flawfinder: ignore */ // bounds checked above
+  hdr[nameSize+2+valueSize] = CR;
+  hdr[nameSize+3+valueSize] = LF;
+  rb->hdrSize += nameSize + valueSize + 4;
+}
+
+// makes room for size more body bytes, grows the connection body buffer (up to WS_MAX_RESP_BODY_SIZE)
+// returns reference to the free body memory or NULL on failure
+char *respReserveBody(struct respBuilder *rb, int size) {
+  struct wsConn *conn = rb->conn;
+  int required = rb->bodySize + size;
+
+  if (size < 0 || required > WS_MAX_RESP_BODY_SIZE) {
+    rb->err = errSecCheck;
+    return NULL;
+  }
+  if (required > conn->bodyBuffSize) {
+    int newSize = conn->bodyBuffSize ? conn->bodyBuffSize : WS_BUFF_SIZE;
+    while (newSize < required) {
+      newSize *= 2;
+    }
+    char *newBuff = realloc(conn->bodyBuff, newSize);
+    if (newBuff == NULL) {
+      rb->err = errMemAlloc;
+      return NULL;
+    }
+    conn->bodyBuff = newBuff;
+    conn->bodyBuffSize = newSize;
+  }
+  return conn->bodyBuff + rb->bodySize;
+}
+
+// appends size bytes of data to the response body
+void respAppendBody(struct respBuilder *rb, const char *data, int size) {
+  char *body = respReserveBody(rb, size);
+  if (body == NULL) {
+    return;
+  }
+  memcpy(body, data, size); /* Flawfinder: ignore */ // reserved above
+  rb->bodySize += size;
+}
+
+// appends formatted string to the response body
+void respPrintf(struct respBuilder *rb, const char *format, ...) {
+  va_list argptr;
+  char *body;
+  int size;
+
+  // first try with the remaining buffer, then with the exact size
+  for (int try = 0; try < 2; try++) {
+    int avail = rb->conn->bodyBuffSize - rb->bodySize;
+    body = rb->conn->bodyBuff ? rb->conn->bodyBuff + rb->bodySize : NULL;
+
+    va_start(argptr, format);
+    size = vsnprintf(body, avail, format, argptr); /* Flawfinder: ignore */ // format is defined by the handler
+    va_end(argptr);
+    if (size < 0) {
+      rb->err = errParse;
+      return;
+    }
+    if (size < avail) {
+      rb->bodySize += size;
+      return;
+    }
+    // +1 for the \0 written by vsnprintf
+    if (respReserveBody(rb, size+1) == NULL) {
+      return;
+    }
+  }
+}
+
+// serializes the status line, webserver set (incl. the cached Date field if not NULL) and handler appended header fields into respBuff
+// returns the header size
+int respFinish(struct respBuilder *rb, int keepAlive, const char *date, char *respBuff, int respBuffSize, int *err) {
+  // 204 responses must not carry content header fields
+  if (rb->statusCode == 204) {
+    return serializeHeader(rb->statusCode, NULL, 0, -1, keepAlive, date, rb->conn->hdrBuff, rb->hdrSize, respBuff, respBuffSize, err);
+  }
+  return serializeHeader(rb->statusCode, rb->hasContentType ? NULL : wsHdrContentTypeHtml, rb->hasContentType ? 0 : sizeof(wsHdrContentTypeHtml)-1,
+    rb->bodySize, keepAlive, date, rb->conn->hdrBuff, rb->hdrSize, respBuff, respBuffSize, err);
+}
+
+// returns the size of the request header (up to and including the empty line) or -1 if it's not complete yet
+// bare LF line endings are accepted as well
+int findHeaderEnd(char *reqBuff, int reqBuffSize) {
+  for (int i = 1; i < reqBuffSize; i++) {
+    if (reqBuff[i] == LF) {
+      if (reqBuff[i-1] == LF) {
+        return i+1;
+      }
+      if (i >= 3 && reqBuff[i-1] == CR && reqBuff[i-2] == LF && reqBuff[i-3] == CR) {
+        return i+1;
+      }
+    }
+  }
+  return -1;
+}
+
+// returns the value of the first header field with given (case insensitive) name or NULL if there is none
+// the value is not copied and not \0 terminated, its size (without surrounding white space) is put into valueSize
+char *getHeader(char *reqBuff, int headerSize, const char *name, int *valueSize) {
+  int nameSize = strlen(name); /* Flawfinder: ignore */ // names are developer defined literals
+  int i = 0;
+
+  // skipping the request line
+  while (i < headerSize && reqBuff[i] != LF) {
+    i++;
+  }
+  i++;
+
+  while (i < headerSize) {
+    int lineEnd = i;
+    while (lineEnd < headerSize && reqBuff[lineEnd] != LF) {
+      lineEnd++;
+    }
+    if (lineEnd - i > nameSize && reqBuff[i+nameSize] == ':' && strncasecmp(reqBuff+i, name, nameSize) == 0) {
+      int valueStart = i + nameSize + 1;
+      int valueEnd = lineEnd;
+      while (valueStart < valueEnd && (reqBuff[valueStart] == SP || reqBuff[valueStart] == '\t')) {
+        valueStart++;
+      }
+      while (valueEnd > valueStart && (reqBuff[valueEnd-1] == SP || reqBuff[valueEnd-1] == '\t' || reqBuff[valueEnd-1] == CR)) {
+        valueEnd--;
+      }
+      *valueSize = valueEnd - valueStart;
+      return reqBuff + valueStart;
+    }
+    i = lineEnd + 1;
+  }
+  return NULL;
+}
+
+// looks up a header field of the request, see getHeader
+char *getRequestHeader(struct httpRequest *req, const char *name, int *valueSize) {
+  return getHeader(req->header, req->headerSize, name, valueSize);
+}
+
+// returns 1 if the (comma separated) header value contains token (case insensitive)
+int headerHasToken(char *value, int valueSize, const char *token) {
+  int tokenSize = strlen(token); /* Flawfinder: ignore */ // tokens are developer defined literals
+  for (int i = 0; i + tokenSize <= valueSize; i++) {
+    if (strncasecmp(value+i, token, tokenSize) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// allocates size bytes from the arena
+// returns NULL if the arena is exhausted
+char *arenaAlloc(struct wsArena *arena, int size) {
+  if (arena == NULL || size < 0 || arena->size - arena->used < size) {
+    return NULL;
+  }
+  char *mem = arena->buff + arena->used;
+  arena->used += size;
+  return mem;
+}
+
+// returns the value of hex digit c or -1
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// percent-decodes (application/x-www-form-urlencoded, '+' is a space) size bytes of src into dst
+// dst has to be at least size bytes, invalid escapes are copied as they are
+// returns the decoded size
+int percentDecode(const char *src, int size, char *dst) {
+  int n = 0;
+  for (int i = 0; i < size; i++) {
+    if (src[i] == '%' && i+2 < size && hexValue(src[i+1]) >= 0 && hexValue(src[i+2]) >= 0) {
+      dst[n++] = (char)(hexValue(src[i+1]) << 4 | hexValue(src[i+2]));
+      i += 2;
+    } else if (src[i] == '+') {
+      dst[n++] = SP;
+    } else {
+      dst[n++] = src[i];
+    }
+  }
+  return n;
+}
+
+// returns 1 if the slice has to be percent-decoded
+int needsDecode(struct wsSlice *slice) {
+  return memchr(slice->data, '%', slice->size) != NULL || memchr(slice->data, '+', slice->size) != NULL;
+}
+
+// decodes the slice into the arena, on exhaustion the slice stays encoded
+void decodeSlice(struct wsSlice *slice, struct wsArena *arena) {
+  char *dst = arenaAlloc(arena, slice->size);
+  if (dst == NULL) {
+    return;
+  }
+  slice->size = percentDecode(slice->data, slice->size, dst);
+  slice->data = dst;
+}
+
+// fnv-1a hash
+uint32_t hashBytes(const char *data, int size) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < size; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// splits the (query/ form-urlencoded) string src into key/value slices and indexes the keys
+// nothing is copied except for keys which require decoding, values are decoded on demand by paramsGet
+void paramsParse(struct wsParams *params, char *src, int size, struct wsArena *arena) {
+  int i = 0;
+
+  params->nParams = 0;
+  params->parsed = 1;
+  memset(params->index, 0, sizeof params->index);
+
+  while (i < size && params->nParams < WS_MAX_PARAMS) {
+    int pairStart = i;
+    int eq = -1;
+    while (i < size && src[i] != '&') {
+      if (src[i] == '=' && eq == -1) {
+        eq = i;
+      }
+      i++;
+    }
+    int pairEnd = i++;
+    if (pairEnd == pairStart) {
+      continue;
+    }
+
+    int n = params->nParams;
+    struct wsSlice *key = &params->keys[n];
+    key->data = src + pairStart;
+    key->size = (eq == -1 ? pairEnd : eq) - pairStart;
+    params->values[n].data = eq == -1 ? src + pairEnd : src + eq + 1;
+    params->values[n].size = eq == -1 ? 0 : pairEnd - eq - 1;
+    params->decoded[n] = 0;
+    if (needsDecode(key)) {
+      decodeSlice(key, arena);
+    }
+
+    // the first occurrence of a key wins
+    int slot = hashBytes(key->data, key->size) & (WS_PARAMS_INDEX_SIZE-1);
+    int duplicate = 0;
+    while (params->index[slot] != 0) {
+      struct wsSlice *other = &params->keys[params->index[slot]-1];
+      if (other->size == key->size && memcmp(other->data, key->data, key->size) == 0) {
+        duplicate = 1;
+        break;
+      }
+      slot = (slot+1) & (WS_PARAMS_INDEX_SIZE-1);
+    }
+    if (!duplicate) {
+      params->index[slot] = n+1;
+    }
+    params->nParams++;
+  }
+}
+
+// looks up (decoded) key and puts its decoded value into value
+// returns 1 if the key has been found
+int paramsGet(struct wsParams *params, const char *key, struct wsSlice *value, struct wsArena *arena) {
+  int keySize = strlen(key); /* Flawfinder: ignore */ // \0 termination expected from the handler
+  int slot = hashBytes(key, keySize) & (WS_PARAMS_INDEX_SIZE-1);
+
+  while (params->index[slot] != 0) {
+    int n = params->index[slot]-1;
+    if (params->keys[n].size == keySize && memcmp(params->keys[n].data, key, keySize) == 0) {
+      if (!params->decoded[n]) {
+        if (needsDecode(&params->values[n])) {
+          decodeSlice(&params->values[n], arena);
+        }
+        params->decoded[n] = 1;
+      }
+      *value = params->values[n];
+      return 1;
+    }
+    slot = (slot+1) & (WS_PARAMS_INDEX_SIZE-1);
+  }
+  return 0;
+}
+
+// looks up query parameter key of the request, the query string is parsed on the first call
+// returns 1 if the key has been found
+int getQueryParam(struct httpRequest *req, const char *key, struct wsSlice *value) {
+  if (!req->queryParams.parsed) {
+    paramsParse(&req->queryParams, req->query, req->querySize, req->arena);
+  }
+  return paramsGet(&req->queryParams, key, value, req->arena);
+}
+
+// inits the body reader of the request from its Content-Length/ Transfer-Encoding header fields
+// the staging area starts behind the header, already buffered body bytes are consumed first
+void bodyInit(struct httpRequest *req, webserver *wserver, struct wsConn *conn, int *err) {
+  struct bodyReader *body = &req->body;
+  int valueSize;
+  char *value;
+
+  memset(body, 0, sizeof *body);
+  body->wserver = wserver;
+  body->conn = conn;
+  body->state = bodyNone;
+  body->base = req->headerSize;
+  body->pos = req->headerSize;
+  body->limit = WS_MAX_REQ_BODY_SIZE;
+  *err = errOk;
+
+  char *contentLength = getHeader(req->header, req->headerSize, "Content-Length", &valueSize);
+  int contentLengthSize = valueSize;
+  char *transferEncoding = getHeader(req->header, req->headerSize, "Transfer-Encoding", &valueSize);
+
+  if (transferEncoding != NULL) {
+    // both or other codings are rejected to prevent request smuggling
+    if (contentLength != NULL || valueSize != 7 || strncasecmp(transferEncoding, "chunked", 7) != 0) {
+      *err = errParse;
+      return;
+    }
+    body->state = bodyChunkSize;
+  } else if (contentLength != NULL) {
+    if (contentLengthSize < 1 || contentLengthSize > 18) {
+      *err = errParse;
+      return;
+    }
+    for (int i = 0; i < contentLengthSize; i++) {
+      if (contentLength[i] < '0' || contentLength[i] > '9') {
+        *err = errParse;
+        return;
+      }
+      body->remaining = body->remaining * 10 + (contentLength[i] - '0');
+    }
+    body->state = body->remaining > 0 ? bodyData : bodyDone;
+  } else {
+    return;
+  }
+
+  value = getHeader(req->header, req->headerSize, "Expect", &valueSize);
+  body->expectContinue = value != NULL && headerHasToken(value, valueSize, "100-continue");
+}
+
+// reads more data from the socket into the staging area
+// returns the number of bytes read
+int bodyFill(struct bodyReader *body, int *err) {
+  struct wsConn *conn = body->conn;
+
+  if (body->pos == conn->readBuffSize) {
+    body->pos = body->base;
+    conn->readBuffSize = body->base;
+  } else if (body->pos > body->base) {
+    memmove(conn->readBuff+body->base, conn->readBuff+body->pos, conn->readBuffSize-body->pos);
+    conn->readBuffSize -= body->pos - body->base;
+    body->pos = body->base;
+  }
+  // a single line (chunk size/ trailer) exceeds the staging area
+  if (conn->readBuffSize >= WS_BUFF_SIZE-1) {
+    *err = errSecCheck;
+    return 0;
+  }
+  int readSize = connRead(conn, conn->readBuff+conn->readBuffSize, WS_BUFF_SIZE-1-conn->readBuffSize);
+  if (readSize <= 0) {
+    *err = errNet;
+    return 0;
+  }
+  conn->readBuffSize += readSize;
+  *err = errOk;
+  return readSize;
+}
+
+// reads one line (chunk size/ chunk end/ trailer) from the staging area
+// returns the line size without line ending and puts its start into line
+int bodyReadLine(struct bodyReader *body, char **line, int *err) {
+  char *buff = body->conn->readBuff;
+  while (1) {
+    char *lf = memchr(buff+body->pos, LF, body->conn->readBuffSize-body->pos);
+    if (lf != NULL) {
+      *line = buff+body->pos;
+      int size = lf - *line;
+      body->pos += size+1;
+      if (size > 0 && (*line)[size-1] == CR) {
+        size--;
+      }
+      *err = errOk;
+      return size;
+    }
+    bodyFill(body, err);
+    if (*err != errOk) {
+      return 0;
+    }
+  }
+}
+
+// reads up to buffSize bytes of the (de-chunked) request body into buff
+// data is only read from the socket while the handler reads the body, which backpressures the client
+// returns the number of bytes read, 0 at the end of the body
+int readBody(struct httpRequest *req, char *buff, int buffSize, int *err) {
+  struct bodyReader *body = &req->body;
+  struct wsConn *conn = body->conn;
+  char *line;
+  int lineSize, digits, want, staged;
+  int n = 0;
+
+  *err = body->err;
+  if (body->err != errOk || body->state == bodyNone || body->state == bodyDone || buffSize <= 0) {
+    return 0;
+  }
+  if (!body->started) {
+    body->started = 1;
+    connArmTimer(body->wserver, conn, body->wserver->config.bodyTimeoutMs, 0);
+    if (body->expectContinue) {
+      char continueResp[] = "HTTP/1.1 100 Continue\r\n\r\n";
+      struct iovec iov = {.iov_base = continueResp, .iov_len = sizeof(continueResp)-1};
+      connSendBuffers(conn, &iov, 1, err);
+      if (*err != errOk) {
+        body->err = *err;
+        return 0;
+      }
+    }
+  }
+
+  while (n == 0 && body->state != bodyDone) {
+    switch (body->state) {
+      case bodyChunkSize:
+        lineSize = bodyReadLine(body, &line, err);
+        if (*err != errOk) {
+          break;
+        }
+        body->remaining = 0;
+        digits = 0;
+        // chunk extensions (;...) are ignored
+        for (int i = 0; i < lineSize && line[i] != ';' && line[i] != SP; i++) {
+          if (hexValue(line[i]) < 0 || ++digits > 15) {
+            *err = errParse;
+            break;
+          }
+          body->remaining = body->remaining << 4 | hexValue(line[i]);
+        }
+        if (digits == 0) {
+          *err = errParse;
+        }
+        body->state = body->remaining > 0 ? bodyChunkData : bodyTrailer;
+        break;
+      case bodyData:
+      case bodyChunkData:
+        if (body->received + body->remaining > body->limit && body->state == bodyChunkData) {
+          *err = errSecCheck;
+          break;
+        }
+        want = body->remaining < buffSize ? (int)body->remaining : buffSize;
+        staged = conn->readBuffSize - body->pos;
+        if (staged > 0) {
+          n = staged < want ? staged : want;
+          memcpy(buff, conn->readBuff+body->pos, n); /* Flawfinder: ignore */ // bounded by buffSize
+          body->pos += n;
+        } else {
+          // reading directly into the handler buffer
+          n = connRead(conn, buff, want);
+          if (n <= 0) {
+            n = 0;
+            *err = errNet;
+            break;
+          }
+        }
+        body->remaining -= n;
+        body->received += n;
+        if (body->remaining == 0) {
+          body->state = body->state == bodyData ? bodyDone : bodyChunkEnd;
+        }
+        break;
+      case bodyChunkEnd:
+        lineSize = bodyReadLine(body, &line, err);
+        if (*err == errOk && lineSize != 0) {
+          *err = errParse;
+        }
+        body->state = bodyChunkSize;
+        break;
+      case bodyTrailer:
+        // trailer fields are discarded
+        lineSize = bodyReadLine(body, &line, err);
+        if (*err == errOk && lineSize == 0) {
+          body->state = bodyDone;
+        }
+        break;
+    }
+    if (*err != errOk) {
+      body->err = *err;
+      return 0;
+    }
+  }
+  return n;
+}
+
+// looks up form (application/x-www-form-urlencoded) parameter key of the request body
+// the body is read into the scratch arena and parsed on the first call, bodies exceeding the arena are rejected
+// returns 1 if the key has been found
+int getFormParam(struct httpRequest *req, const char *key, struct wsSlice *value, int *err) {
+  *err = errOk;
+  if (!req->formParams.parsed) {
+    char *form = req->arena->buff + req->arena->used;
+    int formSize = 0;
+    int readSize;
+    while ((readSize = readBody(req, form+formSize, req->arena->size-req->arena->used-formSize, err)) > 0) {
+      formSize += readSize;
+    }
+    if (*err != errOk) {
+      return 0;
+    }
+    // the arena is full but the body is not read completely
+    if (req->body.state != bodyDone && req->body.state != bodyNone) {
+      *err = errSecCheck;
+      req->body.err = *err;
+      return 0;
+    }
+    arenaAlloc(req->arena, formSize);
+    paramsParse(&req->formParams, form, formSize, req->arena);
+  }
+  return paramsGet(&req->formParams, key, value, req->arena);
+}
+
+// parses incoming httpRequest from reqBuff to the httpRequest struct
+void parseHttpRequest(struct httpRequest *req, char *reqBuff, int reqBuffSize, int *err) {
+  #ifdef DEBUG
+  printf("------------ request -------------\n");
+  printf("%s \n", reqBuff);
+  printf("------------ request -------------\n");
+  #endif
+
+  char *tok;
+  int endOfParse = 0;
+
+  req->query = NULL;
+  req->querySize = 0;
+  req->queryParams.parsed = 0;
+
+  int iElement = 0;
+  int iElementSize = 0;
+  int iElementUsedMem = 0;
+
+  for (int i = 0; i<reqBuffSize; i++) {
+    // request line parsing
+    if (reqBuff[i] == SP || (reqBuff[i] == CR && reqBuff[i+1] == LF)) {
+      if (iElement == 0) {
+        iElementSize = i;
+      } else {
+        iElementSize = (i-iElementUsedMem);
+      }
+      switch (iElement) {
+        case 0:
+          req->reqMethod = -1;
+          for (int m = 0; m < httpNMethods; m++) {
+            if ((size_t)iElementSize == strlen(httpMethodNames[m]) && strncmp(reqBuff+iElementUsedMem, httpMethodNames[m], iElementSize) == 0) { /* Flawfinder: ignore */ // \0 terminated literals
+              req->reqMethod = m;
+              break;
+            }
+          }
+          break;
+        case 1:
+          req->requestUri = malloc(sizeof(char)*(iElementSize+1));
+          if (req->requestUri == NULL) {
+            *err = errMemAlloc;
+            return;
+          }
+          memcpy(req->requestUri, reqBuff+iElementUsedMem, iElementSize);/* Flawfinder: ignore */ // in the line above memory is adequately allocated
+          // terminated before the spaces are removed so removeSpaces only touches initialized memory
+          req->requestUri[iElementSize] = 0;
+          removeSpaces(req->requestUri, iElementSize);
+          // splitting the query off the path, the query stays in the same allocation
+          tok = strchr(req->requestUri, '?');
+          if (tok != NULL) {
+            *tok = 0;
+            req->query = tok+1;
+            req->querySize = strlen(req->query); /* Flawfinder: ignore */ // \0 terminated above
+          }
+          break;
+        case 2:
+          // extracing version number - http/x.x
+          // the buffer is left untouched, the header is kept as it is for getHeader (and copied by http/2 streams)
+          // terminating character ensured by the clientThread which hands the reqBuff to this function
+          tok = memchr(reqBuff+iElementUsedMem, '/', iElementSize);
+          // if conversion fails atof returns a 0.0 value - no other err handling possible
+          req->httpVersion = tok != NULL ? atof(tok+1) : 0.0f;
+          endOfParse = 1;
+          break;
+      }
+      iElementUsedMem += iElementSize;
+      iElement++;
+      if (endOfParse)
+        break;
+    }
+  }
+
+  *err = errOk;
+}
+
+// decodes an hpack integer with a prefixBits bit prefix at *pos of src
+// returns the value or -1 if it's truncated or exceeds 2^28
+long hpackDecodeInt(const uint8_t *src, int size, int *pos, int prefixBits) {
+  long max = (1 << prefixBits) - 1;
+  if (*pos >= size) {
+    return -1;
+  }
+  long value = src[(*pos)++] & max;
+  if (value < max) {
+    return value;
+  }
+  for (int shift = 0; shift <= 21 && *pos < size; shift += 7) {
+    uint8_t b = src[(*pos)++];
+    value += (long)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return value;
+    }
+  }
+  return -1;
+}
+
+// encodes value as hpack integer with a prefixBits bit prefix, the remaining high bits of the first byte are taken from pattern
+// returns the encoded size (at most 6 bytes)
+int hpackEncodeInt(uint8_t *out, uint32_t value, int prefixBits, uint8_t pattern) {
+  uint32_t max = (1 << prefixBits) - 1;
+  if (value < max) {
+    out[0] = pattern | value;
+    return 1;
+  }
+  int size = 1;
+  out[0] = pattern | max;
+  value -= max;
+  while (value >= 0x80) {
+    out[size++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out[size++] = value;
+  return size;
+}
+
+// decodes the huffman coded string src into dst, bit by bit through the code ranges of the canonical code
+// returns the decoded size or -1 if it's invalid (EOS, padding longer than 7 bits or not all ones) or exceeds dstSize
+int hpackHuffDecode(const uint8_t *src, int srcSize, char *dst, int dstSize) {
+  int size = 0, len = 0, code = 0, first = 0, index = 0, ones = 1;
+  for (int i = 0; i < srcSize*8; i++) {
+    int bit = (src[i >> 3] >> (7 - (i & 7))) & 1;
+    code |= bit;
+    ones &= bit;
+    len++;
+    if (code - first < hpackHuffCounts[len]) {
+      index += code - first;
+      if (index >= 256 || size >= dstSize) {
+        return -1;
+      }
+      dst[size++] = hpackHuffSymbols[index];
+      len = code = first = index = 0;
+      ones = 1;
+      continue;
+    }
+    if (len == 30) {
+      return -1;
+    }
+    index += hpackHuffCounts[len];
+    first = (first + hpackHuffCounts[len]) << 1;
+    code <<= 1;
+  }
+  if (len > 7 || !ones) {
+    return -1;
+  }
+  return size;
+}
+
+// decodes an hpack string literal (raw or huffman coded) at *pos of src into dst
+// returns its size or -1 if it's invalid or exceeds dstSize
+int hpackDecodeString(const uint8_t *src, int size, int *pos, char *dst, int dstSize) {
+  if (*pos >= size) {
+    return -1;
+  }
+  int huffman = src[*pos] & 0x80;
+  long len = hpackDecodeInt(src, size, pos, 7);
+  if (len < 0 || len > size - *pos) {
+    return -1;
+  }
+  const uint8_t *str = src + *pos;
+  *pos += len;
+  if (huffman) {
+    return hpackHuffDecode(str, len, dst, dstSize);
+  }
+  if (len > dstSize) {
+    return -1;
+  }
+  memcpy(dst, str, len); /* Flawfinder: ignore */ // bounds checked above
+  return len;
+}
+
+// inits an empty dynamic table of maxSize
+void hpackInit(struct hpackTable *table, int maxSize) {
+  table->oldest = 0;
+  table->nEntries = 0;
+  table->start = 0;
+  table->end = 0;
+  table->size = 0;
+  table->maxSize = maxSize;
+}
+
+// evicts the oldest entries until the table size doesn't exceed maxSize
+void hpackEvict(struct hpackTable *table, int maxSize) {
+  while (table->nEntries > 0 && table->size > maxSize) {
+    struct hpackEntry *entry = &table->entries[table->oldest];
+    table->size -= entry->nameSize + entry->valueSize + 32;
+    table->start = entry->offset + entry->nameSize + entry->valueSize;
+    table->oldest = (table->oldest + 1) % HPACK_MAX_ENTRIES;
+    table->nEntries--;
+  }
+  if (table->nEntries == 0) {
+    table->start = 0;
+    table->end = 0;
+  }
+}
+
+// inserts a new entry, evicting old ones as needed, an entry larger than the max size empties the table
+// name & value must not point into the table
+void hpackInsert(struct hpackTable *table, const char *name, int nameSize, const char *value, int valueSize) {
+  int entrySize = nameSize + valueSize + 32;
+  hpackEvict(table, table->maxSize - entrySize);
+  if (entrySize > table->maxSize) {
+    return;
+  }
+  if (table->end + nameSize + valueSize > (int)sizeof table->buff) {
+    memmove(table->buff, table->buff+table->start, table->end-table->start);
+    for (int i = 0; i < table->nEntries; i++) {
+      table->entries[(table->oldest + i) % HPACK_MAX_ENTRIES].offset -= table->start;
+    }
+    table->end -= table->start;
+    table->start = 0;
+  }
+  struct hpackEntry *entry = &table->entries[(table->oldest + table->nEntries) % HPACK_MAX_ENTRIES];
+  entry->offset = table->end;
+  entry->nameSize = nameSize;
+  entry->valueSize = valueSize;
+  memcpy(table->buff+table->end, name, nameSize); /* Flawfinder: ignore */ // live data + new entry fit after compaction
+  memcpy(table->buff+table->end+nameSize, value, valueSize); /* Flawfinder: ignore */ // live data + new entry fit after compaction
+  table->end += nameSize + valueSize;
+  table->nEntries++;
+  table->size += entrySize;
+}
+
+// looks up the header field of hpack index (static table from 1, dynamic table from 62, newest first)
+// returns 0 if the index is out of range
+int hpackLookup(struct hpackTable *table, long index, struct wsSlice *name, struct wsSlice *value) {
+  if (index >= 1 && index <= HPACK_STATIC_ENTRIES) {
+    const struct hpackStaticEntry *entry = &hpackStaticTable[index-1];
+    *name = (struct wsSlice){.data = (char*)entry->name, .size = entry->nameSize};
+    *value = (struct wsSlice){.data = (char*)entry->value, .size = entry->valueSize};
+    return 1;
+  }
+  index -= HPACK_STATIC_ENTRIES + 1;
+  if (index < 0 || index >= table->nEntries) {
+    return 0;
+  }
+  struct hpackEntry *entry = &table->entries[(table->oldest + table->nEntries - 1 - index) % HPACK_MAX_ENTRIES];
+  *name = (struct wsSlice){.data = table->buff+entry->offset, .size = entry->nameSize};
+  *value = (struct wsSlice){.data = table->buff+entry->offset+entry->nameSize, .size = entry->valueSize};
+  return 1;
+}
+
+// decodes the next header field representation at *pos of the header block, literals are decoded into scratch (2*WS_H2_TABLE_SIZE bytes)
+// dynamic table size updates (only allowed at the start of a block, up to WS_H2_TABLE_SIZE) are applied to the table
+// returns 1 if a field has been decoded into name & value (valid until the next call), 0 for a size update
+int hpackDecodeField(struct hpackTable *table, const uint8_t *block, int size, int *pos, int startOfBlock, char *scratch, struct wsSlice *name, struct wsSlice *value, int *err) {
+  *err = errParse;
+  uint8_t first = block[*pos];
+  if (first & 0x80) {
+    // indexed field
+    long index = hpackDecodeInt(block, size, pos, 7);
+    if (!hpackLookup(table, index, name, value)) {
+      return 0;
+    }
+    *err = errOk;
+    return 1;
+  }
+  if ((first & 0xe0) == 0x20) {
+    long maxSize = hpackDecodeInt(block, size, pos, 5);
+    if (!startOfBlock || maxSize < 0 || maxSize > WS_H2_TABLE_SIZE) {
+      return 0;
+    }
+    table->maxSize = maxSize;
+    hpackEvict(table, maxSize);
+    *err = errOk;
+    return 0;
+  }
+
+  // literal with incremental indexing (01), without indexing (0000) or never indexed (0001)
+  int indexing = (first & 0xc0) == 0x40;
+  long index = hpackDecodeInt(block, size, pos, indexing ? 6 : 4);
+  if (index < 0) {
+    return 0;
+  }
+  if (index > 0) {
+    struct wsSlice indexedValue;
+    if (!hpackLookup(table, index, name, &indexedValue) || name->size > WS_H2_TABLE_SIZE) {
+      return 0;
+    }
+    // copied, the entry may be evicted by the insertion
+    memcpy(scratch, name->data, name->size); /* Flawfinder: ignore */ // bounds checked above
+    name->data = scratch;
+  } else {
+    name->size = hpackDecodeString(block, size, pos, scratch, WS_H2_TABLE_SIZE);
+    name->data = scratch;
+    if (name->size < 0) {
+      return 0;
+    }
+  }
+  value->data = scratch + name->size;
+  value->size = hpackDecodeString(block, size, pos, value->data, WS_H2_TABLE_SIZE);
+  if (value->size < 0) {
+    return 0;
+  }
+  if (indexing) {
+    hpackInsert(table, name->data, name->size, value->data, value->size);
+  }
+  *err = errOk;
+  return 1;
+}
+
+// encodes a header field (lowercase name) into out, indexed if the static or dynamic table has it
+// otherwise as literal (with an indexed name if possible), which is added to the dynamic table if index is set
+// returns the encoded size, at most nameSize + valueSize + 12 bytes
+int hpackEncodeField(struct hpackTable *table, uint8_t *out, const char *name, int nameSize, const char *value, int valueSize, int index) {
+  int nameIndex = 0;
+  for (int i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+    const struct hpackStaticEntry *entry = &hpackStaticTable[i];
+    if (entry->nameSize != nameSize || memcmp(entry->name, name, nameSize) != 0) {
+      continue;
+    }
+    if (entry->valueSize == valueSize && memcmp(entry->value, value, valueSize) == 0) {
+      return hpackEncodeInt(out, i+1, 7, 0x80);
+    }
+    if (nameIndex == 0) {
+      nameIndex = i+1;
+    }
+  }
+  for (int i = 0; i < table->nEntries; i++) {
+    struct hpackEntry *entry = &table->entries[(table->oldest + table->nEntries - 1 - i) % HPACK_MAX_ENTRIES];
+    char *entryName = table->buff + entry->offset;
+    if (entry->nameSize != nameSize || memcmp(entryName, name, nameSize) != 0) {
+      continue;
+    }
+    if (entry->valueSize == valueSize && memcmp(entryName+nameSize, value, valueSize) == 0) {
+      return hpackEncodeInt(out, HPACK_STATIC_ENTRIES+1+i, 7, 0x80);
+    }
+    if (nameIndex == 0) {
+      nameIndex = HPACK_STATIC_ENTRIES+1+i;
+    }
+  }
+
+  int size = index ? hpackEncodeInt(out, nameIndex, 6, 0x40) : hpackEncodeInt(out, nameIndex, 4, 0);
+  if (nameIndex == 0) {
+    size += hpackEncodeInt(out+size, nameSize, 7, 0);
+    memcpy(out+size, name, nameSize); /* Flawfinder: ignore */ // size guaranteed by the caller
+    size += nameSize;
+  }
+  size += hpackEncodeInt(out+size, valueSize, 7, 0);
+  memcpy(out+size, value, valueSize); /* Flawfinder: ignore */ // size guaranteed by the caller
+  size += valueSize;
+  if (index) {
+    hpackInsert(table, name, nameSize, value, valueSize);
+  }
+  return size;
+}
+
+// enables the response cache for GET (and HEAD) requests of the handler route, to be called before the route is added
+// responses are fresh for ttlMs, then served stale for staleMs more while one request refreshes them
+// vary is a comma separated list of request header fields whose values are part of the cache key (NULL for none)
+void routeSetCache(struct httpRoute *route, int ttlMs, int staleMs, const char *vary, int *err) {
+  if (route->handler == NULL || ttlMs < 0 || staleMs < 0) {
+    *err = errInit;
+    return;
+  }
+  free(route->cacheVary);
+  route->cacheVary = NULL;
+  route->nCacheVary = 0;
+  if (vary != NULL) {
+    int size = strlen(vary); /* Flawfinder: ignore */ // \0 termination expected from the caller
+    route->cacheVary = malloc(size+1);
+    if (route->cacheVary == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+    // the names are stored without separators & whitespace, each \0 terminated
+    int n = 0;
+    for (int i = 0; i <= size; i++) {
+      if (vary[i] == ',' || vary[i] == 0) {
+        if (n > 0 && route->cacheVary[n-1] != 0) {
+          route->cacheVary[n++] = 0;
+          route->nCacheVary++;
+        }
+      } else if (vary[i] != SP && vary[i] != '\t') {
+        route->cacheVary[n++] = vary[i];
+      }
+    }
+  }
+  route->cacheTtlMs = ttlMs;
+  route->cacheStaleMs = staleMs;
+  *err = errOk;
+}
+
+// sets the max request body size of a handler route (WS_MAX_REQ_BODY_SIZE by default), to be called before the route is added
+void routeSetMaxBodySize(struct httpRoute *route, long long size, int *err) {
+  if (size < 0) {
+    *err = errInit;
+    return;
+  }
+  route->maxBodySize = size;
+  *err = errOk;
+}
+
+// marks the handler of the route as blocking (file system, legacy libraries), to be called before the route is added
+// with event loops it's run on the blocking pool, which parks the serving coroutine instead of stalling its loop
+void routeSetBlocking(struct httpRoute *route, int *err) {
+  if (route->handler == NULL || route->proxy != NULL) {
+    *err = errInit;
+    return;
+  }
+  route->blocking = 1;
+  *err = errOk;
+}
+
+// restricts the route to connections of unix socket listeners, which are protected by the file permissions of the socket
+// (wsListenerConfig.mode), others get a 404 as if there was no route, to be called before the route is added
+void routeSetAdmin(struct httpRoute *route, int *err) {
+  route->admin = 1;
+  *err = errOk;
+}
+
+// returns 1 if route is an admin route & conn isn't a connection of a unix socket listener
+int routeHidden(struct httpRoute *route, struct wsConn *conn) {
+  if (route == NULL || !route->admin) {
+    return 0;
+  }
+  struct sockaddr_storage local;
+  socklen_t localSize = sizeof local;
+  return getsockname(conn->socket, (struct sockaddr*)&local, &localSize) != 0 || local.ss_family != AF_UNIX;
+}
+
+// limits the requests of every client address to the route to rate per second with bursts of up to burst requests,
+// on top of the server wide limit (wsConfig.rateLimit), to be called before the route is added
+void routeSetRateLimit(struct httpRoute *route, int rate, int burst, int *err) {
+  if (rate < 0 || burst < 1) {
+    *err = errInit;
+    return;
+  }
+  route->rateLimit = rate;
+  route->rateBurst = burst;
+  *err = errOk;
+}
+
+// 64 bit FNV-1a hash with a final avalanche (murmur3 fmix64), the shard, bucket & sketch counters are taken from different bits
+uint64_t cacheHash(const char *data, int size) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < size; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// rate limiting key of the client address addr, IPv6 clients are keyed by their /64 prefix (the usual size of a client
+// network) & IPv4 mapped addresses as IPv4
+// returns 0 for addresses which aren't limited (unix sockets)
+uint64_t ratePeerKey(const struct sockaddr_storage *addr) {
+  char key[9];
+  int keySize;
+  if (addr->ss_family == AF_INET) {
+    key[0] = 4;
+    memcpy(key+1, &((const struct sockaddr_in*)addr)->sin_addr, 4); /* Flawfinder: ignore */ // IPv4 address size
+    keySize = 5;
+  } else if (addr->ss_family == AF_INET6) {
+    const struct in6_addr *addr6 = &((const struct sockaddr_in6*)addr)->sin6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(addr6)) {
+      key[0] = 4;
+      memcpy(key+1, addr6->s6_addr+12, 4); /* Flawfinder: ignore */ // IPv4 address size
+      keySize = 5;
+    } else {
+      key[0] = 6;
+      memcpy(key+1, addr6->s6_addr, 8); /* Flawfinder: ignore */ // prefix size
+      keySize = 9;
+    }
+  } else {
+    return 0;
+  }
+  uint64_t hash = cacheHash(key, keySize);
+  return hash != 0 ? hash : 1;
+}
+
+// key of slot, a claimed slot is waited for (its claimer only sets the state & publishes the key)
+uint64_t rateSlotKey(struct rateSlot *slot) {
+  uint64_t key;
+  while ((key = atomic_load_explicit(&slot->key, memory_order_acquire)) == WS_RATE_CLAIMED) {
+    sched_yield();
+  }
+  return key;
+}
+
+// takes a token from the bucket of key, which is refilled with rate tokens per second up to burst tokens
+// take 0 only checks if the bucket has a token
+// returns 1 if the bucket had a token
+int rateTake(struct wsRateLimiter *limiter, uint64_t key, int rate, int burst, int take) {
+  uint32_t nowMs = (uint32_t)(wsNowNs() / 1000000);
+  uint64_t full = (uint64_t)burst * 1000 << 32 | nowMs;
+  struct rateSlot *slot = NULL, *oldest = NULL;
+  uint32_t oldestAge = 0;
+
+  if (key == WS_RATE_CLAIMED) {
+    key--;
+  }
+  for (int i = 0; i < WS_RATE_PROBES && slot == NULL; i++) {
+    struct rateSlot *probe = &limiter->slots[(key + i) & (WS_RATE_TABLE_SIZE - 1)];
+    uint64_t probeKey = atomic_load_explicit(&probe->key, memory_order_acquire);
+    // a new bucket starts full, the slot is claimed before its state is set & the key is published
+    if (probeKey == 0 && atomic_compare_exchange_strong(&probe->key, &probeKey, WS_RATE_CLAIMED)) {
+      atomic_store_explicit(&probe->state, full, memory_order_relaxed);
+      atomic_store_explicit(&probe->key, key, memory_order_release);
+      slot = probe;
+      break;
+    }
+    // the slot may be claimed for key right now, the next slot would become a second bucket of it
+    if (probeKey == WS_RATE_CLAIMED) {
+      probeKey = rateSlotKey(probe);
+    }
+    if (probeKey == key) {
+      slot = probe;
+      break;
+    }
+    uint32_t age = nowMs - (uint32_t)atomic_load_explicit(&probe->state, memory_order_relaxed);
+    if (oldest == NULL || age > oldestAge) {
+      oldest = probe;
+      oldestAge = age;
+    }
+  }
+  if (slot == NULL) {
+    // approximate lru, the least recently refilled bucket of the probed slots is replaced
+    uint64_t oldestKey = rateSlotKey(oldest);
+    if (oldestKey != key) {
+      if (atomic_compare_exchange_strong(&oldest->key, &oldestKey, WS_RATE_CLAIMED)) {
+        atomic_store_explicit(&oldest->state, full, memory_order_relaxed);
+        atomic_store_explicit(&oldest->key, key, memory_order_release);
+      } else if (rateSlotKey(oldest) != key) {
+        // claimed by another client meanwhile, the request isn't limited
+        return 1;
+      }
+    }
+    slot = oldest;
+  }
+
+  uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+  while (1) {
+    uint64_t tokens = state >> 32;
+    uint32_t last = (uint32_t)state;
+    uint32_t elapsed = nowMs - last;
+    // refilled by a thread with a later clock reading
+    if ((int32_t)elapsed < 0) {
+      elapsed = 0;
+      nowMs = last;
+    }
+    tokens += (uint64_t)elapsed * rate;
+    if (tokens > (uint64_t)burst * 1000) {
+      tokens = (uint64_t)burst * 1000;
+    }
+    if (tokens < 1000) {
+      return 0;
+    }
+    if (!take) {
+      return 1;
+    }
+    if (atomic_compare_exchange_weak_explicit(&slot->state, &state, (tokens - 1000) << 32 | nowMs, memory_order_relaxed, memory_order_relaxed)) {
+      return 1;
+    }
+  }
+}
+
+// takes a token from the bucket of the client of conn & the one of its client for route (if the route is limited)
+// returns 1 if the request has to be rejected
+int rateLimited(webserver *wserver, struct wsConn *conn, struct httpRoute *route) {
+  if (conn->peerKey == 0) {
+    return 0;
+  }
+  int limited = wserver->config.rateLimit > 0 && !rateTake(&wserver->rate, conn->peerKey, wserver->config.rateLimit, wserver->config.rateBurst, 1);
+  if (!limited && route != NULL && route->rateLimit > 0) {
+    uint64_t key[2] = {conn->peerKey, (uintptr_t)route};
+    uint64_t routeKey = cacheHash((const char*)key, sizeof key);
+    limited = !rateTake(&wserver->rate, routeKey != 0 ? routeKey : 1, route->rateLimit, route->rateBurst, 1);
+  }
+  if (limited) {
+    atomic_fetch_add_explicit(&wserver->rate.limited, 1, memory_order_relaxed);
+  }
+  return limited;
+}
+
+// compares two query parameters (key=value) bytewise
+int cacheParamCompare(const void *a, const void *b) {
+  const struct wsSlice *x = a;
+  const struct wsSlice *y = b;
+  int cmp = memcmp(x->data, y->data, x->size < y->size ? x->size : y->size);
+  return cmp != 0 ? cmp : x->size - y->size;
+}
+
+// writes the cache key of req into key: the path, the query parameters in sorted order & the values of the vary fields of the route
+// requests differing only in the order of their query parameters share an entry, HEAD requests share the entries of GET
+// returns the key size or -1 if it exceeds keySize (the request is not cached)
+int cacheKey(struct httpRoute *route, struct httpRequest *req, char *key, int keySize) {
+  struct wsSlice params[WS_MAX_PARAMS];
+  int nParams = 0;
+
+  int size = strlen(req->requestUri); /* Flawfinder: ignore */ // \0 terminated by parseHttpRequest
+  if (size > keySize) {
+    return -1;
+  }
+  memcpy(key, req->requestUri, size); /* Flawfinder: ignore */ // bounds checked above
+  // empty parameters (e.g. a=1&&b=2) are dropped
+  for (int i = 0; i < req->querySize;) {
+    char *end = memchr(req->query+i, '&', req->querySize-i);
+    int paramSize = end != NULL ? end - (req->query+i) : req->querySize-i;
+    if (paramSize > 0) {
+      if (nParams == WS_MAX_PARAMS) {
+        return -1;
+      }
+      params[nParams++] = (struct wsSlice){.data = req->query+i, .size = paramSize};
+    }
+    i += paramSize + 1;
+  }
+  qsort(params, nParams, sizeof params[0], cacheParamCompare);
+  for (int i = 0; i < nParams; i++) {
+    if (size + 1 + params[i].size > keySize) {
+      return -1;
+    }
+    key[size++] = i == 0 ? '?' : '&';
+    memcpy(key+size, params[i].data, params[i].size); /* Flawfinder: ignore */ // bounds checked above
+    size += params[i].size;
+  }
+  // the values are separated by LF which is part of neither the path nor a field value
+  char *name = route->cacheVary;
+  for (int i = 0; i < route->nCacheVary; i++) {
+    int valueSize = 0;
+    char *value = getHeader(req->header, req->headerSize, name, &valueSize);
+    if (size + 1 + valueSize > keySize) {
+      return -1;
+    }
+    key[size++] = LF;
+    if (value != NULL) {
+      memcpy(key+size, value, valueSize); /* Flawfinder: ignore */ // bounds checked above
+      size += valueSize;
+    }
+    name += strlen(name) + 1; /* Flawfinder: ignore */ // \0 separated by routeSetCache
+  }
+  return size;
+}
+
+// returns the shard of the key hash
+struct cacheShard *cacheShardOf(struct wsCache *cache, uint64_t hash) {
+  return &cache->shards[(hash >> 48) % WS_CACHE_SHARDS];
+}
+
+// returns the counter index of hash in the sketch row (double hashing)
+int sketchIndex(uint64_t hash, int row) {
+  uint32_t h1 = (uint32_t)hash;
+  uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+  return (h1 + (uint32_t)row * h2) & (WS_CACHE_SKETCH_WIDTH-1);
+}
+
+// counts an access of the key hash in the frequency sketch of shard (shard locked)
+// all counters are halved every WS_CACHE_SKETCH_SAMPLE increments
+void sketchAdd(struct cacheShard *shard, uint64_t hash) {
+  for (int row = 0; row < WS_CACHE_SKETCH_DEPTH; row++) {
+    uint8_t *counter = &shard->sketch[row][sketchIndex(hash, row)];
+    if (*counter < 15) {
+      (*counter)++;
+    }
+  }
+  if (++shard->sketchAdds >= WS_CACHE_SKETCH_SAMPLE) {
+    for (int row = 0; row < WS_CACHE_SKETCH_DEPTH; row++) {
+      for (int i = 0; i < WS_CACHE_SKETCH_WIDTH; i++) {
+        shard->sketch[row][i] >>= 1;
+      }
+    }
+    shard->sketchAdds = 0;
+  }
+}
+
+// returns the estimated access frequency of the key hash (the min of its counters, shard locked)
+int sketchEstimate(struct cacheShard *shard, uint64_t hash) {
+  int freq = 15;
+  for (int row = 0; row < WS_CACHE_SKETCH_DEPTH; row++) {
+    int counter = shard->sketch[row][sketchIndex(hash, row)];
+    freq = counter < freq ? counter : freq;
+  }
+  return freq;
+}
+
+// drops a reference to entry, the last one frees it
+void cacheRelease(struct cacheEntry *entry) {
+  if (atomic_fetch_sub(&entry->refs, 1) == 1) {
+    free(entry);
+  }
+}
+
+// removes entry from the LRU list of shard (shard locked)
+void cacheLruRemove(struct cacheShard *shard, struct cacheEntry *entry) {
+  if (entry->lruPrev != NULL) {
+    entry->lruPrev->lruNext = entry->lruNext;
+  } else {
+    shard->lruHead = entry->lruNext;
+  }
+  if (entry->lruNext != NULL) {
+    entry->lruNext->lruPrev = entry->lruPrev;
+  } else {
+    shard->lruTail = entry->lruPrev;
+  }
+}
+
+// appends entry to the LRU list of shard as most recently used (shard locked)
+void cacheLruAppend(struct cacheShard *shard, struct cacheEntry *entry) {
+  entry->lruNext = NULL;
+  entry->lruPrev = shard->lruTail;
+  if (shard->lruTail != NULL) {
+    shard->lruTail->lruNext = entry;
+  } else {
+    shard->lruHead = entry;
+  }
+  shard->lruTail = entry;
+}
+
+// unlinks entry from its bucket & the LRU list and drops the reference of the shard (shard locked)
+void cacheUnlink(struct cacheShard *shard, struct cacheEntry *entry) {
+  struct cacheEntry **link = &shard->buckets[entry->hash & (WS_CACHE_BUCKETS-1)];
+  while (*link != entry) {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  cacheLruRemove(shard, entry);
+  shard->used -= entry->memSize;
+  cacheRelease(entry);
+}
+
+// returns the entry of key in shard or NULL (shard locked)
+struct cacheEntry *cacheFind(struct cacheShard *shard, uint64_t hash, const char *key, int keySize) {
+  struct cacheEntry *entry = shard->buckets[hash & (WS_CACHE_BUCKETS-1)];
+  while (entry != NULL && (entry->hash != hash || entry->keySize != keySize || memcmp(entry->key, key, keySize) != 0)) {
+    entry = entry->next;
+  }
+  return entry;
+}
+
+// looks up the entry of key and counts the access in the frequency sketch, entries past their stale window are dropped
+// refresh is set if the entry is stale and the caller (if canRefresh) is the one to refresh it, see cacheRefreshDone
+// returns the referenced entry (to be released with cacheRelease) or NULL
+struct cacheEntry *cacheGet(struct wsCache *cache, uint64_t hash, const char *key, int keySize, uint64_t nowMs, int canRefresh, int *refresh) {
+  struct cacheShard *shard = cacheShardOf(cache, hash);
+  *refresh = 0;
+
+  pthread_mutex_lock(&shard->lock);
+  sketchAdd(shard, hash);
+  struct cacheEntry *entry = cacheFind(shard, hash, key, keySize);
+  if (entry != NULL && nowMs >= entry->staleUntilMs) {
+    cacheUnlink(shard, entry);
+    entry = NULL;
+  }
+  if (entry != NULL) {
+    cacheLruRemove(shard, entry);
+    cacheLruAppend(shard, entry);
+    atomic_fetch_add(&entry->refs, 1);
+    if (nowMs >= entry->freshUntilMs && canRefresh && !entry->refreshing) {
+      entry->refreshing = 1;
+      *refresh = 1;
+    }
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return entry;
+}
+
+// ends the refresh of entry (claimed by cacheGet), a refresh that didn't replace it is retried by the next request
+void cacheRefreshDone(struct wsCache *cache, struct cacheEntry *entry) {
+  struct cacheShard *shard = cacheShardOf(cache, entry->hash);
+  pthread_mutex_lock(&shard->lock);
+  entry->refreshing = 0;
+  pthread_mutex_unlock(&shard->lock);
+}
+
+// returns 1 if the built response may be stored: its status is cacheable by default (RFC 9110 section 15.1)
+// and it has neither a Set-Cookie field nor a Cache-Control field with no-store, no-cache or private
+int cacheStorable(struct respBuilder *rb) {
+  switch (rb->statusCode) {
+    case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 405: case 410: case 414: case 501:
+      break;
+    default:
+      return 0;
+  }
+  if (rb->err != errOk) {
+    return 0;
+  }
+  // every field appended by respAddHeader ends with CRLF
+  char *hdr = rb->conn->hdrBuff;
+  for (int i = 0; i < rb->hdrSize;) {
+    char *lineEnd = memchr(hdr+i, LF, rb->hdrSize-i);
+    int lineSize = lineEnd != NULL ? lineEnd - (hdr+i) : rb->hdrSize-i;
+    if (lineSize > 11 && strncasecmp(hdr+i, "Set-Cookie:", 11) == 0) {
+      return 0;
+    }
+    if (lineSize > 14 && strncasecmp(hdr+i, "Cache-Control:", 14) == 0 && (headerHasToken(hdr+i+14, lineSize-14, "no-store")
+      || headerHasToken(hdr+i+14, lineSize-14, "no-cache") || headerHasToken(hdr+i+14, lineSize-14, "private"))) {
+      return 0;
+    }
+    i += lineSize + 1;
+  }
+  return 1;
+}
+
+// stores the built response of route under key, an existing entry of key is replaced (refresh)
+// a new key is admitted if the shard has room or if it's more frequently requested than each LRU entry it evicts (TinyLFU)
+void cachePut(struct wsCache *cache, uint64_t hash, const char *key, int keySize, struct httpRoute *route, struct respBuilder *rb, uint64_t nowMs) {
+  struct cacheShard *shard = cacheShardOf(cache, hash);
+  char header[WS_BUFF_SIZE];
+  int err;
+
+  // the connection response buffer is free until the response is sent
+  int closeSize = respFinish(rb, 0, NULL, rb->conn->respBuff, WS_BUFF_SIZE, &err);
+  if (err != errOk) {
+    return;
+  }
+  int keepAliveSize = respFinish(rb, 1, NULL, header, WS_BUFF_SIZE, &err);
+  if (err != errOk) {
+    return;
+  }
+  size_t memSize = sizeof(struct cacheEntry) + keySize + closeSize + keepAliveSize + rb->bodySize;
+  if (memSize > cache->shardBudget) {
+    atomic_fetch_add(&cache->rejected, 1);
+    return;
+  }
+  struct cacheEntry *entry = malloc(memSize);
+  if (entry == NULL) {
+    return;
+  }
+  entry->key = (char*)(entry+1);
+  entry->header[0] = entry->key + keySize;
+  entry->header[1] = entry->header[0] + closeSize;
+  entry->body = entry->header[1] + keepAliveSize;
+  memcpy(entry->key, key, keySize); /* Flawfinder: ignore */ // allocated above
+  memcpy(entry->header[0], rb->conn->respBuff, closeSize); /* Flawfinder: ignore */ // allocated above
+  memcpy(entry->header[1], header, keepAliveSize); /* Flawfinder: ignore */ // allocated above
+  if (rb->bodySize > 0) {
+    memcpy(entry->body, rb->conn->bodyBuff, rb->bodySize); /* Flawfinder: ignore */ // allocated above
+  }
+  entry->keySize = keySize;
+  entry->headerSize[0] = closeSize;
+  entry->headerSize[1] = keepAliveSize;
+  entry->bodySize = rb->bodySize;
+  entry->hash = hash;
+  entry->freshUntilMs = nowMs + route->cacheTtlMs;
+  entry->staleUntilMs = entry->freshUntilMs + route->cacheStaleMs;
+  entry->refreshing = 0;
+  entry->memSize = memSize;
+  atomic_init(&entry->refs, 1);
+
+  pthread_mutex_lock(&shard->lock);
+  struct cacheEntry *old = cacheFind(shard, hash, key, keySize);
+  if (old != NULL) {
+    cacheUnlink(shard, old);
+  }
+  while (shard->used + memSize > cache->shardBudget) {
+    struct cacheEntry *victim = shard->lruHead;
+    if (old == NULL && sketchEstimate(shard, hash) <= sketchEstimate(shard, victim->hash)) {
+      pthread_mutex_unlock(&shard->lock);
+      atomic_fetch_add(&cache->rejected, 1);
+      free(entry);
+      return;
+    }
+    cacheUnlink(shard, victim);
+    atomic_fetch_add(&cache->evictions, 1);
+  }
+  struct cacheEntry **bucket = &shard->buckets[hash & (WS_CACHE_BUCKETS-1)];
+  entry->next = *bucket;
+  *bucket = entry;
+  cacheLruAppend(shard, entry);
+  shard->used += memSize;
+  pthread_mutex_unlock(&shard->lock);
+  atomic_fetch_add(&cache->stores, 1);
+}
+
+// allocates the response cache, the memory budget size is split evenly among the shards
+struct wsCache *createCache(long long size, int *err) {
+  struct wsCache *cache = calloc(1, sizeof *cache);
+  if (cache == NULL) {
+    *err = errMemAlloc;
+    return NULL;
+  }
+  for (int i = 0; i < WS_CACHE_SHARDS; i++) {
+    cache->shards[i].lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  }
+  cache->shardBudget = size / WS_CACHE_SHARDS;
+  *err = errOk;
+  return cache;
+}
+
+// frees the response cache & all its entries
+void freeCache(struct wsCache *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  for (int i = 0; i < WS_CACHE_SHARDS; i++) {
+    while (cache->shards[i].lruHead != NULL) {
+      cacheUnlink(&cache->shards[i], cache->shards[i].lruHead);
+    }
+  }
+  free(cache);
+}
+
+#ifdef WS_ASSETS
+// looks up the embedded asset of path (binary search on the sorted table)
+// returns the asset or NULL
+const struct wsAsset *assetLookup(const char *path) {
+  int low = 0, high = WS_N_ASSETS-1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    int cmp = strcmp(wsAssets[mid].path, path);
+    if (cmp == 0) {
+      return &wsAssets[mid];
+    }
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+// returns 1 if the Accept-Encoding value accepts the content coding, a coding listed with q=0 (or not listed while "*"
+// has q=0) isn't accepted, an explicitly listed coding takes precedence over "*"
+int acceptsCoding(char *value, int valueSize, const char *coding) {
+  int codingSize = strlen(coding); /* Flawfinder: ignore */ // codings are developer defined literals
+  int wildcard = 0;
+  for (int i = 0; i < valueSize;) {
+    int end = i;
+    while (end < valueSize && value[end] != ',') {
+      end++;
+    }
+    // element: OWS coding *( OWS ";" OWS parameter ), only the weight parameter is of interest
+    while (i < end && (value[i] == ' ' || value[i] == '\t')) {
+      i++;
+    }
+    int codingEnd = i;
+    while (codingEnd < end && value[codingEnd] != ';' && value[codingEnd] != ' ' && value[codingEnd] != '\t') {
+      codingEnd++;
+    }
+    int accepted = 1;
+    for (int j = codingEnd; j < end; j++) {
+      if (value[j] != ';') {
+        continue;
+      }
+      int k = j+1;
+      while (k < end && (value[k] == ' ' || value[k] == '\t')) {
+        k++;
+      }
+      if (k+2 <= end && (value[k] == 'q' || value[k] == 'Q') && value[k+1] == '=') {
+        // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] ), it's 0 if all its digits are
+        k += 2;
+        while (k < end && (value[k] == '0' || value[k] == '.')) {
+          k++;
+        }
+        accepted = k < end && value[k] >= '1' && value[k] <= '9';
+      }
+    }
+    if (codingEnd - i == codingSize && strncasecmp(value+i, coding, codingSize) == 0) {
+      return accepted;
+    }
+    if (codingEnd - i == 1 && value[i] == '*') {
+      wildcard = accepted;
+    }
+    i = end+1;
+  }
+  return wildcard;
+}
+
+// returns the variant of asset answering the request: gzip if it's accepted, its 304 if If-None-Match has the ETag of
+// the selected variant
+const struct wsAssetVariant *assetVariant(const struct wsAsset *asset, char *header, int headerSize) {
+  int valueSize;
+  char *value = getHeader(header, headerSize, "Accept-Encoding", &valueSize);
+  int gzip = asset->variants[assetGzip].header[0] != NULL && value != NULL && acceptsCoding(value, valueSize, "gzip");
+  value = getHeader(header, headerSize, "If-None-Match", &valueSize);
+  if (value != NULL && ((valueSize == 1 && value[0] == '*') || headerHasToken(value, valueSize, asset->etag[gzip]))) {
+    return &asset->variants[gzip ? assetGzipNotModified : assetNotModified];
+  }
+  return &asset->variants[gzip ? assetGzip : assetIdentity];
+}
+#endif
+
+// route of the route config being compiled, path & value point into the config buffer
+struct snapSpec {
+  char *path;
+  char *value;
+  int method;
+  int statusCode;
+  int isFile;
+  int line;
+};
+
+// orders route specs by path & method, routes of a path are adjacent
+int snapSpecCompare(const void *a, const void *b) {
+  const struct snapSpec *x = a;
+  const struct snapSpec *y = b;
+  int cmp = strcmp(x->path, y->path);
+  return cmp != 0 ? cmp : x->method - y->method;
+}
+
+// writes size bytes of data at *offset of the snapshot file & advances it
+// returns the offset data was written to
+uint64_t snapWrite(FILE *out, uint64_t *offset, const void *data, size_t size, int *err) {
+  uint64_t dataOffset = *offset;
+  if (size > 0 && fwrite(data, 1, size, out) != size) {
+    *err = errIO;
+  }
+  *offset += size;
+  return dataOffset;
+}
+
+// parses the route config into specs (grown geometrically), each line is "METHOD PATH STATUS text VALUE" or "METHOD PATH STATUS file FILENAME"
+// returns the number of specs
+int snapParseConfig(char *config, int configSize, const char *configFile, struct snapSpec **specs, int *err) {
+  int nSpecs = 0, specsCap = 0, line = 0;
+  char *lineStart = config;
+
+  *specs = NULL;
+  while (lineStart < config + configSize) {
+    char *lineEnd = memchr(lineStart, LF, config + configSize - lineStart);
+    if (lineEnd == NULL) {
+      // the buffer of readFileToBuffer is \0 terminated
+      lineEnd = config + configSize;
+    }
+    *lineEnd = 0;
+    line++;
+    char *comment = strchr(lineStart, '#');
+    if (comment != NULL) {
+      *comment = 0;
+    }
+    char *tokens[6], *save;
+    int nTokens = 0;
+    for (char *token = strtok_r(lineStart, " \t\r", &save); token != NULL && nTokens < 6; token = strtok_r(NULL, " \t\r", &save)) {
+      tokens[nTokens++] = token;
+    }
+    lineStart = lineEnd + 1;
+    if (nTokens == 0) {
+      continue;
+    }
+
+    struct snapSpec spec = {.method = httpNMethods, .line = line};
+    for (int i = 0; nTokens == 5 && i < httpNMethods; i++) {
+      if (strcmp(tokens[0], httpMethodNames[i]) == 0) {
+        spec.method = i;
+      }
+    }
+    spec.statusCode = nTokens == 5 ? atoi(tokens[2]) : 0;
+    spec.isFile = nTokens == 5 && strcmp(tokens[3], "file") == 0;
+    if (spec.method == httpNMethods || tokens[1][0] != '/' || spec.statusCode < 100 || statusLine(spec.statusCode) == NULL || (!spec.isFile && strcmp(tokens[3], "text") != 0)) {
+      wsLog("route config %s:%d invalid \n", configFile, line);
+      *err = errParse;
+      return nSpecs;
+    }
+    spec.path = tokens[1];
+    spec.value = tokens[4];
+    if (nSpecs == specsCap) {
+      specsCap = specsCap ? specsCap*2 : 64;
+      struct snapSpec *grown = realloc(*specs, specsCap * sizeof(struct snapSpec));
+      if (grown == NULL) {
+        *err = errMemAlloc;
+        return nSpecs;
+      }
+      *specs = grown;
+    }
+    (*specs)[nSpecs++] = spec;
+  }
+  *err = errOk;
+  return nSpecs;
+}
+
+// writes the data of the routes (sorted specs) & fills their snapshot records
+void snapWriteRoutes(FILE *out, uint64_t *offset, struct snapSpec *specs, int nSpecs, struct snapRoute *routes, int *err) {
+  struct httpResponse resp;
+
+  for (int i = 0; i < nSpecs && *err == errOk; i++) {
+    struct snapRoute *route = &routes[i];
+    route->method = specs[i].method;
+    route->statusCode = specs[i].statusCode;
+    route->pathSize = strlen(specs[i].path); /* Flawfinder: ignore */ // \0 terminated by snapParseConfig
+    route->hash = hashBytes(specs[i].path, route->pathSize);
+    if (i > 0 && strcmp(specs[i].path, specs[i-1].path) == 0) {
+      if (specs[i].method == specs[i-1].method) {
+        wsLog("route config line %d duplicates line %d \n", specs[i].line, specs[i-1].line);
+        *err = errParse;
+        return;
+      }
+      route->pathOffset = routes[i-1].pathOffset;
+      route->allowOffset = routes[i-1].allowOffset;
+    } else {
+      // the Allow value of the path as built by routeNodeAllow
+      int methods = 0, size = 0;
+      char allow[64];
+      for (int j = i; j < nSpecs && strcmp(specs[j].path, specs[i].path) == 0; j++) {
+        methods |= 1 << specs[j].method;
+      }
+      for (int m = 0; m < httpNMethods; m++) {
+        if (methods & (1 << m) || (m == httpHead && methods & (1 << httpGet)) || m == httpOptions) {
+          size += sprintf(allow+size, "%s%s", size > 0 ? ", " : "", httpMethodNames[m]); /* Flawfinder: ignore */ // all method names fit into allow
+        }
+      }
+      route->pathOffset = snapWrite(out, offset, specs[i].path, route->pathSize+1, err);
+      route->allowOffset = snapWrite(out, offset, allow, size+1, err);
+    }
+
+    if (specs[i].isFile) {
+      resp.contentBuff = readFileToBuffer(specs[i].value, &resp.contentSize, err);
+      if (*err != errOk) {
+        wsLog("route config line %d: %s can't be read \n", specs[i].line, specs[i].value);
+        return;
+      }
+    } else {
+      int valueSize = strlen(specs[i].value); /* Flawfinder: ignore */ // \0 terminated by snapParseConfig
+      resp.contentBuff = malloc(valueSize+1);
+      if (resp.contentBuff == NULL) {
+        *err = errMemAlloc;
+        return;
+      }
+      resp.contentSize = percentDecode(specs[i].value, valueSize, resp.contentBuff);
+    }
+    resp.statusCode = specs[i].statusCode;
+    preSerializeResp(&resp, err);
+    if (*err == errOk) {
+      for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+        route->headerSize[keepAlive] = resp.headerSize[keepAlive];
+        route->headerOffset[keepAlive] = snapWrite(out, offset, resp.header[keepAlive], resp.headerSize[keepAlive], err);
+      }
+      route->bodySize = resp.contentSize;
+      route->bodyOffset = snapWrite(out, offset, resp.contentBuff, resp.contentSize, err);
+    }
+    free(resp.header[0]);
+    free(resp.header[1]);
+    free(resp.contentBuff);
+  }
+}
+
+// compiles the route config file into the snapshot file of its static routes, see README for the config format
+// the snapshot is written to a temporary file which replaces snapshotFile, a loading server never maps a partial one
+void wsCompileRoutes(const char *configFile, const char *snapshotFile, int *err) {
+  char tmpFile[PATH_MAX];
+  struct snapSpec *specs;
+  int configSize;
+
+  if (snprintf(tmpFile, sizeof tmpFile, "%s.tmp", snapshotFile) >= (int)sizeof tmpFile) {
+    *err = errInit;
+    return;
+  }
+  char *config = readFileToBuffer((char*)configFile, &configSize, err);
+  if (*err != errOk) {
+    return;
+  }
+  int nSpecs = snapParseConfig(config, configSize, configFile, &specs, err);
+  if (*err != errOk) {
+    free(specs);
+    free(config);
+    return;
+  }
+  qsort(specs, nSpecs, sizeof(struct snapSpec), snapSpecCompare);
+
+  // at least twice as many buckets as routes
+  struct snapHeader header = {.version = WS_SNAPSHOT_VERSION, .byteOrder = 0x01020304, .nRoutes = nSpecs, .nBuckets = 16};
+  while (header.nBuckets < 2 * header.nRoutes) {
+    header.nBuckets *= 2;
+  }
+  memcpy(header.magic, WS_SNAPSHOT_MAGIC, sizeof header.magic); /* Flawfinder: ignore */ // the magic has 8 bytes
+  header.routesOffset = sizeof header;
+  header.bucketsOffset = header.routesOffset + header.nRoutes * sizeof(struct snapRoute);
+  uint64_t offset = header.bucketsOffset + header.nBuckets * sizeof(uint32_t);
+  struct snapRoute *routes = calloc(header.nRoutes+1, sizeof(struct snapRoute));
+  uint32_t *buckets = calloc(header.nBuckets, sizeof(uint32_t));
+  FILE *out = fopen(tmpFile, "w"); /* Flawfinder: ignore */ // the snapshot path is developer defined
+  if (routes == NULL || buckets == NULL || out == NULL) {
+    *err = routes == NULL || buckets == NULL ? errMemAlloc : errIO;
+  } else if (fseek(out, offset, SEEK_SET) != 0) {
+    *err = errIO;
+  } else {
+    snapWriteRoutes(out, &offset, specs, nSpecs, routes, err);
+  }
+  if (*err == errOk) {
+    for (int i = 0; i < nSpecs; i++) {
+      uint32_t bucket = routes[i].hash & (header.nBuckets-1);
+      while (buckets[bucket] != 0) {
+        bucket = (bucket+1) & (header.nBuckets-1);
+      }
+      buckets[bucket] = i+1;
+    }
+    header.size = offset;
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof header, 1, out) != 1 || (nSpecs > 0 && fwrite(routes, sizeof(struct snapRoute), nSpecs, out) != (size_t)nSpecs)
+      || fwrite(buckets, sizeof(uint32_t), header.nBuckets, out) != header.nBuckets) {
+      *err = errIO;
+    }
+  }
+  if (out != NULL && fclose(out) != 0 && *err == errOk) {
+    *err = errIO;
+  }
+  if (*err == errOk && rename(tmpFile, snapshotFile) != 0) {
+    *err = errIO;
+  }
+  if (*err != errOk && out != NULL) {
+    unlink(tmpFile);
+  }
+  free(routes);
+  free(buckets);
+  free(specs);
+  free(config);
+}
+
+// returns 1 if the mapped snapshot is of this version & byte order and all its records are in bounds
+// every route has to be in exactly one bucket, the others are empty so lookup probes always end
+// the data isn't read, the records are checked against the file size only
+int snapValid(const char *base, size_t size) {
+  const struct snapHeader *header = (const struct snapHeader*)base;
+  if (size < sizeof *header || memcmp(header->magic, WS_SNAPSHOT_MAGIC, sizeof header->magic) != 0 || header->version != WS_SNAPSHOT_VERSION
+    || header->byteOrder != 0x01020304 || header->size != size) {
+    return 0;
+  }
+  if (header->nBuckets == 0 || (header->nBuckets & (header->nBuckets-1)) != 0 || header->nBuckets <= header->nRoutes
+    || header->routesOffset % 8 != 0 || header->routesOffset > size || (size - header->routesOffset) / sizeof(struct snapRoute) < header->nRoutes
+    || header->bucketsOffset % 4 != 0 || header->bucketsOffset > size || (size - header->bucketsOffset) / sizeof(uint32_t) < header->nBuckets) {
+    return 0;
+  }
+  const uint32_t *buckets = (const uint32_t*)(base + header->bucketsOffset);
+  // nRoutes is bounded by the file size
+  char *inBucket = calloc(header->nRoutes+1, 1);
+  if (inBucket == NULL) {
+    return 0;
+  }
+  uint32_t nUsed = 0;
+  for (uint32_t i = 0; i < header->nBuckets; i++) {
+    if (buckets[i] > header->nRoutes || (buckets[i] != 0 && inBucket[buckets[i]]++)) {
+      free(inBucket);
+      return 0;
+    }
+    nUsed += buckets[i] != 0;
+  }
+  free(inBucket);
+  if (nUsed != header->nRoutes) {
+    return 0;
+  }
+  const struct snapRoute *routes = (const struct snapRoute*)(base + header->routesOffset);
+  for (uint32_t i = 0; i < header->nRoutes; i++) {
+    const struct snapRoute *route = &routes[i];
+    if (route->method >= httpNMethods || route->statusCode > WS_MAX_STATUS_CODE || statusLine(route->statusCode) == NULL
+      || route->pathOffset >= size || route->pathSize > size - route->pathOffset || route->allowOffset >= size
+      || route->bodyOffset > size || route->bodySize > size - route->bodyOffset || route->bodySize > INT_MAX) {
+      return 0;
+    }
+    for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+      if (route->headerOffset[keepAlive] > size || route->headerSize[keepAlive] < 2 || route->headerSize[keepAlive] > size - route->headerOffset[keepAlive]) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// maps the route snapshot file (replacing a loaded one), its routes are served from the mapping
+// a replaced mapping is unmapped right away, so it's only to be called before the server is started
+// errParse if it's not a valid snapshot of this version
+void wsLoadSnapshot(webserver *wserver, const char *snapshotFile, int *err) {
+  struct stat st;
+  int fd = open(snapshotFile, O_RDONLY | O_CLOEXEC); /* Flawfinder: ignore */ // the snapshot path is developer defined
+  if (fd == -1) {
+    *err = errIO;
+    return;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct snapHeader)) {
+    close(fd);
+    *err = errParse;
+    return;
+  }
+  char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    *err = errIO;
+    return;
+  }
+  if (!snapValid(base, st.st_size)) {
+    munmap(base, st.st_size);
+    *err = errParse;
+    return;
+  }
+  if (wserver->snapshot.base != NULL) {
+    munmap(wserver->snapshot.base, wserver->snapshot.size);
+  }
+  const struct snapHeader *header = (const struct snapHeader*)base;
+  wserver->snapshot = (struct wsSnapshot){.base = base, .size = st.st_size, .header = header,
+    .routes = (const struct snapRoute*)(base + header->routesOffset), .buckets = (const uint32_t*)(base + header->bucketsOffset)};
+  *err = errOk;
+}
+
+// loads the static routes of the route config file from its snapshot, before the server is started (wsListen, wsStart)
+// the snapshot is compiled first if it's missing, older than the config or not valid (e.g. of another version)
+void wsLoadRoutes(webserver *wserver, const char *configFile, const char *snapshotFile, int *err) {
+  struct stat configStat, snapshotStat;
+  if (stat(configFile, &configStat) != 0) {
+    *err = errIO;
+    return;
+  }
+  int stale = stat(snapshotFile, &snapshotStat) != 0 || snapshotStat.st_mtim.tv_sec < configStat.st_mtim.tv_sec
+    || (snapshotStat.st_mtim.tv_sec == configStat.st_mtim.tv_sec && snapshotStat.st_mtim.tv_nsec < configStat.st_mtim.tv_nsec);
+  if (!stale) {
+    wsLoadSnapshot(wserver, snapshotFile, err);
+    if (*err != errParse) {
+      return;
+    }
+  }
+  wsCompileRoutes(configFile, snapshotFile, err);
+  if (*err != errOk) {
+    return;
+  }
+  wsLoadSnapshot(wserver, snapshotFile, err);
+}
+
+// looks up the snapshot route of path & method, HEAD falls back to GET
+// returns the route or NULL, allow is set to the Allow value of the path if it has routes (of other methods)
+const struct snapRoute *snapLookup(struct wsSnapshot *snapshot, const char *path, int method, const char **allow) {
+  int pathSize = strlen(path); /* Flawfinder: ignore */ // \0 terminated by parseHttpRequest
+  uint32_t hash = hashBytes(path, pathSize);
+  uint32_t mask = snapshot->header->nBuckets-1;
+  const struct snapRoute *getRoute = NULL;
+
+  *allow = NULL;
+  for (uint32_t bucket = hash & mask; snapshot->buckets[bucket] != 0; bucket = (bucket+1) & mask) {
+    const struct snapRoute *route = &snapshot->routes[snapshot->buckets[bucket]-1];
+    if (route->hash != hash || route->pathSize != (uint32_t)pathSize || memcmp(snapshot->base + route->pathOffset, path, pathSize) != 0) {
+      continue;
+    }
+    if ((int)route->method == method) {
+      return route;
+    }
+    if (route->method == httpGet) {
+      getRoute = route;
+    }
+    // the value was written \0 terminated, a corrupted one isn't used
+    if (memchr(snapshot->base + route->allowOffset, 0, snapshot->size - route->allowOffset) != NULL) {
+      *allow = snapshot->base + route->allowOffset;
+    }
+  }
+  return method == httpHead ? getRoute : NULL;
+}
+
+// adds a listening endpoint to the config, see wsListenerConfig for the address format
+// returns the endpoint config (e.g. to set the unix socket mode) or NULL if the max number of listeners is reached
+struct wsListenerConfig *wsConfigAddListener(struct wsConfig *config, int type, const char *address, unsigned short port, int *err) {
+  if (config->nListeners >= WS_MAX_LISTENERS) {
+    *err = errInit;
+    return NULL;
+  }
+  struct wsListenerConfig *listener = &config->listeners[config->nListeners++];
+  *listener = (struct wsListenerConfig){.type = type, .address = address, .port = port, .mode = 0, .v6Only = 0, .tls = 0};
+  *err = errOk;
+  return listener;
+}
+
+// sets the default webserver config with one tcp listener on given port (any IPv4 address)
+// further listeners are added with wsConfigAddListener, nListeners is reset to replace the default one
+void wsDefaultConfig(struct wsConfig *config, int port) {
+  int err;
+  config->nListeners = 0;
+  wsConfigAddListener(config, listenerTcp, NULL, port, &err);
+  config->tlsCertFile = NULL;
+  config->tlsKeyFile = NULL;
+  config->listenBacklog = WS_LISTEN_BACKLOG;
+  config->maxConns = WS_MAX_CONNS;
+  config->maxQueued = WS_MAX_QUEUED;
+  config->queueTargetMs = WS_QUEUE_TARGET_MS;
+  config->queueIntervalMs = WS_QUEUE_INTERVAL_MS;
+  config->retryAfterSec = WS_RETRY_AFTER_SEC;
+  config->headerTimeoutMs = WS_HEADER_TIMEOUT_MS;
+  config->bodyTimeoutMs = WS_BODY_TIMEOUT_MS;
+  config->keepAliveTimeoutMs = WS_KEEP_ALIVE_TIMEOUT_MS;
+  config->writeTimeoutMs = WS_WRITE_TIMEOUT_MS;
+  config->drainTimeoutMs = WS_DRAIN_TIMEOUT_MS;
+  config->tcpNoDelay = WS_TCP_NODELAY;
+  config->tcpCork = WS_TCP_CORK;
+  config->deferAcceptSec = WS_DEFER_ACCEPT_SEC;
+  config->fastOpenQueue = WS_FASTOPEN_QUEUE;
+  config->reuseAddr = WS_REUSE_ADDR;
+  config->sndBufSize = WS_SNDBUF_SIZE;
+  config->rcvBufSize = WS_RCVBUF_SIZE;
+  config->http2 = WS_HTTP2;
+  config->cacheSize = WS_CACHE_SIZE;
+  config->nLoops = WS_LOOPS;
+  config->driven = 0;
+  config->nBlockingThreads = WS_BLOCKING_THREADS;
+  config->blockingQueueSize = WS_BLOCKING_QUEUE;
+  config->rateLimit = WS_RATE_LIMIT;
+  config->rateBurst = WS_RATE_BURST;
+  config->traceSample = WS_TRACE_SAMPLE;
+}
+
+// sets a socket option, failures are only logged since the server works without any of them
+void wsSetSockOpt(int socket, int level, int name, int value, const char *optName) {
+  if (setsockopt(socket, level, name, &value, sizeof value) != 0) {
+    wsLog("socket option %s could not be set \n", optName);
+  }
+}
+
+// applies the tcp tuning config to the listening socket before it's bound, unix sockets only get the buffer sizes
+// buffer sizes are set on the listener since the receive window scale is negotiated before accept
+void wsTuneListener(webserver *wserver, int socket, int type) {
+  struct wsConfig *config = &wserver->config;
+  if (config->sndBufSize > 0) {
+    wsSetSockOpt(socket, SOL_SOCKET, SO_SNDBUF, config->sndBufSize, "SO_SNDBUF");
+  }
+  if (config->rcvBufSize > 0) {
+    wsSetSockOpt(socket, SOL_SOCKET, SO_RCVBUF, config->rcvBufSize, "SO_RCVBUF");
+  }
+  if (type != listenerTcp) {
+    return;
+  }
+  if (config->reuseAddr) {
+    wsSetSockOpt(socket, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+  }
+  if (config->deferAcceptSec > 0) {
+    wsSetSockOpt(socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, config->deferAcceptSec, "TCP_DEFER_ACCEPT");
+  }
+  if (config->fastOpenQueue > 0) {
+    wsSetSockOpt(socket, IPPROTO_TCP, TCP_FASTOPEN, config->fastOpenQueue, "TCP_FASTOPEN");
+  }
+}
+
+// applies the tcp tuning config to an accepted tcp connection
+void wsTuneConn(webserver *wserver, int socket) {
+  if (wserver->config.tcpNoDelay) {
+    wsSetSockOpt(socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+}
+
+// corks/ uncorks the connection around a response if configured
+// uncorking flushes the pending partial segment right away
+void connCork(webserver *wserver, struct wsConn *conn, int cork) {
+  if (wserver->config.tcpCork && conn->tcp) {
+    wsSetSockOpt(conn->socket, IPPROTO_TCP, TCP_CORK, cork, "TCP_CORK");
+  }
+}
+
+#ifdef WS_TLS
+// alpn callback, h2 is preferred (if enabled) over http/1.1
+int wsAlpnSelect(SSL *ssl, const unsigned char **out, unsigned char *outSize, const unsigned char *in, unsigned int inSize, void *arg) {
+  webserver *wserver = (webserver*)arg;
+  static const unsigned char protos[] = "\x02h2\x08http/1.1";
+  (void)ssl;
+  int skip = wserver->config.http2 ? 0 : 3;
+  if (SSL_select_next_proto((unsigned char**)out, outSize, protos+skip, sizeof(protos)-1-skip, in, inSize) != OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  return SSL_TLSEXT_ERR_OK;
+}
+
+// creates the tls context shared by all tls listeners from the configured certificate & key
+// sessions are resumable by ticket and by id through the server session cache of the context (shared by all connections)
+// records are encrypted by the kernel (kTLS) after the handshake if it's supported
+void wsTlsInit(webserver *wserver, int *err) {
+  struct wsConfig *config = &wserver->config;
+  if (config->tlsCertFile == NULL || config->tlsKeyFile == NULL) {
+    *err = errInit;
+    return;
+  }
+  wserver->tlsCtx = SSL_CTX_new(TLS_server_method());
+  if (wserver->tlsCtx == NULL) {
+    *err = errInit;
+    return;
+  }
+  SSL_CTX *ctx = wserver->tlsCtx;
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+  #ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+  #endif
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, WS_TLS_SESSION_CACHE_SIZE);
+  SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"basicWebserver", 14);
+  SSL_CTX_set_num_tickets(ctx, WS_TLS_NUM_TICKETS);
+  SSL_CTX_set_alpn_select_cb(ctx, wsAlpnSelect, wserver);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, config->tlsCertFile) != 1 || SSL_CTX_use_PrivateKey_file(ctx, config->tlsKeyFile, SSL_FILETYPE_PEM) != 1
+    || SSL_CTX_check_private_key(ctx) != 1) {
+    wsLog("tls certificate or key could not be loaded \n");
+    *err = errInit;
+    return;
+  }
+  // openssl writes to the socket without MSG_NOSIGNAL (alerts, records without kTLS)
+  signal(SIGPIPE, SIG_IGN);
+  *err = errOk;
+}
+
+// tls handshake on the accepted connection, bounded by the header timeout (the timer shuts the socket down)
+// the cpu time of the handshake is added to the tls stats
+void connTlsAccept(webserver *wserver, struct wsConn *conn, int *err) {
+  struct timespec start, end;
+  conn->ktlsSend = 0;
+  conn->ssl = SSL_new(wserver->tlsCtx);
+  if (conn->ssl == NULL || SSL_set_fd(conn->ssl, conn->socket) != 1) {
+    *err = errMemAlloc;
+    return;
+  }
+  connArmTimer(wserver, conn, wserver->config.headerTimeoutMs, 0);
+
+  int rc;
+  // only the cpu time of the calls is counted, not the one of other coroutines while the handshake is parked
+  do {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    rc = SSL_accept(conn->ssl);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    atomic_fetch_add(&wserver->tlsStats.cpuNs, (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+  } while (rc != 1 && connWaitTls(conn, SSL_get_error(conn->ssl, rc)));
+  if (rc != 1) {
+    atomic_fetch_add(&wserver->tlsStats.failed, 1);
+    *err = errNet;
+    return;
+  }
+  atomic_fetch_add(&wserver->tlsStats.handshakes, 1);
+  if (SSL_session_reused(conn->ssl)) {
+    atomic_fetch_add(&wserver->tlsStats.resumed, 1);
+  }
+  #ifdef BIO_get_ktls_send
+  conn->ktlsSend = BIO_get_ktls_send(SSL_get_wbio(conn->ssl)) == 1;
+  #endif
+  if (conn->ktlsSend) {
+    atomic_fetch_add(&wserver->tlsStats.ktls, 1);
+  }
+  *err = errOk;
+}
+
+// sends the close notify alert (without waiting for the one of the peer) and frees the tls state of the connection
+void connTlsClose(struct wsConn *conn) {
+  if (conn->ssl == NULL) {
+    return;
+  }
+  if (SSL_is_init_finished(conn->ssl)) {
+    SSL_shutdown(conn->ssl);
+  }
+  SSL_free(conn->ssl);
+  conn->ssl = NULL;
+  conn->ktlsSend = 0;
+}
+#endif
+
+// creates, binds & starts listening on the configured endpoint, the listener is added to the webserver
+void wsOpenListener(webserver *wserver, struct wsListenerConfig *config, int *err) {
+  struct sockaddr_storage addr;
+  socklen_t addrSize;
+  struct wsListener *listener = &wserver->listeners[wserver->nListeners];
+  memset(&addr, 0, sizeof addr);
+  listener->type = config->type;
+  listener->tls = config->tls;
+  listener->path[0] = 0;
+
+  if (config->type == listenerTcp) {
+    if (config->address == NULL) {
+      struct sockaddr_in *in = (struct sockaddr_in*)&addr;
+      in->sin_family = AF_INET;
+      in->sin_addr.s_addr = INADDR_ANY;
+      addrSize = sizeof *in;
+    } else {
+      struct addrinfo hints = {.ai_flags = AI_NUMERICHOST | AI_PASSIVE, .ai_socktype = SOCK_STREAM};
+      struct addrinfo *info;
+      if (getaddrinfo(config->address, NULL, &hints, &info) != 0) {
+        *err = errInit;
+        return;
+      }
+      memcpy(&addr, info->ai_addr, info->ai_addrlen); /* Flawfinder: ignore */ // sockaddr_storage fits any address
+      addrSize = info->ai_addrlen;
+      freeaddrinfo(info);
+    }
+    // the port is at the same offset for IPv4 & IPv6
+    ((struct sockaddr_in*)&addr)->sin_port = htons(config->port);
+  } else if (config->type == listenerUnix) {
+    struct sockaddr_un *un = (struct sockaddr_un*)&addr;
+    int pathSize = config->address ? strlen(config->address) : 0; /* Flawfinder: ignore */ // \0 terminated by the caller
+    if (pathSize == 0 || pathSize >= (int)sizeof(un->sun_path)) {
+      *err = errInit;
+      return;
+    }
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, config->address, pathSize); /* Flawfinder: ignore */ // bounds checked above
+    if (config->address[0] == '@') {
+      // abstract namespace, the name is not \0 terminated and leaves no file behind
+      un->sun_path[0] = 0;
+      addrSize = offsetof(struct sockaddr_un, sun_path) + pathSize;
+    } else {
+      // a stale socket of a previous run would fail the bind
+      unlink(config->address);
+      memcpy(listener->path, config->address, pathSize+1); /* Flawfinder: ignore */ // same size as sun_path
+      addrSize = sizeof *un;
+    }
+  } else {
+    *err = errInit;
+    return;
+  }
+
+  // non blocking so wsListen can accept in batches and wake up on control commands
+  if ((listener->socket = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+    *err = errNet;
+    return;
+  }
+  wserver->nListeners++;
+
+  if (addr.ss_family == AF_INET6) {
+    wsSetSockOpt(listener->socket, IPPROTO_IPV6, IPV6_V6ONLY, config->v6Only, "IPV6_V6ONLY");
+  }
+  wsTuneListener(wserver, listener->socket, config->type);
+  if (bind(listener->socket, (struct sockaddr *)&addr, addrSize) < 0) {
+    listener->path[0] = 0;
+    *err = errNet;
+    return;
+  }
+  if (listener->path[0] != 0 && config->mode != 0 && chmod(listener->path, config->mode) != 0) {
+    *err = errInit;
+    return;
+  }
+  // port 0 binds an ephemeral port
+  addrSize = sizeof addr;
+  if (config->type == listenerTcp && wserver->port == 0 && getsockname(listener->socket, (struct sockaddr *)&addr, &addrSize) == 0) {
+    wserver->port = ntohs(((struct sockaddr_in*)&addr)->sin_port);
+  }
+
+  if (listen(listener->socket, wserver->config.listenBacklog) != 0) {
+    *err = errNet;
+    return;
+  }
+  *err = errOk;
+}
+
+// takes over the listening sockets handed over by the previous process on upgrade
+// the endpoints of the previous process are kept, the listener config is not applied
+void wsTakeOverListeners(webserver *wserver, int *err) {
+  int fds[WS_MAX_LISTENERS];
+  struct sockaddr_storage addr;
+  socklen_t addrSize;
+
+  wserver->upgradeFd = atoi(getenv(WS_UPGRADE_ENV));
+  unsetenv(WS_UPGRADE_ENV);
+  fcntl(wserver->upgradeFd, F_SETFD, FD_CLOEXEC);
+
+  char tags[WS_MAX_LISTENERS];
+  int nFds = recvFds(wserver->upgradeFd, fds, tags, WS_MAX_LISTENERS, err);
+  if (*err != errOk) {
+    return;
+  }
+  for (int i = 0; i < nFds; i++) {
+    struct wsListener *listener = &wserver->listeners[wserver->nListeners++];
+    listener->socket = fds[i];
+    listener->type = listenerTcp;
+    listener->tls = tags[i] == 't';
+    listener->path[0] = 0;
+    addrSize = sizeof addr;
+    if (getsockname(fds[i], (struct sockaddr *)&addr, &addrSize) != 0) {
+      continue;
+    }
+    if (addr.ss_family == AF_UNIX) {
+      struct sockaddr_un *un = (struct sockaddr_un*)&addr;
+      listener->type = listenerUnix;
+      if (addrSize > offsetof(struct sockaddr_un, sun_path) && un->sun_path[0] != 0) {
+        memcpy(listener->path, un->sun_path, sizeof listener->path); /* Flawfinder: ignore */ // same size as sun_path
+        listener->path[sizeof listener->path - 1] = 0;
+      }
+    } else if (wserver->port == 0) {
+      wserver->port = ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    }
+  }
+  wsLog("listening sockets taken over \n");
+}
+
+// closes all listening sockets, the paths of unix sockets are unlinked unless they have been handed over
+void wsCloseListeners(webserver *wserver, int handedOver) {
+  for (int i = 0; i < wserver->nListeners; i++) {
+    if (wserver->listeners[i].socket == -1) {
+      continue;
+    }
+    close(wserver->listeners[i].socket);
+    wserver->listeners[i].socket = -1;
+    if (!handedOver && wserver->listeners[i].path[0] != 0) {
+      unlink(wserver->listeners[i].path);
+    }
+  }
+}
+
+// allocates a webserver, to be initialized with wsInit (applications embedding the server can't size the struct)
+webserver *createWs(int *err) {
+  webserver *wserver = malloc(sizeof *wserver);
+  *err = wserver != NULL ? errOk : errMemAlloc;
+  return wserver;
+}
+
+// inits the webserver struct with given config
+// pre-serializes the shed response, binds & starts listening on all configured endpoints
+void wsInit(webserver *wserver, struct wsConfig *config, int *err) {
+  wserver->config = *config;
+  wserver->port = 0;
+  wserver->nRoutes = 0;
+  wserver->routesCap = 0;
+  wserver->routes = NULL;
+  memset(&wserver->snapshot, 0, sizeof wserver->snapshot);
+  wserver->routeTree = NULL;
+  wserver->ctlPipe[0] = -1;
+  wserver->ctlPipe[1] = -1;
+  wserver->upgradeFd = -1;
+  wserver->nListeners = 0;
+#ifdef WS_TLS
+  wserver->tlsCtx = NULL;
+  memset(&wserver->tlsStats, 0, sizeof wserver->tlsStats);
+#endif
+  wserver->timersStopped = 0;
+  wserver->argv = NULL;
+  wserver->exePath = NULL;
+  wserver->cache = NULL;
+  wserver->loops = NULL;
+  wserver->nLoops = 0;
+  wserver->nextLoop = 0;
+  memset(&wserver->blocking, 0, sizeof wserver->blocking);
+  memset(&wserver->rate, 0, sizeof wserver->rate);
+  memset(&wserver->tracer, 0, sizeof wserver->tracer);
+  memset(&wserver->drive, 0, sizeof wserver->drive);
+  wserver->drive.fd = -1;
+  memset(&wserver->admission, 0, sizeof wserver->admission);
+
+  if (config->maxConns < 1 || config->maxQueued < 1 || config->queueIntervalMs < 1 || config->nListeners < 1 || config->nListeners > WS_MAX_LISTENERS
+    || config->nLoops < 0 || config->nBlockingThreads < 0 || config->blockingQueueSize < 1 || config->rateLimit < 0 || config->rateBurst < 1
+    || config->traceSample < 0) {
+    *err = errInit;
+    return;
+  }
+  // the application drives a single loop
+  if (config->driven) {
+    wserver->config.nLoops = 1;
+  }
+
+  wserver->admission.lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  wserver->admission.queue = malloc(sizeof(struct pendingConn) * config->maxQueued);
+  wserver->admission.shedResp = malloc(sizeof(char) * WS_BUFF_SIZE);
+  if (wserver->admission.queue == NULL || wserver->admission.shedResp == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  wserver->admission.shedRespSize = snprintf(wserver->admission.shedResp, WS_BUFF_SIZE, "HTTP/%s 503 Service Unavailable\r\nRetry-After: %d\r\nContent-length: 0\r\nConnection: close\r\n\r\n", HTTP_VERSION, config->retryAfterSec);
+
+  // buckets refill at least a token per second
+  for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+    wserver->rate.resp[keepAlive] = malloc(sizeof(char) * WS_BUFF_SIZE);
+    if (wserver->rate.resp[keepAlive] == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+    wserver->rate.respSize[keepAlive] = serializeHeader(429, NULL, 0, 0, keepAlive, NULL, "Retry-After: 1\r\n", sizeof("Retry-After: 1\r\n")-1, wserver->rate.resp[keepAlive], WS_BUFF_SIZE, err);
+    if (*err != errOk) {
+      return;
+    }
+  }
+
+  if (config->cacheSize > 0) {
+    wserver->cache = createCache(config->cacheSize, err);
+    if (*err != errOk) {
+      return;
+    }
+  }
+
+  if (wserver->config.nLoops > 0) {
+    wserver->loops = malloc(sizeof(struct wsLoop) * wserver->config.nLoops);
+    if (wserver->loops == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+    for (; wserver->nLoops < wserver->config.nLoops; wserver->nLoops++) {
+      loopInit(&wserver->loops[wserver->nLoops], err);
+      if (*err != errOk) {
+        return;
+      }
+    }
+    // client threads may block, so the pool is only used with loops
+    if (config->nBlockingThreads > 0) {
+      blockingInit(&wserver->blocking, config->blockingQueueSize, err);
+      if (*err != errOk) {
+        return;
+      }
+    }
+  }
+
+  wserver->mutexLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  wserver->timerLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  timerWheelInit(&wserver->timers, wsNowTicks());
+  memset(&wserver->date, 0, sizeof wserver->date);
+  wsDateUpdate(&wserver->date);
+
+  if (pipe2(wserver->ctlPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    *err = errInit;
+    return;
+  }
+
+  // started by a binary upgrade, the listening sockets are taken over from the previous process
+  if (getenv(WS_UPGRADE_ENV) != NULL) {
+    wsTakeOverListeners(wserver, err);
+    if (*err != errOk) {
+      return;
+    }
+  } else {
+    for (int i = 0; i < config->nListeners; i++) {
+      wsOpenListener(wserver, &config->listeners[i], err);
+      if (*err != errOk) {
+        return;
+      }
+    }
+  }
+
+  for (int i = 0; i < wserver->nListeners; i++) {
+    if (wserver->listeners[i].tls) {
+      #ifdef WS_TLS
+      wsTlsInit(wserver, err);
+      #else
+      // built without tls support
+      *err = errInit;
+      #endif
+      return;
+    }
+  }
+  *err = errOk;
+}
+
+// frees all allocated memory from the clientHandle thread
+void freeClientThread(void *args) {
+  struct freeClientThreadArgs *argss = (struct freeClientThreadArgs*)args;
+  free(argss->readBuff);
+  free(argss->respBuff);
+  free(argss->conn->hdrBuff);
+  free(argss->conn->bodyBuff);
+  free(argss->conn->arena.buff);
+
+  free(argss->httpReq->requestUri);
+  free(argss->httpReq);
+#ifdef WS_TLS
+  connTlsClose(argss->conn);
+#endif
+
+  free(argss->clientHandleArgs);
+}
+
+// returns 1 if a persistent connection should be closed after the current request
+// since connections are waiting in the admission queue or the server is draining
+int admissionYield(webserver *wserver) {
+  pthread_mutex_lock(&wserver->admission.lock);
+  int yield = wserver->admission.nQueued > 0 || wserver->admission.draining;
+  pthread_mutex_unlock(&wserver->admission.lock);
+  return yield;
+}
+
+// consumes the served request (header & read body) from the connection read buffer, pipelined data is moved to the buffer start
+// returns 1 if the connection is persistent
+int serveClientDone(struct wsConn *conn, struct httpRequest *httpReq) {
+  int consumed = httpReq->body.pos;
+  conn->readBuffSize -= consumed;
+  memmove(conn->readBuff, conn->readBuff+consumed, conn->readBuffSize);
+
+  return httpReq->keepAlive;
+}
+
+// sends the response built by the response builder (status line & header fields gathered with the body)
+void sendBuiltResp(webserver *wserver, struct wsConn *conn, struct httpRequest *httpReq, struct respBuilder *rb, int *err) {
+  connArmTimer(wserver, conn, wserver->config.writeTimeoutMs, 0);
+  int respSize = respFinish(rb, httpReq->keepAlive, wsDateGet(&wserver->date), conn->respBuff, WS_BUFF_SIZE, err);
+  if (*err != errOk) {
+    return;
+  }
+  struct iovec iov[2] = {{.iov_base = conn->respBuff, .iov_len = respSize}, {.iov_base = conn->bodyBuff, .iov_len = rb->bodySize}};
+  // HEAD responses carry the header fields (content-length included) of the GET response only
+  connCork(wserver, conn, 1);
+  connSendBuffers(conn, iov, rb->bodySize > 0 && httpReq->reqMethod != httpHead ? 2 : 1, err);
+  connCork(wserver, conn, 0);
+  traceStage(wserver, conn, spanSend);
+}
+
+// sends a response serialized beforehand (static & snapshot routes, cache entries), header is indexed by keepAlive & ends with the empty line
+// the cached Date field (incl. the empty line) replaces the empty line, the body is sent from where it's stored
+void sendStaticResp(webserver *wserver, struct wsConn *conn, struct httpRequest *httpReq, char **header, const int *headerSize, const char *body, int bodySize, int *err) {
+  struct iovec iov[3] = {{.iov_base = header[httpReq->keepAlive], .iov_len = headerSize[httpReq->keepAlive]-2},
+    {.iov_base = (char*)wsDateGet(&wserver->date), .iov_len = WS_DATE_HDR_SIZE+2}, {.iov_base = (char*)body, .iov_len = bodySize}};
+  connArmTimer(wserver, conn, wserver->config.writeTimeoutMs, 0);
+  connCork(wserver, conn, 1);
+  connSendBuffers(conn, iov, bodySize > 0 && httpReq->reqMethod != httpHead ? 3 : 2, err);
+  connCork(wserver, conn, 0);
+  traceStage(wserver, conn, spanSend);
+}
+
+// builds an error response with the reason phrase of the status line as body
+void respError(struct respBuilder *rb, struct wsConn *conn, int statusCode) {
+  const struct wsStatusLine *status = statusLine(statusCode);
+  respInit(rb, conn);
+  respSetStatus(rb, statusCode);
+  // the reason phrase follows "HTTP/x.x nnn " and is followed by CRLF
+  int phraseOffset = sizeof("HTTP/" HTTP_VERSION " 200 ")-1;
+  respAppendBody(rb, status->line+phraseOffset, status->size-phraseOffset-2);
+}
+
+// sends an error response with the reason phrase of the status line as body
+void sendErrorResp(webserver *wserver, struct wsConn *conn, struct httpRequest *httpReq, int statusCode, int *err) {
+  struct respBuilder rb;
+  respError(&rb, conn, statusCode);
+  sendBuiltResp(wserver, conn, httpReq, &rb, err);
+}
+
+// builds the response to a request without route, node is the node matching the path with any method (see routeLookup)
+// 404 if there is none, otherwise 204 for OPTIONS & 405 for other methods with the methods of the path in Allow
+void respNoRoute(struct respBuilder *rb, struct wsConn *conn, struct httpRequest *httpReq, struct routeNode *node) {
+  respInit(rb, conn);
+  if (node == NULL) {
+    wsLog("page not found \n");
+    respSetStatus(rb, 404);
+    respAppendBody(rb, "404 page not found", 18);
+  } else if (httpReq->reqMethod == httpOptions) {
+    respSetStatus(rb, 204);
+    respAddHeader(rb, "Allow", node->allow);
+  } else {
+    respSetStatus(rb, 405);
+    respAddHeader(rb, "Allow", node->allow);
+    respAppendBody(rb, "405 method not allowed", 22);
+  }
+}
+
+// calls the handler of route, the response is replaced by 413/400 if reading the body failed and by 500 if building it failed
+// handlers of blocking routes called by a coroutine run on the blocking pool, 503 if its queue is full
+void respRunHandler(webserver *wserver, struct httpRoute *route, struct wsConn *conn, struct httpRequest *httpReq, struct respBuilder *rb) {
+  respInit(rb, conn);
+  if (route->blocking && wserver->blocking.nThreads > 0 && coCurrent() != NULL) {
+    if (!blockingRun(&wserver->blocking, route, httpReq, rb)) {
+      char retryAfter[16];
+      snprintf(retryAfter, sizeof retryAfter, "%d", wserver->config.retryAfterSec);
+      respError(rb, conn, 503);
+      respAddHeader(rb, "Retry-After", retryAfter);
+      return;
+    }
+  } else {
+    route->handler(httpReq, rb, route->handlerCtx);
+  }
+  if (httpReq->body.err != errOk) {
+    printErr(httpReq->body.err);
+    respInit(rb, conn);
+    if (httpReq->body.err == errSecCheck) {
+      respSetStatus(rb, 413);
+    } else {
+      respSetStatus(rb, 400);
+    }
+  } else if (rb->err != errOk) {
+    printErr(rb->err);
+    respInit(rb, conn);
+    respSetStatus(rb, 500);
+  }
+}
+
+// decodes base64url (RFC 4648 section 5, without padding) src into dst
+// returns the decoded size or -1 if src is invalid or exceeds dstSize
+int base64UrlDecode(const char *src, int size, uint8_t *dst, int dstSize) {
+  uint32_t bits = 0;
+  int nBits = 0, decoded = 0;
+  for (int i = 0; i < size; i++) {
+    char c = src[i];
+    int v;
+    if (c >= 'A' && c <= 'Z') {
+      v = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      v = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      v = c - '0' + 52;
+    } else if (c == '-') {
+      v = 62;
+    } else if (c == '_') {
+      v = 63;
+    } else if (c == '=') {
+      break;
+    } else {
+      return -1;
+    }
+    bits = bits << 6 | v;
+    nBits += 6;
+    if (nBits >= 8) {
+      nBits -= 8;
+      if (decoded >= dstSize) {
+        return -1;
+      }
+      dst[decoded++] = bits >> nBits;
+    }
+  }
+  return decoded;
+}
+
+// returns the big endian 32 bit value at p
+uint32_t h2Uint32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// writes v big endian to p
+void h2PutUint32(char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// writes a frame header (payload length, type, flags & stream id) to out
+void h2FrameHeader(char *out, int length, int type, int flags, uint32_t streamId) {
+  out[0] = length >> 16;
+  out[1] = length >> 8;
+  out[2] = length;
+  out[3] = type;
+  out[4] = flags;
+  h2PutUint32(out+5, streamId & 0x7fffffff);
+}
+
+// writes the batched frames to the connection
+void h2Write(struct h2Session *sess) {
+  int err = errOk;
+  if (sess->iovCnt > 0 && !sess->writeFailed) {
+    connArmTimer(sess->wserver, sess->conn, sess->wserver->config.writeTimeoutMs, 0);
+    connSendBuffers(sess->conn, sess->iov, sess->iovCnt, &err);
+    if (err != errOk) {
+      printErr(err);
+      sess->writeFailed = 1;
+      sess->closing = 1;
+    }
+  }
+  sess->iovCnt = 0;
+  sess->outSize = 0;
+}
+
+// reserves size bytes (at most WS_H2_OUT_SIZE) of the batch buffer, the batch is written first if it's full
+// returns the reserved memory which is appended to the batch by h2Commit
+char *h2Reserve(struct h2Session *sess, int size) {
+  if (sess->outSize + size > WS_H2_OUT_SIZE || sess->iovCnt >= WS_H2_MAX_IOV-2) {
+    h2Write(sess);
+  }
+  return sess->out + sess->outSize;
+}
+
+// appends size bytes of the reserved memory to the batch
+void h2Commit(struct h2Session *sess, int size) {
+  char *data = sess->out + sess->outSize;
+  if (sess->iovCnt > 0 && (char*)sess->iov[sess->iovCnt-1].iov_base + sess->iov[sess->iovCnt-1].iov_len == data) {
+    sess->iov[sess->iovCnt-1].iov_len += size;
+  } else {
+    sess->iov[sess->iovCnt++] = (struct iovec){.iov_base = data, .iov_len = size};
+  }
+  sess->outSize += size;
+}
+
+// appends a reference to data to the batch, data must stay valid until the batch is written
+void h2AppendRef(struct h2Session *sess, const char *data, int size) {
+  if (sess->iovCnt >= WS_H2_MAX_IOV) {
+    h2Write(sess);
+  }
+  sess->iov[sess->iovCnt++] = (struct iovec){.iov_base = (char*)data, .iov_len = size};
+}
+
+// appends a frame with size bytes of payload (at most WS_H2_OUT_SIZE-H2_FRAME_HEADER_SIZE) to the batch
+void h2QueueFrame(struct h2Session *sess, int type, int flags, uint32_t streamId, const char *payload, int size) {
+  char *out = h2Reserve(sess, H2_FRAME_HEADER_SIZE+size);
+  h2FrameHeader(out, size, type, flags, streamId);
+  if (size > 0) {
+    memcpy(out+H2_FRAME_HEADER_SIZE, payload, size); /* Flawfinder: ignore */ // reserved above
+  }
+  h2Commit(sess, H2_FRAME_HEADER_SIZE+size);
+}
+
+// appends a frame with a 32 bit payload (RST_STREAM error code/ WINDOW_UPDATE increment) to the batch
+void h2QueueUint32Frame(struct h2Session *sess, int type, uint32_t streamId, uint32_t value) {
+  char payload[4];
+  h2PutUint32(payload, value);
+  h2QueueFrame(sess, type, 0, streamId, payload, 4);
+}
+
+// connection error, a GOAWAY with the last processed stream is sent & the connection is closed after the batch is written
+void h2ConnError(struct h2Session *sess, int code) {
+  char payload[8];
+  h2PutUint32(payload, sess->lastStreamId);
+  h2PutUint32(payload+4, code);
+  h2QueueFrame(sess, h2Goaway, 0, 0, payload, 8);
+  sess->goawaySent = 1;
+  sess->closing = 1;
+}
+
+// returns the open stream with id or NULL if there is none (idle or closed)
+struct h2Stream *h2FindStream(struct h2Session *sess, uint32_t id) {
+  for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+    if (sess->streams[i].state != h2StreamIdle && sess->streams[i].id == id) {
+      return &sess->streams[i];
+    }
+  }
+  return NULL;
+}
+
+// opens a new stream
+// returns NULL if the max number of concurrent streams is reached
+struct h2Stream *h2NewStream(struct h2Session *sess, uint32_t id) {
+  for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+    struct h2Stream *stream = &sess->streams[i];
+    if (stream->state == h2StreamIdle) {
+      memset(stream, 0, sizeof *stream);
+      stream->id = id;
+      stream->state = h2StreamOpen;
+      stream->sendWindow = sess->peerInitialWindow;
+      stream->recvWindow = WS_H2_WINDOW_SIZE;
+      sess->nStreams++;
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+// closes the stream & frees its buffers
+void h2FreeStream(struct h2Session *sess, struct h2Stream *stream) {
+  // the batch may still reference the response body owned by the stream
+  if (stream->ownedData != NULL) {
+    h2Write(sess);
+  }
+  free(stream->header);
+  free(stream->body);
+  free(stream->ownedData);
+  memset(stream, 0, sizeof *stream);
+  stream->state = h2StreamIdle;
+  sess->nStreams--;
+}
+
+// stream error, the stream is reset with code & closed
+void h2ResetStream(struct h2Session *sess, struct h2Stream *stream, int code) {
+  h2QueueUint32Frame(sess, h2RstStream, stream->id, code);
+  h2FreeStream(sess, stream);
+}
+
+// the response of the stream is completely batched, the stream is closed
+// a stream whose request isn't complete yet (answered early) is reset with NO_ERROR, the rest of the request body is discarded
+void h2StreamSent(struct h2Session *sess, struct h2Stream *stream) {
+  if (stream->state == h2StreamOpen) {
+    h2QueueUint32Frame(sess, h2RstStream, stream->id, h2NoError);
+  }
+  h2FreeStream(sess, stream);
+}
+
+// batches DATA frames of the pending response bodies as far as the flow control windows allow & writes the batch
+// streams get one frame per round, so concurrent responses are interleaved
+void h2Flush(struct h2Session *sess) {
+  int progress = 1;
+  while (progress && sess->sendWindow > 0 && !sess->closing) {
+    progress = 0;
+    for (int i = 0; i < WS_H2_MAX_STREAMS && sess->sendWindow > 0; i++) {
+      struct h2Stream *stream = &sess->streams[i];
+      if (stream->state == h2StreamIdle || stream->data == NULL || stream->sendWindow <= 0) {
+        continue;
+      }
+      int64_t size = stream->dataSize - stream->dataSent;
+      size = size < stream->sendWindow ? size : stream->sendWindow;
+      size = size < sess->sendWindow ? size : sess->sendWindow;
+      size = size < sess->peerMaxFrameSize ? size : sess->peerMaxFrameSize;
+      int last = stream->dataSent + size == stream->dataSize;
+
+      char *out = h2Reserve(sess, H2_FRAME_HEADER_SIZE);
+      h2FrameHeader(out, size, h2Data, last ? H2_END_STREAM : 0, stream->id);
+      h2Commit(sess, H2_FRAME_HEADER_SIZE);
+      h2AppendRef(sess, stream->data+stream->dataSent, size);
+      stream->dataSent += size;
+      stream->sendWindow -= size;
+      sess->sendWindow -= size;
+      progress = 1;
+      if (last) {
+        h2StreamSent(sess, stream);
+      }
+    }
+  }
+  h2Write(sess);
+}
+
+// encodes the response header fields (status, content type & length if given, the cached Date & the handler fields in http/1.1 form) into a header block
+// & batches it as HEADERS frame (split into CONTINUATION frames beyond the max frame size of the peer)
+void h2QueueHeaders(struct h2Session *sess, struct h2Stream *stream, int statusCode, const char *contentType, int contentTypeSize, long long contentLength, const char *hdr, int hdrSize, int endStream) {
+  struct hpackTable *encoder = &sess->encoder;
+  uint8_t *block = (uint8_t*)sess->respBlock;
+  char digits[20], name[WS_BUFF_SIZE];
+  int size = 0;
+
+  if (sess->encoderSizeUpdate) {
+    size += hpackEncodeInt(block, encoder->maxSize, 5, 0x20);
+    sess->encoderSizeUpdate = 0;
+  }
+  size += hpackEncodeField(encoder, block+size, ":status", 7, digits, uintToDec(digits, statusCode), 1);
+  if (contentType != NULL) {
+    size += hpackEncodeField(encoder, block+size, "content-type", 12, contentType, contentTypeSize, 1);
+  }
+  if (contentLength >= 0) {
+    size += hpackEncodeField(encoder, block+size, "content-length", 14, digits, uintToDec(digits, contentLength), 0);
+  }
+  // "Date: " + IMF-fixdate + CRLF
+  size += hpackEncodeField(encoder, block+size, "date", 4, wsDateGet(&sess->wserver->date)+6, WS_DATE_HDR_SIZE-8, 1);
+
+  // "Name: value\r\n" lines of respAddHeader, names are lowercase in http/2
+  int pos = 0;
+  while (pos < hdrSize) {
+    const char *line = hdr+pos;
+    const char *lineEnd = memchr(line, LF, hdrSize-pos);
+    const char *colon = memchr(line, ':', lineEnd-line);
+    pos = lineEnd - hdr + 1;
+    int nameSize = colon != NULL ? colon - line : 0;
+    // fields beyond the block buffer (only reachable with many tiny fields) are dropped
+    if (colon == NULL || size + (lineEnd - line) + 12 > (int)sizeof sess->respBlock) {
+      continue;
+    }
+    for (int i = 0; i < nameSize; i++) {
+      name[i] = tolower((unsigned char)line[i]);
+    }
+    // connection specific fields are not allowed
+    if ((nameSize == 10 && memcmp(name, "connection", 10) == 0) || (nameSize == 10 && memcmp(name, "keep-alive", 10) == 0)
+      || (nameSize == 17 && memcmp(name, "transfer-encoding", 17) == 0) || (nameSize == 7 && memcmp(name, "upgrade", 7) == 0)) {
+      continue;
+    }
+    size += hpackEncodeField(encoder, block+size, name, nameSize, colon+2, lineEnd-colon-3, 1);
+  }
+
+  int maxFrame = sess->peerMaxFrameSize < WS_H2_OUT_SIZE-H2_FRAME_HEADER_SIZE ? sess->peerMaxFrameSize : WS_H2_OUT_SIZE-H2_FRAME_HEADER_SIZE;
+  int type = h2Headers;
+  int sent = 0;
+  while (type == h2Headers || sent < size) {
+    int chunk = size-sent < maxFrame ? size-sent : maxFrame;
+    int flags = (sent+chunk == size ? H2_END_HEADERS : 0) | (type == h2Headers && endStream ? H2_END_STREAM : 0);
+    h2QueueFrame(sess, type, flags, stream->id, (char*)block+sent, chunk);
+    sent += chunk;
+    type = h2Continuation;
+  }
+}
+
+// batches the response built by the response builder
+// the body is referenced from the connection body buffer, which the stream takes over if the body can't be sent completely right away
+void h2RespondBuilt(struct h2Session *sess, struct h2Stream *stream, struct respBuilder *rb, int head) {
+  struct wsConn *conn = sess->conn;
+  // the value of the "Content-type: " fragment without CRLF
+  int valueOffset = sizeof("Content-type: ")-1;
+  const char *contentType = rb->hasContentType ? NULL : wsHdrContentTypeHtml+valueOffset;
+  int contentTypeSize = sizeof(wsHdrContentTypeHtml)-1-valueOffset-2;
+  // 204 responses must not carry content header fields
+  int noContent = rb->statusCode == 204;
+  int hasData = !head && !noContent && rb->bodySize > 0;
+
+  h2QueueHeaders(sess, stream, rb->statusCode, noContent ? NULL : contentType, contentTypeSize, noContent ? -1 : rb->bodySize, conn->hdrBuff, rb->hdrSize, !hasData);
+  if (!hasData) {
+    h2StreamSent(sess, stream);
+    return;
+  }
+  stream->data = conn->bodyBuff;
+  stream->dataSize = rb->bodySize;
+  stream->dataSent = 0;
+  h2Flush(sess);
+  // the connection body buffer is reused by the next handler
+  if (stream->state != h2StreamIdle && stream->data == conn->bodyBuff) {
+    stream->ownedData = conn->bodyBuff;
+    conn->bodyBuff = NULL;
+    conn->bodyBuffSize = 0;
+  }
+}
+
+// batches the response of a static route, the body is referenced from the route
+void h2RespondStatic(struct h2Session *sess, struct h2Stream *stream, struct httpResponse *resp, int head) {
+  int valueOffset = sizeof("Content-type: ")-1;
+  int hasData = !head && resp->contentSize > 0;
+  h2QueueHeaders(sess, stream, resp->statusCode, wsHdrContentTypeStatic+valueOffset, sizeof(wsHdrContentTypeStatic)-1-valueOffset-2, resp->contentSize, NULL, 0, !hasData);
+  if (!hasData) {
+    h2StreamSent(sess, stream);
+    return;
+  }
+  stream->data = resp->contentBuff;
+  stream->dataSize = resp->contentSize;
+  stream->dataSent = 0;
+}
+
+// batches an error response with the reason phrase of the status line as body
+void h2RespondError(struct h2Session *sess, struct h2Stream *stream, int statusCode) {
+  struct respBuilder rb;
+  respError(&rb, sess->conn, statusCode);
+  h2RespondBuilt(sess, stream, &rb, 0);
+}
+
+// routes the request of the stream, its header is in http/1.1 form (\0 terminated)
+// handler routes are called once the request is complete (the body is buffered until then), all other requests are answered right away
+void h2Request(struct h2Session *sess, struct h2Stream *stream, char *header, int headerSize) {
+  struct httpRequest *req = sess->req;
+  struct wsConn *conn = sess->conn;
+  struct routeNode *node = NULL;
+  struct respBuilder rb;
+  int err = errOk;
+  int valueSize;
+
+  req->requestUri = NULL;
+  parseHttpRequest(req, header, headerSize, &err);
+  if (err != errOk || req->requestUri == NULL) {
+    printErr(err != errOk ? err : errParse);
+    free(req->requestUri);
+    req->requestUri = NULL;
+    h2ResetStream(sess, stream, h2InternalError);
+    return;
+  }
+  req->keepAlive = 1;
+  req->header = header;
+  req->headerSize = headerSize;
+  req->arena = &conn->arena;
+  req->formParams.parsed = 0;
+  conn->arena.used = 0;
+  memset(&req->body, 0, sizeof req->body);
+  req->body.state = bodyNone;
+
+  pthread_mutex_lock(&sess->wserver->mutexLock);
+  struct httpRoute *route = routeLookup(sess->wserver->routeTree, req->requestUri, req->reqMethod, req, &node);
+  pthread_mutex_unlock(&sess->wserver->mutexLock);
+  if (routeHidden(route, conn)) {
+    route = NULL;
+    node = NULL;
+  }
+  int head = req->reqMethod == httpHead;
+
+  // limited clients are answered before the body (if any) is received, which is discarded
+  // requests with body are routed again once complete (with the buffered header), they took their token already
+  if (sess->wserver->rate.slots != NULL && header != stream->header && rateLimited(sess->wserver, conn, route)) {
+    stream->discard = stream->state == h2StreamOpen;
+    free(req->requestUri);
+    req->requestUri = NULL;
+    respError(&rb, conn, 429);
+    respAddHeader(&rb, "Retry-After", "1");
+    h2RespondBuilt(sess, stream, &rb, head);
+    return;
+  }
+
+  if (route != NULL && route->handler != NULL && stream->state == h2StreamOpen) {
+    // the body is buffered until the request is complete
+    stream->bodyLimit = route->maxBodySize < WS_H2_MAX_BODY_SIZE ? route->maxBodySize : WS_H2_MAX_BODY_SIZE;
+    char *value = getHeader(header, headerSize, "content-length", &valueSize);
+    long long contentLength = 0;
+    for (int i = 0; value != NULL && i < valueSize && i < 18 && value[i] >= '0' && value[i] <= '9'; i++) {
+      contentLength = contentLength * 10 + (value[i] - '0');
+    }
+    free(req->requestUri);
+    req->requestUri = NULL;
+    if (contentLength > stream->bodyLimit) {
+      stream->discard = 1;
+      h2RespondError(sess, stream, 413);
+      return;
+    }
+    stream->header = malloc(headerSize+1);
+    if (stream->header == NULL) {
+      printErr(errMemAlloc);
+      h2ResetStream(sess, stream, h2InternalError);
+      return;
+    }
+    memcpy(stream->header, header, headerSize+1); /* Flawfinder: ignore */ // allocated above
+    stream->headerSize = headerSize;
+    return;
+  }
+  // answered before the body (if any) is received, which is discarded
+  stream->discard = stream->state == h2StreamOpen;
+
+  struct routeNode allowNode;
+  const struct snapRoute *snapRoute = NULL;
+  if (route == NULL && sess->wserver->snapshot.base != NULL) {
+    const char *allow;
+    snapRoute = snapLookup(&sess->wserver->snapshot, req->requestUri, req->reqMethod, &allow);
+    if (node == NULL && allow != NULL) {
+      allowNode.allow = (char*)allow;
+      node = &allowNode;
+    }
+  }
+
+#ifdef WS_ASSETS
+  const struct wsAsset *asset = route == NULL && snapRoute == NULL && node == NULL ? assetLookup(req->requestUri) : NULL;
+  if (asset != NULL && req->reqMethod != httpGet && !head) {
+    allowNode.allow = "GET, HEAD, OPTIONS";
+    node = &allowNode;
+    asset = NULL;
+  }
+  if (asset != NULL) {
+    const struct wsAssetVariant *variant = assetVariant(asset, header, headerSize);
+    int hasData = !head && variant->bodySize > 0;
+    int notModified = variant->statusCode == 304;
+    h2QueueHeaders(sess, stream, variant->statusCode, notModified ? NULL : asset->contentType, asset->contentTypeSize, notModified ? -1 : variant->bodySize,
+      variant->fields, variant->fieldsSize, !hasData);
+    if (!hasData) {
+      h2StreamSent(sess, stream);
+    } else {
+      stream->data = (char*)variant->body;
+      stream->dataSize = variant->bodySize;
+      stream->dataSent = 0;
+    }
+    free(req->requestUri);
+    req->requestUri = NULL;
+    return;
+  }
+#endif
+  if (snapRoute != NULL) {
+    // the body is referenced by the stream, the snapshot stays mapped while the server runs
+    struct httpResponse resp = {.statusCode = snapRoute->statusCode, .contentSize = snapRoute->bodySize, .contentBuff = sess->wserver->snapshot.base + snapRoute->bodyOffset};
+    h2RespondStatic(sess, stream, &resp, head);
+  } else if (route == NULL) {
+    respNoRoute(&rb, conn, req, node);
+    h2RespondBuilt(sess, stream, &rb, head);
+  } else if (route->handler == NULL) {
+    h2RespondStatic(sess, stream, route->httpResp, head);
+  } else {
+    if (stream->bodySize > 0) {
+      // the buffered body is consumed by the body reader as data staged on a view of the connection
+      sess->bodyView = (struct wsConn){.readBuff = stream->body, .readBuffSize = stream->bodySize};
+      req->body = (struct bodyReader){.wserver = sess->wserver, .conn = &sess->bodyView, .state = bodyData, .remaining = stream->bodySize,
+        .limit = route->maxBodySize, .started = 1};
+    }
+    respRunHandler(sess->wserver, route, conn, req, &rb);
+    h2RespondBuilt(sess, stream, &rb, head);
+  }
+  free(req->requestUri);
+  req->requestUri = NULL;
+}
+
+// the request of the stream is complete (END_STREAM received), requests with body are routed now
+void h2RequestComplete(struct h2Session *sess, struct h2Stream *stream) {
+  stream->state = h2StreamHalfClosed;
+  if (!stream->discard) {
+    h2Request(sess, stream, stream->header, stream->headerSize);
+  }
+}
+
+// returns 1 if the header field name is valid in a request (lowercase token, pseudo-header fields start with ':')
+int h2ValidName(struct wsSlice *name) {
+  if (name->size == 0) {
+    return 0;
+  }
+  for (int i = name->data[0] == ':'; i < name->size; i++) {
+    unsigned char c = name->data[i];
+    if (c <= SP || c >= 0x7f || (c >= 'A' && c <= 'Z') || c == ':') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// decodes the header block of a new request into the http/1.1 form (reqHeader), the request line is built from the pseudo-header fields
+// and :authority becomes the Host field, the block is always decoded completely to keep the hpack state in sync
+// returns the header size, 0 if the request is malformed & -1 if it exceeds WS_BUFF_SIZE, err is set on a compression error
+int h2DecodeRequest(struct h2Session *sess, const uint8_t *block, int size, int *err) {
+  struct wsSlice name, value;
+  // pseudo-header values (method, path, authority) are kept in pseudo until the request line is built
+  char pseudo[WS_BUFF_SIZE];
+  struct wsSlice method = {0}, path = {0}, authority = {0};
+  int pseudoSize = 0, hasScheme = 0, regular = 0, malformed = 0, tooLarge = 0, nFields = 0;
+  char *out = sess->reqHeader;
+  int outSize = 0;
+
+  int pos = 0;
+  while (pos < size) {
+    int isField = hpackDecodeField(&sess->decoder, block, size, &pos, nFields == 0, sess->field, &name, &value, err);
+    if (*err != errOk) {
+      return 0;
+    }
+    if (!isField) {
+      continue;
+    }
+    nFields++;
+    if (!h2ValidName(&name) || memchr(value.data, 0, value.size) || memchr(value.data, CR, value.size) || memchr(value.data, LF, value.size)) {
+      malformed = 1;
+      continue;
+    }
+    if (name.data[0] == ':') {
+      struct wsSlice *target = NULL;
+      if (name.size == 7 && memcmp(name.data, ":method", 7) == 0) {
+        target = &method;
+      } else if (name.size == 5 && memcmp(name.data, ":path", 5) == 0) {
+        target = &path;
+      } else if (name.size == 10 && memcmp(name.data, ":authority", 10) == 0) {
+        target = &authority;
+      } else if (name.size == 7 && memcmp(name.data, ":scheme", 7) == 0 && !hasScheme) {
+        hasScheme = 1;
+        continue;
+      }
+      // unknown, repeated or after regular fields
+      if (target == NULL || target->data != NULL || regular) {
+        malformed = 1;
+        continue;
+      }
+      if (pseudoSize + value.size > WS_BUFF_SIZE) {
+        tooLarge = 1;
+        continue;
+      }
+      memcpy(pseudo+pseudoSize, value.data, value.size); /* Flawfinder: ignore */ // bounds checked above
+      *target = (struct wsSlice){.data = pseudo+pseudoSize, .size = value.size};
+      pseudoSize += value.size;
+      continue;
+    }
+    regular = 1;
+    // connection specific fields are not allowed, te only with trailers
+    if ((name.size == 10 && (memcmp(name.data, "connection", 10) == 0 || memcmp(name.data, "keep-alive", 10) == 0))
+      || (name.size == 16 && memcmp(name.data, "proxy-connection", 16) == 0) || (name.size == 17 && memcmp(name.data, "transfer-encoding", 17) == 0)
+      || (name.size == 7 && memcmp(name.data, "upgrade", 7) == 0) || (name.size == 2 && memcmp(name.data, "te", 2) == 0 && (value.size != 8 || memcmp(value.data, "trailers", 8) != 0))) {
+      malformed = 1;
+      continue;
+    }
+    // name: value\r\n
+    if (outSize + name.size + value.size + 4 > WS_BUFF_SIZE) {
+      tooLarge = 1;
+      continue;
+    }
+    memcpy(out+outSize, name.data, name.size); /* Flawfinder: ignore */ // bounds checked above
+    outSize += name.size;
+    out[outSize++] = ':';
+    out[outSize++] = SP;
+    memcpy(out+outSize, value.data, value.size); /* Flawfinder: ignore */ // bounds checked above
+    outSize += value.size;
+    out[outSize++] = CR;
+    out[outSize++] = LF;
+  }
+  *err = errOk;
+
+  // the request line must be parseable (no spaces or controls in method & path)
+  if (malformed || method.data == NULL || path.data == NULL || !hasScheme || path.size == 0 || (path.data[0] != '/' && !(path.size == 1 && path.data[0] == '*'))) {
+    return 0;
+  }
+  for (int i = 0; i < method.size + path.size; i++) {
+    unsigned char c = i < method.size ? method.data[i] : path.data[i-method.size];
+    if (c <= SP || c == 0x7f) {
+      return 0;
+    }
+  }
+  // request line "METHOD path HTTP/2.0\r\n", host field & empty line
+  int lineSize = method.size + path.size + sizeof(" ") + sizeof(" HTTP/2.0\r\n")-2;
+  int hostSize = authority.data != NULL ? authority.size + sizeof("host: \r\n")-1 : 0;
+  if (tooLarge || lineSize + hostSize + outSize + 2 > WS_BUFF_SIZE) {
+    return -1;
+  }
+  memmove(out+lineSize+hostSize, out, outSize);
+  int n = 0;
+  memcpy(out, method.data, method.size); /* Flawfinder: ignore */ // bounds checked above
+  n += method.size;
+  out[n++] = SP;
+  memcpy(out+n, path.data, path.size); /* Flawfinder: ignore */ // bounds checked above
+  n += path.size;
+  memcpy(out+n, " HTTP/2.0\r\n", sizeof(" HTTP/2.0\r\n")-1); /* Flawfinder: ignore */ // bounds checked above
+  n += sizeof(" HTTP/2.0\r\n")-1;
+  if (authority.data != NULL) {
+    memcpy(out+n, "host: ", 6); /* Flawfinder: ignore */ // bounds checked above
+    memcpy(out+n+6, authority.data, authority.size); /* Flawfinder: ignore */ // bounds checked above
+    n += 6 + authority.size;
+    out[n++] = CR;
+    out[n++] = LF;
+  }
+  n += outSize;
+  out[n++] = CR;
+  out[n++] = LF;
+  out[n] = 0;
+  return n;
+}
+
+// processes a complete header block of stream id, either the request header of a new stream or trailers
+void h2OnHeaderBlock(struct h2Session *sess, uint32_t id, int flags, const uint8_t *block, int size) {
+  int err = errOk;
+  struct h2Stream *stream = h2FindStream(sess, id);
+
+  if (stream != NULL || id <= sess->lastStreamId) {
+    // trailer fields are decoded (for the hpack state) & discarded, they must end the stream
+    struct wsSlice name, value;
+    int pos = 0, nFields = 0;
+    while (pos < size) {
+      nFields += hpackDecodeField(&sess->decoder, block, size, &pos, nFields == 0, sess->field, &name, &value, &err);
+      if (err != errOk) {
+        h2ConnError(sess, h2CompressionError);
+        return;
+      }
+    }
+    if (stream == NULL) {
+      h2ConnError(sess, h2StreamClosed);
+    } else if (stream->state != h2StreamOpen) {
+      h2ResetStream(sess, stream, h2StreamClosed);
+    } else if (!(flags & H2_END_STREAM)) {
+      h2ResetStream(sess, stream, h2ProtocolError);
+    } else {
+      h2RequestComplete(sess, stream);
+    }
+    return;
+  }
+  // client initiated streams are odd & increasing
+  if (id % 2 == 0) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  sess->lastStreamId = id;
+
+  int headerSize = h2DecodeRequest(sess, block, size, &err);
+  if (err != errOk) {
+    h2ConnError(sess, h2CompressionError);
+    return;
+  }
+  // streams initiated after the GOAWAY are ignored
+  if (sess->goawaySent) {
+    return;
+  }
+  stream = h2NewStream(sess, id);
+  if (stream == NULL) {
+    h2QueueUint32Frame(sess, h2RstStream, id, h2RefusedStream);
+    return;
+  }
+  if (headerSize == 0) {
+    h2ResetStream(sess, stream, h2ProtocolError);
+    return;
+  }
+  if (flags & H2_END_STREAM) {
+    stream->state = h2StreamHalfClosed;
+  }
+  if (headerSize < 0) {
+    stream->discard = stream->state == h2StreamOpen;
+    h2RespondError(sess, stream, 431);
+    return;
+  }
+  h2Request(sess, stream, sess->reqHeader, headerSize);
+}
+
+// processes a HEADERS frame, the header block is accumulated if it's continued by CONTINUATION frames
+void h2OnHeaders(struct h2Session *sess, uint32_t id, int flags, const uint8_t *payload, int length) {
+  int pos = 0, pad = 0;
+  if (id == 0) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  if (flags & H2_PADDED) {
+    if (length < 1) {
+      h2ConnError(sess, h2FrameSizeError);
+      return;
+    }
+    pad = payload[0];
+    pos = 1;
+  }
+  // the priority (stream dependency & weight) is ignored
+  if (flags & H2_PRIORITY) {
+    pos += 5;
+  }
+  if (pos + pad > length) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  if (!(flags & H2_END_HEADERS)) {
+    memcpy(sess->block, payload+pos, length-pos-pad); /* Flawfinder: ignore */ // frames don't exceed WS_H2_MAX_FRAME_SIZE
+    sess->blockSize = length-pos-pad;
+    sess->continuedStream = id;
+    sess->continuedFlags = flags;
+    return;
+  }
+  h2OnHeaderBlock(sess, id, flags, payload+pos, length-pos-pad);
+}
+
+// processes a DATA frame, the data is appended to the buffered request body & the consumed windows are replenished
+void h2OnData(struct h2Session *sess, uint32_t id, int flags, const uint8_t *payload, int length) {
+  int pos = 0, pad = 0;
+  if (id == 0) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  // the whole payload (incl. padding) counts against the windows
+  if (length > sess->recvWindow) {
+    h2ConnError(sess, h2FlowControlError);
+    return;
+  }
+  sess->recvWindow -= length;
+  sess->recvConsumed += length;
+  if (sess->recvConsumed >= WS_H2_WINDOW_SIZE/2) {
+    h2QueueUint32Frame(sess, h2WindowUpdate, 0, sess->recvConsumed);
+    sess->recvWindow += sess->recvConsumed;
+    sess->recvConsumed = 0;
+  }
+
+  struct h2Stream *stream = h2FindStream(sess, id);
+  if (stream == NULL) {
+    if (id > sess->lastStreamId) {
+      h2ConnError(sess, h2ProtocolError);
+    }
+    // data in flight of closed (e.g. answered early & reset) streams is discarded
+    return;
+  }
+  if (stream->state != h2StreamOpen) {
+    h2ResetStream(sess, stream, h2StreamClosed);
+    return;
+  }
+  if (length > stream->recvWindow) {
+    h2ResetStream(sess, stream, h2FlowControlError);
+    return;
+  }
+  stream->recvWindow -= length;
+  if (flags & H2_PADDED) {
+    if (length < 1) {
+      h2ConnError(sess, h2FrameSizeError);
+      return;
+    }
+    pad = payload[0];
+    pos = 1;
+  }
+  if (pos + pad > length) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  int size = length-pos-pad;
+
+  if (!stream->discard && stream->bodySize + size > stream->bodyLimit) {
+    stream->discard = 1;
+    h2RespondError(sess, stream, 413);
+    // closed if the response has been sent completely
+    if (stream->state == h2StreamIdle) {
+      return;
+    }
+  }
+  if (!stream->discard && size > 0) {
+    if (stream->bodySize + size > stream->bodyBuffSize) {
+      int newSize = stream->bodyBuffSize ? stream->bodyBuffSize : WS_BUFF_SIZE;
+      while (newSize < stream->bodySize + size) {
+        newSize *= 2;
+      }
+      char *newBody = realloc(stream->body, newSize);
+      if (newBody == NULL) {
+        printErr(errMemAlloc);
+        h2ResetStream(sess, stream, h2InternalError);
+        return;
+      }
+      stream->body = newBody;
+      stream->bodyBuffSize = newSize;
+    }
+    memcpy(stream->body+stream->bodySize, payload+pos, size); /* Flawfinder: ignore */ // grown above
+    stream->bodySize += size;
+  }
+
+  if (flags & H2_END_STREAM) {
+    h2RequestComplete(sess, stream);
+    return;
+  }
+  stream->recvConsumed += length;
+  if (stream->recvConsumed >= WS_H2_WINDOW_SIZE/2) {
+    h2QueueUint32Frame(sess, h2WindowUpdate, stream->id, stream->recvConsumed);
+    stream->recvWindow += stream->recvConsumed;
+    stream->recvConsumed = 0;
+  }
+}
+
+// applies the settings of the peer (payload of a SETTINGS frame or of the HTTP2-Settings field of an upgrade)
+void h2ApplySettings(struct h2Session *sess, const uint8_t *payload, int length) {
+  for (int pos = 0; pos + 6 <= length; pos += 6) {
+    int id = payload[pos] << 8 | payload[pos+1];
+    uint32_t value = h2Uint32(payload+pos+2);
+    switch (id) {
+      case h2SettingTableSize:
+        // the encoder uses at most WS_H2_TABLE_SIZE, a change is signaled in the next header block
+        value = value < WS_H2_TABLE_SIZE ? value : WS_H2_TABLE_SIZE;
+        if ((int)value != sess->encoder.maxSize) {
+          sess->encoder.maxSize = value;
+          hpackEvict(&sess->encoder, value);
+          sess->encoderSizeUpdate = 1;
+        }
+        break;
+      case h2SettingEnablePush:
+        if (value > 1) {
+          h2ConnError(sess, h2ProtocolError);
+          return;
+        }
+        break;
+      case h2SettingInitialWindow:
+        if (value > 0x7fffffff) {
+          h2ConnError(sess, h2FlowControlError);
+          return;
+        }
+        // the difference applies to the windows of all open streams
+        for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+          struct h2Stream *stream = &sess->streams[i];
+          if (stream->state != h2StreamIdle) {
+            stream->sendWindow += (int64_t)value - sess->peerInitialWindow;
+            if (stream->sendWindow > 0x7fffffff) {
+              h2ConnError(sess, h2FlowControlError);
+              return;
+            }
+          }
+        }
+        sess->peerInitialWindow = value;
+        break;
+      case h2SettingMaxFrameSize:
+        if (value < 16384 || value > 16777215) {
+          h2ConnError(sess, h2ProtocolError);
+          return;
+        }
+        sess->peerMaxFrameSize = value;
+        break;
+    }
+  }
+}
+
+// processes a received frame
+void h2OnFrame(struct h2Session *sess, int type, int flags, uint32_t id, const uint8_t *payload, int length) {
+  struct h2Stream *stream;
+
+  // a header block must be continued without any other frame in between & the preface must be followed by SETTINGS
+  if ((sess->continuedStream != 0 && type != h2Continuation) || (!sess->settingsReceived && type != h2Settings)) {
+    h2ConnError(sess, h2ProtocolError);
+    return;
+  }
+  switch (type) {
+    case h2Data:
+      h2OnData(sess, id, flags, payload, length);
+      break;
+    case h2Headers:
+      h2OnHeaders(sess, id, flags, payload, length);
+      break;
+    case h2Priority:
+      if (id == 0) {
+        h2ConnError(sess, h2ProtocolError);
+      } else if (length != 5) {
+        h2ConnError(sess, h2FrameSizeError);
+      }
+      break;
+    case h2RstStream:
+      if (id == 0 || id > sess->lastStreamId) {
+        h2ConnError(sess, h2ProtocolError);
+      } else if (length != 4) {
+        h2ConnError(sess, h2FrameSizeError);
+      } else if ((stream = h2FindStream(sess, id)) != NULL) {
+        h2FreeStream(sess, stream);
+      }
+      break;
+    case h2Settings:
+      if (id != 0) {
+        h2ConnError(sess, h2ProtocolError);
+      } else if ((flags & H2_ACK) ? length != 0 : length % 6 != 0) {
+        h2ConnError(sess, h2FrameSizeError);
+      } else if (!(flags & H2_ACK)) {
+        sess->settingsReceived = 1;
+        h2ApplySettings(sess, payload, length);
+        h2QueueFrame(sess, h2Settings, H2_ACK, 0, NULL, 0);
+      }
+      break;
+    case h2Ping:
+      if (id != 0) {
+        h2ConnError(sess, h2ProtocolError);
+      } else if (length != 8) {
+        h2ConnError(sess, h2FrameSizeError);
+      } else if (!(flags & H2_ACK)) {
+        h2QueueFrame(sess, h2Ping, H2_ACK, 0, (const char*)payload, 8);
+      }
+      break;
+    case h2Goaway:
+      if (id != 0) {
+        h2ConnError(sess, h2ProtocolError);
+      }
+      sess->peerGoaway = 1;
+      break;
+    case h2WindowUpdate: {
+      if (length != 4) {
+        h2ConnError(sess, h2FrameSizeError);
+        break;
+      }
+      uint32_t increment = h2Uint32(payload) & 0x7fffffff;
+      if (id == 0) {
+        sess->sendWindow += increment;
+        if (increment == 0 || sess->sendWindow > 0x7fffffff) {
+          h2ConnError(sess, increment == 0 ? h2ProtocolError : h2FlowControlError);
+        }
+      } else if ((stream = h2FindStream(sess, id)) != NULL) {
+        stream->sendWindow += increment;
+        if (increment == 0 || stream->sendWindow > 0x7fffffff) {
+          h2ResetStream(sess, stream, increment == 0 ? h2ProtocolError : h2FlowControlError);
+        }
+      } else if (id > sess->lastStreamId) {
+        h2ConnError(sess, h2ProtocolError);
+      }
+      break;
+    }
+    case h2Continuation:
+      if (id != sess->continuedStream || id == 0) {
+        h2ConnError(sess, h2ProtocolError);
+      } else if (sess->blockSize + length > (int)sizeof sess->block) {
+        h2ConnError(sess, h2EnhanceYourCalm);
+      } else {
+        memcpy(sess->block+sess->blockSize, payload, length); /* Flawfinder: ignore */ // bounds checked above
+        sess->blockSize += length;
+        if (flags & H2_END_HEADERS) {
+          sess->continuedStream = 0;
+          h2OnHeaderBlock(sess, id, sess->continuedFlags, (uint8_t*)sess->block, sess->blockSize);
+        }
+      }
+      break;
+    case h2PushPromise:
+      // only servers push
+      h2ConnError(sess, h2ProtocolError);
+      break;
+    default:
+      // unknown frame types are ignored
+      break;
+  }
+}
+
+// batches the SETTINGS frame of the server connection preface
+void h2QueueSettings(struct h2Session *sess) {
+  uint32_t settings[][2] = {{h2SettingTableSize, WS_H2_TABLE_SIZE}, {h2SettingEnablePush, 0}, {h2SettingMaxStreams, WS_H2_MAX_STREAMS},
+    {h2SettingInitialWindow, WS_H2_WINDOW_SIZE}, {h2SettingMaxFrameSize, WS_H2_MAX_FRAME_SIZE}, {h2SettingMaxHeaderList, WS_BUFF_SIZE}};
+  int nSettings = sizeof settings / sizeof settings[0];
+  char payload[sizeof settings / sizeof settings[0] * 6];
+  for (int i = 0; i < nSettings; i++) {
+    payload[i*6] = settings[i][0] >> 8;
+    payload[i*6+1] = settings[i][0];
+    h2PutUint32(payload+i*6+2, settings[i][1]);
+  }
+  h2QueueFrame(sess, h2Settings, 0, 0, payload, nSettings*6);
+}
+
+// serves an http/2 connection until it's closed by the peer (or timed out), on a connection error or after a GOAWAY once all streams are done
+// the received data from consumed in the read buffer of conn starts the connection, req is used for the requests of the streams
+// with upgradeSettings (HTTP2-Settings field) req is an h2c upgrade request, it's answered as stream 1
+void h2Serve(webserver *wserver, struct wsConn *conn, struct httpRequest *req, int consumed, const char *upgradeSettings, int upgradeSettingsSize) {
+  struct h2Session *sess = malloc(sizeof *sess);
+  if (sess == NULL) {
+    printErr(errMemAlloc);
+    return;
+  }
+  wsLog("http/2 connection \n");
+  sess->wserver = wserver;
+  sess->conn = conn;
+  sess->req = req;
+  memset(sess->streams, 0, sizeof sess->streams);
+  sess->nStreams = 0;
+  sess->lastStreamId = 0;
+  sess->continuedStream = 0;
+  sess->sendWindow = 65535;
+  sess->recvWindow = 65535;
+  sess->recvConsumed = 0;
+  sess->peerInitialWindow = 65535;
+  sess->peerMaxFrameSize = 16384;
+  hpackInit(&sess->decoder, WS_H2_TABLE_SIZE);
+  hpackInit(&sess->encoder, WS_H2_TABLE_SIZE);
+  sess->encoderSizeUpdate = 0;
+  sess->settingsReceived = 0;
+  sess->goawaySent = 0;
+  sess->peerGoaway = 0;
+  sess->closing = 0;
+  sess->writeFailed = 0;
+  sess->iovCnt = 0;
+  sess->outSize = 0;
+  sess->readBuffSize = conn->readBuffSize - consumed;
+  memcpy(sess->readBuff, conn->readBuff+consumed, sess->readBuffSize); /* Flawfinder: ignore */ // the connection read buffer is smaller
+  conn->readBuffSize = 0;
+
+  if (upgradeSettings != NULL) {
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    char *out = h2Reserve(sess, sizeof(switching)-1);
+    memcpy(out, switching, sizeof(switching)-1); /* Flawfinder: ignore */ // reserved above
+    h2Commit(sess, sizeof(switching)-1);
+    int settingsSize = base64UrlDecode(upgradeSettings, upgradeSettingsSize, (uint8_t*)sess->block, sizeof sess->block);
+    if (settingsSize > 0 && settingsSize % 6 == 0) {
+      h2ApplySettings(sess, (uint8_t*)sess->block, settingsSize);
+    }
+  }
+  h2QueueSettings(sess);
+  // window for request bodies of the connection, streams get it through the settings
+  if (WS_H2_WINDOW_SIZE > 65535) {
+    h2QueueUint32Frame(sess, h2WindowUpdate, 0, WS_H2_WINDOW_SIZE-65535);
+    sess->recvWindow = WS_H2_WINDOW_SIZE;
+  }
+
+  if (upgradeSettings != NULL) {
+    // the upgrade request (without body) is answered as stream 1, its header is copied since the read buffer is reused
+    int headerSize = req->headerSize;
+    memcpy(sess->reqHeader, req->header, headerSize); /* Flawfinder: ignore */ // the header fits into the connection read buffer
+    sess->reqHeader[headerSize] = 0;
+    free(req->requestUri);
+    req->requestUri = NULL;
+    struct h2Stream *stream = h2NewStream(sess, 1);
+    sess->lastStreamId = 1;
+    stream->state = h2StreamHalfClosed;
+    h2Request(sess, stream, sess->reqHeader, headerSize);
+  }
+
+  int prefaceReceived = 0;
+  while (!sess->closing) {
+    int pos = 0;
+    if (!prefaceReceived && sess->readBuffSize >= H2_PREFACE_SIZE) {
+      if (memcmp(sess->readBuff, H2_PREFACE, H2_PREFACE_SIZE) != 0) {
+        h2ConnError(sess, h2ProtocolError);
+        break;
+      }
+      prefaceReceived = 1;
+      pos = H2_PREFACE_SIZE;
+    }
+    while (prefaceReceived && !sess->closing && sess->readBuffSize - pos >= H2_FRAME_HEADER_SIZE) {
+      uint8_t *frame = (uint8_t*)sess->readBuff + pos;
+      int length = frame[0] << 16 | frame[1] << 8 | frame[2];
+      if (length > WS_H2_MAX_FRAME_SIZE) {
+        h2ConnError(sess, h2FrameSizeError);
+        break;
+      }
+      if (sess->readBuffSize - pos < H2_FRAME_HEADER_SIZE + length) {
+        break;
+      }
+      h2OnFrame(sess, frame[3], frame[4], h2Uint32(frame+5) & 0x7fffffff, frame+H2_FRAME_HEADER_SIZE, length);
+      pos += H2_FRAME_HEADER_SIZE + length;
+    }
+    sess->readBuffSize -= pos;
+    memmove(sess->readBuff, sess->readBuff+pos, sess->readBuffSize);
+
+    h2Flush(sess);
+    if (sess->closing || (sess->nStreams == 0 && (sess->goawaySent || sess->peerGoaway))) {
+      break;
+    }
+    // the connection would block this thread while other connections wait for one
+    if (!sess->goawaySent && admissionYield(wserver)) {
+      char payload[8];
+      h2PutUint32(payload, sess->lastStreamId);
+      h2PutUint32(payload+4, h2NoError);
+      h2QueueFrame(sess, h2Goaway, 0, 0, payload, 8);
+      sess->goawaySent = 1;
+      h2Write(sess);
+      if (sess->nStreams == 0) {
+        break;
+      }
+    }
+
+    // a connection without open streams is idle
+    int idle = sess->nStreams == 0;
+    connArmTimer(wserver, conn, idle ? wserver->config.keepAliveTimeoutMs : wserver->config.bodyTimeoutMs, idle);
+    int readSize = connRead(conn, sess->readBuff+sess->readBuffSize, sizeof sess->readBuff - sess->readBuffSize);
+    if (readSize <= 0) {
+      if (readSize == -1) {
+        printErr(errNet);
+      }
+      break;
+    }
+    sess->readBuffSize += readSize;
+  }
+  h2Write(sess);
+
+  for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+    if (sess->streams[i].state != h2StreamIdle) {
+      h2FreeStream(sess, &sess->streams[i]);
+    }
+  }
+  free(sess);
+}
+
+// 32 bit FNV-1a hash of data with a final avalanche (murmur3 fmix), spreads similar keys & ring points evenly
+uint32_t proxyHash(const char *data, int size) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < size; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+int proxyRingCompare(const void *a, const void *b) {
+  uint32_t hashA = ((const struct proxyRingPoint*)a)->hash;
+  uint32_t hashB = ((const struct proxyRingPoint*)b)->hash;
+  return (hashA > hashB) - (hashA < hashB);
+}
+
+// creates a proxy without upstreams, hashHeader (copied) is the key of the proxyBalanceHash balancing (the request path if NULL)
+// returns reference to the proxy, freed with freeProxy after the webserver
+struct wsProxy *createProxy(int balance, const char *hashHeader, int *err) {
+  struct wsProxy *proxy = calloc(1, sizeof *proxy);
+  if (proxy == NULL) {
+    *err = errMemAlloc;
+    return NULL;
+  }
+  proxy->balance = balance;
+  if (hashHeader != NULL) {
+    proxy->hashHeader = malloc(strlen(hashHeader)+1); /* Flawfinder: ignore */ // \0 termination expected from the caller
+    if (proxy->hashHeader == NULL) {
+      free(proxy);
+      *err = errMemAlloc;
+      return NULL;
+    }
+    strcpy(proxy->hashHeader, hashHeader); /* Flawfinder: ignore */ // allocated above
+  }
+  *err = errOk;
+  return proxy;
+}
+
+// adds the upstream server host (name or numeric address) & port to proxy, the name is resolved once
+// its ring points are derived from host & port, so keys only move to or from added upstreams
+void proxyAddUpstream(struct wsProxy *proxy, const char *host, unsigned short port, int *err) {
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *res;
+  char key[300];
+
+  if (proxy->nUpstreams >= WS_PROXY_MAX_UPSTREAMS) {
+    *err = errInit;
+    return;
+  }
+  snprintf(key, sizeof key, "%u", port);
+  if (getaddrinfo(host, key, &hints, &res) != 0) {
+    *err = errInit;
+    return;
+  }
+  struct proxyUpstream *upstream = &proxy->upstreams[proxy->nUpstreams];
+  memcpy(&upstream->addr, res->ai_addr, res->ai_addrlen); /* Flawfinder: ignore */ // sockaddr_storage fits any address
+  upstream->addrSize = res->ai_addrlen;
+  freeaddrinfo(res);
+  pthread_mutex_init(&upstream->lock, NULL);
+
+  for (int i = 0; i < WS_PROXY_RING_REPLICAS; i++) {
+    int keySize = snprintf(key, sizeof key, "%s:%u#%d", host, port, i);
+    keySize = keySize < (int)sizeof key ? keySize : (int)sizeof key - 1;
+    proxy->ring[proxy->ringSize++] = (struct proxyRingPoint){.hash = proxyHash(key, keySize), .upstream = proxy->nUpstreams};
+  }
+  qsort(proxy->ring, proxy->ringSize, sizeof *proxy->ring, proxyRingCompare);
+  proxy->nUpstreams++;
+  *err = errOk;
+}
+
+// closes the pooled connections & frees the proxy
+void freeProxy(struct wsProxy *proxy) {
+  if (proxy == NULL) {
+    return;
+  }
+  for (int i = 0; i < proxy->nUpstreams; i++) {
+    for (int j = 0; j < proxy->upstreams[i].nIdle; j++) {
+      close(proxy->upstreams[i].idle[j]);
+    }
+    pthread_mutex_destroy(&proxy->upstreams[i].lock);
+  }
+  free(proxy->hashHeader);
+  free(proxy);
+}
+
+// picks the upstream for req among the ones not tried yet (bit mask), ejected upstreams only if all remaining ones are ejected
+// returns NULL if all upstreams have been tried
+struct proxyUpstream *proxyPick(struct wsProxy *proxy, struct httpRequest *req, uint32_t tried) {
+  uint64_t nowMs = wsNowNs() / 1000000;
+  int best = -1;
+  int start = 0;
+
+  if (proxy->balance == proxyBalanceHash) {
+    int keySize = strlen(req->requestUri); /* Flawfinder: ignore */ // \0 terminated by the parser
+    char *key = req->requestUri;
+    int valueSize;
+    char *value = proxy->hashHeader != NULL ? getHeader(req->header, req->headerSize, proxy->hashHeader, &valueSize) : NULL;
+    if (value != NULL) {
+      key = value;
+      keySize = valueSize;
+    }
+    // first ring point clockwise of the key
+    uint32_t hash = proxyHash(key, keySize);
+    int high = proxy->ringSize;
+    while (start < high) {
+      int mid = (start + high) / 2;
+      if (proxy->ring[mid].hash < hash) {
+        start = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+  } else {
+    start = atomic_fetch_add(&proxy->next, 1);
+  }
+
+  // the second pass ignores the ejection (all remaining upstreams are ejected)
+  for (int pass = 0; pass < 2 && best == -1; pass++) {
+    if (proxy->balance == proxyBalanceHash) {
+      for (int i = 0; i < proxy->ringSize && best == -1; i++) {
+        int candidate = proxy->ring[(start + i) % proxy->ringSize].upstream;
+        if (!(tried & 1u << candidate) && (pass == 1 || atomic_load(&proxy->upstreams[candidate].ejectedUntilMs) <= nowMs)) {
+          best = candidate;
+        }
+      }
+      continue;
+    }
+    for (int i = 0; i < proxy->nUpstreams; i++) {
+      int candidate = (start + i) % proxy->nUpstreams;
+      struct proxyUpstream *upstream = &proxy->upstreams[candidate];
+      if ((tried & 1u << candidate) || (pass == 0 && atomic_load(&upstream->ejectedUntilMs) > nowMs)) {
+        continue;
+      }
+      if (best == -1 || atomic_load(&upstream->outstanding) < atomic_load(&proxy->upstreams[best].outstanding)) {
+        best = candidate;
+      }
+    }
+  }
+  return best == -1 ? NULL : &proxy->upstreams[best];
+}
+
+// passive health check, the upstream is ejected for WS_PROXY_EJECT_MS after WS_PROXY_MAX_FAILS consecutive failures
+// its pooled connections are closed on ejection
+void proxyResult(struct proxyUpstream *upstream, int ok) {
+  pthread_mutex_lock(&upstream->lock);
+  if (ok) {
+    upstream->fails = 0;
+  } else {
+    atomic_fetch_add(&upstream->failures, 1);
+    if (++upstream->fails >= WS_PROXY_MAX_FAILS) {
+      upstream->fails = 0;
+      atomic_store(&upstream->ejectedUntilMs, wsNowNs() / 1000000 + WS_PROXY_EJECT_MS);
+      atomic_fetch_add(&upstream->ejections, 1);
+      for (int i = 0; i < upstream->nIdle; i++) {
+        close(upstream->idle[i]);
+      }
+      upstream->nIdle = 0;
+      wsLog("upstream ejected \n");
+    }
+  }
+  pthread_mutex_unlock(&upstream->lock);
+}
+
+// takes an idle connection from the pool of upstream (ones closed by the upstream are dropped) or connects a new one
+// the connection counts as outstanding request until it's released
+// returns 1 on success
+int proxyConnect(struct proxyUpstream *upstream, struct proxyConn *pc) {
+  pc->upstream = upstream;
+  pc->reused = 0;
+  atomic_fetch_add(&upstream->outstanding, 1);
+  atomic_fetch_add(&upstream->requests, 1);
+
+  while (1) {
+    pthread_mutex_lock(&upstream->lock);
+    pc->socket = upstream->nIdle > 0 ? upstream->idle[--upstream->nIdle] : -1;
+    pthread_mutex_unlock(&upstream->lock);
+    if (pc->socket == -1) {
+      break;
+    }
+    // an idle connection is only readable if the upstream closed it (or sent something unsolicited)
+    struct pollfd pollFd = {.fd = pc->socket, .events = POLLIN};
+    if (poll(&pollFd, 1, 0) == 0) {
+      pc->reused = 1;
+      return 1;
+    }
+    close(pc->socket);
+  }
+
+  // coroutines park on upstream sockets as on client sockets (with WS_PROXY_TIMEOUT_MS), so a proxy is used by one server
+  int nonBlocking = coCurrent() != NULL;
+  pc->socket = socket(upstream->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0), 0);
+  if (pc->socket == -1) {
+    return 0;
+  }
+  // bounds the (blocking) connect and every read & write
+  struct timeval timeout = {.tv_sec = WS_PROXY_TIMEOUT_MS / 1000, .tv_usec = (WS_PROXY_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(pc->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  setsockopt(pc->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+  if (upstream->addr.ss_family != AF_UNIX) {
+    wsSetSockOpt(pc->socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  int connected = connect(pc->socket, (struct sockaddr*)&upstream->addr, upstream->addrSize) == 0;
+  if (!connected && nonBlocking && errno == EINPROGRESS && coWait(pc->socket, EPOLLOUT, WS_PROXY_TIMEOUT_MS)) {
+    int sockErr = 0;
+    socklen_t sockErrSize = sizeof sockErr;
+    connected = getsockopt(pc->socket, SOL_SOCKET, SO_ERROR, &sockErr, &sockErrSize) == 0 && sockErr == 0;
+  }
+  if (!connected) {
+    close(pc->socket);
+    pc->socket = -1;
+    return 0;
+  }
+  atomic_fetch_add(&upstream->connects, 1);
+  return 1;
+}
+
+// returns the connection to the pool of its upstream if it's reusable (and the pool isn't full), closes it otherwise
+void proxyRelease(struct proxyConn *pc, int reusable) {
+  struct proxyUpstream *upstream = pc->upstream;
+  if (pc->socket != -1 && reusable) {
+    pthread_mutex_lock(&upstream->lock);
+    if (upstream->nIdle < WS_PROXY_POOL_SIZE) {
+      upstream->idle[upstream->nIdle++] = pc->socket;
+      pc->socket = -1;
+    }
+    pthread_mutex_unlock(&upstream->lock);
+  }
+  if (pc->socket != -1) {
+    close(pc->socket);
+    pc->socket = -1;
+  }
+  atomic_fetch_sub(&upstream->outstanding, 1);
+}
+
+// sends size bytes of data to the upstream socket
+// returns 1 on success
+int proxySendAll(int socket, const char *data, int size) {
+  while (size > 0) {
+    ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      if (sent == -1 && (errno == EINTR || coWaitIo(socket, EPOLLOUT, WS_PROXY_TIMEOUT_MS))) {
+        continue;
+      }
+      return 0;
+    }
+    data += sent;
+    size -= sent;
+  }
+  return 1;
+}
+
+// puts the name & value of the next header field at *pos (starting behind the request/ status line) into name & value
+// returns 0 at the end of the header
+int proxyNextField(char *header, int headerSize, int *pos, struct wsSlice *name, struct wsSlice *value) {
+  if (*pos == 0) {
+    char *lineEnd = memchr(header, LF, headerSize);
+    *pos = lineEnd != NULL ? lineEnd - header + 1 : headerSize;
+  }
+  while (*pos < headerSize) {
+    char *line = header + *pos;
+    char *lineEnd = memchr(line, LF, headerSize - *pos);
+    if (lineEnd == NULL) {
+      break;
+    }
+    *pos = lineEnd - header + 1;
+    char *colon = memchr(line, ':', lineEnd - line);
+    // the empty line (and malformed lines) are skipped
+    if (colon == NULL || colon == line) {
+      continue;
+    }
+    char *valueStart = colon + 1;
+    while (valueStart < lineEnd && (*valueStart == SP || *valueStart == '\t')) {
+      valueStart++;
+    }
+    while (lineEnd > valueStart && (lineEnd[-1] == CR || lineEnd[-1] == SP || lineEnd[-1] == '\t')) {
+      lineEnd--;
+    }
+    *name = (struct wsSlice){.data = line, .size = colon - line};
+    *value = (struct wsSlice){.data = valueStart, .size = lineEnd - valueStart};
+    return 1;
+  }
+  *pos = headerSize;
+  return 0;
+}
+
+// returns 1 if the field name is hop-by-hop (listed in RFC 9110 or in the Connection field) and isn't forwarded
+// also for the framing & Date fields which are set by the sending side itself
+int proxyHopByHop(struct wsSlice *name, char *connection, int connectionSize) {
+  static const char *fields[] = {"connection", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade", "content-length", "date"};
+  for (size_t i = 0; i < sizeof fields / sizeof fields[0]; i++) {
+    if ((size_t)name->size == strlen(fields[i]) && strncasecmp(name->data, fields[i], name->size) == 0) { /* Flawfinder: ignore */ // literals
+      return 1;
+    }
+  }
+  // comma separated field names
+  for (int i = 0; connection != NULL && i < connectionSize; i++) {
+    int start = i;
+    while (i < connectionSize && connection[i] != ',') {
+      i++;
+    }
+    int end = i;
+    while (start < end && (connection[start] == SP || connection[start] == '\t')) {
+      start++;
+    }
+    while (end > start && (connection[end-1] == SP || connection[end-1] == '\t')) {
+      end--;
+    }
+    if (end - start == name->size && strncasecmp(connection+start, name->data, name->size) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// serializes the request header forwarded to the upstream into out: the request line (http/1.1, http/1.0 for http/1.0 clients so the
+// response isn't chunked), the end-to-end fields, X-Forwarded-For (the client address appended)/ -Proto & the body framing
+// returns the size or -1 if it exceeds outSize
+int proxyBuildRequest(struct httpRequest *req, struct wsConn *conn, char *out, int outSize) {
+  char *header = req->header;
+  int headerSize = req->headerSize;
+  struct wsSlice name, value;
+  int connectionSize, forwardedSize, pos = 0;
+
+  // the request target as received
+  char *lineEnd = memchr(header, LF, headerSize);
+  char *target = memchr(header, SP, headerSize);
+  if (lineEnd == NULL || target == NULL || target > lineEnd) {
+    return -1;
+  }
+  char *targetEnd = ++target;
+  while (targetEnd < lineEnd && *targetEnd != SP && *targetEnd != CR) {
+    targetEnd++;
+  }
+  int size = snprintf(out, outSize, "%s %.*s HTTP/%s\r\n", httpMethodNames[req->reqMethod], (int)(targetEnd - target), target, req->httpVersion < 1.1f ? "1.0" : "1.1");
+
+  char *connection = getHeader(header, headerSize, "Connection", &connectionSize);
+  char *forwarded = getHeader(header, headerSize, "X-Forwarded-For", &forwardedSize);
+  while (size < outSize && proxyNextField(header, headerSize, &pos, &name, &value)) {
+    // the body has been read by the server (100-continue is answered by it), the forwarding fields are rebuilt
+    if (proxyHopByHop(&name, connection, connectionSize) || (name.size == 6 && strncasecmp(name.data, "expect", 6) == 0)
+      || (name.size == 15 && strncasecmp(name.data, "x-forwarded-for", 15) == 0) || (name.size == 17 && strncasecmp(name.data, "x-forwarded-proto", 17) == 0)) {
+      continue;
+    }
+    size += snprintf(out+size, outSize-size, "%.*s: %.*s\r\n", name.size, name.data, value.size, value.data);
+  }
+
+  char addr[INET6_ADDRSTRLEN] = "";
+  struct sockaddr_storage peer;
+  socklen_t peerSize = sizeof peer;
+  if (getpeername(conn->socket, (struct sockaddr*)&peer, &peerSize) == 0) {
+    if (peer.ss_family == AF_INET) {
+      inet_ntop(AF_INET, &((struct sockaddr_in*)&peer)->sin_addr, addr, sizeof addr);
+    } else if (peer.ss_family == AF_INET6) {
+      inet_ntop(AF_INET6, &((struct sockaddr_in6*)&peer)->sin6_addr, addr, sizeof addr);
+    }
+  }
+  if (size < outSize && (forwarded != NULL || addr[0] != 0)) {
+    size += snprintf(out+size, outSize-size, "X-Forwarded-For: %.*s%s%s\r\n", forwarded != NULL ? forwardedSize : 0, forwarded != NULL ? forwarded : "",
+      forwarded != NULL && addr[0] != 0 ? ", " : "", addr);
+  }
+  int tls = 0;
+#ifdef WS_TLS
+  tls = conn->ssl != NULL;
+#endif
+  if (size < outSize) {
+    size += snprintf(out+size, outSize-size, "X-Forwarded-Proto: %s\r\n", tls ? "https" : "http");
+  }
+  if (size < outSize && req->body.state == bodyData) {
+    size += snprintf(out+size, outSize-size, "Content-Length: %lld\r\n", req->body.remaining);
+  } else if (size < outSize && req->body.state != bodyNone && req->body.state != bodyDone) {
+    size += snprintf(out+size, outSize-size, "Transfer-Encoding: chunked\r\n");
+  }
+  if (size < outSize) {
+    size += snprintf(out+size, outSize-size, "\r\n");
+  }
+  return size < outSize ? size : -1;
+}
+
+// streams the request body to the upstream socket, chunked bodies are re-chunked as they are read
+// returns 1 on success, 0 if sending failed & -1 if reading the body from the client failed
+int proxySendBody(struct httpRequest *req, int socket) {
+  // room for the chunk size line in front of the data & the CRLF behind it
+  char buff[12 + WS_PROXY_RELAY_SIZE + 2];
+  int chunked = req->body.state != bodyData;
+  int size, err;
+
+  while ((size = readBody(req, buff+12, WS_PROXY_RELAY_SIZE, &err)) > 0) {
+    char *data = buff+12;
+    int dataSize = size;
+    if (chunked) {
+      char line[12];
+      int lineSize = snprintf(line, sizeof line, "%x\r\n", size);
+      data -= lineSize;
+      memcpy(data, line, lineSize); /* Flawfinder: ignore */ // 12 bytes reserved in front
+      data[lineSize+size] = CR;
+      data[lineSize+size+1] = LF;
+      dataSize += lineSize + 2;
+    }
+    if (!proxySendAll(socket, data, dataSize)) {
+      return 0;
+    }
+  }
+  if (err != errOk) {
+    return -1;
+  }
+  return !chunked || proxySendAll(socket, "0\r\n\r\n", 5);
+}
+
+// scans chunked framing, a call stops at the end of a run of chunk data (isData set) or of framing bytes
+// returns the number of bytes scanned or -1 if the framing is invalid, the state is bodyDone once the trailer is complete
+int proxyChunkScan(struct proxyChunks *chunks, const char *data, int size, int *isData) {
+  *isData = chunks->state == bodyChunkData;
+  if (*isData) {
+    int n = size < chunks->remaining ? size : (int)chunks->remaining;
+    chunks->remaining -= n;
+    if (chunks->remaining == 0) {
+      chunks->state = bodyChunkEnd;
+    }
+    return n;
+  }
+  int i = 0;
+  while (i < size && chunks->state != bodyChunkData && chunks->state != bodyDone) {
+    char c = data[i++];
+    switch (chunks->state) {
+      case bodyChunkSize:
+        if (c == LF) {
+          if (chunks->digits == 0) {
+            return -1;
+          }
+          chunks->state = chunks->remaining > 0 ? bodyChunkData : bodyTrailer;
+          chunks->digits = 0;
+          chunks->ext = 0;
+          chunks->lineSize = 0;
+        } else if (c == ';' || c == SP || c == '\t' || c == CR) {
+          // chunk extensions are ignored
+          chunks->ext = 1;
+        } else if (!chunks->ext) {
+          if (hexValue(c) < 0 || ++chunks->digits > 15) {
+            return -1;
+          }
+          chunks->remaining = chunks->remaining << 4 | hexValue(c);
+        }
+        break;
+      case bodyChunkEnd:
+        if (c == LF) {
+          chunks->state = bodyChunkSize;
+        } else if (c != CR) {
+          return -1;
+        }
+        break;
+      case bodyTrailer:
+        if (c == LF) {
+          chunks->state = chunks->lineSize == 0 ? bodyDone : bodyTrailer;
+          chunks->lineSize = 0;
+        } else if (c != CR) {
+          chunks->lineSize++;
+        }
+        break;
+    }
+  }
+  return i;
+}
+
+// receives the response head from the upstream into resp->buff, interim (1xx) responses are skipped, head is set for HEAD requests
+// returns 1 on success, 0 if the upstream failed (timedOut is set if it didn't answer in time)
+int proxyReadHead(struct proxyResp *resp, int head, int *timedOut) {
+  int headSize, valueSize;
+  char *value;
+  resp->size = 0;
+  *timedOut = 0;
+
+  while (1) {
+    while ((headSize = findHeaderEnd(resp->buff, resp->size)) == -1) {
+      if (resp->size >= resp->buffSize) {
+        return 0;
+      }
+      ssize_t readSize = recv(resp->pc->socket, resp->buff+resp->size, resp->buffSize-resp->size, 0);
+      if (readSize <= 0) {
+        if (readSize == -1 && (errno == EINTR || coWaitIo(resp->pc->socket, EPOLLIN, WS_PROXY_TIMEOUT_MS))) {
+          continue;
+        }
+        *timedOut = readSize == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        return 0;
+      }
+      resp->size += readSize;
+    }
+    // "HTTP/1.x nnn"
+    char *status = resp->buff + 9;
+    if (headSize < 13 || strncmp(resp->buff, "HTTP/1.", 7) != 0 || status[0] < '1' || status[0] > '5' || status[1] < '0' || status[1] > '9'
+      || status[2] < '0' || status[2] > '9') {
+      return 0;
+    }
+    resp->statusCode = (status[0]-'0')*100 + (status[1]-'0')*10 + status[2]-'0';
+    if (resp->statusCode >= 200) {
+      break;
+    }
+    // upgrades aren't forwarded (Upgrade is hop-by-hop)
+    if (resp->statusCode == 101) {
+      return 0;
+    }
+    resp->size -= headSize;
+    memmove(resp->buff, resp->buff+headSize, resp->size);
+  }
+  resp->headSize = headSize;
+  resp->pos = headSize;
+
+  value = getHeader(resp->buff, headSize, "Connection", &valueSize);
+  if (resp->buff[7] == '0') {
+    resp->keepAlive = value != NULL && headerHasToken(value, valueSize, "keep-alive");
+  } else {
+    resp->keepAlive = value == NULL || !headerHasToken(value, valueSize, "close");
+  }
+  resp->contentLength = -1;
+  value = getHeader(resp->buff, headSize, "Content-Length", &valueSize);
+  if (value != NULL) {
+    if (valueSize < 1 || valueSize > 18) {
+      return 0;
+    }
+    resp->contentLength = 0;
+    for (int i = 0; i < valueSize; i++) {
+      if (value[i] < '0' || value[i] > '9') {
+        return 0;
+      }
+      resp->contentLength = resp->contentLength * 10 + (value[i] - '0');
+    }
+  }
+  char *transferEncoding = getHeader(resp->buff, headSize, "Transfer-Encoding", &valueSize);
+
+  if (head || resp->statusCode == 204 || resp->statusCode == 304) {
+    resp->framing = proxyNoBody;
+  } else if (transferEncoding != NULL) {
+    if (valueSize != 7 || strncasecmp(transferEncoding, "chunked", 7) != 0) {
+      return 0;
+    }
+    resp->framing = proxyChunked;
+    resp->chunks = (struct proxyChunks){.state = bodyChunkSize};
+  } else if (resp->contentLength >= 0) {
+    resp->framing = proxyLength;
+    resp->remaining = resp->contentLength;
+  } else {
+    resp->framing = proxyUntilClose;
+    resp->keepAlive = 0;
+  }
+  resp->done = resp->framing == proxyNoBody || (resp->framing == proxyLength && resp->remaining == 0);
+  return 1;
+}
+
+// puts the next part of the response body (up to maxSize bytes, staged ones first) into data, chunk framing is kept if raw is set
+// returns the size, 0 at the end of the body or -1 if the upstream failed
+int proxyReadBody(struct proxyResp *resp, char **data, int maxSize, int raw) {
+  while (!resp->done) {
+    if (resp->pos == resp->size) {
+      resp->pos = resp->size = 0;
+      ssize_t readSize = recv(resp->pc->socket, resp->buff, resp->buffSize, 0);
+      if (readSize == 0 && resp->framing == proxyUntilClose) {
+        resp->done = 1;
+        break;
+      }
+      if (readSize <= 0) {
+        if (readSize == -1 && (errno == EINTR || coWaitIo(resp->pc->socket, EPOLLIN, WS_PROXY_TIMEOUT_MS))) {
+          continue;
+        }
+        return -1;
+      }
+      resp->size = readSize;
+    }
+    *data = resp->buff + resp->pos;
+    int size = resp->size - resp->pos < maxSize ? resp->size - resp->pos : maxSize;
+    if (resp->framing == proxyLength) {
+      size = size < resp->remaining ? size : (int)resp->remaining;
+      resp->remaining -= size;
+      resp->done = resp->remaining == 0;
+    } else if (resp->framing == proxyChunked) {
+      int scanned = 0, isData = 0;
+      // raw data is passed on as it is up to the end of the body, otherwise one run of chunk data is passed on
+      do {
+        int n = proxyChunkScan(&resp->chunks, *data + scanned, size - scanned, &isData);
+        if (n < 0) {
+          return -1;
+        }
+        scanned += n;
+        resp->done = resp->chunks.state == bodyDone;
+      } while (raw && scanned < size && !resp->done);
+      if (!raw && !isData) {
+        resp->pos += scanned;
+        continue;
+      }
+      size = scanned;
+    }
+    resp->pos += size;
+    return size;
+  }
+  // data beyond the response, the connection is out of sync
+  if (resp->pos != resp->size) {
+    resp->keepAlive = 0;
+  }
+  return 0;
+}
+
+// forwards req (with its body) to an upstream of proxy & receives the response head into resp
+// connect failures are retried on the remaining upstreams, a pooled connection closed by the upstream once on a new connection (requests without body)
+// returns 0 on success, otherwise the status of the error response (502/504, 413/400 if reading the request body failed), pc is released then
+int proxyExchange(struct wsProxy *proxy, struct httpRequest *req, struct wsConn *conn, struct proxyConn *pc, struct proxyResp *resp) {
+  char reqHead[2*WS_BUFF_SIZE];
+  int reqHeadSize = proxyBuildRequest(req, conn, reqHead, sizeof reqHead);
+  int hasBody = req->body.state != bodyNone && req->body.state != bodyDone;
+  uint32_t tried = 0;
+  int retried = 0;
+  if (reqHeadSize < 0) {
+    return 502;
+  }
+
+  while (1) {
+    struct proxyUpstream *upstream = proxyPick(proxy, req, tried);
+    if (upstream == NULL) {
+      return 502;
+    }
+    if (!proxyConnect(upstream, pc)) {
+      proxyResult(upstream, 0);
+      proxyRelease(pc, 0);
+      tried |= 1u << (upstream - proxy->upstreams);
+      continue;
+    }
+    resp->pc = pc;
+    int timedOut = 0;
+    int ok = proxySendAll(pc->socket, reqHead, reqHeadSize);
+    if (ok && hasBody) {
+      ok = proxySendBody(req, pc->socket);
+      if (ok < 0) {
+        // the client failed, not the upstream
+        proxyRelease(pc, 0);
+        return req->body.err == errSecCheck ? 413 : 400;
+      }
+    }
+    if (ok && proxyReadHead(resp, req->reqMethod == httpHead, &timedOut)) {
+      return 0;
+    }
+    if (pc->reused && !hasBody && !timedOut && !retried) {
+      proxyRelease(pc, 0);
+      retried = 1;
+      continue;
+    }
+    proxyResult(upstream, 0);
+    proxyRelease(pc, 0);
+    return timedOut ? 504 : 502;
+  }
+}
+
+// handler of proxy routes for requests which aren't relayed by proxyServe (http/2 streams), the response is built from the upstream response
+void proxyHandler(struct httpRequest *req, struct respBuilder *rb, void *ctx) {
+  struct wsProxy *proxy = (struct wsProxy*)ctx;
+  char buff[WS_PROXY_HEAD_SIZE];
+  char field[WS_BUFF_SIZE];
+  struct proxyConn pc;
+  struct proxyResp resp = {.buff = buff, .buffSize = sizeof buff};
+  struct wsSlice name, value;
+  char *data;
+  int size, connectionSize, pos = 0;
+
+  int status = proxyExchange(proxy, req, rb->conn, &pc, &resp);
+  if (status != 0) {
+    respError(rb, rb->conn, status);
+    return;
+  }
+  respSetStatus(rb, resp.statusCode);
+  char *connection = getHeader(buff, resp.headSize, "Connection", &connectionSize);
+  while (proxyNextField(buff, resp.headSize, &pos, &name, &value)) {
+    if (proxyHopByHop(&name, connection, connectionSize) || name.size + value.size + 2 > (int)sizeof field) {
+      continue;
+    }
+    // respAddHeader takes \0 terminated name & value
+    memcpy(field, name.data, name.size); /* Flawfinder: ignore */ // bounds checked above
+    field[name.size] = 0;
+    memcpy(field+name.size+1, value.data, value.size); /* Flawfinder: ignore */ // bounds checked above
+    field[name.size+1+value.size] = 0;
+    respAddHeader(rb, field, field+name.size+1);
+  }
+  while ((size = proxyReadBody(&resp, &data, resp.buffSize, 0)) > 0) {
+    respAppendBody(rb, data, size);
+  }
+  int upstreamOk = size == 0 && (resp.statusCode < 502 || resp.statusCode > 504);
+  proxyResult(pc.upstream, upstreamOk);
+  proxyRelease(&pc, resp.done && resp.keepAlive);
+  if (size < 0) {
+    respError(rb, rb->conn, 502);
+  }
+}
+
+// splices the rest of the response body (known length, nothing staged) from the upstream socket through a pipe to the client socket
+// returns 1 on success, 0 if the client failed, -1 if the upstream failed & -2 if no pipe could be created
+int proxySplice(webserver *wserver, struct wsConn *conn, struct proxyResp *resp) {
+  int pipeFds[2];
+  int ret = 1;
+  if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+    return -2;
+  }
+  while (resp->remaining > 0 && ret == 1) {
+    ssize_t in = splice(resp->pc->socket, NULL, pipeFds[1], NULL, resp->remaining < WS_PROXY_RELAY_SIZE*4 ? resp->remaining : WS_PROXY_RELAY_SIZE*4, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in <= 0) {
+      if (in == -1 && (errno == EINTR || coWaitIo(resp->pc->socket, EPOLLIN, WS_PROXY_TIMEOUT_MS))) {
+        continue;
+      }
+      ret = -1;
+      break;
+    }
+    resp->remaining -= in;
+    connArmTimer(wserver, conn, wserver->config.writeTimeoutMs, 0);
+    while (in > 0) {
+      ssize_t out = splice(pipeFds[0], NULL, conn->socket, NULL, in, SPLICE_F_MOVE | (resp->remaining > 0 ? SPLICE_F_MORE : 0));
+      if (out <= 0) {
+        if (out == -1 && (errno == EINTR || coWaitIo(conn->socket, EPOLLOUT, -1))) {
+          continue;
+        }
+        ret = 0;
+        break;
+      }
+      in -= out;
+    }
+  }
+  resp->done = resp->remaining == 0 && ret == 1;
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  return ret;
+}
+
+// serves req on a proxy route over http/1.x: the response head is rewritten & the body relayed while it's received,
+// bodies of known length are spliced from the upstream socket to the client socket (plaintext or kTLS connections)
+// returns 1 if the connection is persistent
+int proxyServe(webserver *wserver, struct wsConn *conn, struct httpRequest *req, struct wsProxy *proxy) {
+  char buff[WS_PROXY_HEAD_SIZE];
+  char fields[WS_PROXY_HEAD_SIZE];
+  char head[WS_PROXY_HEAD_SIZE + 256];
+  struct proxyConn pc;
+  struct proxyResp resp = {.buff = buff, .buffSize = sizeof buff};
+  struct wsSlice name, value;
+  int err = errOk, fieldsSize = 0, connectionSize, pos = 0;
+
+  int status = proxyExchange(proxy, req, conn, &pc, &resp);
+  if (status != 0) {
+    // an unread request body can't be skipped
+    if (req->body.err != errOk || (req->body.state != bodyNone && req->body.state != bodyDone)) {
+      req->keepAlive = 0;
+    }
+    sendErrorResp(wserver, conn, req, status, &err);
+    return err == errOk ? serveClientDone(conn, req) : 0;
+  }
+
+  // end-to-end fields of the upstream response, framing, Connection & Date are set by the server
+  char *connection = getHeader(buff, resp.headSize, "Connection", &connectionSize);
+  while (proxyNextField(buff, resp.headSize, &pos, &name, &value) && fieldsSize < (int)sizeof fields) {
+    if (!proxyHopByHop(&name, connection, connectionSize)) {
+      fieldsSize += snprintf(fields+fieldsSize, sizeof fields - fieldsSize, "%.*s: %.*s\r\n", name.size, name.data, value.size, value.data);
+    }
+  }
+  long long contentLength = -1;
+  if (resp.framing == proxyLength || (resp.framing == proxyNoBody && resp.statusCode != 204 && resp.statusCode != 304)) {
+    contentLength = resp.contentLength;
+  } else if (resp.framing == proxyChunked && fieldsSize < (int)sizeof fields) {
+    fieldsSize += snprintf(fields+fieldsSize, sizeof fields - fieldsSize, "Transfer-Encoding: chunked\r\n");
+  }
+  // bodies ending with the upstream connection end the client connection as well, chunked ones for http/1.0 clients
+  // (only sent by upstreams violating the protocol) are rejected
+  if (resp.framing == proxyUntilClose) {
+    req->keepAlive = 0;
+  }
+  // the head leaves with the body data received with it
+  char *data = NULL;
+  int size = resp.pos < resp.size ? proxyReadBody(&resp, &data, resp.buffSize, 1) : 0;
+  int headSize = 0;
+  if (size >= 0 && fieldsSize < (int)sizeof fields && !(resp.framing == proxyChunked && req->httpVersion < 1.1f)) {
+    headSize = serializeHeader(resp.statusCode, NULL, 0, contentLength, req->keepAlive, wsDateGet(&wserver->date), fields, fieldsSize, head, sizeof head, &err);
+  }
+  if (headSize == 0 || err != errOk) {
+    proxyResult(pc.upstream, 0);
+    proxyRelease(&pc, 0);
+    err = errOk;
+    sendErrorResp(wserver, conn, req, 502, &err);
+    return err == errOk ? serveClientDone(conn, req) : 0;
+  }
+
+  int spliceable = 1;
+#ifdef WS_TLS
+  spliceable = conn->ssl == NULL || conn->ktlsSend;
+#endif
+  struct iovec iov[2] = {{.iov_base = head, .iov_len = headSize}, {.iov_base = data, .iov_len = size}};
+  connArmTimer(wserver, conn, wserver->config.writeTimeoutMs, 0);
+  connSendBuffers(conn, iov, size > 0 ? 2 : 1, &err);
+
+  int upstreamOk = 1;
+  while (err == errOk && !resp.done) {
+    if (spliceable && resp.framing == proxyLength && resp.pos == resp.size) {
+      int spliced = proxySplice(wserver, conn, &resp);
+      if (spliced != -2) {
+        upstreamOk = spliced != -1;
+        err = spliced == 1 ? errOk : errNet;
+        break;
+      }
+      spliceable = 0;
+    }
+    size = proxyReadBody(&resp, &data, resp.buffSize, 1);
+    if (size <= 0) {
+      upstreamOk = size == 0;
+      err = size == 0 ? errOk : errNet;
+      break;
+    }
+    connArmTimer(wserver, conn, wserver->config.writeTimeoutMs, 0);
+    iov[0] = (struct iovec){.iov_base = data, .iov_len = size};
+    connSendBuffers(conn, iov, 1, &err);
+  }
+  // the data beyond the response is detected at its end
+  if (resp.done && resp.pos != resp.size) {
+    resp.keepAlive = 0;
+  }
+  proxyResult(pc.upstream, upstreamOk && (resp.statusCode < 502 || resp.statusCode > 504));
+  proxyRelease(&pc, resp.done && resp.keepAlive);
+  if (err != errOk) {
+    printErr(err);
+    return 0;
+  }
+  wsLog("proxy response relayed \n");
+  return serveClientDone(conn, req);
+}
+
+// declares&inits proxy route struct, requests are forwarded to the upstreams of proxy (owned by the caller)
+// returns reference to route struct
+struct httpRoute *createProxyRoute(char *path, int method, struct wsProxy *proxy, int *err) {
+  struct httpRoute *route = createHandlerRoute(path, method, proxyHandler, proxy, err);
+  if (route == NULL) {
+    return NULL;
+  }
+  route->proxy = proxy;
+  // splice doesn't take MSG_NOSIGNAL, client connections may be closed while relaying
+  signal(SIGPIPE, SIG_IGN);
+  return route;
+}
+
+// serves GET & HEAD requests of a cached route from the response cache, on a miss GET requests run the handler & store its response
+// a stale entry is sent as is, the first GET request which found it stale refreshes it afterwards
+// returns like serveClient or -1 if the request isn't cached (key too large, HEAD miss) and is to be served as usual
+int cacheServe(webserver *wserver, struct wsConn *conn, struct httpRequest *httpReq, struct httpRoute *route) {
+  struct wsCache *cache = wserver->cache;
+  char key[WS_CACHE_KEY_SIZE];
+  struct respBuilder rb;
+  int err = errOk;
+  int refresh;
+  int isGet = httpReq->reqMethod == httpGet;
+
+  int keySize = cacheKey(route, httpReq, key, sizeof key);
+  if (keySize < 0) {
+    return -1;
+  }
+  uint64_t hash = cacheHash(key, keySize);
+  uint64_t nowMs = wsNowNs() / 1000000;
+  struct cacheEntry *entry = cacheGet(cache, hash, key, keySize, nowMs, isGet, &refresh);
+  if (entry == NULL) {
+    atomic_fetch_add(&cache->misses, 1);
+    // the handler of proxy routes would forward the HEAD request, its response can't be stored for GET
+    if (!isGet) {
+      return -1;
+    }
+    respRunHandler(wserver, route, conn, httpReq, &rb);
+    if (cacheStorable(&rb)) {
+      cachePut(cache, hash, key, keySize, route, &rb, nowMs);
+    }
+    sendBuiltResp(wserver, conn, httpReq, &rb, &err);
+    if (err != errOk) {
+      printErr(err);
+      return 0;
+    }
+    wsLog("server-response sent \n");
+    return serveClientDone(conn, httpReq);
+  }
+  atomic_fetch_add(nowMs >= entry->freshUntilMs ? &cache->staleHits : &cache->hits, 1);
+  sendStaticResp(wserver, conn, httpReq, entry->header, entry->headerSize, entry->body, entry->bodySize, &err);
+
+  // the client has its response, the entry is refreshed before the next request of the connection is read
+  if (refresh) {
+    respRunHandler(wserver, route, conn, httpReq, &rb);
+    if (cacheStorable(&rb)) {
+      cachePut(cache, hash, key, keySize, route, &rb, wsNowNs() / 1000000);
+    }
+    cacheRefreshDone(cache, entry);
+  }
+  cacheRelease(entry);
+  if (err != errOk) {
+    printErr(err);
+    return 0;
+  }
+  wsLog("server-response sent \n");
+  return serveClientDone(conn, httpReq);
+}
+
+// reads the next request from the client connection and replies accordingly
+// returns 1 if the connection is persistent and the next request is to be read, the socket is closed by the caller
+int serveClient(webserver *wserver, struct wsConn *conn, struct httpRequest *httpReq) {
+  int err = errOk;
+  struct httpRoute *route = NULL;
+  struct routeNode *node = NULL;
+  struct respBuilder rb;
+  int headerSize, readSize, valueSize;
+  char *value;
+  char *readBuff = conn->readBuff;
+
+  // a persistent connection without pipelined data is idle until the next request arrives
+  int idle = conn->nRequests > 0 && conn->readBuffSize == 0;
+  connArmTimer(wserver, conn, idle ? wserver->config.keepAliveTimeoutMs : wserver->config.headerTimeoutMs, idle);
+  if (wserver->config.traceSample > 0) {
+    traceBegin(wserver, conn, idle);
+  }
+
+  while ((headerSize = findHeaderEnd(readBuff, conn->readBuffSize)) == -1) {
+    // sec checks, one byte is reserved for the \0 termination
+    if (conn->readBuffSize >= WS_BUFF_SIZE-1) {
+      printErr(errSecCheck);
+      return 0;
+    }
+    readSize = connRead(conn, readBuff+conn->readBuffSize, WS_BUFF_SIZE-1-conn->readBuffSize);
+    if (readSize <= 0) {
+      // closed by the client or the timer thread while idle
+      if (readSize == -1 || !idle) {
+        printErr(errNet);
+      }
+      return 0;
+    }
+    conn->readBuffSize += readSize;
+    if (idle) {
+      idle = 0;
+      connArmTimer(wserver, conn, wserver->config.headerTimeoutMs, 0);
+      traceFirstByte(conn);
+    }
+  }
+  // http/2 with prior knowledge, the start of the connection preface looks like a request header
+  if (conn->nRequests == 0 && wserver->config.http2 && headerSize == H2_PREFACE_SIZE-6 && memcmp(readBuff, H2_PREFACE, H2_PREFACE_SIZE-6) == 0) {
+    // http/2 streams aren't traced
+    conn->trace.sampled = 0;
+    h2Serve(wserver, conn, httpReq, 0, NULL, 0);
+    return 0;
+  }
+  conn->nRequests++;
+  traceStage(wserver, conn, spanRead);
+
+  // \0 terminating the request header for parsing, the byte is restored afterwards (body/ pipelined requests)
+  char headerEndByte = readBuff[headerSize];
+  readBuff[headerSize] = (char)0;
+
+  parseHttpRequest(httpReq, readBuff, headerSize, &err);
+  readBuff[headerSize] = headerEndByte;
+  if (err != errOk){
+    printErr(err);
+    return 0;
+  }
+  // not a mem alloc error (which is already handled by parseHttpRequest) has never been allocated instead due to a parsing issue
+  if (!httpReq->requestUri) {
+    printErr(errParse);
+    return 0;
+  }
+
+  httpReq->header = readBuff;
+  httpReq->headerSize = headerSize;
+  httpReq->arena = &conn->arena;
+  httpReq->formParams.parsed = 0;
+  conn->arena.used = 0;
+
+  bodyInit(httpReq, wserver, conn, &err);
+  if (err != errOk) {
+    httpReq->keepAlive = 0;
+    sendErrorResp(wserver, conn, httpReq, 400, &err);
+    return 0;
+  }
+
+  // http/1.1 connections are persistent by default, http/1.0 connections only on request
+  value = getHeader(readBuff, headerSize, "Connection", &valueSize);
+  if (httpReq->httpVersion >= 1.1f) {
+    httpReq->keepAlive = value == NULL || !headerHasToken(value, valueSize, "close");
+  } else {
+    httpReq->keepAlive = value != NULL && headerHasToken(value, valueSize, "keep-alive");
+  }
+  // an idle persistent connection would block this thread while other connections wait for one
+  if (httpReq->keepAlive && admissionYield(wserver)) {
+    httpReq->keepAlive = 0;
+  }
+  // bodies are only read by handler routes, otherwise the connection can't be reused
+  int hasBody = httpReq->body.state != bodyNone && httpReq->body.state != bodyDone;
+
+  // upgrade to http/2 (h2c, TLS connections negotiate it with ALPN), requests with body are served over http/1.1
+  value = getHeader(readBuff, headerSize, "Upgrade", &valueSize);
+  int tls = 0;
+#ifdef WS_TLS
+  tls = conn->ssl != NULL;
+#endif
+  if (wserver->config.http2 && !hasBody && !tls && value != NULL && headerHasToken(value, valueSize, "h2c")) {
+    value = getHeader(readBuff, headerSize, "HTTP2-Settings", &valueSize);
+    if (value != NULL) {
+      conn->trace.sampled = 0;
+      h2Serve(wserver, conn, httpReq, headerSize, value, valueSize);
+      return 0;
+    }
+  }
+
+  #ifdef DEBUG
+  printf("------------ parsed request -------------\n");
+  printf("http version: %f \n", httpReq->httpVersion);
+  printf("req method: %d \n", httpReq->reqMethod);
+  printf("req uri: %s \n", httpReq->requestUri);
+  printf("keep alive: %d \n", httpReq->keepAlive);
+  printf("------------ parsed request -------------\n");
+  #endif
+
+  // static and handler routes share the lookup
+  // handlers are called outside of the lock, routes are never removed while listening
+  traceStage(wserver, conn, spanParse);
+  pthread_mutex_lock(&wserver->mutexLock);
+  route = routeLookup(wserver->routeTree, httpReq->requestUri, httpReq->reqMethod, httpReq, &node);
+  pthread_mutex_unlock(&wserver->mutexLock);
+  traceStage(wserver, conn, spanLookup);
+  if (routeHidden(route, conn)) {
+    route = NULL;
+    node = NULL;
+  }
+
+  // limited clients get the pre-serialized 429, a body which would have to be skipped closes the connection
+  if (wserver->rate.slots != NULL && rateLimited(wserver, conn, route)) {
+    httpReq->keepAlive = httpReq->keepAlive && !hasBody;
+    sendStaticResp(wserver, conn, httpReq, wserver->rate.resp, wserver->rate.respSize, NULL, 0, &err);
+    if (err != errOk) {
+      printErr(err);
+      return 0;
+    }
+    return serveClientDone(conn, httpReq);
+  }
+
+  // the mapped snapshot is read only, it's looked up without lock
+  struct routeNode allowNode;
+  if (route == NULL && wserver->snapshot.base != NULL) {
+    const char *allow;
+    const struct snapRoute *snapRoute = snapLookup(&wserver->snapshot, httpReq->requestUri, httpReq->reqMethod, &allow);
+    if (snapRoute != NULL) {
+      httpReq->keepAlive = httpReq->keepAlive && !hasBody;
+      char *header[2] = {wserver->snapshot.base + snapRoute->headerOffset[0], wserver->snapshot.base + snapRoute->headerOffset[1]};
+      int headerSize[2] = {snapRoute->headerSize[0], snapRoute->headerSize[1]};
+      sendStaticResp(wserver, conn, httpReq, header, headerSize, wserver->snapshot.base + snapRoute->bodyOffset, snapRoute->bodySize, &err);
+      if (err != errOk) {
+        printErr(err);
+        return 0;
+      }
+      wsLog("server-response sent \n");
+      return serveClientDone(conn, httpReq);
+    }
+    // 405 & OPTIONS with the methods of the snapshot path
+    if (node == NULL && allow != NULL) {
+      allowNode.allow = (char*)allow;
+      node = &allowNode;
+    }
+  }
+#ifdef WS_ASSETS
+  const struct wsAsset *asset = route == NULL && node == NULL ? assetLookup(httpReq->requestUri) : NULL;
+  if (asset != NULL && (httpReq->reqMethod == httpGet || httpReq->reqMethod == httpHead)) {
+    httpReq->keepAlive = httpReq->keepAlive && !hasBody;
+    const struct wsAssetVariant *variant = assetVariant(asset, readBuff, headerSize);
+    sendStaticResp(wserver, conn, httpReq, (char**)variant->header, variant->headerSize, variant->body, variant->bodySize, &err);
+    if (err != errOk) {
+      printErr(err);
+      return 0;
+    }
+    wsLog("server-response sent \n");
+    return serveClientDone(conn, httpReq);
+  }
+  if (asset != NULL) {
+    allowNode.allow = "GET, HEAD, OPTIONS";
+    node = &allowNode;
+  }
+#endif
+
+  if (route == NULL) {
+    httpReq->keepAlive = httpReq->keepAlive && !hasBody;
+    respNoRoute(&rb, conn, httpReq, node);
+    sendBuiltResp(wserver, conn, httpReq, &rb, &err);
+    if (err != errOk) {
+      printErr(err);
+      return 0;
+    }
+    return serveClientDone(conn, httpReq);
+  }
+
+  if (route->handler == NULL) {
+    // the header has been serialized when the route was added
+    httpReq->keepAlive = httpReq->keepAlive && !hasBody;
+    struct httpResponse *resp = route->httpResp;
+    sendStaticResp(wserver, conn, httpReq, resp->header, resp->headerSize, resp->contentBuff, resp->contentSize, &err);
+    if (err != errOk) {
+      printErr(err);
+      return 0;
+    }
+    wsLog("server-response sent \n");
+    return serveClientDone(conn, httpReq);
+  }
+
+  httpReq->body.limit = route->maxBodySize;
+  if (httpReq->body.state == bodyData && httpReq->body.remaining > route->maxBodySize) {
+    httpReq->keepAlive = 0;
+    sendErrorResp(wserver, conn, httpReq, 413, &err);
+    return 0;
+  }
+
+  if (route->cacheTtlMs > 0 && wserver->cache != NULL && !hasBody && (httpReq->reqMethod == httpGet || httpReq->reqMethod == httpHead)) {
+    int keepAlive = cacheServe(wserver, conn, httpReq, route);
+    if (keepAlive != -1) {
+      return keepAlive;
+    }
+  }
+
+  if (route->proxy != NULL) {
+    int keepAlive = proxyServe(wserver, conn, httpReq, route->proxy);
+    traceStage(wserver, conn, spanProxy);
+    return keepAlive;
+  }
+
+  respRunHandler(wserver, route, conn, httpReq, &rb);
+  traceStage(wserver, conn, spanHandler);
+  // the body has not been read completely, the connection can't be reused
+  if (httpReq->body.err != errOk || (httpReq->body.state != bodyNone && httpReq->body.state != bodyDone)) {
+    httpReq->keepAlive = 0;
+  }
+
+  sendBuiltResp(wserver, conn, httpReq, &rb, &err);
+  if (err != errOk) {
+    printErr(err);
+    return 0;
+  }
+  wsLog("server-response sent \n");
+  return serveClientDone(conn, httpReq);
+}
+
+// waits for incoming requests and crafts the replies accordingly, body of client threads & connection coroutines
+// replies to requests on the connection until it's closed or timed out (persistent connections)
+// after a connection is closed it continues with the next connection from the admission queue
+void clientServe(void *args) {
+  struct pthreadClientHandleArgs *argss = (struct pthreadClientHandleArgs*)args;
+  webserver *wserver = argss->wserver;
+  int socket = argss->socket;
+  int tls = argss->tls;
+
+  char *readBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
+  char *respBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
+  char *hdrBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
+  char *scratchBuff = malloc(sizeof(char)*WS_SCRATCH_SIZE);
+  struct httpRequest *httpReq = malloc(sizeof (struct httpRequest));
+  if (readBuff == NULL || respBuff == NULL || hdrBuff == NULL || scratchBuff == NULL || httpReq == NULL) {
+    printErr(errMemAlloc);
+    free(readBuff);
+    free(respBuff);
+    free(hdrBuff);
+    free(scratchBuff);
+    free(httpReq);
+    free(argss);
+    close(socket);
+    admissionRelease(wserver);
+    return;
+  }
+  httpReq->requestUri = NULL;
+
+  struct wsConn conn = {.readBuff = readBuff, .respBuff = respBuff, .hdrBuff = hdrBuff, .bodyBuff = NULL, .bodyBuffSize = 0};
+  conn.arena = (struct wsArena){.buff = scratchBuff, .size = WS_SCRATCH_SIZE, .used = 0};
+  conn.timer.data = &conn;
+
+  wsLog("new client thread created \n");
+
+  // no cleanup handler (pthread_cleanup_push) since client threads aren't cancelled and coroutines share their thread
+  struct freeClientThreadArgs freeArgs = {.httpReq = httpReq, .clientHandleArgs = argss, .conn = &conn, .readBuff = readBuff, .respBuff = respBuff};
+
+  while (socket != -1) {
+    coBind(socket);
+    conn.socket = socket;
+    conn.peerKey = 0;
+    // connections may have been queued by the admission control, the address is taken once per connection
+    if (wserver->rate.slots != NULL) {
+      struct sockaddr_storage peer;
+      socklen_t peerSize = sizeof peer;
+      if (getpeername(socket, (struct sockaddr*)&peer, &peerSize) == 0) {
+        conn.peerKey = ratePeerKey(&peer);
+      }
+    }
+    // TCP_CORK fails on connections of unix socket listeners
+    conn.tcp = 0;
+    if (wserver->config.tcpCork) {
+      struct sockaddr_storage local;
+      socklen_t localSize = sizeof local;
+      conn.tcp = getsockname(socket, (struct sockaddr*)&local, &localSize) == 0 && local.ss_family != AF_UNIX;
+    }
+    conn.readBuffSize = 0;
+    conn.nRequests = 0;
+    conn.trace.sampled = 0;
+    conn.trace.acceptNs = argss->acceptNs;
+    conn.trace.servedNs = argss->acceptNs != 0 ? wsNowNs() : 0;
+    argss->acceptNs = 0;
+
+    int keepAlive = 1;
+#ifdef WS_TLS
+    if (tls) {
+      int err = errOk;
+      connTlsAccept(wserver, &conn, &err);
+      keepAlive = err == errOk;
+    }
+#endif
+#ifdef WS_TLS
+    const unsigned char *alpn = NULL;
+    unsigned int alpnSize = 0;
+    if (keepAlive && conn.ssl != NULL) {
+      SSL_get0_alpn_selected(conn.ssl, &alpn, &alpnSize);
+    }
+    if (alpnSize == 2 && memcmp(alpn, "h2", 2) == 0) {
+      h2Serve(wserver, &conn, httpReq, 0, NULL, 0);
+      keepAlive = 0;
+    }
+#endif
+    while (keepAlive) {
+      keepAlive = serveClient(wserver, &conn, httpReq);
+      if (conn.trace.sampled) {
+        traceEnd(wserver, &conn, httpReq->requestUri);
+      }
+      free(httpReq->requestUri);
+      httpReq->requestUri = NULL;
+    }
+
+    // the timer thread must not shut down the socket number once it's closed (and possibly reused)
+    connDisarmTimer(wserver, &conn);
+#ifdef WS_TLS
+    connTlsClose(&conn);
+#endif
+    close(socket);
+
+    socket = admissionNext(wserver, &tls);
+  }
+
+  freeClientThread(&freeArgs);
+}
+
+// client thread entry
+void *clientHandle(void *args) {
+  clientServe(args);
+  return NULL;
+}
+
+// closes the connection of a client coroutine which couldn't be created
+void clientCancel(void *args) {
+  struct pthreadClientHandleArgs *argss = (struct pthreadClientHandleArgs*)args;
+  close(argss->socket);
+  admissionRelease(argss->wserver);
+  free(argss);
+}
+
+// handles an accepted connection, either by creating a new client thread (or coroutine) or through the admission queue
+void wsAcceptConn(webserver *wserver, int newSocket, int tls, pthread_attr_t *threadAttr, int *err) {
+  wsLog("new client connected \n");
+
+  *err = errOk;
+  if (!admitConn(wserver, newSocket, tls)) {
+    return;
+  }
+
+  // freed when thread is dead
+  struct pthreadClientHandleArgs *clientArgs = malloc(sizeof *clientArgs);
+  if (clientArgs == NULL) {
+    printErr(errMemAlloc);
+    close(newSocket);
+    admissionRelease(wserver);
+    return;
+  }
+  clientArgs->wserver = wserver;
+  clientArgs->socket = newSocket;
+  clientArgs->tls = tls;
+  clientArgs->acceptNs = wserver->config.traceSample > 0 ? wsNowNs() : 0;
+
+  if (wserver->nLoops > 0) {
+    clientArgs->task = (struct coTask){.fn = clientServe, .cancel = clientCancel, .arg = clientArgs};
+    loopSubmit(&wserver->loops[wserver->nextLoop++ % wserver->nLoops], &clientArgs->task);
+    return;
+  }
+  if(pthread_create(&wserver->clientThread, threadAttr, clientHandle, (void*)clientArgs) != 0 ) {
+    free(clientArgs);
+    close(newSocket);
+    admissionRelease(wserver);
+    *err = errIO;
+  }
+}
+
+// the webserver which is commanded by the signal handler (only a single webserver per process handles signals)
+static int wsSignalCtlFd = -1;
+
+// writes the command matching the signal to the control pipe (async signal safe)
+void wsSignalHandler(int sig) {
+  int savedErrno = errno;
+  char cmd = sig == SIGUSR2 ? 'u' : 's';
+  if (write(wsSignalCtlFd, &cmd, 1) == -1) {
+    // the pipe is full, a command is already pending
+  }
+  errno = savedErrno;
+}
+
+// installs the signal handlers, SIGTERM & SIGINT gracefully stop the server, SIGUSR2 upgrades the binary
+// argv is used to exec the upgraded binary which is expected at the path of the current one
+void wsHandleSignals(webserver *wserver, char **argv, int *err) {
+  char exePath[PATH_MAX];
+  struct sigaction sa;
+
+  ssize_t exePathSize = readlink("/proc/self/exe", exePath, sizeof(exePath)-1);
+  if (exePathSize <= 0) {
+    *err = errInit;
+    return;
+  }
+  exePath[exePathSize] = 0;
+  wserver->exePath = strdup(exePath);
+  if (wserver->exePath == NULL) {
+    *err = errMemAlloc;
+    return;
+  }
+  wserver->argv = argv;
+
+  wsSignalCtlFd = wserver->ctlPipe[1];
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = wsSignalHandler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGTERM, &sa, NULL) != 0 || sigaction(SIGINT, &sa, NULL) != 0 || sigaction(SIGUSR2, &sa, NULL) != 0) {
+    *err = errInit;
+    return;
+  }
+  *err = errOk;
+}
+
+// gracefully stops the server (wsListen returns once the connections are drained)
+// if upgrade is set the upgraded binary is exec'd and takes over the listening socket first
+void wsStop(webserver *wserver, int upgrade) {
+  char cmd = upgrade ? 'u' : 's';
+  if (write(wserver->ctlPipe[1], &cmd, 1) == -1) {
+    // the pipe is full, a command is already pending
+  }
+}
+
+// profile being sampled (only one at a time since SIGPROF is process wide), read by the signal handler
+static _Atomic(struct wsProfile*) wsProfActive = NULL;
+// signal handlers between loading wsProfActive & finishing their sample
+static atomic_int wsProfInFlight = 0;
+static atomic_int wsProfBusy = 0;
+
+// SIGPROF handler, captures the stack of the interrupted thread into the next preallocated sample (async signal safe)
+// backtrace is safe once it has been called outside of the handler (it loads libgcc_s on its first call)
+void profSignal(int sig) {
+  int savedErrno = errno;
+  (void)sig;
+  atomic_fetch_add(&wsProfInFlight, 1);
+  struct wsProfile *prof = atomic_load(&wsProfActive);
+  if (prof != NULL) {
+    int i = atomic_fetch_add_explicit(&prof->nTaken, 1, memory_order_relaxed);
+    if (i < prof->capacity) {
+      prof->samples[i].depth = backtrace(prof->samples[i].frames, WS_PROF_DEPTH);
+    }
+  }
+  atomic_fetch_sub(&wsProfInFlight, 1);
+  errno = savedErrno;
+}
+
+// frees the samples of a profile
+void freeProfile(struct wsProfile *prof) {
+  if (prof == NULL) {
+    return;
+  }
+  free(prof->samples);
+  free(prof);
+}
+
+// samples the stacks of all threads hz times per second of process cpu time (ITIMER_PROF) for durationMs, blocks meanwhile
+// the samples are preallocated (up to WS_PROF_MAX_SAMPLES, further ones are only counted in nTaken)
+// returns the profile (to be freed with freeProfile), NULL on failure (errFailed if another profile is running)
+struct wsProfile *profRun(int durationMs, int hz, int *err) {
+  struct sigaction sa;
+  void *warmUp[1];
+
+  if (durationMs <= 0 || hz <= 0 || hz > 1000) {
+    *err = errInit;
+    return NULL;
+  }
+  if (atomic_exchange(&wsProfBusy, 1)) {
+    *err = errFailed;
+    return NULL;
+  }
+  // every cpu may take hz samples per second
+  long long capacity = (long long)hz * durationMs / 1000 * sysconf(_SC_NPROCESSORS_ONLN) + 1;
+  struct wsProfile *prof = calloc(1, sizeof *prof);
+  if (prof != NULL) {
+    prof->capacity = capacity < WS_PROF_MAX_SAMPLES ? (int)capacity : WS_PROF_MAX_SAMPLES;
+    prof->samples = malloc(sizeof(struct profSample) * prof->capacity);
+  }
+  if (prof == NULL || prof->samples == NULL) {
+    freeProfile(prof);
+    atomic_store(&wsProfBusy, 0);
+    *err = errMemAlloc;
+    return NULL;
+  }
+  prof->hz = hz;
+  backtrace(warmUp, 1);
+
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = profSignal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  struct itimerval timer = {.it_interval = {.tv_usec = 1000000 / hz}, .it_value = {.tv_usec = 1000000 / hz}};
+  atomic_store(&wsProfActive, prof);
+  // the handler stays installed after the profile, the default action of a SIGPROF still pending would terminate the process
+  if (sigaction(SIGPROF, &sa, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    atomic_store(&wsProfActive, NULL);
+    freeProfile(prof);
+    atomic_store(&wsProfBusy, 0);
+    *err = errInit;
+    return NULL;
+  }
+  // interrupted by the signals of the profile itself, the remaining time is slept
+  struct timespec remaining = {.tv_sec = durationMs / 1000, .tv_nsec = (durationMs % 1000) * 1000000L};
+  while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR);
+
+  struct itimerval off = {0};
+  setitimer(ITIMER_PROF, &off, NULL);
+  atomic_store(&wsProfActive, NULL);
+  // handlers already running finish their sample, a SIGPROF still pending finds no profile
+  while (atomic_load(&wsProfInFlight) > 0) {
+    sched_yield();
+  }
+  atomic_store(&wsProfBusy, 0);
+  *err = errOk;
+  return prof;
+}
+
+// orders samples by their stack, identical stacks are adjacent afterwards
+int profSampleCmp(const void *a, const void *b) {
+  const struct profSample *sa = (const struct profSample*)a;
+  const struct profSample *sb = (const struct profSample*)b;
+  if (sa->depth != sb->depth) {
+    return sa->depth < sb->depth ? -1 : 1;
+  }
+  return memcmp(sa->frames, sb->frames, sa->depth * sizeof(void*));
+}
+
+// writes the name of the function at addr into buff, module+offset if the symbol isn't exported (static functions, no -rdynamic)
+void profSymbol(void *addr, char *buff, int size) {
+  Dl_info info;
+  if (dladdr(addr, &info) == 0 || info.dli_fname == NULL) {
+    snprintf(buff, size, "[unknown]");
+  } else if (info.dli_sname != NULL) {
+    snprintf(buff, size, "%s", info.dli_sname);
+  } else {
+    const char *module = strrchr(info.dli_fname, '/');
+    snprintf(buff, size, "%s+0x%lx", module != NULL ? module+1 : info.dli_fname, (unsigned long)((char*)addr - (char*)info.dli_fbase));
+  }
+}
+
+// folds the samples of prof into lines of the stack frames (outermost first, separated by ';') followed by their count
+// the format of flamegraph.pl & speedscope, appended to the response body as long as it fits
+// returns the number of samples which have been written
+int profFold(struct wsProfile *prof, struct respBuilder *resp) {
+  char symbol[WS_PROF_SYMBOL_SIZE];
+  int nSamples = atomic_load(&prof->nTaken) < prof->capacity ? atomic_load(&prof->nTaken) : prof->capacity;
+  int written = 0;
+
+  qsort(prof->samples, nSamples, sizeof(struct profSample), profSampleCmp);
+  for (int i = 0, count; i < nSamples; i += count) {
+    for (count = 1; i + count < nSamples && profSampleCmp(&prof->samples[i], &prof->samples[i+count]) == 0; count++);
+    struct profSample *sample = &prof->samples[i];
+    // the signal handler & the signal trampoline aren't part of the profiled stack
+    if (sample->depth <= WS_PROF_SKIP_FRAMES) {
+      continue;
+    }
+    if (resp->bodySize + WS_PROF_DEPTH * WS_PROF_SYMBOL_SIZE + 16 > WS_MAX_RESP_BODY_SIZE) {
+      break;
+    }
+    for (int j = sample->depth-1; j >= WS_PROF_SKIP_FRAMES; j--) {
+      // return addresses point after the call, which may be the last instruction of the caller
+      profSymbol(j == WS_PROF_SKIP_FRAMES ? sample->frames[j] : (char*)sample->frames[j] - 1, symbol, sizeof symbol);
+      respPrintf(resp, j == WS_PROF_SKIP_FRAMES ? "%s" : "%s;", symbol);
+    }
+    respPrintf(resp, " %d\n", count);
+    written += count;
+  }
+  return written;
+}
+
+// forks & execs the upgraded binary and hands it the listening sockets over a unix socket pair
+// returns the handoff socket on which the new process acks once it's listening, -1 on failure
+int wsUpgradeExec(webserver *wserver, pid_t *pid, int *err) {
+  extern char **environ;
+  int sv[2];
+  char envEntry[32];
+  int nEnv = 0;
+
+  if (wserver->exePath == NULL) {
+    *err = errInit;
+    return -1;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+    *err = errNet;
+    return -1;
+  }
+
+  // the environment is prepared before the fork since only async signal safe calls are allowed in the child
+  while (environ[nEnv] != NULL) {
+    nEnv++;
+  }
+  char **envp = malloc(sizeof(char*) * (nEnv+2));
+  if (envp == NULL) {
+    close(sv[0]);
+    close(sv[1]);
+    *err = errMemAlloc;
+    return -1;
+  }
+  memcpy(envp, environ, sizeof(char*) * nEnv); /* Flawfinder: ignore */ // allocated above
+  snprintf(envEntry, sizeof envEntry, "%s=%d", WS_UPGRADE_ENV, sv[1]);
+  envp[nEnv] = envEntry;
+  envp[nEnv+1] = NULL;
+
+  *pid = fork();
+  if (*pid == 0) {
+    // the handoff socket has to survive the exec
+    fcntl(sv[1], F_SETFD, 0);
+    execve(wserver->exePath, wserver->argv, envp);
+    _exit(EXIT_FAILURE);
+  }
+  free(envp);
+  close(sv[1]);
+  if (*pid == -1) {
+    close(sv[0]);
+    *err = errInit;
+    return -1;
+  }
+
+  // the tags mark the tls listeners
+  int listenFds[WS_MAX_LISTENERS];
+  char tags[WS_MAX_LISTENERS];
+  for (int i = 0; i < wserver->nListeners; i++) {
+    listenFds[i] = wserver->listeners[i].socket;
+    tags[i] = wserver->listeners[i].tls ? 't' : 'p';
+  }
+  sendFds(sv[0], listenFds, tags, wserver->nListeners, err);
+  if (*err != errOk) {
+    close(sv[0]);
+    return -1;
+  }
+  return sv[0];
+}
+
+// closes the listeners, flags the admission control as draining & closes the idle connections, the first step of a drain
+void wsDrainBegin(webserver *wserver, int handedOver) {
+  wsLog("server draining \n");
+  wsCloseListeners(wserver, handedOver);
+
+  pthread_mutex_lock(&wserver->admission.lock);
+  wserver->admission.draining = 1;
+  pthread_mutex_unlock(&wserver->admission.lock);
+
+  connShutdownAll(wserver, 1);
+}
+
+// allocates the token buckets if the server or a route is rate limited & starts the blocking pool if there are blocking routes
+// the pool is stopped on drain
+void wsStartRoutes(webserver *wserver, int *err) {
+  int nBlocking = 0, nLimited = wserver->config.rateLimit > 0;
+  for (int i = 0; i < wserver->nRoutes; i++) {
+    nBlocking += wserver->routes[i]->blocking;
+    nLimited += wserver->routes[i]->rateLimit > 0;
+  }
+  if (nLimited > 0 && wserver->rate.slots == NULL) {
+    wserver->rate.slots = calloc(WS_RATE_TABLE_SIZE, sizeof *wserver->rate.slots);
+    if (wserver->rate.slots == NULL) {
+      *err = errMemAlloc;
+      return;
+    }
+  }
+  if (wserver->blocking.queue != NULL && nBlocking > 0) {
+    blockingStart(&wserver->blocking, wserver->config.nBlockingThreads, err);
+    if (*err != errOk) {
+      return;
+    }
+  }
+  *err = errOk;
+}
+
+// accepts the pending connections of the (non-blocking) listener in a batch until its backlog is empty
+// threadAttr is only used if connections are served by client threads
+void wsAcceptBatch(webserver *wserver, struct wsListener *listener, pthread_attr_t *threadAttr, int *err) {
+  struct sockaddr_storage tempClient;
+  socklen_t addrSize;
+
+  *err = errOk;
+  while (1) {
+    addrSize = sizeof tempClient;
+    // sockets of coroutines are non-blocking, an operation which would block parks the coroutine
+    int newSocket = accept4(listener->socket, (struct sockaddr *) &tempClient, &addrSize, SOCK_CLOEXEC | (wserver->nLoops > 0 ? SOCK_NONBLOCK : 0));
+    if (newSocket == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      *err = errNet;
+      printErr(*err);
+      return;
+    }
+
+    // clients without tokens left are rejected before a thread or coroutine is spent on them
+    if (wserver->config.rateLimit > 0 && wserver->rate.slots != NULL) {
+      uint64_t peerKey = ratePeerKey(&tempClient);
+      if (peerKey != 0 && !rateTake(&wserver->rate, peerKey, wserver->config.rateLimit, wserver->config.rateBurst, 0)) {
+        atomic_fetch_add_explicit(&wserver->rate.limitedConns, 1, memory_order_relaxed);
+        rejectConn(wserver, newSocket, listener->tls, wserver->rate.resp[0], wserver->rate.respSize[0]);
+        continue;
+      }
+    }
+    if (listener->type == listenerTcp) {
+      wsTuneConn(wserver, newSocket);
+    }
+    wsAcceptConn(wserver, newSocket, listener->tls, threadAttr, err);
+    if (*err != errOk) {
+      return;
+    }
+  }
+}
+
+// stops accepting and waits until all in-flight connections are served or the drain deadline passed
+// idle persistent connections are closed right away, all others after their current request
+// handedOver is set if the listening sockets have been taken over by an upgraded binary
+void wsDrain(webserver *wserver, int handedOver) {
+  struct timespec tick = {.tv_sec = WS_TIMER_TICK_MS / 1000, .tv_nsec = (WS_TIMER_TICK_MS % 1000) * 1000000L};
+  uint64_t deadline = wsNowNs() + (uint64_t)wserver->config.drainTimeoutMs * 1000000ULL;
+  int forced = 0;
+
+  wsDrainBegin(wserver, handedOver);
+  while (1) {
+    pthread_mutex_lock(&wserver->admission.lock);
+    int nActive = wserver->admission.nActive;
+    pthread_mutex_unlock(&wserver->admission.lock);
+    if (nActive == 0) {
+      break;
+    }
+    if (!forced && wsNowNs() > deadline) {
+      wsLog("drain deadline passed, shutting down remaining connections \n");
+      connShutdownAll(wserver, 0);
+      forced = 1;
+    }
+    // connections which became idle meanwhile (since the drain flag was checked before) are closed as well
+    connShutdownAll(wserver, 1);
+    nanosleep(&tick, NULL);
+  }
+
+  for (int i = 0; i < wserver->nLoops; i++) {
+    if (wserver->loops[i].running) {
+      loopStop(&wserver->loops[i]);
+    }
+  }
+  blockingStop(&wserver->blocking);
+  pthread_mutex_lock(&wserver->timerLock);
+  wserver->timersStopped = 1;
+  pthread_mutex_unlock(&wserver->timerLock);
+  pthread_join(wserver->timerThread, NULL);
+  wsLog("server drained \n");
+}
+
+// waits for new incoming connections on port x and creates clientHandles threads (or coroutines) accordingly
+// connections exceeding the max concurrent connections are queued or shed by the admission control
+// returns once the server has been stopped (wsStop or signal) and all connections are drained
+void wsListen(webserver *wserver, int *err) {
+  pthread_attr_t threadAttr;
+  // control pipe, upgrade handoff socket (ignored by poll while -1) & listeners
+  struct pollfd fds[2+WS_MAX_LISTENERS];
+  int upgradeSock = -1;
+  pid_t upgradePid = -1;
+  uint64_t upgradeDeadline = 0;
+  int stop = 0;
+  int handedOver = 0;
+  char cmd;
+
+  // driven servers are started with wsStart
+  if (wserver->config.driven) {
+    *err = errInit;
+    return;
+  }
+  if (pthread_mutex_init(&wserver->mutexLock, NULL) != 0) {
+    *err = errInit;
+    return;
+  }
+  // the timer thread is joined on drain
+  if (pthread_create(&wserver->timerThread, NULL, timerThread, (void*)wserver) != 0) {
+    *err = errInit;
+    return;
+  }
+  // event loops are joined on drain
+  for (int i = 0; i < wserver->nLoops; i++) {
+    if (pthread_create(&wserver->loops[i].thread, NULL, loopThread, (void*)&wserver->loops[i]) != 0) {
+      *err = errInit;
+      wsDrain(wserver, 0);
+      return;
+    }
+    wserver->loops[i].running = 1;
+  }
+  wsStartRoutes(wserver, err);
+  if (*err != errOk) {
+    wsDrain(wserver, 0);
+    return;
+  }
+  // client threads are never joined
+  if (pthread_attr_init(&threadAttr) != 0 || pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED) != 0) {
+    *err = errInit;
+    wsDrain(wserver, 0);
+    return;
+  }
+
+  // acking the takeover to the previous process, which then stops accepting
+  if (wserver->upgradeFd != -1) {
+    cmd = 'r';
+    if (write(wserver->upgradeFd, &cmd, 1) != 1) {
+      printErr(errNet);
+    }
+    close(wserver->upgradeFd);
+    wserver->upgradeFd = -1;
+  }
+
+  wsLog("server listening \n");
+
+  *err = errOk;
+
+  while (!stop) {
+    fds[0] = (struct pollfd){.fd = wserver->ctlPipe[0], .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = upgradeSock, .events = POLLIN};
+    for (int i = 0; i < wserver->nListeners; i++) {
+      fds[2+i] = (struct pollfd){.fd = wserver->listeners[i].socket, .events = POLLIN};
+    }
+    if (poll(fds, 2+wserver->nListeners, upgradeSock == -1 ? -1 : WS_TIMER_TICK_MS) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      *err = errNet;
+      break;
+    }
+
+    while (fds[0].revents & POLLIN && read(wserver->ctlPipe[0], &cmd, 1) == 1) {
+      if (cmd == 's') {
+        stop = 1;
+      } else if (cmd == 'u' && upgradeSock == -1) {
+        wsLog("upgrading binary \n");
+        upgradeSock = wsUpgradeExec(wserver, &upgradePid, err);
+        if (upgradeSock == -1) {
+          printErr(*err);
+          *err = errOk;
+        }
+        upgradeDeadline = wsNowNs() + WS_UPGRADE_TIMEOUT_MS * 1000000ULL;
+      }
+    }
+
+    if (upgradeSock != -1) {
+      if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (read(upgradeSock, &cmd, 1) == 1) {
+          // the new process accepts on the same sockets, queued connections are served by it
+          wsLog("upgraded binary took over \n");
+          stop = 1;
+          handedOver = 1;
+        } else {
+          wsLog("upgrade failed, binary exited \n");
+          waitpid(upgradePid, NULL, WNOHANG);
+        }
+        close(upgradeSock);
+        upgradeSock = -1;
+      } else if (wsNowNs() > upgradeDeadline) {
+        wsLog("upgrade failed, binary did not take over in time \n");
+        kill(upgradePid, SIGKILL);
+        waitpid(upgradePid, NULL, 0);
+        close(upgradeSock);
+        upgradeSock = -1;
+      }
+    }
+
+    for (int i = 0; i < wserver->nListeners && !stop; i++) {
+      if (fds[2+i].revents & POLLIN) {
+        wsAcceptBatch(wserver, &wserver->listeners[i], &threadAttr, err);
+        stop = *err != errOk;
+      }
+    }
+  }
+
+  pthread_attr_destroy(&threadAttr);
+  wsDrain(wserver, handedOver);
+}
+
+// starts serving without blocking the calling thread (wsConfig.driven), the counterpart of wsListen for applications with
+// an event loop of their own: they watch wsDriveFd for readability and call wsDrive once it's readable or wsDriveTimeout passed
+// connections are served by coroutines which only run within wsDrive (on the calling thread)
+void wsStart(webserver *wserver, int *err) {
+  if (!wserver->config.driven || wserver->drive.fd != -1) {
+    *err = errInit;
+    return;
+  }
+  wserver->mutexLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  wsStartRoutes(wserver, err);
+  if (*err != errOk) {
+    return;
+  }
+
+  // level triggered, the nested loop epoll instance is readable while it has ready events
+  wserver->drive.fd = epoll_create1(EPOLL_CLOEXEC);
+  if (wserver->drive.fd == -1) {
+    *err = errInit;
+    return;
+  }
+  int fds[2+WS_MAX_LISTENERS] = {wserver->loops[0].epollFd, wserver->ctlPipe[0]};
+  for (int i = 0; i < wserver->nListeners; i++) {
+    fds[2+i] = wserver->listeners[i].socket;
+  }
+  for (int i = 0; i < 2+wserver->nListeners; i++) {
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[i]};
+    if (epoll_ctl(wserver->drive.fd, EPOLL_CTL_ADD, fds[i], &event) != 0) {
+      *err = errInit;
+      return;
+    }
+  }
+  timerWheelInit(&wserver->loops[0].timers, wsNowTicks());
+  wsLog("server listening \n");
+  *err = errOk;
+}
+
+// returns the fd the application waits on for readability (e.g. in its own epoll instance) to call wsDrive
+int wsDriveFd(webserver *wserver) {
+  return wserver->drive.fd;
+}
+
+// returns the time in ms after which wsDrive has to be called even if wsDriveFd isn't readable (timeouts & the Date field),
+// -1 while there are no connections
+int wsDriveTimeout(webserver *wserver) {
+  return atomic_load(&wserver->loops[0].nCoroutines) > 0 || wserver->drive.draining ? WS_TIMER_TICK_MS : -1;
+}
+
+// accepts pending connections & runs the coroutines which are ready without blocking, stops on wsStop (upgrades aren't supported)
+// returns 1 while serving, 0 once the server has been stopped & drained (or failed), it's freed with freeWs afterwards
+int wsDrive(webserver *wserver, int *err) {
+  struct wsLoop *loop = &wserver->loops[0];
+  char cmd;
+
+  *err = errOk;
+  if (wserver->drive.fd == -1) {
+    *err = errInit;
+    return 0;
+  }
+  while (read(wserver->ctlPipe[0], &cmd, 1) == 1) {
+    if (cmd == 's' && !wserver->drive.draining) {
+      wserver->drive.draining = 1;
+      wserver->drive.deadline = wsNowNs() + (uint64_t)wserver->config.drainTimeoutMs * 1000000ULL;
+      wsDrainBegin(wserver, 0);
+    }
+  }
+
+  // the timer thread's tick, the wheel catches up with the current tick
+  pthread_mutex_lock(&wserver->timerLock);
+  int nExpired = wsTimerTick(wserver);
+  pthread_mutex_unlock(&wserver->timerLock);
+  if (nExpired > 0) {
+    wsLog("connection(s) timed out \n");
+  }
+
+  for (int i = 0; i < wserver->nListeners && !wserver->drive.draining; i++) {
+    wsAcceptBatch(wserver, &wserver->listeners[i], NULL, err);
+    if (*err != errOk) {
+      wserver->drive.draining = 1;
+      wserver->drive.deadline = wsNowNs() + (uint64_t)wserver->config.drainTimeoutMs * 1000000ULL;
+      wsDrainBegin(wserver, 0);
+    }
+  }
+
+  wsCurrentLoop = loop;
+  int ok = loopStep(loop, 0);
+  wsCurrentLoop = NULL;
+  if (!ok) {
+    *err = errNet;
+  }
+
+  if (wserver->drive.draining) {
+    pthread_mutex_lock(&wserver->admission.lock);
+    int nActive = wserver->admission.nActive;
+    pthread_mutex_unlock(&wserver->admission.lock);
+    if (nActive > 0 && ok) {
+      if (!wserver->drive.forced && wsNowNs() > wserver->drive.deadline) {
+        wsLog("drain deadline passed, shutting down remaining connections \n");
+        connShutdownAll(wserver, 0);
+        wserver->drive.forced = 1;
+      }
+      // connections which became idle meanwhile are closed as well
+      connShutdownAll(wserver, 1);
+      return 1;
+    }
+    blockingStop(&wserver->blocking);
+    loopReleaseStacks(loop);
+    wsLog("server drained \n");
+    return 0;
+  }
+  return ok;
+}
+
+// frees the webserver struct and all allocated attributes
+void freeWs(webserver *wserver) {
+  freeRoutes(wserver);
+  wsCloseListeners(wserver, 0);
+  if (wserver->ctlPipe[0] != -1) {
+    close(wserver->ctlPipe[0]);
+    close(wserver->ctlPipe[1]);
+  }
+  if (wserver->drive.fd != -1) {
+    close(wserver->drive.fd);
+  }
+  free(wserver->exePath);
+  free(wserver->admission.queue);
+  free(wserver->admission.shedResp);
+  free(wserver->rate.slots);
+  free(wserver->rate.resp[0]);
+  free(wserver->rate.resp[1]);
+  for (int i = 0; i < WS_TRACE_RINGS; i++) {
+    free(atomic_load(&wserver->tracer.rings[i]));
+  }
+  freeCache(wserver->cache);
+  for (int i = 0; i < wserver->nLoops; i++) {
+    loopFree(&wserver->loops[i]);
+  }
+  free(wserver->loops);
+  blockingFree(&wserver->blocking);
+  if (wserver->snapshot.base != NULL) {
+    munmap(wserver->snapshot.base, wserver->snapshot.size);
+  }
+#ifdef WS_TLS
+  SSL_CTX_free(wserver->tlsCtx);
+#endif
+  free(wserver);
+}
+
+// handler of the /stats route, replies the admission control counters as json
+void statsHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  webserver *wserver = (webserver*)ctx;
+  (void)req;
+
+  pthread_mutex_lock(&wserver->admission.lock);
+  int nActive = wserver->admission.nActive;
+  int nQueued = wserver->admission.nQueued;
+  unsigned long nShed = wserver->admission.nShed;
+  pthread_mutex_unlock(&wserver->admission.lock);
+
+  respAddHeader(resp, "Content-type", "application/json");
+  respAddHeader(resp, "Cache-Control", "no-store");
+  respPrintf(resp, "{\"active\": %d, \"queued\": %d, \"shed\": %lu", nActive, nQueued, nShed);
+#ifdef WS_TLS
+  respPrintf(resp, ", \"tlsHandshakes\": %lu, \"tlsResumed\": %lu, \"tlsFailed\": %lu, \"tlsKtls\": %lu, \"tlsHandshakeCpuUs\": %llu",
+    atomic_load(&wserver->tlsStats.handshakes), atomic_load(&wserver->tlsStats.resumed), atomic_load(&wserver->tlsStats.failed),
+    atomic_load(&wserver->tlsStats.ktls), atomic_load(&wserver->tlsStats.cpuNs) / 1000);
+#endif
+  if (wserver->cache != NULL) {
+    struct wsCache *cache = wserver->cache;
+    respPrintf(resp, ", \"cacheHits\": %lu, \"cacheStaleHits\": %lu, \"cacheMisses\": %lu, \"cacheStores\": %lu, \"cacheEvictions\": %lu, \"cacheRejected\": %lu",
+      atomic_load(&cache->hits), atomic_load(&cache->staleHits), atomic_load(&cache->misses), atomic_load(&cache->stores),
+      atomic_load(&cache->evictions), atomic_load(&cache->rejected));
+  }
+  if (wserver->nLoops > 0) {
+    int nCoroutines = 0;
+    for (int i = 0; i < wserver->nLoops; i++) {
+      nCoroutines += atomic_load(&wserver->loops[i].nCoroutines);
+    }
+    respPrintf(resp, ", \"loops\": %d, \"coroutines\": %d", wserver->nLoops, nCoroutines);
+  }
+  if (wserver->rate.slots != NULL) {
+    respPrintf(resp, ", \"rateLimited\": %lu, \"rateLimitedConns\": %lu", atomic_load(&wserver->rate.limited), atomic_load(&wserver->rate.limitedConns));
+  }
+  if (wserver->blocking.nThreads > 0) {
+    struct wsBlockingPool *pool = &wserver->blocking;
+    pthread_mutex_lock(&pool->lock);
+    respPrintf(resp, ", \"blockingThreads\": %d, \"blockingRunning\": %d, \"blockingQueued\": %d, \"blockingPeakQueued\": %d, \"blockingCompleted\": %lu, \"blockingRejected\": %lu",
+      pool->nThreads, pool->nRunning, pool->nQueued, pool->peakQueued, pool->completed, pool->rejected);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  respPrintf(resp, "}");
+}
+
+// handler of the /admin/trace route (admin socket only), replies the recorded spans of the traced requests in the Chrome trace event format (Perfetto, chrome://tracing)
+// the events are dumped ring by ring until the response body is full, the rings keep them
+void traceHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  webserver *wserver = (webserver*)ctx;
+  struct wsTracer *tracer = &wserver->tracer;
+  int pid = (int)getpid();
+  int truncated = 0;
+  (void)req;
+
+  respAddHeader(resp, "Content-type", "application/json");
+  respAddHeader(resp, "Cache-Control", "no-store");
+  respPrintf(resp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  int first = 1;
+  for (int i = 0; i < WS_TRACE_RINGS && !truncated; i++) {
+    struct traceRing *ring = atomic_load_explicit(&tracer->rings[i], memory_order_acquire);
+    if (ring == NULL) {
+      continue;
+    }
+    // writers of the ring drop their events meanwhile
+    while (atomic_exchange_explicit(&ring->busy, 1, memory_order_acquire)) {
+      sched_yield();
+    }
+    uint64_t from = ring->written > WS_TRACE_RING_SIZE ? ring->written - WS_TRACE_RING_SIZE : 0;
+    for (uint64_t n = from; n < ring->written; n++) {
+      // an event takes less than 256 bytes, the closing brackets included
+      if (resp->bodySize > WS_MAX_RESP_BODY_SIZE - 256) {
+        truncated = 1;
+        break;
+      }
+      const struct traceEvent *event = &ring->events[n & (WS_TRACE_RING_SIZE - 1)];
+      // paths are json escaped, control characters & quotes are replaced
+      char path[sizeof event->path];
+      int j;
+      for (j = 0; event->path[j] != 0; j++) {
+        path[j] = (unsigned char)event->path[j] < 0x20 || event->path[j] == '"' || event->path[j] == '\\' ? '?' : event->path[j];
+      }
+      path[j] = 0;
+      respPrintf(resp, "%s\n{\"name\": \"%s\", \"cat\": \"request\", \"ph\": \"X\", \"ts\": %llu.%03llu, \"dur\": %llu.%03llu, \"pid\": %d, \"tid\": %d, \"args\": {\"req\": %u%s%s%s}}",
+        first ? "" : ",", traceSpanNames[event->stage], (unsigned long long)(event->startNs / 1000), (unsigned long long)(event->startNs % 1000),
+        (unsigned long long)(event->durNs / 1000), (unsigned long long)(event->durNs % 1000), pid, event->tid, event->reqId,
+        event->stage == spanRequest ? ", \"path\": \"" : "", event->stage == spanRequest ? path : "", event->stage == spanRequest ? "\"" : "");
+      first = 0;
+    }
+    atomic_store_explicit(&ring->busy, 0, memory_order_release);
+  }
+  respPrintf(resp, "\n], \"otherData\": {\"sample\": %d, \"dropped\": %lu, \"truncated\": %d}}", wserver->config.traceSample,
+    atomic_load(&tracer->dropped), truncated);
+}
+
+// handler of the /admin/profile route (admin & blocking), samples the stacks of all threads for ?seconds=n (WS_PROF_SECONDS by default)
+// and replies them folded for flame graphs, 409 while another profile is running
+void profileHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct wsSlice param;
+  char number[16];
+  unsigned long seconds = WS_PROF_SECONDS;
+  int err;
+  (void)ctx;
+
+  if (getQueryParam(req, "seconds", &param)) {
+    if (param.size == 0 || param.size >= (int)sizeof number) {
+      respSetStatus(resp, 400);
+      return;
+    }
+    memcpy(number, param.data, param.size); /* Flawfinder: ignore */ // size checked above
+    number[param.size] = '\0';
+    char *end;
+    seconds = strtoul(number, &end, 10);
+    if (*end != '\0' || seconds == 0 || seconds > WS_PROF_MAX_SECONDS) {
+      respSetStatus(resp, 400);
+      return;
+    }
+  }
+  struct wsProfile *prof = profRun(seconds * 1000, WS_PROF_HZ, &err);
+  if (prof == NULL) {
+    respSetStatus(resp, err == errFailed ? 409 : 500);
+    return;
+  }
+  int written = profFold(prof, resp);
+  char value[16];
+  snprintf(value, sizeof value, "%d", atomic_load(&prof->nTaken));
+  respAddHeader(resp, "X-Profile-Samples", value);
+  snprintf(value, sizeof value, "%d", atomic_load(&prof->nTaken) - written);
+  respAddHeader(resp, "X-Profile-Dropped", value);
+  respAddHeader(resp, "Content-type", "text/plain");
+  respAddHeader(resp, "Cache-Control", "no-store");
+  freeProfile(prof);
+}
+
+#ifndef WS_LIBRARY
+// the example routes & binary and the tests aren't part of the library
+
+// handler of the /upload route, streams the request body in constant memory and replies its size and checksum
+void uploadHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  char buff[WS_BUFF_SIZE];
+  long long size = 0;
+  uint32_t checksum = 0;
+  int readSize, err;
+  (void)ctx;
+
+  while ((readSize = readBody(req, buff, WS_BUFF_SIZE, &err)) > 0) {
+    for (int i = 0; i < readSize; i++) {
+      checksum = checksum * 31 + (uint8_t)buff[i];
+    }
+    size += readSize;
+  }
+  if (err != errOk) {
+    return;
+  }
+  respAddHeader(resp, "Content-type", "application/json");
+  respPrintf(resp, "{\"size\": %lld, \"checksum\": %u}", size, checksum);
+}
+
+// handler of the /hello/:name route, greets the captured name
+void helloHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct wsSlice name;
+  (void)ctx;
+
+  if (!getPathParam(req, "name", &name)) {
+    respSetStatus(resp, 400);
+    return;
+  }
+  respAddHeader(resp, "Content-type", "text/plain");
+  respPrintf(resp, "hello %.*s", name.size, name.data);
+}
+
+// counts the primes in the range by trial division, ranges above 64k numbers are split in halves counted in parallel
+void primesCount(void *arg) {
+  struct primesRange *range = (struct primesRange*)arg;
+  if (range->to - range->from > 65536) {
+    unsigned long mid = range->from + (range->to - range->from) / 2;
+    struct primesRange halves[2] = {
+      {.executor = range->executor, .from = range->from, .to = mid},
+      {.executor = range->executor, .from = mid, .to = range->to}
+    };
+    struct wsTask task = {.fn = primesCount, .arg = &halves[0]};
+    struct wsTaskGroup group;
+    atomic_init(&group.pending, 0);
+    execFork(range->executor, &group, &task);
+    primesCount(&halves[1]);
+    execJoin(range->executor, &group);
+    range->count = halves[0].count + halves[1].count;
+    return;
+  }
+  range->count = 0;
+  for (unsigned long i = range->from; i < range->to; i++) {
+    int prime = i >= 2;
+    for (unsigned long d = 2; d * d <= i && prime; d++) {
+      prime = i % d != 0;
+    }
+    range->count += prime;
+  }
+}
+
+// handler of the /primes/:n route, counts the primes below n (at most 10^7) on the executor (ctx)
+void primesHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct wsSlice param;
+  char number[16];
+
+  if (!getPathParam(req, "n", &param) || param.size == 0 || param.size >= (int)sizeof number) {
+    respSetStatus(resp, 400);
+    return;
+  }
+  memcpy(number, param.data, param.size); /* Flawfinder: ignore */ // size checked above
+  number[param.size] = '\0';
+  char *end;
+  unsigned long n = strtoul(number, &end, 10);
+  if (*end != '\0' || n > 10000000) {
+    respSetStatus(resp, 400);
+    return;
+  }
+  struct primesRange range = {.executor = (struct wsExecutor*)ctx, .from = 0, .to = n};
+  execRun(range.executor, primesCount, &range);
+  respAddHeader(resp, "Content-type", "application/json");
+  respPrintf(resp, "{\"n\": %lu, \"primes\": %lu}", n, range.count);
+}
+
+/*
+ * Server Main.
+ */
+int main(int argc, char **argv) {
+  int err = errOk;
+  struct wsConfig config;
+
+  // offline compilation of a route config: --compile-routes <config> <snapshot>
+  if (argc == 4 && strcmp(argv[1], "--compile-routes") == 0) {
+    wsCompileRoutes(argv[2], argv[3], &err);
+    if (err != errOk) {
+      printErr(err);
+      return EXIT_FAILURE;
+    }
+    return 0;
+  }
+
+  webserver *wserver = createWs(&err);
+  if (err != errOk) {
+    printErr(err);
+    return EXIT_FAILURE;
+  }
+
+  wsDefaultConfig(&config, 8080);
+  // connections are served by coroutines on an event loop per core, which affords far more concurrent connections
+  config.nLoops = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  config.maxConns = 16384;
+  // 1 in 1000 requests is traced, the spans are dumped by /admin/trace (admin socket only)
+  config.traceSample = 1000;
+  // admin routes (/admin/profile) are only served on a unix socket accessible to the user running the server
+  struct wsListenerConfig *adminListener = wsConfigAddListener(&config, listenerUnix, "basicWebserver.sock", 0, &err);
+  if (adminListener == NULL) {
+    printErr(err);
+    free(wserver);
+    return EXIT_FAILURE;
+  }
+  adminListener->mode = 0600;
+#ifdef WS_TLS
+  // additional tls listener if a certificate is provided in the working directory
+  if (access("cert.pem", R_OK) == 0 && access("key.pem", R_OK) == 0) {
+    config.tlsCertFile = "cert.pem";
+    config.tlsKeyFile = "key.pem";
+    struct wsListenerConfig *tlsListener = wsConfigAddListener(&config, listenerTcp, NULL, 8443, &err);
+    if (tlsListener == NULL) {
+      printErr(err);
+      free(wserver);
+      return EXIT_FAILURE;
+    }
+    tlsListener->tls = 1;
+  }
+#endif
+  wsInit(wserver, &config, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  wsLog("server initiated \n");
+
+  wsHandleSignals(wserver, argv, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  // static routes of the route config in the working directory, compiled into a snapshot on the first start
+  if (access("routes.conf", R_OK) == 0) {
+    wsLoadRoutes(wserver, "routes.conf", "routes.snap", &err);
+    if (err != errOk) {
+      printErr(err);
+      freeWs(wserver);
+      return EXIT_FAILURE;
+    }
+  }
+
+  struct httpResponse *mainRouteResponse = malloc(sizeof(struct httpResponse));
+  if (mainRouteResponse == NULL) {
+    printErr(errMemAlloc);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  mainRouteResponse->statusCode = 200;
+  mainRouteResponse->isFile = 0;
+  mainRouteResponse->contentBuff = "Hai";
+  mainRouteResponse->contentSize = 3;
+  struct httpRoute *mainRoute = createRoute("/", httpGet, mainRouteResponse, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  addRouteToWs(wserver, mainRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+
+  struct httpResponse *routeResponse = malloc(sizeof *routeResponse);
+  if (routeResponse == NULL) {
+    printErr(errMemAlloc);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  routeResponse->statusCode = 200;
+  // by marking it as file, the dynamically allocated memory from the file buffer gets freed
+  routeResponse->isFile = 1;
+  routeResponse->contentBuff = readFileToBuffer("testPage.html", &routeResponse->contentSize, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  struct httpRoute *route = createRoute("/testPage", httpGet, routeResponse, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, route, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  struct httpRoute *statsRoute = createHandlerRoute("/stats", httpGet, statsHandler, wserver, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, statsRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  // the traces contain the paths of all clients, only served on the admin socket
+  struct httpRoute *traceRoute = createHandlerRoute("/admin/trace", httpGet, traceHandler, wserver, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  routeSetAdmin(traceRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, traceRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  // the profiler sleeps while sampling, on the blocking pool instead of an event loop
+  struct httpRoute *profileRoute = createHandlerRoute("/admin/profile", httpGet, profileHandler, NULL, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  routeSetAdmin(profileRoute, &err);
+  routeSetBlocking(profileRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, profileRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  struct httpRoute *helloRoute = createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  // greetings are cached for a second and served stale for up to 10 more while being refreshed
+  routeSetCache(helloRoute, 1000, 10000, NULL, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, helloRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  struct httpRoute *uploadRoute = createHandlerRoute("/upload", httpPost, uploadHandler, NULL, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  routeSetMaxBodySize(uploadRoute, 64*1024*1024, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, uploadRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+
+  // cpu heavy work runs on the executor, the event loops keep serving meanwhile
+  struct wsExecutor *executor = createExecutor(0, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    return EXIT_FAILURE;
+  }
+  struct httpRoute *primesRoute = createHandlerRoute("/primes/:n", httpGet, primesHandler, executor, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    freeExecutor(executor);
+    return EXIT_FAILURE;
+  }
+  // a client can't keep all cores busy on its own
+  routeSetRateLimit(primesRoute, 10, 20, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    freeExecutor(executor);
+    return EXIT_FAILURE;
+  }
+  addRouteToWs(wserver, primesRoute, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    freeExecutor(executor);
+    return EXIT_FAILURE;
+  }
+
+  wsListen(wserver, &err);
+  if (err != errOk) {
+    printErr(err);
+    freeWs(wserver);
+    freeExecutor(executor);
+    return EXIT_FAILURE;
+  }
+
+  freeWs(wserver);
+  freeExecutor(executor);
+  return 0;
+}
+
+
+// /* tests */
+
+int testRespCraft() {
+  int err = 0;
+  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
+  if (testRouteResponse == NULL) {
+    return 1;
+  }
+  char *respBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
+  if (respBuff == NULL) {
+    return 1;
+  }
+  testRouteResponse->statusCode = 200;
+  testRouteResponse->contentBuff = "Hai";
+  testRouteResponse->contentSize = 3;
+  craftResp(testRouteResponse, 1, respBuff, WS_BUFF_SIZE, &err);
+
+  char craftedResponse[] = "HTTP/1.1 200 OK\r\n\
+Content-type: text/html, text, plain\r\n\
+Content-length: 3\r\n\
+Connection: keep-alive\r\n\
+\r\n\
+Hai";
+
+  if (strcmp(respBuff, craftedResponse) != 0) {
+    printf("NOT THE SAME \n");
+    return 1;
+  }
+  return 0;
+}
+
+int testParsing() {
+  int err = 0;
+
+  char parsingTestString[] = "GET /testPage HTTP/1.1\n\
+Host: localhost:8080\n\
+User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:95.0) Gecko/20100101 Firefox/95.0\n\
+Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\n\
+Accept-Language: de,en-US;q=0.7,en;q=0.3\n\
+Accept-Encoding: gzip, deflate\n\
+Connection: keep-alive\n\
+Upgrade-Insecure-Requests: 1\n\
+Sec-Fetch-Dest: document\n\
+Sec-Fetch-Mode: navigate\n\
+Sec-Fetch-Site: none\n\
+Sec-Fetch-User: ?1\n\
+Cache-Control: max-age=0\n\
+\n\
+";
+
+  struct httpRequest *httpReq = malloc(sizeof (struct httpRequest));
+  if (httpReq == NULL) {
+    return 1;
+  }
+  parseHttpRequest(httpReq, parsingTestString, 487, &err);
+  if (err != errOk){
+    return 1;
+  }
+
+  if (httpReq->httpVersion != 1.1 && httpReq->reqMethod != 0)  {
+    return 1;
+  }
+
+  if (strcmp(httpReq->requestUri, "/testPage") != 0) {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+int testCreateRoute() {
+  int err = 0;
+  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
+  if (testRouteResponse == NULL) {
+    return 1;
+  }
+  testRouteResponse->statusCode = 200;
+  testRouteResponse->contentBuff = "test";
+  testRouteResponse->contentSize = 4;
+  struct httpRoute *testRoute = createRoute("/test", httpGet, testRouteResponse, &err);
+  if (err != errOk) {
+    return 1;
+  }
+  free(testRoute->path);
+  free(testRoute);
+  free(testRouteResponse);
+  return 0;
+}
+
+int testWsInitAndFree() {
+  int err = 0;
+  struct wsConfig config;
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL) {
+    return 1;
+  }
+
+  wsDefaultConfig(&config, 8080);
+  wsInit(wserver, &config, &err);
+  if (err != errOk) {
+    return 1;
+  }
+
+  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
+  if (testRouteResponse == NULL) {
+    return 1;
+  }
+  testRouteResponse->statusCode = 200;
+  testRouteResponse->contentBuff = "test";
+  testRouteResponse->contentSize = 4;
+  struct httpRoute *mainRoute = createRoute("/", httpGet, testRouteResponse, &err);
+  if (err != errOk) {
+    return 1;
+  }
+
+  addRouteToWs(wserver, mainRoute, &err);
+  if (err != errOk) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int testCodel() {
+  struct codelState codel = {0};
+  uint64_t ms = 1000000ULL;
+  uint64_t target = 10*ms;
+  uint64_t interval = 100*ms;
+
+  // below target nothing is ever shed
+  for (uint64_t t = 0; t < 1000; t++) {
+    if (codelShouldDrop(&codel, t*ms, 1*ms, target, interval)) {
+      return 1;
+    }
+  }
+
+  // above target shedding only starts after a full interval
+  if (codelShouldDrop(&codel, 1000*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+  if (codelShouldDrop(&codel, 1050*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+  if (!codelShouldDrop(&codel, 1100*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+  // next drop is scheduled an interval later, not immediately
+  if (codelShouldDrop(&codel, 1101*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+  if (!codelShouldDrop(&codel, 1200*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+  // drop rate increases with the drop count (interval/sqrt(2))
+  if (!codelShouldDrop(&codel, 1271*ms, 20*ms, target, interval)) {
+    return 1;
+  }
+
+  // delay back below target leaves the dropping state
+  if (codelShouldDrop(&codel, 1300*ms, 1*ms, target, interval) || codel.dropping) {
+    return 1;
+  }
+  return 0;
+}
+
+int testTimerWheel() {
+  struct timerWheel *tw = malloc(sizeof *tw);
+  if (tw == NULL) {
+    return 1;
+  }
+  struct wsTimer timers[4] = {0};
+  // expiry ticks on level 0, 1, 2 and one which is deleted before it expires
+  uint64_t expires[4] = {10, 200, 5000, 300};
+  int nExpired = 0;
+
+  timerWheelInit(tw, 0);
+  for (int i = 0; i < 4; i++) {
+    timers[i].data = &expires[i];
+    timerAdd(tw, &timers[i], expires[i]);
+  }
+  timerDel(&timers[3]);
+
+  // advancing in irregular steps, every timer has to expire exactly at its tick
+  for (uint64_t t = 0; t <= 6000; t += 7) {
+    struct wsTimer *timer = timerWheelAdvance(tw, t);
+    while (timer != NULL) {
+      uint64_t exp = *(uint64_t*)timer->data;
+      if (exp > t || exp + 7 <= t || timer == &timers[3]) {
+        return 1;
+      }
+      nExpired++;
+      timer = timer->next;
+    }
+  }
+  if (nExpired != 3) {
+    return 1;
+  }
+  free(tw);
+  return 0;
+}
+
+int testRespBuilder() {
+  int err = 0;
+  struct respBuilder rb;
+  struct wsConn conn = {0};
+  char respBuff[WS_BUFF_SIZE];
+  char hdrBuff[WS_BUFF_SIZE];
+  conn.hdrBuff = hdrBuff;
+
+  respInit(&rb, &conn);
+  respSetStatus(&rb, 201);
+  respAddHeader(&rb, "X-Test", "1");
+  respAppendBody(&rb, "Hai", 3);
+  // forces the body buffer to grow
+  for (int i = 0; i < WS_BUFF_SIZE; i++) {
+    respPrintf(&rb, "%d", i % 10);
+  }
+  if (rb.err != errOk || rb.bodySize != 3 + WS_BUFF_SIZE || strncmp(conn.bodyBuff, "Hai0123", 7) != 0) {
+    return 1;
+  }
+
+  int size = respFinish(&rb, 0, NULL, respBuff, WS_BUFF_SIZE, &err);
+  respBuff[size] = 0;
+  char craftedHeader[] = "HTTP/1.1 201 Created\r\n\
+Content-type: text/html\r\n\
+Content-length: 1027\r\n\
+Connection: close\r\n\
+X-Test: 1\r\n\
+\r\n";
+  if (err != errOk || strcmp(respBuff, craftedHeader) != 0) {
+    return 1;
+  }
+
+  // header injection is rejected
+  respAddHeader(&rb, "X-Test", "1\r\nSet-Cookie: a=b");
+  if (rb.err == errOk) {
+    return 1;
+  }
+  free(conn.bodyBuff);
+  return 0;
+}
+
+int testParams() {
+  char scratch[WS_SCRATCH_SIZE];
+  struct wsArena arena = {.buff = scratch, .size = WS_SCRATCH_SIZE, .used = 0};
+  struct wsParams params;
+  struct wsSlice value;
+  char query[] = "a=1&msg=hello%20world+!&flag&&%6Bey=x&a=2&bad=%zz";
+
+  paramsParse(&params, query, strlen(query), &arena);
+  if (params.nParams != 6) {
+    return 1;
+  }
+  // first occurrence wins
+  if (!paramsGet(&params, "a", &value, &arena) || value.size != 1 || value.data[0] != '1') {
+    return 1;
+  }
+  // values are not copied unless they need decoding
+  if (value.data != query+2) {
+    return 1;
+  }
+  if (!paramsGet(&params, "msg", &value, &arena) || value.size != 13 || memcmp(value.data, "hello world !", 13) != 0) {
+    return 1;
+  }
+  if (!paramsGet(&params, "flag", &value, &arena) || value.size != 0) {
+    return 1;
+  }
+  // encoded keys are decoded at parse time
+  if (!paramsGet(&params, "key", &value, &arena) || value.size != 1 || value.data[0] != 'x') {
+    return 1;
+  }
+  if (!paramsGet(&params, "bad", &value, &arena) || value.size != 3 || memcmp(value.data, "%zz", 3) != 0) {
+    return 1;
+  }
+  if (paramsGet(&params, "missing", &value, &arena)) {
+    return 1;
+  }
+
+  // the query is split from the path
+  int err = 0;
+  struct httpRequest req;
+  char reqBuff[] = "GET /testPage?v=123&x=y HTTP/1.1\r\n\r\n";
+  parseHttpRequest(&req, reqBuff, strlen(reqBuff), &err);
+  req.arena = &arena;
+  if (err != errOk || strcmp(req.requestUri, "/testPage") != 0 || req.querySize != 9) {
+    return 1;
+  }
+  if (!getQueryParam(&req, "x", &value) || value.size != 1 || value.data[0] != 'y') {
+    return 1;
+  }
+  free(req.requestUri);
+  return 0;
+}
+
+int testChunkedBody() {
+  int err = 0;
+  int sv[2];
+  char body[64];
+  int bodySize = 0;
+  int readSize;
+  char readBuff[WS_BUFF_SIZE];
+  struct httpRequest req;
+  struct wsConn conn = {0};
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    return 1;
+  }
+  wserver->timerLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  wserver->config.bodyTimeoutMs = WS_BODY_TIMEOUT_MS;
+  timerWheelInit(&wserver->timers, 0);
+
+  // header & first chunk are already buffered, the rest arrives on the socket
+  char buffered[] = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5;ext=1\r\nhello\r\n";
+  char pending[] = "7\r\n, world\r\n0\r\nTrailer: x\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+  memcpy(readBuff, buffered, sizeof(buffered)-1);
+  conn.readBuff = readBuff;
+  conn.readBuffSize = sizeof(buffered)-1;
+  conn.socket = sv[0];
+  conn.timer.data = &conn;
+  if (write(sv[1], pending, sizeof(pending)-1) != sizeof(pending)-1) {
+    return 1;
+  }
+
+  req.header = readBuff;
+  req.headerSize = findHeaderEnd(readBuff, conn.readBuffSize);
+  bodyInit(&req, wserver, &conn, &err);
+  if (err != errOk || req.body.state != bodyChunkSize) {
+    return 1;
+  }
+  // reading in small steps to cross the chunk boundaries
+  while ((readSize = readBody(&req, body+bodySize, 3, &err)) > 0) {
+    bodySize += readSize;
+  }
+  if (err != errOk || bodySize != 12 || memcmp(body, "hello, world", 12) != 0 || req.body.state != bodyDone) {
+    return 1;
+  }
+  // the pipelined request stays in the read buffer
+  serveClientDone(&conn, &req);
+  if (conn.readBuffSize != 18 || memcmp(readBuff, "GET / HTTP/1.1", 14) != 0) {
+    return 1;
+  }
+
+  // content-length and chunked at once is rejected
+  char smuggled[] = "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n";
+  req.header = smuggled;
+  req.headerSize = sizeof(smuggled)-1;
+  bodyInit(&req, wserver, &conn, &err);
+  if (err == errOk) {
+    return 1;
+  }
+
+  connDisarmTimer(wserver, &conn);
+  close(sv[0]);
+  close(sv[1]);
+  free(wserver);
+  return 0;
+}
+
+int testRouter() {
+  int err = 0;
+  struct httpRequest req;
+  struct routeNode *node;
+  struct wsSlice value;
+  char *paths[] = {"/", "/users", "/users/new", "/users/:id", "/users/:id/posts", "/users/:id/posts/:post", "/files/*path", "/files/static/logo", "/use"};
+  int nPaths = sizeof(paths)/sizeof(paths[0]);
+  struct httpRoute *routes[sizeof(paths)/sizeof(paths[0])];
+  struct routeNode *root = createRouteNode("", 0, &err);
+  if (err != errOk) {
+    return 1;
+  }
+  for (int i = 0; i < nPaths; i++) {
+    routes[i] = createRoute(paths[i], httpGet, NULL, &err);
+    routeInsert(root, paths[i], routes[i], &err);
+    if (err != errOk) {
+      return 1;
+    }
+  }
+  // the same segment captured under another name is rejected
+  routeInsert(root, "/users/:name/x", routes[0], &err);
+  if (err == errOk) {
+    return 1;
+  }
+
+  // static routes
+  for (int i = 0; i < nPaths; i++) {
+    if (strchr(paths[i], ':') == NULL && strchr(paths[i], '*') == NULL && routeLookup(root, paths[i], httpGet, &req, &node) != routes[i]) {
+      return 1;
+    }
+  }
+  // static before param
+  if (routeLookup(root, "/users/new", httpGet, &req, &node) != routes[2] || req.nPathParams != 0) {
+    return 1;
+  }
+  if (routeLookup(root, "/users/123", httpGet, &req, &node) != routes[3] || !getPathParam(&req, "id", &value) || value.size != 3 || strncmp(value.data, "123", 3) != 0) {
+    return 1;
+  }
+  if (routeLookup(root, "/users/7/posts/42", httpGet, &req, &node) != routes[5] || !getPathParam(&req, "post", &value) || value.size != 2 || !getPathParam(&req, "id", &value) || value.data[0] != '7') {
+    return 1;
+  }
+  // static before wildcard, with backtracking out of the static dead end
+  if (routeLookup(root, "/files/static/logo", httpGet, &req, &node) != routes[7]) {
+    return 1;
+  }
+  if (routeLookup(root, "/files/static/other.png", httpGet, &req, &node) != routes[6] || !getPathParam(&req, "path", &value) || value.size != 16) {
+    return 1;
+  }
+  if (routeLookup(root, "/users/", httpGet, &req, &node) != NULL || routeLookup(root, "/user", httpGet, &req, &node) != NULL || routeLookup(root, "/users/1/posts/2/x", httpGet, &req, &node) != NULL) {
+    return 1;
+  }
+
+  freeRouteTree(root);
+  for (int i = 0; i < nPaths; i++) {
+    free(routes[i]->path);
+    free(routes[i]);
+  }
+  return 0;
+}
+
+int testMethodRouting() {
+  int err = 0;
+  struct httpRequest req;
+  struct routeNode *node;
+  struct httpResponse resp = {.statusCode = 200, .isFile = 0, .contentBuff = "body", .contentSize = 4};
+  struct httpRoute *getRoute = createRoute("/a", httpGet, &resp, &err);
+  struct httpRoute *postRoute = createRoute("/a", httpPost, NULL, &err);
+  struct httpRoute *putRoute = createRoute("/b/:id", httpPut, NULL, &err);
+  struct httpRoute *badRoute = createRoute("/c", httpNMethods, NULL, &err);
+  struct routeNode *root = createRouteNode("", 0, &err);
+  if (err != errOk) {
+    return 1;
+  }
+  routeInsert(root, getRoute->path, getRoute, &err);
+  routeInsert(root, postRoute->path, postRoute, &err);
+  routeInsert(root, putRoute->path, putRoute, &err);
+  if (err != errOk) {
+    return 1;
+  }
+  routeInsert(root, badRoute->path, badRoute, &err);
+  if (err == errOk) {
+    return 1;
+  }
+
+  if (routeLookup(root, "/a", httpGet, &req, &node) != getRoute || routeLookup(root, "/a", httpPost, &req, &node) != postRoute) {
+    return 1;
+  }
+  // HEAD is served by the GET route
+  if (routeLookup(root, "/a", httpHead, &req, &node) != getRoute) {
+    return 1;
+  }
+  // 405/ OPTIONS, the path matches with another method
+  if (routeLookup(root, "/a", httpDelete, &req, &node) != NULL || node == NULL || strcmp(node->allow, "GET, POST, HEAD, OPTIONS") != 0) {
+    return 1;
+  }
+  if (routeLookup(root, "/b/1", httpOptions, &req, &node) != NULL || node == NULL || strcmp(node->allow, "PUT, OPTIONS") != 0 || req.nPathParams != 1) {
+    return 1;
+  }
+  if (routeLookup(root, "/b/1", -1, &req, &node) != NULL || node == NULL) {
+    return 1;
+  }
+  // 404
+  if (routeLookup(root, "/c", httpGet, &req, &node) != NULL || node != NULL) {
+    return 1;
+  }
+
+  preSerializeResp(&resp, &err);
+  if (err != errOk || resp.headerSize[1] < 4 || strncmp(resp.header[1]+resp.headerSize[1]-4, "\r\n\r\n", 4) != 0) {
+    return 1;
+  }
+  if (memmem(resp.header[1], resp.headerSize[1], "Content-length: 4", 17) == NULL || memmem(resp.header[0], resp.headerSize[0], "Connection: close", 17) == NULL) {
+    return 1;
+  }
+
+  freeRouteTree(root);
+  free(resp.header[0]);
+  free(resp.header[1]);
+  struct httpRoute *allRoutes[] = {getRoute, postRoute, putRoute, badRoute};
+  for (int i = 0; i < 4; i++) {
+    free(allRoutes[i]->path);
+    free(allRoutes[i]);
+  }
+  return 0;
+}
+
+int testSerializeHeader() {
+  int err = 0;
+  char digits[21];
+  char out[WS_BUFF_SIZE];
+  uint64_t values[] = {0, 7, 10, 99, 100, 1024, 99999, 1234567890, UINT64_MAX};
+  for (int i = 0; i < (int)(sizeof(values)/sizeof(values[0])); i++) {
+    char expected[21];
+    int size = uintToDec(digits, values[i]);
+    digits[size] = 0;
+    snprintf(expected, sizeof expected, "%llu", (unsigned long long)values[i]);
+    if (strcmp(digits, expected) != 0) {
+      return 1;
+    }
+  }
+
+  int size = serializeHeader(404, NULL, 0, 18, 1, NULL, "X-A: b\r\n", 8, out, WS_BUFF_SIZE, &err);
+  out[size] = 0;
+  if (err != errOk || strcmp(out, "HTTP/1.1 404 Not Found\r\nContent-length: 18\r\nConnection: keep-alive\r\nX-A: b\r\n\r\n") != 0) {
+    return 1;
+  }
+  // codes without a status line
+  serializeHeader(299, NULL, 0, 0, 1, NULL, NULL, 0, out, WS_BUFF_SIZE, &err);
+  if (err != errParse) {
+    return 1;
+  }
+  // the size is checked before anything is written
+  out[0] = 0;
+  serializeHeader(200, NULL, 0, 0, 1, NULL, NULL, 0, out, 32, &err);
+  if (err != errSecCheck || out[0] != 0) {
+    return 1;
+  }
+  return 0;
+}
+
+int testDateHeader() {
+  struct wsDate date;
+  char expected[WS_DATE_HDR_SIZE+3];
+  struct tm tm;
+  memset(&date, 0, sizeof date);
+
+  wsDateUpdate(&date);
+  const char *current = wsDateGet(&date);
+  gmtime_r(&date.second, &tm);
+  strftime(expected, sizeof expected, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n\r\n", &tm);
+  if (current == NULL || strlen(current) != WS_DATE_HDR_SIZE+2 || strcmp(current, expected) != 0) {
+    return 1;
+  }
+  // formatted once per second only
+  wsDateUpdate(&date);
+  if (date.second == time(NULL) && wsDateGet(&date) != current) {
+    return 1;
+  }
+  // a new second is published in the next slot
+  date.second--;
+  wsDateUpdate(&date);
+  if (wsDateGet(&date) == current || date.next != 2) {
+    return 1;
+  }
+  return 0;
+}
+
+// compares the header serializer to the former snprintf based respFinish
+int benchSerializeHeader() {
+  int err = 0;
+  int n = 1000000;
+  char out[WS_BUFF_SIZE];
+  char hdr[] = "Content-type: text/plain\r\n";
+  uint64_t sum = 0;
+
+  uint64_t start = wsNowNs();
+  for (int i = 0; i < n; i++) {
+    int size = snprintf(out, sizeof out, "HTTP/%s %d %s\r\n%sContent-length: %d\r\nConnection: %s\r\n", HTTP_VERSION, 200, "OK", "", i, "keep-alive");
+    memcpy(out+size, hdr, sizeof(hdr)-1);
+    size += sizeof(hdr)-1;
+    out[size++] = CR;
+    out[size++] = LF;
+    sum += size;
+  }
+  uint64_t printfNs = wsNowNs() - start;
+
+  start = wsNowNs();
+  for (int i = 0; i < n; i++) {
+    sum += serializeHeader(200, NULL, 0, i, 1, NULL, hdr, sizeof(hdr)-1, out, sizeof out, &err);
+  }
+  uint64_t serializerNs = wsNowNs() - start;
+
+  printf("header serialization benchmark (%llu): snprintf %.1f ns/header, serializer %.1f ns/header \n", (unsigned long long)sum, (double)printfNs / n, (double)serializerNs / n);
+  return err != errOk;
+}
+
+// compares the route tree lookup to the former linear strcmp scan over the routes arr
+int benchRouter() {
+  int err = 0;
+  int nRoutes = 1000;
+  int nLookups = 1000000;
+  char path[64];
+  struct httpRequest req;
+  struct routeNode *node;
+  struct httpRoute **routes = malloc(sizeof(struct httpRoute*) * nRoutes);
+  char **lookups = malloc(sizeof(char*) * 1024);
+  struct routeNode *root = createRouteNode("", 0, &err);
+  if (routes == NULL || lookups == NULL || err != errOk) {
+    return 1;
+  }
+  for (int i = 0; i < nRoutes; i++) {
+    snprintf(path, sizeof path, "/api/v1/resource%d/items", i);
+    routes[i] = createRoute(path, httpGet, NULL, &err);
+    routeInsert(root, path, routes[i], &err);
+  }
+  for (int i = 0; i < 1024; i++) {
+    snprintf(path, sizeof path, "/api/v1/resource%d/items", (i * 7919) % nRoutes);
+    lookups[i] = strdup(path);
+  }
+
+  uint64_t found = 0;
+  uint64_t start = wsNowNs();
+  for (int i = 0; i < nLookups; i++) {
+    for (int r = 0; r < nRoutes; r++) {
+      if (strcmp(routes[r]->path, lookups[i & 1023]) == 0) {
+        found += r;
+        break;
+      }
+    }
+  }
+  uint64_t linearNs = wsNowNs() - start;
+
+  start = wsNowNs();
+  for (int i = 0; i < nLookups; i++) {
+    found += routeLookup(root, lookups[i & 1023], httpGet, &req, &node) != NULL;
+  }
+  uint64_t treeNs = wsNowNs() - start;
+
+  printf("router benchmark (%d routes, %llu): linear scan %.1f ns/lookup, radix tree %.1f ns/lookup \n", nRoutes, (unsigned long long)found, (double)linearNs / nLookups, (double)treeNs / nLookups);
+
+  freeRouteTree(root);
+  for (int i = 0; i < nRoutes; i++) {
+    free(routes[i]->path);
+    free(routes[i]);
+  }
+  for (int i = 0; i < 1024; i++) {
+    free(lookups[i]);
+  }
+  free(routes);
+  free(lookups);
+  return 0;
+}
+
+void *benchListenThread(void *args) {
+  int err = errOk;
+  wsListen((webserver*)args, &err);
+  return NULL;
+}
+
+// sends req on sock (with MSG_FASTOPEN to addr if set) and reads until the response ends with "ok" or the connection is closed
+// returns the latency in ns or 0 on failure
+uint64_t benchRoundTrip(int sock, const char *req, struct sockaddr_in *fastOpenAddr) {
+  char buff[WS_BUFF_SIZE];
+  int size = 0;
+  int reqSize = strlen(req); /* Flawfinder: ignore */ // \0 terminated literals
+  uint64_t start = wsNowNs();
+  ssize_t rc;
+  if (fastOpenAddr != NULL) {
+    rc = sendto(sock, req, reqSize, MSG_FASTOPEN | MSG_NOSIGNAL, (struct sockaddr*)fastOpenAddr, sizeof *fastOpenAddr);
+  } else {
+    rc = send(sock, req, reqSize, MSG_NOSIGNAL);
+  }
+  if (rc != reqSize) {
+    return 0;
+  }
+  while (size < 2 || strncmp(buff+size-2, "ok", 2) != 0) {
+    rc = recv(sock, buff+size, sizeof(buff)-size, 0); /* Flawfinder: ignore */ // bounded by the buffer size
+    if (rc <= 0) {
+      return 0;
+    }
+    size += rc;
+  }
+  return wsNowNs() - start;
+}
+
+int benchCompareNs(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// measures the small response latency (persistent connection round trips & new connections) with each tcp tuning option
+// and over a unix socket listener instead of loopback tcp
+int benchTcpTuning() {
+  int nRequests = 2000;
+  int nConns = 500;
+  char *variants[] = {"defaults", "no TCP_NODELAY", "TCP_CORK", "TCP_DEFER_ACCEPT", "TCP_FASTOPEN", "4k socket buffers", "unix socket"};
+  char path[64];
+  snprintf(path, sizeof path, "/tmp/wsBench-%d.sock", (int)getpid());
+  uint64_t *latencies = malloc(sizeof(uint64_t) * nRequests);
+  if (latencies == NULL) {
+    return 1;
+  }
+
+  for (int v = 0; v < (int)(sizeof(variants)/sizeof(variants[0])); v++) {
+    int err = errOk;
+    struct wsConfig config;
+    pthread_t listenThread;
+    webserver *wserver = malloc(sizeof *wserver);
+    struct httpResponse *resp = malloc(sizeof *resp);
+    if (wserver == NULL || resp == NULL) {
+      return 1;
+    }
+    wsDefaultConfig(&config, 0);
+    config.tcpNoDelay = v != 1;
+    config.tcpCork = v == 2;
+    config.deferAcceptSec = v == 3 ? 1 : 0;
+    config.fastOpenQueue = v == 4 ? 64 : 0;
+    config.sndBufSize = config.rcvBufSize = v == 5 ? 4096 : 0;
+    if (v == 6) {
+      config.nListeners = 0;
+      wsConfigAddListener(&config, listenerUnix, path, 0, &err);
+    }
+    wsInit(wserver, &config, &err);
+    *resp = (struct httpResponse){.statusCode = 200, .isFile = 0, .contentBuff = "ok", .contentSize = 2};
+    struct httpRoute *route = createRoute("/", httpGet, resp, &err);
+    addRouteToWs(wserver, route, &err);
+    if (err != errOk || pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+      return 1;
+    }
+    struct sockaddr_storage addr;
+    socklen_t addrSize = sizeof addr;
+    if (getsockname(wserver->listeners[0].socket, (struct sockaddr*)&addr, &addrSize) != 0) {
+      return 1;
+    }
+    if (addr.ss_family == AF_INET) {
+      ((struct sockaddr_in*)&addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+
+    // persistent connection round trips
+    int sock = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*)&addr, addrSize) != 0) {
+      return 1;
+    }
+    for (int i = 0; i < nRequests; i++) {
+      latencies[i] = benchRoundTrip(sock, "GET / HTTP/1.1\r\nHost: bench\r\n\r\n", NULL);
+    }
+    close(sock);
+    qsort(latencies, nRequests, sizeof(uint64_t), benchCompareNs);
+    double keepAliveP50 = latencies[nRequests/2] / 1000.0, keepAliveP99 = latencies[nRequests*99/100] / 1000.0;
+
+    // new connection per request (connect included)
+    for (int i = 0; i < nConns; i++) {
+      uint64_t start = wsNowNs();
+      sock = socket(addr.ss_family, SOCK_STREAM, 0);
+      if (sock == -1) {
+        return 1;
+      }
+      uint64_t rtt;
+      if (v == 4) {
+        rtt = benchRoundTrip(sock, "GET / HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n", (struct sockaddr_in*)&addr);
+      } else if (connect(sock, (struct sockaddr*)&addr, addrSize) == 0) {
+        rtt = benchRoundTrip(sock, "GET / HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n", NULL);
+      } else {
+        rtt = 0;
+      }
+      latencies[i] = rtt == 0 ? 0 : wsNowNs() - start;
+      close(sock);
+    }
+    qsort(latencies, nConns, sizeof(uint64_t), benchCompareNs);
+
+    printf("tcp tuning benchmark %-18s persistent p50 %6.1f us p99 %6.1f us, new connection p50 %6.1f us p99 %6.1f us%s \n", variants[v],
+      keepAliveP50, keepAliveP99, latencies[nConns/2] / 1000.0, latencies[nConns*99/100] / 1000.0, latencies[0] == 0 ? " (failed requests)" : "");
+
+    wsStop(wserver, 0);
+    pthread_join(listenThread, NULL);
+    freeWs(wserver);
+  }
+  free(latencies);
+  return 0;
+}
+
+// connects to addr and requests "/" (expected to reply "ok") on a new connection
+// returns 1 on success
+int testListenerRequest(struct sockaddr *addr, socklen_t addrSize) {
+  int sock = socket(addr->sa_family, SOCK_STREAM, 0);
+  if (sock == -1) {
+    return 0;
+  }
+  int ok = connect(sock, addr, addrSize) == 0 && benchRoundTrip(sock, "GET / HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n", NULL) != 0;
+  close(sock);
+  return ok;
+}
+
+int testListeners() {
+  int err = errOk;
+  struct wsConfig config;
+  struct stat st;
+  pthread_t listenThread;
+  char path[64], abstract[64];
+  snprintf(path, sizeof path, "/tmp/wsTest-%d.sock", (int)getpid());
+  snprintf(abstract, sizeof abstract, "@wsTest-%d", (int)getpid());
+
+  webserver *wserver = malloc(sizeof *wserver);
+  struct httpResponse *resp = malloc(sizeof *resp);
+  if (wserver == NULL || resp == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  // only the tcp connections are corked
+  config.tcpCork = 1;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsConfigAddListener(&config, listenerTcp, "::", 0, &err);
+  wsConfigAddListener(&config, listenerUnix, path, 0, &err)->mode = 0600;
+  wsConfigAddListener(&config, listenerUnix, abstract, 0, &err);
+  wsInit(wserver, &config, &err);
+  if (err != errOk || wserver->nListeners != 4) {
+    return 1;
+  }
+  *resp = (struct httpResponse){.statusCode = 200, .isFile = 0, .contentBuff = "ok", .contentSize = 2};
+  addRouteToWs(wserver, createRoute("/", httpGet, resp, &err), &err);
+  if (err != errOk || stat(path, &st) != 0 || !S_ISSOCK(st.st_mode) || (st.st_mode & 0777) != 0600) {
+    return 1;
+  }
+  if (pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+
+  // every listener serves the same route table
+  for (int i = 0; i < wserver->nListeners; i++) {
+    struct sockaddr_storage addr;
+    socklen_t addrSize = sizeof addr;
+    if (getsockname(wserver->listeners[i].socket, (struct sockaddr*)&addr, &addrSize) != 0) {
+      return 1;
+    }
+    if (addr.ss_family == AF_INET6) {
+      // dual-stack, reachable over IPv4 as well
+      struct sockaddr_in in = {.sin_family = AF_INET, .sin_port = ((struct sockaddr_in6*)&addr)->sin6_port, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+      if (!testListenerRequest((struct sockaddr*)&in, sizeof in)) {
+        return 1;
+      }
+      ((struct sockaddr_in6*)&addr)->sin6_addr = in6addr_loopback;
+    }
+    if (!testListenerRequest((struct sockaddr*)&addr, addrSize)) {
+      return 1;
+    }
+  }
+
+  wsStop(wserver, 0);
+  pthread_join(listenThread, NULL);
+  // the socket path is removed on stop
+  if (stat(path, &st) == 0) {
+    return 1;
+  }
+  freeWs(wserver);
+
+  // invalid endpoints
+  webserver *invalid = malloc(sizeof *invalid);
+  if (invalid == NULL) {
+    return 1;
+  }
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "not an address", 0, &err);
+  wsInit(invalid, &config, &err);
+  if (err == errOk) {
+    return 1;
+  }
+  freeWs(invalid);
+  return 0;
+}
+
+int testHpack() {
+  int err = errOk;
+  struct hpackTable decoder, encoder;
+  struct wsSlice name, value;
+  char scratch[2*WS_H2_TABLE_SIZE];
+  // RFC 7541 C.4, requests with huffman coding sharing the dynamic table
+  const uint8_t blocks[3][40] = {
+    {0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff},
+    {0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf},
+    {0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f, 0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8, 0xe8, 0xb4, 0xbf}};
+  const int blockSizes[3] = {17, 12, 24};
+  const char *expected[3] = {":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+    ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n",
+    ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"};
+  const int tableSizes[3] = {57, 110, 164};
+
+  hpackInit(&decoder, WS_H2_TABLE_SIZE);
+  for (int i = 0; i < 3; i++) {
+    char fields[256];
+    int fieldsSize = 0, pos = 0;
+    while (pos < blockSizes[i]) {
+      if (hpackDecodeField(&decoder, blocks[i], blockSizes[i], &pos, pos == 0, scratch, &name, &value, &err) != 1 || err != errOk) {
+        return 1;
+      }
+      fieldsSize += snprintf(fields+fieldsSize, sizeof fields - fieldsSize, "%.*s: %.*s\n", name.size, name.data, value.size, value.data);
+    }
+    if (strcmp(fields, expected[i]) != 0 || decoder.size != tableSizes[i]) {
+      return 1;
+    }
+  }
+  // invalid index
+  const uint8_t invalid[] = {0xff, 0x00};
+  int pos = 0;
+  hpackDecodeField(&decoder, invalid, sizeof invalid, &pos, 1, scratch, &name, &value, &err);
+  if (err == errOk) {
+    return 1;
+  }
+
+  // round trip, the second block refers to the fields added to the dynamic table by the first one, the table is shrunk in between
+  hpackInit(&encoder, WS_H2_TABLE_SIZE);
+  hpackInit(&decoder, WS_H2_TABLE_SIZE);
+  const char *roundTrip[][2] = {{":status", "200"}, {"content-type", "application/json"}, {"x-custom", "some value"}, {"date", "Mon, 19 Oct 2026 10:00:00 GMT"}};
+  for (int round = 0; round < 2; round++) {
+    uint8_t block[512];
+    int size = 0;
+    if (round == 1) {
+      encoder.maxSize = 64;
+      hpackEvict(&encoder, 64);
+      size += hpackEncodeInt(block, 64, 5, 0x20);
+    }
+    for (int i = 0; i < 4; i++) {
+      size += hpackEncodeField(&encoder, block+size, roundTrip[i][0], strlen(roundTrip[i][0]), roundTrip[i][1], strlen(roundTrip[i][1]), 1); /* Flawfinder: ignore */ // literals
+    }
+    pos = 0;
+    for (int i = 0; i < 4; i++) {
+      // the table size update is skipped
+      while (hpackDecodeField(&decoder, block, size, &pos, pos == 0, scratch, &name, &value, &err) == 0 && err == errOk) {
+      }
+      if (err != errOk || (size_t)name.size != strlen(roundTrip[i][0]) || memcmp(name.data, roundTrip[i][0], name.size) != 0 /* Flawfinder: ignore */ // literals
+        || (size_t)value.size != strlen(roundTrip[i][1]) || memcmp(value.data, roundTrip[i][1], value.size) != 0) { /* Flawfinder: ignore */ // literals
+        return 1;
+      }
+    }
+    if (pos != size || decoder.size != encoder.size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// appends n bytes to the response, for flow controlled responses spanning several frames & windows
+void testH2BigHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  char chunk[1000];
+  (void)req;
+  (void)ctx;
+  memset(chunk, 'x', sizeof chunk);
+  for (int i = 0; i < 100; i++) {
+    respAppendBody(resp, chunk, sizeof chunk);
+  }
+}
+
+// reads a complete frame from sock into frame (at least H2_FRAME_HEADER_SIZE+WS_H2_MAX_FRAME_SIZE bytes)
+// returns the payload length or -1 on failure
+int testH2ReadFrame(int sock, uint8_t *frame) {
+  if (recv(sock, frame, H2_FRAME_HEADER_SIZE, MSG_WAITALL) != H2_FRAME_HEADER_SIZE) {
+    return -1;
+  }
+  int length = frame[0] << 16 | frame[1] << 8 | frame[2];
+  if (length > WS_H2_MAX_FRAME_SIZE || (length > 0 && recv(sock, frame+H2_FRAME_HEADER_SIZE, length, MSG_WAITALL) != length)) {
+    return -1;
+  }
+  return length;
+}
+
+int testHttp2() {
+  int err = errOk;
+  struct wsConfig config;
+  pthread_t listenThread;
+  struct hpackTable encoder, decoder;
+  struct wsSlice name, value;
+  char scratch[2*WS_H2_TABLE_SIZE];
+
+  webserver *wserver = malloc(sizeof *wserver);
+  struct httpResponse *resp = malloc(sizeof *resp);
+  uint8_t *frame = malloc(H2_FRAME_HEADER_SIZE+WS_H2_MAX_FRAME_SIZE);
+  if (wserver == NULL || resp == NULL || frame == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  *resp = (struct httpResponse){.statusCode = 200, .isFile = 0, .contentBuff = "ok", .contentSize = 2};
+  addRouteToWs(wserver, createRoute("/", httpGet, resp, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/big", httpGet, testH2BigHandler, NULL, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/upload", httpPost, uploadHandler, NULL, &err), &err);
+  if (err != errOk || pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr;
+  socklen_t addrSize = sizeof addr;
+  getsockname(wserver->listeners[0].socket, (struct sockaddr*)&addr, &addrSize);
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct timeval timeout = {.tv_sec = 5};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+
+  // prior knowledge: preface & settings (small stream windows to interleave the responses), then the requests of 4 concurrent streams
+  char out[4096];
+  int outSize = 0;
+  memcpy(out, H2_PREFACE, H2_PREFACE_SIZE); /* Flawfinder: ignore */ // fits
+  outSize += H2_PREFACE_SIZE;
+  h2FrameHeader(out+outSize, 6, h2Settings, 0, 0);
+  out[outSize+9] = 0;
+  out[outSize+10] = h2SettingInitialWindow;
+  h2PutUint32(out+outSize+11, 4096);
+  outSize += 15;
+  const char *paths[4][2] = {{"GET", "/big"}, {"GET", "/"}, {"GET", "/nope"}, {"POST", "/upload"}};
+  hpackInit(&encoder, WS_H2_TABLE_SIZE);
+  for (int i = 0; i < 4; i++) {
+    uint8_t *block = (uint8_t*)out+outSize+H2_FRAME_HEADER_SIZE;
+    int size = hpackEncodeField(&encoder, block, ":method", 7, paths[i][0], strlen(paths[i][0]), 1); /* Flawfinder: ignore */ // literals
+    size += hpackEncodeField(&encoder, block+size, ":scheme", 7, "http", 4, 1);
+    size += hpackEncodeField(&encoder, block+size, ":path", 5, paths[i][1], strlen(paths[i][1]), 1); /* Flawfinder: ignore */ // literals
+    size += hpackEncodeField(&encoder, block+size, ":authority", 10, "test", 4, 1);
+    h2FrameHeader(out+outSize, size, h2Headers, H2_END_HEADERS | (i < 3 ? H2_END_STREAM : 0), i*2+1);
+    outSize += H2_FRAME_HEADER_SIZE + size;
+  }
+  // request body of stream 7 in two DATA frames
+  for (int i = 0; i < 2; i++) {
+    h2FrameHeader(out+outSize, 1000, h2Data, i == 1 ? H2_END_STREAM : 0, 7);
+    memset(out+outSize+H2_FRAME_HEADER_SIZE, 'a', 1000);
+    outSize += H2_FRAME_HEADER_SIZE + 1000;
+  }
+  if (send(sock, out, outSize, MSG_NOSIGNAL) != outSize) {
+    return 1;
+  }
+
+  // responses, the received data is acknowledged right away
+  int status[4] = {0}, bodySize[4] = {0}, done = 0, interleaved = 0, lastDataStream = 0;
+  char body[4][64];
+  hpackInit(&decoder, WS_H2_TABLE_SIZE);
+  while (done < 4) {
+    int length = testH2ReadFrame(sock, frame);
+    if (length < 0) {
+      return 1;
+    }
+    int type = frame[3], flags = frame[4];
+    uint32_t id = h2Uint32(frame+5);
+    int stream = (id-1)/2;
+    if (type == h2Settings && !(flags & H2_ACK)) {
+      h2FrameHeader(out, 0, h2Settings, H2_ACK, 0);
+      send(sock, out, H2_FRAME_HEADER_SIZE, MSG_NOSIGNAL);
+    } else if (type == h2Headers && id % 2 == 1 && stream < 4) {
+      int pos = 0;
+      while (pos < length) {
+        if (hpackDecodeField(&decoder, frame+H2_FRAME_HEADER_SIZE, length, &pos, pos == 0, scratch, &name, &value, &err) == 1
+          && name.size == 7 && memcmp(name.data, ":status", 7) == 0) {
+          status[stream] = value.size == 3 ? (value.data[0]-'0')*100 + (value.data[1]-'0')*10 + value.data[2]-'0' : -1;
+        }
+        if (err != errOk) {
+          return 1;
+        }
+      }
+      done += (flags & H2_END_STREAM) != 0;
+    } else if (type == h2Data && id % 2 == 1 && stream < 4) {
+      if (bodySize[stream] + length < (int)sizeof body[stream]) {
+        memcpy(body[stream]+bodySize[stream], frame+H2_FRAME_HEADER_SIZE, length); /* Flawfinder: ignore */ // bounds checked above
+      }
+      bodySize[stream] += length;
+      interleaved |= lastDataStream != 0 && lastDataStream != (int)id && bodySize[0] > 0 && bodySize[0] < 100000;
+      lastDataStream = id;
+      done += (flags & H2_END_STREAM) != 0;
+      if (length > 0) {
+        h2FrameHeader(out, 4, h2WindowUpdate, 0, 0);
+        h2PutUint32(out+9, length);
+        h2FrameHeader(out+13, 4, h2WindowUpdate, 0, id);
+        h2PutUint32(out+22, length);
+        send(sock, out, 26, MSG_NOSIGNAL);
+      }
+    } else if (type == h2RstStream || type == h2Goaway) {
+      return 1;
+    }
+  }
+  close(sock);
+
+  int fail = status[0] != 200 || bodySize[0] != 100000 || status[1] != 200 || bodySize[1] != 2 || memcmp(body[1], "ok", 2) != 0
+    || status[2] != 404 || status[3] != 200 || bodySize[3] >= (int)sizeof body[3] || !interleaved;
+  body[3][bodySize[3] < (int)sizeof body[3] ? bodySize[3] : 0] = 0;
+  fail = fail || strstr(body[3], "\"size\": 2000,") == NULL;
+
+  wsStop(wserver, 0);
+  pthread_join(listenThread, NULL);
+  freeWs(wserver);
+  free(frame);
+  return fail;
+}
+
+// sends req on sock & receives the response (with Content-length) into resp, the body starts at *body
+// returns the status code or 0 on failure
+int testProxyRequest(int sock, const char *req, int reqSize, char *resp, int respSize, char **body, int *bodySize) {
+  int size = 0, headSize, valueSize;
+  if (send(sock, req, reqSize, MSG_NOSIGNAL) != reqSize) {
+    return 0;
+  }
+  while ((headSize = findHeaderEnd(resp, size)) == -1 || size < headSize + *bodySize) {
+    ssize_t rc = recv(sock, resp+size, respSize-size, 0);
+    if (rc <= 0) {
+      return 0;
+    }
+    size += rc;
+    if ((headSize = findHeaderEnd(resp, size)) != -1) {
+      char *value = getHeader(resp, headSize, "Content-length", &valueSize);
+      *bodySize = value != NULL ? atoi(value) : 0;
+    }
+  }
+  *body = resp + headSize;
+  return atoi(resp + 9);
+}
+
+int testProxy() {
+  int err = errOk;
+  struct wsConfig config;
+  pthread_t upstreamThread, proxyThread;
+  char resp[150000];
+  char *body;
+  int bodySize = 0;
+
+  // chunked bodies, raw & de-chunked, split at every position by the staging buffer size
+  const char chunked[] = "5;ext=1\r\nhello\r\n1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\nTrailer: x\r\n\r\n";
+  for (int raw = 0; raw < 2; raw++) {
+    for (int buffSize = 1; buffSize < (int)sizeof chunked; buffSize++) {
+      int sv[2];
+      char buff[sizeof chunked], out[sizeof chunked];
+      int outSize = 0, size;
+      char *data;
+      socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+      send(sv[0], chunked, sizeof chunked - 1, 0);
+      send(sv[0], "HTTP", 4, 0);
+      struct proxyConn pc = {.socket = sv[1]};
+      struct proxyResp chunkedResp = {.pc = &pc, .framing = proxyChunked, .keepAlive = 1, .chunks = {.state = bodyChunkSize}, .buff = buff, .buffSize = buffSize};
+      while ((size = proxyReadBody(&chunkedResp, &data, sizeof buff, raw)) > 0) {
+        memcpy(out+outSize, data, size); /* Flawfinder: ignore */ // the body fits
+        outSize += size;
+      }
+      close(sv[0]);
+      close(sv[1]);
+      const char *expected = raw ? chunked : "helloabcdefghijklmnopqrstuvwxyz";
+      // the pipelined "HTTP" is detected if it was staged with the end of the body
+      if (size != 0 || outSize != (int)strlen(expected) || memcmp(out, expected, outSize) != 0 || chunkedResp.keepAlive != (chunkedResp.size == chunkedResp.pos)) { /* Flawfinder: ignore */ // literals
+        return 1;
+      }
+    }
+  }
+
+  // consistent hashing, keys only move to an added upstream
+  struct wsProxy *hashProxy = createProxy(proxyBalanceHash, "X-Key", &err);
+  int picks[1000], moved = 0, used[4] = {0};
+  char header[64];
+  struct httpRequest hashReq = {.requestUri = "/", .header = header};
+  for (int round = 0; round < 2; round++) {
+    proxyAddUpstream(hashProxy, "127.0.0.1", 1000 + round*3, &err);
+    proxyAddUpstream(hashProxy, "127.0.0.1", 1001 + round*3, &err);
+    if (round == 0) {
+      proxyAddUpstream(hashProxy, "127.0.0.1", 1002, &err);
+    }
+    for (int i = 0; i < 1000; i++) {
+      hashReq.headerSize = snprintf(header, sizeof header, "GET / HTTP/1.1\r\nX-Key: user%d\r\n\r\n", i);
+      int pick = proxyPick(hashProxy, &hashReq, 0) - hashProxy->upstreams;
+      if (round == 1 && pick != picks[i]) {
+        moved++;
+        if (pick < 3) {
+          return 1;
+        }
+      }
+      used[pick % 4] = 1;
+      picks[i] = pick;
+    }
+  }
+  freeProxy(hashProxy);
+  // 2 of 5 upstreams are new, about 40% of the keys move
+  if (err != errOk || moved < 250 || moved > 550 || !used[0] || !used[1] || !used[2] || !used[3]) {
+    return 1;
+  }
 
-  /*
-  ignoring respBuff flawfinder checks due to the data being developer introduced and thus cannot be exploited
-  */
+  // the upstream
+  webserver *upstream = malloc(sizeof *upstream);
+  webserver *wserver = malloc(sizeof *wserver);
+  if (upstream == NULL || wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(upstream, &config, &err);
+  addRouteToWs(upstream, createHandlerRoute("/api/big", httpGet, testH2BigHandler, NULL, &err), &err);
+  addRouteToWs(upstream, createHandlerRoute("/api/upload", httpPost, uploadHandler, NULL, &err), &err);
+  if (err != errOk || pthread_create(&upstreamThread, NULL, benchListenThread, upstream) != 0) {
+    return 1;
+  }
 
-  // status line
-  size += sprintf(respBuff+size, "HTTP/%s %d %s", HTTP_VERSION, resp->statusCode, resp->reasonPhrase); /* Flawfinder: ignore */
-  size += sprintf(respBuff+size, "\r\n"); /* Flawfinder: ignore */
-  // entity header
-  size += sprintf(respBuff+size, "Content-type: text/html, text, plain"); /* Flawfinder: ignore */
-  size += sprintf(respBuff+size, "\r\n"); /* Flawfinder: ignore */
-  size += sprintf(respBuff+size, "Content-length: %d", resp->contentSize); /* Flawfinder: ignore */
-  size += sprintf(respBuff+size, "\r\n"); /* Flawfinder: ignore */
+  // the proxy balances between a refusing upstream (bound, not listening) & the upstream
+  int refusing = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addrSize = sizeof addr;
+  bind(refusing, (struct sockaddr*)&addr, sizeof addr);
+  getsockname(refusing, (struct sockaddr*)&addr, &addrSize);
+  struct wsProxy *proxy = createProxy(proxyBalanceLeast, NULL, &err);
+  proxyAddUpstream(proxy, "127.0.0.1", ntohs(addr.sin_port), &err);
+  proxyAddUpstream(proxy, "127.0.0.1", upstream->port, &err);
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createProxyRoute("/api/*rest", httpGet, proxy, &err), &err);
+  addRouteToWs(wserver, createProxyRoute("/api/*rest", httpPost, proxy, &err), &err);
+  if (err != errOk || pthread_create(&proxyThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  addr.sin_port = htons(wserver->port);
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct timeval timeout = {.tv_sec = 5};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
 
-  // content
-  size += sprintf(respBuff+size, "\r\n"); /* Flawfinder: ignore */
-  respBuff = strncat(respBuff, resp->contentBuff, resp->contentSize); /* Flawfinder: ignore */
+  // persistent client connection, the upstream connection is pooled & reused
+  const char *getBig = "GET /api/big HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 6; i++) {
+    bodySize = 0;
+    if (testProxyRequest(sock, getBig, strlen(getBig), resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 100000 || body[99999] != 'x') { /* Flawfinder: ignore */ // literal
+      return 1;
+    }
+  }
+  char upload[6000];
+  int uploadSize = snprintf(upload, sizeof upload, "POST /api/upload HTTP/1.1\r\nHost: test\r\nContent-Length: 5000\r\n\r\n");
+  memset(upload+uploadSize, 'a', 5000);
+  bodySize = 0;
+  if (testProxyRequest(sock, upload, uploadSize+5000, resp, sizeof resp, &body, &bodySize) != 200 || strstr(body, "\"size\": 5000,") == NULL) {
+    return 1;
+  }
+  // chunked request bodies are forwarded chunked
+  const char *uploadChunked = "POST /api/upload HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n4\r\ndefg\r\n0\r\n\r\n";
+  bodySize = 0;
+  if (testProxyRequest(sock, uploadChunked, strlen(uploadChunked), resp, sizeof resp, &body, &bodySize) != 200 || strstr(body, "\"size\": 7,") == NULL) { /* Flawfinder: ignore */ // literal
+    return 1;
+  }
+  close(sock);
 
-  // checking for buffer overflow
-  // checking afterfwards and with assert due to developer caused overlow
-  // checking beforehand would require extra memory and code which is spared
-  assert(size < respBuffSize);
+  // every other request tried the refusing upstream first until it got ejected
+  int fail = atomic_load(&proxy->upstreams[0].ejections) != 1 || atomic_load(&proxy->upstreams[0].failures) != WS_PROXY_MAX_FAILS
+    || atomic_load(&proxy->upstreams[1].connects) != 1 || atomic_load(&proxy->upstreams[1].requests) != 8;
 
-  *err = errOk;
+  wsStop(wserver, 0);
+  pthread_join(proxyThread, NULL);
+  freeWs(wserver);
+  freeProxy(proxy);
+  wsStop(upstream, 0);
+  pthread_join(upstreamThread, NULL);
+  freeWs(upstream);
+  close(refusing);
+  return fail;
 }
 
-// parses incoming httpRequest from reqBuff to the httpRequest struct
-void parseHttpRequest(struct httpRequest *req, char *reqBuff, int reqBuffSize, int *err) {
-  #ifdef DEBUG
-  printf("------------ request -------------\n");
-  printf("%s \n", reqBuff);
-  printf("------------ request -------------\n");
-  #endif
+// replies the number of calls of the handler (ctx), with a Set-Cookie field on /cache/cookie
+void testCacheHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  int calls = atomic_fetch_add((atomic_int*)ctx, 1) + 1;
+  if (strcmp(req->requestUri, "/cache/cookie") == 0) {
+    respAddHeader(resp, "Set-Cookie", "id=1");
+  }
+  respPrintf(resp, "%d", calls);
+}
 
-  char *tok;
-  int endOfParse = 0;
+int testCache() {
+  int err = errOk;
+  int refresh;
+  char key[WS_CACHE_KEY_SIZE];
 
-  int iElement = 0;
-  int iElementSize = 0;
-  int iElementUsedMem = 0;
+  // query parameter order doesn't matter, vary field values do
+  struct httpRoute keyRoute = {.handler = testCacheHandler};
+  routeSetCache(&keyRoute, 1000, 0, "Accept-Encoding, X-Tenant", &err);
+  char header[] = "GET /a HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n";
+  struct httpRequest keyReq = {.requestUri = "/a", .query = "b=2&&a=1", .querySize = 8, .header = header, .headerSize = sizeof header - 1};
+  int keySize = cacheKey(&keyRoute, &keyReq, key, sizeof key);
+  free(keyRoute.cacheVary);
+  if (err != errOk || keyRoute.nCacheVary != 2 || keySize != 16 || memcmp(key, "/a?a=1&b=2\ngzip\n", keySize) != 0) {
+    return 1;
+  }
 
-  for (int i = 0; i<reqBuffSize; i++) {
-    // request line parsing
-    if (reqBuff[i] == SP || (reqBuff[i] == CR && reqBuff[i+1] == LF)) {
-      if (iElement == 0) {
-        iElementSize = i;
-      } else {
-        iElementSize = (i-iElementUsedMem);
-      }
-      switch (iElement) {
-        case 0:
-          if (strncmp(reqBuff+iElementUsedMem, "GET", iElementSize) == 0) {
-            req->reqMethod = httpGet;
-          }
-          break;
-        case 1:
-          req->requestUri = malloc(sizeof(char)*iElementSize);
-          if (req->requestUri == NULL) {
-            *err = errMemAlloc;
-            return;
-          }
-          memcpy(req->requestUri, reqBuff+iElementUsedMem, iElementSize);/* Flawfinder: ignore */ // in the line above memory is adequately allocated
-          removeSpaces(req->requestUri, iElementSize);
-          req->requestUri[iElementSize] = 0;
-          break;
-        case 2:
-          // extracing version number - http/x.x
-          // !strtok directly used on reqBuff since it is the last parsed element!
-          // terminating character ensured by the clientThread which hands the reqBuff to this function
-          tok = strtok(reqBuff+iElementUsedMem, "/");
-          tok = strtok(NULL, "/");
-          // if conversion fails atof returns a 0.0 value - no other err handling possible
-          req->httpVersion = atof(tok);
-          endOfParse = 1;
-          break;
-      }
-      iElementUsedMem += iElementSize;
-      iElement++;
-      if (endOfParse)
-        break;
+  // fresh, stale (refreshed by one request at a time) & dropped after the stale window
+  struct wsCache *cache = createCache(WS_CACHE_SHARDS*64*1024, &err);
+  char hdrBuff[WS_BUFF_SIZE], respBuff[WS_BUFF_SIZE];
+  struct wsConn conn = {.hdrBuff = hdrBuff, .respBuff = respBuff};
+  struct httpRoute route = {.cacheTtlMs = 100, .cacheStaleMs = 1000};
+  struct respBuilder rb;
+  struct cacheEntry *entry;
+  uint64_t hash = cacheHash("/stale", 6);
+  respInit(&rb, &conn);
+  respAppendBody(&rb, "body", 4);
+  cachePut(cache, hash, "/stale", 6, &route, &rb, 1000);
+  int fail = 0;
+  entry = cacheGet(cache, hash, "/stale", 6, 1050, 1, &refresh);
+  fail |= entry == NULL || refresh || entry->bodySize != 4 || memcmp(entry->header[1] + entry->headerSize[1] - 4, "\r\n\r\n", 4) != 0;
+  cacheRelease(entry);
+  entry = cacheGet(cache, hash, "/stale", 6, 1200, 1, &refresh);
+  fail |= entry == NULL || !refresh;
+  cacheRelease(entry);
+  entry = cacheGet(cache, hash, "/stale", 6, 1200, 1, &refresh);
+  fail |= entry == NULL || refresh;
+  cacheRefreshDone(cache, entry);
+  cacheRelease(entry);
+  entry = cacheGet(cache, hash, "/stale", 6, 1200, 1, &refresh);
+  fail |= entry == NULL || !refresh;
+  cacheRelease(entry);
+  fail |= cacheGet(cache, hash, "/stale", 6, 2200, 1, &refresh) != NULL;
+  if (fail) {
+    return 1;
+  }
+
+  // a frequently requested entry survives a scan of one-hit keys (of the same shard), a repeatedly requested key is admitted
+  char keys[32][16];
+  int nKeys = 0;
+  uint64_t hotHash = cacheHash("/k00000", 7);
+  for (int i = 1; nKeys < 32; i++) {
+    snprintf(keys[nKeys], sizeof keys[nKeys], "/k%05d", i);
+    if (cacheShardOf(cache, cacheHash(keys[nKeys], 7)) == cacheShardOf(cache, hotHash)) {
+      nKeys++;
     }
   }
+  struct cacheShard *shard = cacheShardOf(cache, hotHash);
+  route.cacheStaleMs = 0;
+  cacheGet(cache, hotHash, "/k00000", 7, 1000, 1, &refresh);
+  cachePut(cache, hotHash, "/k00000", 7, &route, &rb, 1000);
+  cache->shardBudget = shard->used*2 + shard->used/2;
+  for (int i = 0; i < 10; i++) {
+    cacheRelease(cacheGet(cache, hotHash, "/k00000", 7, 1000, 1, &refresh));
+  }
+  for (int i = 0; i < 31; i++) {
+    hash = cacheHash(keys[i], 7);
+    cacheGet(cache, hash, keys[i], 7, 1000, 1, &refresh);
+    cachePut(cache, hash, keys[i], 7, &route, &rb, 1000);
+  }
+  entry = cacheGet(cache, hotHash, "/k00000", 7, 1000, 1, &refresh);
+  fail |= entry == NULL || atomic_load(&cache->rejected) != 30 || atomic_load(&cache->evictions) != 0;
+  cacheRelease(entry);
+  hash = cacheHash(keys[31], 7);
+  for (int i = 0; i < 3; i++) {
+    cacheGet(cache, hash, keys[31], 7, 1000, 1, &refresh);
+  }
+  cachePut(cache, hash, keys[31], 7, &route, &rb, 1000);
+  entry = cacheGet(cache, hash, keys[31], 7, 1000, 1, &refresh);
+  fail |= entry == NULL || atomic_load(&cache->evictions) != 1 || cacheGet(cache, cacheHash(keys[0], 7), keys[0], 7, 1000, 1, &refresh) != NULL;
+  cacheRelease(entry);
+  free(conn.bodyBuff);
+  freeCache(cache);
+  if (fail) {
+    return 1;
+  }
 
-  *err = errOk;
+  // served by a webserver, the handler only runs on misses & refreshes
+  webserver *wserver = malloc(sizeof *wserver);
+  struct wsConfig config;
+  pthread_t listenThread;
+  atomic_int calls = 0;
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  if (wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  struct httpRoute *cachedRoute = createHandlerRoute("/cache/:name", httpGet, testCacheHandler, &calls, &err);
+  routeSetCache(cachedRoute, 300, 10000, NULL, &err);
+  addRouteToWs(wserver, cachedRoute, &err);
+  if (err != errOk || pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct timeval timeout = {.tv_sec = 5};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+  // miss, hit (other parameter order), stale hit which refreshes the entry, refreshed hit, uncacheable (Set-Cookie) twice
+  const char *reqs[] = {"GET /cache/a?x=1&y=2 HTTP/1.1\r\n\r\n", "GET /cache/a?y=2&x=1 HTTP/1.1\r\n\r\n", "GET /cache/a?x=1&y=2 HTTP/1.1\r\n\r\n",
+    "GET /cache/a?x=1&y=2 HTTP/1.1\r\n\r\n", "GET /cache/cookie HTTP/1.1\r\n\r\n", "GET /cache/cookie HTTP/1.1\r\n\r\n"};
+  const char *expected[] = {"1", "1", "1", "2", "3", "4"};
+  for (int i = 0; i < 6; i++) {
+    if (i == 2) {
+      usleep(400*1000);
+    }
+    bodySize = 0;
+    if (testProxyRequest(sock, reqs[i], strlen(reqs[i]), resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 1 || body[0] != expected[i][0]) { /* Flawfinder: ignore */ // literals
+      return 1;
+    }
+  }
+  close(sock);
+  fail = atomic_load(&wserver->cache->hits) != 2 || atomic_load(&wserver->cache->staleHits) != 1 || atomic_load(&wserver->cache->stores) != 2;
+
+  wsStop(wserver, 0);
+  pthread_join(listenThread, NULL);
+  freeWs(wserver);
+  return fail;
 }
 
-// inits the webserver struct on given port
-// binds & starts listening on webserver Socket
-void wsInit(webserver *wserver, int port, int *err) {
-  wserver->port = port;
+int testSnapshot() {
+  int err = errOk;
+  char dir[] = "/tmp/wsSnapshotXXXXXX";
+  char configFile[64], snapshotFile[64], pageFile[64];
+  const char *allow;
 
-  if ((wserver->wserverSocket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-    *err = errNet;
-    return;
+  if (mkdtemp(dir) == NULL) {
+    return 1;
   }
+  snprintf(configFile, sizeof configFile, "%s/routes.conf", dir);
+  snprintf(snapshotFile, sizeof snapshotFile, "%s/routes.snap", dir);
+  snprintf(pageFile, sizeof pageFile, "%s/page.html", dir);
+  FILE *page = fopen(pageFile, "w"); /* Flawfinder: ignore */ // test file
+  FILE *config = fopen(configFile, "w"); /* Flawfinder: ignore */ // test file
+  if (page == NULL || config == NULL) {
+    return 1;
+  }
+  fputs("<p>page</p>", page);
+  fclose(page);
+  fprintf(config, "# static routes\n\nGET /text 200 text hello%%20world\nPOST /text 201 text created # comment\nGET /page 200 file %s\r\nGET /gone 410 text gone\n", pageFile);
+  for (int i = 0; i < 20000; i++) {
+    fprintf(config, "GET /r/%d 200 text %d\n", i, i);
+  }
+  fclose(config);
 
-  wserver->server.sin_family = AF_INET;
-  wserver->server.sin_port = htons(port);
-  wserver->server.sin_addr.s_addr = INADDR_ANY;
-
-  wserver->mutexLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+  webserver *wserver = malloc(sizeof *wserver);
+  struct wsConfig wsConfig;
+  if (wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&wsConfig, 0);
+  wsConfig.nListeners = 0;
+  wsConfigAddListener(&wsConfig, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &wsConfig, &err);
+  wsLoadRoutes(wserver, configFile, snapshotFile, &err);
+  if (err != errOk || wserver->snapshot.header->nRoutes != 20004) {
+    return 1;
+  }
+  struct wsSnapshot *snapshot = &wserver->snapshot;
+  const struct snapRoute *route;
+  char path[32];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(path, sizeof path, "/r/%d", i);
+    route = snapLookup(snapshot, path, httpGet, &allow);
+    if (route == NULL || route->bodySize != strlen(path+3) || memcmp(snapshot->base + route->bodyOffset, path+3, route->bodySize) != 0) { /* Flawfinder: ignore */ // \0 terminated
+      return 1;
+    }
+  }
+  // HEAD falls back to GET, other methods get the Allow value of the path
+  route = snapLookup(snapshot, "/text", httpHead, &allow);
+  if (route == NULL || route->method != httpGet || route->bodySize != 11 || memcmp(snapshot->base + route->bodyOffset, "hello world", 11) != 0) {
+    return 1;
+  }
+  if (snapLookup(snapshot, "/text", httpPut, &allow) != NULL || allow == NULL || strcmp(allow, "GET, POST, HEAD, OPTIONS") != 0
+    || snapLookup(snapshot, "/none", httpGet, &allow) != NULL || allow != NULL) {
+    return 1;
+  }
 
-  if (bind(wserver->wserverSocket, (struct sockaddr *)&wserver->server, sizeof(wserver->server)) < 0) {
-    *err = errNet;
-    return;
+  // served like static routes, the route tree is looked up first
+  pthread_t listenThread;
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  struct httpResponse *treeResp = malloc(sizeof *treeResp);
+  if (treeResp == NULL) {
+    return 1;
+  }
+  *treeResp = (struct httpResponse){.statusCode = 200, .contentBuff = "tree", .contentSize = 4};
+  addRouteToWs(wserver, createRoute("/gone", httpGet, treeResp, &err), &err);
+  if (err != errOk || pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct timeval timeout = {.tv_sec = 5};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+  const char *reqs[] = {"GET /page HTTP/1.1\r\n\r\n", "POST /text HTTP/1.1\r\n\r\n", "GET /gone HTTP/1.1\r\n\r\n", "PUT /text HTTP/1.1\r\n\r\n"};
+  const int status[] = {200, 201, 200, 405};
+  const char *expected[] = {"<p>page</p>", "created", "tree", "405 method not allowed"};
+  int fail = 0;
+  for (int i = 0; i < 4; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(sock, reqs[i], strlen(reqs[i]), resp, sizeof resp, &body, &bodySize) != status[i]
+      || bodySize != (int)strlen(expected[i]) || memcmp(body, expected[i], bodySize) != 0; /* Flawfinder: ignore */ // literals
+  }
+  close(sock);
+  wsStop(wserver, 0);
+  pthread_join(listenThread, NULL);
+  freeWs(wserver);
+  if (fail) {
+    return 1;
   }
 
-  if (listen(wserver->wserverSocket, 1) != 0) {
-    *err = errNet;
-    return;
+  // snapshots whose buckets have no empty one left (duplicated routes) are rejected, lookups of missing paths wouldn't end
+  struct snapHeader header;
+  uint32_t firstRoute = 1;
+  int snapFd = open(snapshotFile, O_RDWR); /* Flawfinder: ignore */ // test file
+  fail |= pread(snapFd, &header, sizeof header, 0) != sizeof header;
+  for (uint32_t i = 0; i < header.nBuckets; i++) {
+    fail |= pwrite(snapFd, &firstRoute, sizeof firstRoute, header.bucketsOffset + i * sizeof firstRoute) != sizeof firstRoute;
   }
+  close(snapFd);
+  webserver corrupted = {.snapshot = {.base = NULL}};
+  wsLoadSnapshot(&corrupted, snapshotFile, &err);
+  fail |= err != errParse || corrupted.snapshot.base != NULL;
 
-  *err = errOk;
+  // truncated snapshots & invalid or duplicate config lines are rejected
+  truncate(snapshotFile, 4096);
+  webserver truncated = {.snapshot = {.base = NULL}};
+  wsLoadSnapshot(&truncated, snapshotFile, &err);
+  fail |= err != errParse || truncated.snapshot.base != NULL;
+  const char *invalid[] = {"GET /a 200 text a\nGET /a 200 text b\n", "FETCH /a 200 text a\n", "GET /a 999 text a\n", "GET a 200 text a\n", "GET /a 200 blob a\n", "GET /a 200 text\n"};
+  for (int i = 0; i < 6; i++) {
+    config = fopen(configFile, "w"); /* Flawfinder: ignore */ // test file
+    fputs(invalid[i], config);
+    fclose(config);
+    wsCompileRoutes(configFile, snapshotFile, &err);
+    fail |= err != errParse;
+  }
+  unlink(configFile);
+  unlink(snapshotFile);
+  unlink(pageFile);
+  rmdir(dir);
+  return fail;
 }
 
-// frees all allocated memory from the clientHandle thread
-void freeClientThread(void *args) {
-  struct freeClientThreadArgs *argss = (struct freeClientThreadArgs*)args;
-  free(argss->readBuff);
-  free(argss->respBuff);
+// state shared by the coroutines of testCoroutines
+struct testCoState {
+  int sv[2];
+  int idle[2];
+  int size;
+  atomic_int received;
+  atomic_int sent;
+  atomic_int timedOut;
+};
 
-  free(argss->httpReq->requestUri);
-  free(argss->httpReq);
+// writes size bytes to the non-blocking socket sv[0], parks whenever the socket buffer is full
+void testCoWriter(void *arg) {
+  struct testCoState *state = (struct testCoState*)arg;
+  char *data = malloc(state->size);
+  int err;
+  memset(data, 'c', state->size);
+  struct iovec iov = {.iov_base = data, .iov_len = state->size};
+  atomic_store(&state->sent, sendBuffers(state->sv[0], &iov, 1, &err));
+  free(data);
+}
 
-  // other members are already freed in response craft
-  free(argss->httpResp);
+// reads from the non-blocking socket sv[1] until size bytes arrived, parks whenever nothing is buffered
+void testCoReader(void *arg) {
+  struct testCoState *state = (struct testCoState*)arg;
+  char buff[WS_BUFF_SIZE];
+  int received = 0;
+  ssize_t rc;
+  while (received < state->size) {
+    while ((rc = read(state->sv[1], buff, sizeof buff)) == -1 && coWaitIo(state->sv[1], EPOLLIN, -1)); /* Flawfinder: ignore */ // bounded
+    if (rc <= 0) {
+      break;
+    }
+    received += rc;
+  }
+  atomic_store(&state->received, received);
+}
 
-  free(argss->clientHandleArgs);
+// waits on a socket which never becomes readable
+void testCoTimeout(void *arg) {
+  struct testCoState *state = (struct testCoState*)arg;
+  uint64_t start = wsNowNs();
+  int ready = coWait(state->idle[0], EPOLLIN, 200);
+  atomic_store(&state->timedOut, !ready && wsNowNs() - start >= 200000000ULL ? 1 : -1);
 }
 
-// the clientHandle thread waits for incoming request and crafts the reply accordingly
-// quits thread after reply/ does not continue to reply to multiple requests on one connection. does not support persistent connections
-void *clientHandle(void *args) {
-  struct pthreadClientHandleArgs *argss = (struct pthreadClientHandleArgs*)args;
-  int socket = argss->socket;
+// returns the number of threads of the process
+int testThreadCount() {
+  char line[256];
+  int threads = -1;
+  FILE *status = fopen("/proc/self/status", "r"); /* Flawfinder: ignore */ // fixed path
+  if (status == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof line, status) != NULL) {
+    if (strncmp(line, "Threads:", 8) == 0) {
+      threads = atoi(line+8);
+    }
+  }
+  fclose(status);
+  return threads;
+}
 
+int testCoroutines() {
   int err = errOk;
+  struct timespec tick = {.tv_nsec = 10000000L};
 
-  char *readBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
-  char *respBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
-  struct httpRequest *httpReq = malloc(sizeof (struct httpRequest));
-  struct httpResponse *httpResp = malloc(sizeof (struct httpResponse));
-  if (readBuff == NULL || respBuff == NULL || httpReq == NULL || httpResp == NULL) {
-    printErr(errMemAlloc);
-    close(socket);
-    pthread_exit(NULL);
+  // a writer & a reader coroutine on the same loop thread only get through a transfer larger than the socket buffers by parking
+  struct wsLoop loop;
+  struct testCoState state = {.size = 4*1024*1024};
+  loopInit(&loop, &err);
+  if (err != errOk || socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, state.sv) != 0 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, state.idle) != 0) {
+    return 1;
+  }
+  if (pthread_create(&loop.thread, NULL, loopThread, &loop) != 0) {
+    return 1;
+  }
+  loop.running = 1;
+  struct coTask tasks[3] = {{.fn = testCoReader, .arg = &state}, {.fn = testCoWriter, .arg = &state}, {.fn = testCoTimeout, .arg = &state}};
+  for (int i = 0; i < 3; i++) {
+    loopSubmit(&loop, &tasks[i]);
+  }
+  for (int i = 0; i < 500 && (atomic_load(&state.received) == 0 || atomic_load(&state.timedOut) == 0); i++) {
+    nanosleep(&tick, NULL);
+  }
+  loopStop(&loop);
+  loopFree(&loop);
+  close(state.sv[0]);
+  close(state.sv[1]);
+  close(state.idle[0]);
+  close(state.idle[1]);
+  if (atomic_load(&state.sent) != state.size || atomic_load(&state.received) != state.size || atomic_load(&state.timedOut) != 1
+    || atomic_load(&loop.nCoroutines) != 0 || loop.pool != NULL) {
+    return 1;
   }
 
-  int respSize, reqSize, sentBuffSize;
-  int routeFound = 0;
+  // the upstream of the proxy route is served by client threads
+  pthread_t upstreamThread, serverThread;
+  struct wsConfig config;
+  webserver *upstream = malloc(sizeof *upstream);
+  webserver *wserver = malloc(sizeof *wserver);
+  if (upstream == NULL || wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(upstream, &config, &err);
+  addRouteToWs(upstream, createHandlerRoute("/api/big", httpGet, testH2BigHandler, NULL, &err), &err);
+  if (err != errOk || pthread_create(&upstreamThread, NULL, benchListenThread, upstream) != 0) {
+    return 1;
+  }
+  struct wsProxy *proxy = createProxy(proxyBalanceLeast, NULL, &err);
+  proxyAddUpstream(proxy, "127.0.0.1", upstream->port, &err);
 
-  wsLog("new client thread created \n");
+  // many more connections than loop threads
+  config.nLoops = 2;
+  config.maxConns = 1000;
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createHandlerRoute("/big", httpGet, testH2BigHandler, NULL, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/upload", httpPost, uploadHandler, NULL, &err), &err);
+  addRouteToWs(wserver, createProxyRoute("/api/*rest", httpGet, proxy, &err), &err);
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  enum {nConns = 300};
+  int socks[nConns];
+  char resp[150000];
+  char *body;
+  int bodySize, fail = 0;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  for (int i = 0; i < nConns; i++) {
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    if (connect(socks[i], (struct sockaddr*)&addr, sizeof addr) != 0) {
+      return 1;
+    }
+  }
+  // all requests are in flight before the first response is read
+  const char *getBig = "GET /big HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < nConns; i++) {
+    fail |= send(socks[i], getBig, strlen(getBig), MSG_NOSIGNAL) != (ssize_t)strlen(getBig); /* Flawfinder: ignore */ // literal
+  }
+  for (int i = 0; i < nConns && !fail; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[i], "", 0, resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 100000 || body[99999] != 'x';
+  }
+  // the connections are parked on the loops, not served by threads of their own (listen, timer & loop threads of both servers)
+  fail |= testThreadCount() > 10;
 
-  int readBuffSize = read(socket, readBuff, WS_BUFF_SIZE); /* Flawfinder: ignore */ // buffer-overlow check follows in sec-checks
-  if (readBuffSize == -1) {
-    printErr(errNet);
-    close(socket);
-    pthread_exit(NULL);
+  // the request body is read by the handler while the client sends it
+  char *upload = malloc(1024*1024 + 128);
+  int uploadSize = snprintf(upload, 128, "POST /upload HTTP/1.1\r\nHost: test\r\nContent-Length: %d\r\n\r\n", 1024*1024);
+  memset(upload+uploadSize, 'u', 1024*1024);
+  bodySize = 0;
+  fail |= testProxyRequest(socks[0], upload, uploadSize + 1024*1024, resp, sizeof resp, &body, &bodySize) != 200 || strstr(body, "\"size\": 1048576,") == NULL;
+  free(upload);
+  // proxied (connect, send, receive & splice park on the upstream socket)
+  const char *getProxied = "GET /api/big HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 3; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[1], getProxied, strlen(getProxied), resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 100000; /* Flawfinder: ignore */ // literal
   }
-  // sec checks
-  if (readBuffSize >= WS_BUFF_SIZE) {
-    printErr(errSecCheck);
-    close(socket);
-    pthread_exit(NULL);
+  for (int i = 0; i < nConns; i++) {
+    close(socks[i]);
   }
-  // \0 terminating readBuffer
-  readBuff[readBuffSize] = (char)0;
 
-  struct freeClientThreadArgs freeArgs = {.httpReq = httpReq, .httpResp = httpResp, .clientHandleArgs = argss, .readBuff = readBuff, .respBuff = respBuff};
-  pthread_cleanup_push(freeClientThread, &freeArgs);
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
+  fail |= atomic_load(&wserver->loops[0].nCoroutines) + atomic_load(&wserver->loops[1].nCoroutines) != 0;
+  freeWs(wserver);
+  freeProxy(proxy);
+  wsStop(upstream, 0);
+  pthread_join(upstreamThread, NULL);
+  freeWs(upstream);
+  return fail;
+}
 
-  parseHttpRequest(httpReq, readBuff, readBuffSize, &err);
-  if (err != errOk){
-    printErr(err);
+// forked by testExecForkSleep, sleeps a millisecond so that idle workers steal the remaining tasks meanwhile
+void testExecSleep(void *arg) {
+  struct timespec ms = {.tv_nsec = 1000000L};
+  nanosleep(&ms, NULL);
+  atomic_fetch_add((atomic_int*)arg, 1);
+}
 
-    close(socket);
-    pthread_exit(NULL);
+// forks & joins 64 sleeping tasks on the executor of testExecArgs
+struct testExecArgs {
+  struct wsExecutor *executor;
+  atomic_int done;
+};
+
+void testExecForkSleep(void *arg) {
+  struct testExecArgs *args = (struct testExecArgs*)arg;
+  struct wsTask tasks[64];
+  struct wsTaskGroup group;
+  atomic_init(&group.pending, 0);
+  for (int i = 0; i < 64; i++) {
+    tasks[i] = (struct wsTask){.fn = testExecSleep, .arg = &args->done};
+    execFork(args->executor, &group, &tasks[i]);
   }
+  execJoin(args->executor, &group);
+}
 
-  #ifdef DEBUG
-  printf("------------ parsed request -------------\n");
-  printf("http version: %f \n", httpReq->httpVersion);
-  printf("req method: %d \n", httpReq->reqMethod);
-  printf("req uri: %s \n", httpReq->requestUri);
-  printf("------------ parsed request -------------\n");
-  #endif
+void testExecCount(void *arg) {
+  atomic_fetch_add((atomic_int*)arg, 1);
+}
 
-  pthread_mutex_lock(&argss->wserver->mutexLock);
-  for (int i = 0; i < argss->wserver->nRoutes; i++) {
-    // not a mem alloc error (which is already handled by parseHttpRequest) has never been allocated instead due to a parsing issue
-    if (!httpReq->requestUri) {
-      printErr(errParse);
-      close(socket);
-      pthread_mutex_unlock(&argss->wserver->mutexLock);
-      pthread_exit(NULL);
-    }
-    if (strcmp(argss->wserver->routes[i]->path, httpReq->requestUri) == 0) {
-      routeFound = 1;
-      craftResp(argss->wserver->routes[i]->httpResp, respBuff, WS_BUFF_SIZE, &err);
+// handler of the /spin route, runs 20000 no-op calls on the executor (ctx), most of them finish before the coroutine parks
+void testExecSpinHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct testExecArgs args = {.executor = (struct wsExecutor*)ctx};
+  (void)req;
+  for (int i = 0; i < 20000; i++) {
+    execRun(args.executor, testExecCount, &args.done);
+  }
+  respPrintf(resp, "%d", atomic_load(&args.done));
+}
 
+// handler of the /heavy route, keeps the executor (ctx) busy for 300ms
+void testExecHeavyHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct testExecArgs args = {.executor = (struct wsExecutor*)ctx};
+  (void)req;
+  for (int i = 0; i < 300; i++) {
+    execRun(args.executor, testExecSleep, &args.done);
+  }
+  respPrintf(resp, "%d", atomic_load(&args.done));
+}
 
-      if (err != errOk) {
-        printErr(err);
+int testExecutor() {
+  int err = errOk, fail = 0;
 
-        close(socket);
-        pthread_mutex_unlock(&argss->wserver->mutexLock);
-        pthread_exit(NULL);
-      }
+  // the owner takes the newest task, thieves the oldest
+  struct execDeque *deque = calloc(1, sizeof *deque);
+  struct wsTask tasks[3];
+  if (deque == NULL) {
+    return 1;
+  }
+  for (int i = 0; i < 3; i++) {
+    fail |= !dequePush(deque, &tasks[i]);
+  }
+  fail |= dequeTake(deque) != &tasks[2] || dequeSteal(deque) != &tasks[0] || dequeTake(deque) != &tasks[1];
+  fail |= dequeTake(deque) != NULL || dequeSteal(deque) != NULL;
+  for (int i = 0; i < WS_EXEC_DEQUE_SIZE; i++) {
+    fail |= !dequePush(deque, &tasks[0]);
+  }
+  fail |= dequePush(deque, &tasks[0]);
+  free(deque);
+  if (fail) {
+    return 1;
+  }
 
-      sentBuffSize = sendBuffer(socket, respBuff, strlen(respBuff), &err); /* Flawfinder: ignore */ // \0 termination given by craftResp function
-      if (err != errOk) {
-        printErr(err);
+  // fork & join from a thread which isn't a worker
+  struct wsExecutor *executor = createExecutor(4, &err);
+  if (err != errOk) {
+    return 1;
+  }
+  struct primesRange range = {.executor = executor, .from = 0, .to = 1000000};
+  execRun(executor, primesCount, &range);
+  struct testExecArgs args = {.executor = executor};
+  execRun(executor, testExecForkSleep, &args);
+  unsigned long executed, stolen;
+  execStats(executor, &executed, &stolen);
+  fail |= range.count != 78498 || atomic_load(&args.done) != 64 || stolen == 0 || executed < 64;
 
-        close(socket);
-        pthread_mutex_unlock(&argss->wserver->mutexLock);
-        pthread_exit(NULL);
-      }
+  // the only loop keeps serving while a handler of it waits for the executor
+  pthread_t serverThread;
+  struct wsConfig config;
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.nLoops = 1;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createHandlerRoute("/heavy", httpGet, testExecHeavyHandler, executor, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/primes/:n", httpGet, primesHandler, executor, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/spin", httpGet, testExecSpinHandler, executor, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err), &err);
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  int socks[2];
+  for (int i = 0; i < 2; i++) {
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    if (connect(socks[i], (struct sockaddr*)&addr, sizeof addr) != 0) {
+      return 1;
     }
   }
-  pthread_mutex_unlock(&argss->wserver->mutexLock);
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  const char *getHeavy = "GET /heavy HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getHello = "GET /hello/loop HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getPrimes = "GET /primes/100000 HTTP/1.1\r\nHost: test\r\n\r\n";
+  fail |= send(socks[0], getHeavy, strlen(getHeavy), MSG_NOSIGNAL) != (ssize_t)strlen(getHeavy); /* Flawfinder: ignore */ // literal
+  struct timespec wait = {.tv_nsec = 50000000L};
+  nanosleep(&wait, NULL);
+  uint64_t start = wsNowNs();
+  bodySize = 0;
+  fail |= testProxyRequest(socks[1], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 10; /* Flawfinder: ignore */ // literal
+  // answered long before the heavy request
+  fail |= wsNowNs() - start > 150000000ULL;
+  bodySize = 0;
+  fail |= testProxyRequest(socks[0], "", 0, resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 3 || memcmp(body, "300", 3) != 0;
+  bodySize = 0;
+  fail |= testProxyRequest(socks[1], getPrimes, strlen(getPrimes), resp, sizeof resp, &body, &bodySize) != 200 /* Flawfinder: ignore */ // literal
+    || strstr(body, "\"primes\": 9592}") == NULL;
+  // calls completing before their coroutine parks, concurrently on both connections
+  const char *getSpin = "GET /spin HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 2; i++) {
+    fail |= send(socks[i], getSpin, strlen(getSpin), MSG_NOSIGNAL) != (ssize_t)strlen(getSpin); /* Flawfinder: ignore */ // literal
+  }
+  for (int i = 0; i < 2; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[i], "", 0, resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 5 || memcmp(body, "20000", 5) != 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    close(socks[i]);
+  }
 
-  if (!routeFound) {
-    wsLog("page not found \n");
-    httpResp->statusCode = 404;
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
+  fail |= atomic_load(&wserver->loops[0].nCoroutines) != 0;
+  freeWs(wserver);
+  freeExecutor(executor);
+  return fail;
+}
 
-    httpResp->reasonPhrase = "err";
-    httpResp->contentBuff = "404 page not found";
+// handler of the /slow route, blocks its thread for 300ms
+void testBlockingSlowHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  struct timespec wait = {.tv_nsec = 300000000L};
+  (void)req;
+  (void)ctx;
+  nanosleep(&wait, NULL);
+  respPrintf(resp, "slow");
+}
 
-    httpResp->contentSize = strlen(httpResp->contentBuff); /* Flawfinder: ignore */ // \0 termination set in the line above
-    craftResp(httpResp, respBuff, WS_BUFF_SIZE, &err);
-    if (err != errOk){
-      printErr(err);
+// handler of the /fast route, returns right away so the pool thread often completes before the coroutine parks
+void testBlockingFastHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx) {
+  (void)req;
+  (void)ctx;
+  respPrintf(resp, "fast");
+}
 
-      close(socket);
-      pthread_exit(NULL);
-    }
+// client of testBlocking, sends 500 requests to /fast over a persistent connection, counts the served (not rejected) ones
+struct testBlockingClient {
+  unsigned short port;
+  int served;
+  int fail;
+};
 
-    sentBuffSize = sendBuffer(socket, respBuff, strlen(respBuff), &err); /* Flawfinder: ignore */ // \0 termination given by craftResp function
-    if (err != errOk) {
-      printErr(err);
+void *testBlockingClientThread(void *args) {
+  struct testBlockingClient *client = (struct testBlockingClient*)args;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(client->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  const char *getFast = "GET /fast HTTP/1.1\r\nHost: test\r\n\r\n";
 
-      close(socket);
-      pthread_exit(NULL);
-    }
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  client->fail |= connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0;
+  for (int i = 0; i < 500 && !client->fail; i++) {
+    bodySize = 0;
+    int status = testProxyRequest(sock, getFast, strlen(getFast), resp, sizeof resp, &body, &bodySize); /* Flawfinder: ignore */ // literal
+    client->served += status == 200 && bodySize == 4 && memcmp(body, "fast", 4) == 0;
+    client->fail |= status != 200 && status != 503;
   }
-
-  #ifdef DEBUG
-  printf("------------ response -------------\n");
-  printf("%s \n", respBuff);
-  printf("------------ response -------------\n");
-  fflush(stdout);
-  #endif
-
-  wsLog("server-response sent \n");
-
-  close(socket);
-  pthread_cleanup_pop(1);
-  pthread_exit(NULL);
+  close(sock);
+  return NULL;
 }
 
-// waits for new incoming connections on port x and creates clientHandles threads accordingly
-void wsListen(webserver *wserver, int *err) {
-  struct sockaddr_in tempClient;
+int testBlocking() {
+  int err = errOk, fail = 0;
+  pthread_t serverThread;
+  struct wsConfig config;
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL) {
+    return 1;
+  }
+  // one thread & one queued call, the third concurrent call is rejected
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.nLoops = 1;
+  config.nBlockingThreads = 1;
+  config.blockingQueueSize = 1;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  struct httpRoute *slowRoute = createHandlerRoute("/slow", httpGet, testBlockingSlowHandler, NULL, &err);
+  routeSetBlocking(slowRoute, &err);
+  addRouteToWs(wserver, slowRoute, &err);
+  struct httpRoute *uploadRoute = createHandlerRoute("/upload", httpPost, uploadHandler, NULL, &err);
+  routeSetBlocking(uploadRoute, &err);
+  addRouteToWs(wserver, uploadRoute, &err);
+  struct httpRoute *fastRoute = createHandlerRoute("/fast", httpGet, testBlockingFastHandler, NULL, &err);
+  routeSetBlocking(fastRoute, &err);
+  addRouteToWs(wserver, fastRoute, &err);
+  addRouteToWs(wserver, createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/stats", httpGet, statsHandler, wserver, &err), &err);
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  int socks[4];
+  for (int i = 0; i < 4; i++) {
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    if (connect(socks[i], (struct sockaddr*)&addr, sizeof addr) != 0) {
+      return 1;
+    }
+  }
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  struct timespec wait = {.tv_nsec = 50000000L};
+  const char *getSlow = "GET /slow HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getHello = "GET /hello/loop HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getStats = "GET /stats HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 2; i++) {
+    fail |= send(socks[i], getSlow, strlen(getSlow), MSG_NOSIGNAL) != (ssize_t)strlen(getSlow); /* Flawfinder: ignore */ // literal
+    nanosleep(&wait, NULL);
+  }
+  uint64_t start = wsNowNs();
+  bodySize = 0;
+  fail |= testProxyRequest(socks[2], getSlow, strlen(getSlow), resp, sizeof resp, &body, &bodySize) != 503 || strstr(resp, "Retry-After:") == NULL; /* Flawfinder: ignore */ // literal
+  // the loop keeps serving other routes while its coroutines wait for the pool
+  bodySize = 0;
+  fail |= testProxyRequest(socks[3], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 10; /* Flawfinder: ignore */ // literal
+  fail |= wsNowNs() - start > 150000000ULL;
+  for (int i = 0; i < 2; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[i], "", 0, resp, sizeof resp, &body, &bodySize) != 200 || bodySize != 4 || memcmp(body, "slow", 4) != 0;
+  }
 
-  if (pthread_mutex_init(&wserver->mutexLock, NULL) != 0) {
-    *err = errInit;
-    return;
+  // the body of the non-blocking socket is read (polled) by the pool thread
+  char *upload = malloc(1024*1024 + 128);
+  int uploadSize = snprintf(upload, 128, "POST /upload HTTP/1.1\r\nHost: test\r\nContent-Length: %d\r\n\r\n", 1024*1024);
+  memset(upload+uploadSize, 'u', 1024*1024);
+  bodySize = 0;
+  fail |= testProxyRequest(socks[3], upload, uploadSize + 1024*1024, resp, sizeof resp, &body, &bodySize) != 200 || strstr(body, "\"size\": 1048576,") == NULL;
+  free(upload);
+  bodySize = 0;
+  fail |= testProxyRequest(socks[3], getStats, strlen(getStats), resp, sizeof resp, &body, &bodySize) != 200 /* Flawfinder: ignore */ // literal
+    || strstr(body, "\"blockingCompleted\": 3, \"blockingRejected\": 1") == NULL || strstr(body, "\"blockingPeakQueued\": 1") == NULL;
+  for (int i = 0; i < 4; i++) {
+    close(socks[i]);
+  }
+
+  // handlers returning right away, hit concurrently (calls beyond the queue are rejected)
+  pthread_t clientThreads[4];
+  struct testBlockingClient clients[4];
+  for (int i = 0; i < 4; i++) {
+    clients[i] = (struct testBlockingClient){.port = wserver->port};
+    if (pthread_create(&clientThreads[i], NULL, testBlockingClientThread, &clients[i]) != 0) {
+      return 1;
+    }
+  }
+  int served = 0;
+  for (int i = 0; i < 4; i++) {
+    pthread_join(clientThreads[i], NULL);
+    fail |= clients[i].fail;
+    served += clients[i].served;
   }
+  fail |= served == 0;
 
-  wsLog("server listening \n");
-
-  int newSocket;
-  socklen_t addr_size;
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
+  freeWs(wserver);
+  return fail;
+}
 
-  // // only for debugging purposes if the wserver needs to stop after n requests
-  // for (int n = 0; n <= 5; n++) {
+// takers of testRateLimit, take 20 tokens each from the buckets (burst 10, no refill) of 1000 new keys
+struct testRateArgs {
+  struct wsRateLimiter *limiter;
+  pthread_barrier_t start;
+  atomic_int granted;
+};
 
-  while (1) {
-    addr_size = sizeof tempClient;
-    newSocket = accept(wserver->wserverSocket, (struct sockaddr *) &tempClient, &addr_size);
-    if (newSocket == -1) {
-      *err = errNet;
-      printErr(*err);
-      return;
+void *testRateTaker(void *arg) {
+  struct testRateArgs *args = (struct testRateArgs*)arg;
+  pthread_barrier_wait(&args->start);
+  for (uint64_t key = 1; key <= 1000; key++) {
+    for (int i = 0; i < 20; i++) {
+      atomic_fetch_add(&args->granted, rateTake(args->limiter, key * 8, 0, 10, 1));
     }
-    wsLog("new client connected \n");
+  }
+  return NULL;
+}
 
-    #ifdef DEBUG
-    // telling the kernel that the socket is reused - only for debugging purposes
-    int yes=1;
-    if (setsockopt(newSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
-        wsLog("(debug flag set) socket reuse set failed \n");
-        *err = errNet;
-        return;
-    }
-    #endif
+int testRateLimit() {
+  int err = errOk, fail = 0;
 
-    // freed when thread is dead
-    struct pthreadClientHandleArgs *clientArgs = malloc(sizeof clientArgs);
-    if (clientArgs == NULL) {
-      printErr(errMemAlloc);
-      close(newSocket);
-    }
-    clientArgs->wserver = wserver;
-    clientArgs->socket = newSocket;
+  // IPv4 mapped addresses are keyed as IPv4, IPv6 addresses by their /64 prefix
+  struct sockaddr_storage a = {0}, b = {0};
+  struct sockaddr_in *a4 = (struct sockaddr_in*)&a;
+  struct sockaddr_in6 *b6 = (struct sockaddr_in6*)&b;
+  a4->sin_family = AF_INET;
+  inet_pton(AF_INET, "192.0.2.7", &a4->sin_addr);
+  b6->sin6_family = AF_INET6;
+  inet_pton(AF_INET6, "::ffff:192.0.2.7", &b6->sin6_addr);
+  fail |= ratePeerKey(&a) == 0 || ratePeerKey(&a) != ratePeerKey(&b);
+  inet_pton(AF_INET6, "2001:db8:1:2::1", &b6->sin6_addr);
+  uint64_t key6 = ratePeerKey(&b);
+  inet_pton(AF_INET6, "2001:db8:1:2:ffff::9", &b6->sin6_addr);
+  fail |= ratePeerKey(&b) != key6;
+  inet_pton(AF_INET6, "2001:db8:1:3::1", &b6->sin6_addr);
+  fail |= ratePeerKey(&b) == key6;
+  a.ss_family = AF_UNIX;
+  fail |= ratePeerKey(&a) != 0;
 
-    if(pthread_create(&wserver->clientThread, NULL, clientHandle, (void*)clientArgs) != 0 ) {
-      *err = errIO;
-      return;
+  // a burst of 3, then the bucket is empty (a token per second), other keys have buckets of their own
+  struct wsRateLimiter limiter = {.slots = calloc(WS_RATE_TABLE_SIZE, sizeof(struct rateSlot))};
+  if (limiter.slots == NULL) {
+    return 1;
+  }
+  for (int i = 0; i < 3; i++) {
+    fail |= !rateTake(&limiter, 5, 1, 3, 1);
+  }
+  fail |= rateTake(&limiter, 5, 1, 3, 0) || rateTake(&limiter, 5, 1, 3, 1) || !rateTake(&limiter, 6, 1, 3, 1);
+  // keys of the same probe window, the one without a free slot replaces the least recently refilled bucket
+  memset(limiter.slots, 0, WS_RATE_TABLE_SIZE * sizeof(struct rateSlot));
+  for (int i = 0; i <= WS_RATE_PROBES; i++) {
+    fail |= !rateTake(&limiter, (uint64_t)(i+1) * WS_RATE_TABLE_SIZE + 5, 1, 1, 1);
+  }
+  int found = 0;
+  for (int i = 0; i < WS_RATE_PROBES; i++) {
+    found |= atomic_load(&limiter.slots[5+i].key) == (uint64_t)(WS_RATE_PROBES+1) * WS_RATE_TABLE_SIZE + 5;
+  }
+  fail |= !found || rateTake(&limiter, (uint64_t)(WS_RATE_PROBES+1) * WS_RATE_TABLE_SIZE + 5, 1, 1, 1);
+  // new buckets claimed concurrently grant their burst once (no refill)
+  memset(limiter.slots, 0, WS_RATE_TABLE_SIZE * sizeof(struct rateSlot));
+  struct testRateArgs rateArgs = {.limiter = &limiter};
+  pthread_t takers[4];
+  pthread_barrier_init(&rateArgs.start, NULL, 4);
+  for (int i = 0; i < 4; i++) {
+    if (pthread_create(&takers[i], NULL, testRateTaker, &rateArgs) != 0) {
+      return 1;
     }
   }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(takers[i], NULL);
+  }
+  pthread_barrier_destroy(&rateArgs.start);
+  fail |= atomic_load(&rateArgs.granted) != 1000 * 10;
+  // a single bucket per key
+  int nBuckets = 0;
+  for (int i = 0; i < WS_RATE_TABLE_SIZE; i++) {
+    uint64_t slotKey = atomic_load(&limiter.slots[i].key);
+    nBuckets += slotKey != 0 && slotKey % 8 == 0 && slotKey <= 1000 * 8;
+  }
+  fail |= nBuckets != 1000;
+  free(limiter.slots);
+  if (fail) {
+    return 1;
+  }
 
-  *err = errOk;
-}
+  pthread_t serverThread;
+  struct wsConfig config;
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.rateLimit = 1;
+  config.rateBurst = 3;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err), &err);
+  struct httpRoute *limitedRoute = createHandlerRoute("/limited/:name", httpGet, helloHandler, NULL, &err);
+  routeSetRateLimit(limitedRoute, 1, 1, &err);
+  addRouteToWs(wserver, limitedRoute, &err);
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  // another client address of the loopback network
+  struct sockaddr_in otherClient = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1)};
+  struct timeval timeout = {.tv_sec = 5};
+  int socks[3];
+  for (int i = 0; i < 3; i++) {
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  }
+  if (connect(socks[0], (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  const char *getHello = "GET /hello/rate HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getLimited = "GET /limited/rate HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 3; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[0], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200; /* Flawfinder: ignore */ // literal
+  }
+  // the connection stays open, further requests are answered with 429
+  for (int i = 0; i < 2; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(socks[0], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 429 /* Flawfinder: ignore */ // literal
+      || strstr(resp, "Retry-After: 1\r\n") == NULL || strstr(resp, "Connection: keep-alive\r\n") == NULL;
+  }
+  // a new connection of the client is rejected right after accept
+  if (connect(socks[1], (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+  bodySize = 0;
+  fail |= testProxyRequest(socks[1], "", 0, resp, sizeof resp, &body, &bodySize) != 429 || strstr(resp, "Connection: close\r\n") == NULL;
 
-// frees the webserver struct and all allocated attributes
-void freeWs(webserver *wserver) {
-  freeRoutes(wserver);
-  free(wserver);
+  // the route bucket is exhausted first, the client can still use other routes
+  if (bind(socks[2], (struct sockaddr*)&otherClient, sizeof otherClient) != 0 || connect(socks[2], (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
+  }
+  bodySize = 0;
+  fail |= testProxyRequest(socks[2], getLimited, strlen(getLimited), resp, sizeof resp, &body, &bodySize) != 200; /* Flawfinder: ignore */ // literal
+  bodySize = 0;
+  fail |= testProxyRequest(socks[2], getLimited, strlen(getLimited), resp, sizeof resp, &body, &bodySize) != 429; /* Flawfinder: ignore */ // literal
+  bodySize = 0;
+  fail |= testProxyRequest(socks[2], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200; /* Flawfinder: ignore */ // literal
+  for (int i = 0; i < 3; i++) {
+    close(socks[i]);
+  }
+
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
+  fail |= atomic_load(&wserver->rate.limited) != 3 || atomic_load(&wserver->rate.limitedConns) != 1;
+  freeWs(wserver);
+  return fail;
 }
 
-/*
- * Server Main.
- */
-int main() {
-  int err = errOk;
+int testTracing() {
+  int err = errOk, fail = 0;
 
+  // the ring keeps the last WS_TRACE_RING_SIZE events, paths are truncated
+  struct wsTracer tracer;
+  memset(&tracer, 0, sizeof tracer);
+  for (int i = 0; i <= WS_TRACE_RING_SIZE; i++) {
+    traceRecord(&tracer, spanRead, i, 1000, 1500, "/a/path/longer/than/the/thirty/eight/bytes/of/an/event");
+  }
+  struct traceRing *ring = atomic_load(&tracer.rings[wsTraceRing]);
+  fail |= ring == NULL || ring->written != WS_TRACE_RING_SIZE + 1 || ring->events[0].reqId != WS_TRACE_RING_SIZE
+    || ring->events[1].reqId != 1 || ring->events[0].durNs != 500 || strlen(ring->events[0].path) != sizeof ring->events[0].path - 1; /* Flawfinder: ignore */ // \0 terminated by traceRecord
+  // a busy ring drops the event
+  if (ring != NULL) {
+    atomic_store(&ring->busy, 1);
+    traceRecord(&tracer, spanRead, 0, 0, 0, NULL);
+    fail |= ring->written != WS_TRACE_RING_SIZE + 1 || atomic_load(&tracer.dropped) != 1;
+  }
+  free(ring);
+  if (fail) {
+    return 1;
+  }
+
+  pthread_t serverThread;
+  struct wsConfig config;
   webserver *wserver = malloc(sizeof *wserver);
   if (wserver == NULL) {
-    printErr(errMemAlloc);
-    return EXIT_FAILURE;
+    return 1;
   }
-
-  wsInit(wserver, 8080, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.traceSample = 1;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err), &err);
+  addRouteToWs(wserver, createHandlerRoute("/trace", httpGet, traceHandler, wserver, &err), &err);
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
   }
-  wsLog("server initiated \n");
-
-  struct httpResponse *mainRouteResponse = malloc(sizeof(struct httpResponse));
-  if (mainRouteResponse == NULL) {
-    printErr(errMemAlloc);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof addr) != 0) {
+    return 1;
   }
-  mainRouteResponse->statusCode = 200;
-  mainRouteResponse->reasonPhrase = "succ";
-  mainRouteResponse->contentBuff = "Hai";
-  mainRouteResponse->contentSize = 3;
-  struct httpRoute *mainRoute = createRoute("/", httpGet, mainRouteResponse, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  char resp[65536];
+  char *body;
+  int bodySize;
+  const char *getHello = "GET /hello/trace HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getTrace = "GET /trace HTTP/1.1\r\nHost: test\r\n\r\n";
+  for (int i = 0; i < 2; i++) {
+    bodySize = 0;
+    fail |= testProxyRequest(sock, getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200; /* Flawfinder: ignore */ // literal
+  }
+  // the spans of both requests (the accept span only once), the dumping request is still running
+  bodySize = 0;
+  fail |= testProxyRequest(sock, getTrace, strlen(getTrace), resp, sizeof resp - 1, &body, &bodySize) != 200; /* Flawfinder: ignore */ // literal
+  close(sock);
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
+  freeWs(wserver);
+  if (fail) {
+    return 1;
+  }
+  body[bodySize] = 0;
+  const char *stages[] = {"read", "parse", "lookup", "handler", "send"};
+  for (int i = 0; i < 5; i++) {
+    char name[32];
+    snprintf(name, sizeof name, "\"name\": \"%s\"", stages[i]);
+    char *first = strstr(body, name);
+    fail |= first == NULL || strstr(first+1, name) == NULL;
   }
+  char *accept = strstr(body, "\"name\": \"accept\"");
+  fail |= accept == NULL || strstr(accept+1, "\"name\": \"accept\"") != NULL;
+  char *request = strstr(body, "\"path\": \"/hello/trace\"");
+  fail |= request == NULL || strstr(request+1, "\"path\": \"/hello/trace\"") == NULL || strstr(body, "\"name\": \"proxy\"") != NULL;
+  fail |= strncmp(body, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n{", 44) != 0 || strstr(body, "\"ph\": \"X\"") == NULL
+    || strstr(body, "\"dropped\": 0, \"truncated\": 0}}") == NULL;
+  return fail;
+}
 
-  addRouteToWs(wserver, mainRoute, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+// keeps a cpu busy until the flag is set, to be sampled by the profiler
+void *testProfileSpin(void *arg) {
+  atomic_int *stop = (atomic_int*)arg;
+  volatile unsigned long n = 0;
+  while (!atomic_load_explicit(stop, memory_order_relaxed)) {
+    n++;
   }
+  return NULL;
+}
 
+int testProfiler() {
+  int err = errOk, fail = 0;
 
-  struct httpResponse *routeResponse = malloc(sizeof *routeResponse);
-  if (routeResponse == NULL) {
-    printErr(errMemAlloc);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  // samples of a busy thread, folded into lines of frames & counts which add up to the written samples
+  atomic_int stop = 0;
+  pthread_t spinThread;
+  if (pthread_create(&spinThread, NULL, testProfileSpin, &stop) != 0) {
+    return 1;
   }
-  routeResponse->statusCode = 200;
-  routeResponse->reasonPhrase = "succ";
-  // by marking it as file, the dynamically allocated memory from the file buffer gets freed
-  routeResponse->isFile = 1;
-  routeResponse->contentBuff = readFileToBuffer("testPage.html", &routeResponse->contentSize, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  struct wsProfile *prof = profRun(300, 500, &err);
+  atomic_store(&stop, 1);
+  pthread_join(spinThread, NULL);
+  if (prof == NULL || atomic_load(&prof->nTaken) == 0) {
+    freeProfile(prof);
+    return 1;
+  }
+  char hdrBuff[WS_BUFF_SIZE];
+  struct wsConn conn = {.hdrBuff = hdrBuff, .bodyBuff = NULL, .bodyBuffSize = 0};
+  struct respBuilder rb;
+  respInit(&rb, &conn);
+  int written = profFold(prof, &rb);
+  respAppendBody(&rb, "", 1);
+  int sum = 0;
+  for (char *line = conn.bodyBuff; rb.err == errOk && *line != 0; line = strchr(line, '\n') + 1) {
+    char *count = strchr(line, ' ');
+    fail |= count == NULL || count == line || strchr(line, '\n') == NULL || count > strchr(line, '\n');
+    if (fail) {
+      break;
+    }
+    sum += atoi(count+1);
+  }
+  fail |= rb.err != errOk || written == 0 || sum != written || written > atomic_load(&prof->nTaken);
+  free(conn.bodyBuff);
+  freeProfile(prof);
+  // one profile at a time
+  atomic_store(&wsProfBusy, 1);
+  fail |= profRun(10, 100, &err) != NULL || err != errFailed;
+  atomic_store(&wsProfBusy, 0);
+  fail |= profRun(10, 2000, &err) != NULL || err != errInit;
+  if (fail) {
+    return 1;
   }
 
-  struct httpRoute *route = createRoute("/testPage", httpGet, routeResponse, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  // the admin route is served on the unix socket listener only
+  pthread_t serverThread;
+  struct wsConfig config;
+  char abstract[64];
+  snprintf(abstract, sizeof abstract, "@wsProf-%d", (int)getpid());
+  webserver *wserver = malloc(sizeof *wserver);
+  if (wserver == NULL) {
+    return 1;
   }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsConfigAddListener(&config, listenerUnix, abstract, 0, &err);
+  wsInit(wserver, &config, &err);
+  struct httpRoute *route = createHandlerRoute("/admin/profile", httpGet, profileHandler, NULL, &err);
+  routeSetAdmin(route, &err);
   addRouteToWs(wserver, route, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  if (err != errOk || pthread_create(&serverThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
   }
-
-  wsListen(wserver, &err);
-  if (err != errOk) {
-    printErr(err);
-    freeWs(wserver);
-    return EXIT_FAILURE;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(wserver->port)};
+  struct sockaddr_un unixAddr = {.sun_family = AF_UNIX};
+  memcpy(unixAddr.sun_path + 1, abstract + 1, strlen(abstract) - 1); /* Flawfinder: ignore */ // fits sun_path
+  socklen_t unixAddrSize = offsetof(struct sockaddr_un, sun_path) + strlen(abstract); /* Flawfinder: ignore */ // \0 terminated above
+  struct timeval timeout = {.tv_sec = 5};
+  int tcpSock = socket(AF_INET, SOCK_STREAM, 0);
+  int unixSock = socket(AF_UNIX, SOCK_STREAM, 0);
+  setsockopt(tcpSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  setsockopt(unixSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+  if (connect(tcpSock, (struct sockaddr*)&addr, sizeof addr) != 0 || connect(unixSock, (struct sockaddr*)&unixAddr, unixAddrSize) != 0) {
+    return 1;
   }
+  char resp[WS_BUFF_SIZE * 64];
+  char *body;
+  int bodySize = 0;
+  // \0 terminated for strstr, one byte is never received
+  memset(resp, 0, sizeof resp);
+  const char *getProfile = "GET /admin/profile?seconds=1 HTTP/1.1\r\nHost: test\r\n\r\n";
+  const char *getInvalid = "GET /admin/profile?seconds=0 HTTP/1.1\r\nHost: test\r\n\r\n";
+  fail |= testProxyRequest(tcpSock, getProfile, strlen(getProfile), resp, sizeof resp, &body, &bodySize) != 404; /* Flawfinder: ignore */ // literal
+  bodySize = 0;
+  fail |= testProxyRequest(unixSock, getInvalid, strlen(getInvalid), resp, sizeof resp, &body, &bodySize) != 400; /* Flawfinder: ignore */ // literal
+  bodySize = 0;
+  fail |= testProxyRequest(unixSock, getProfile, strlen(getProfile), resp, sizeof resp - 1, &body, &bodySize) != 200 /* Flawfinder: ignore */ // literal
+    || strstr(resp, "X-Profile-Samples: ") == NULL;
+  close(tcpSock);
+  close(unixSock);
 
+  wsStop(wserver, 0);
+  pthread_join(serverThread, NULL);
   freeWs(wserver);
-  return 0;
+  return fail;
 }
 
+// client of testDrive, its requests are served by the loop driven by the test thread, then it stops the server
+struct testDriveClient {
+  webserver *wserver;
+  int fail;
+};
 
-// /* tests */
+void *testDriveClientThread(void *args) {
+  struct testDriveClient *client = (struct testDriveClient*)args;
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = htons(client->wserver->port)};
+  struct timeval timeout = {.tv_sec = 5};
+  char resp[WS_BUFF_SIZE];
+  char *body;
+  int bodySize;
+  const char *getHello = "GET /hello/drive HTTP/1.1\r\nHost: test\r\n\r\n";
 
-int testRespCraft() {
-  int err = 0;
-  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
-  if (testRouteResponse == NULL) {
-    return 1;
+  int socks[2];
+  for (int i = 0; i < 2; i++) {
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    client->fail |= connect(socks[i], (struct sockaddr*)&addr, sizeof addr) != 0;
   }
-  char *respBuff = malloc(sizeof(char)*WS_BUFF_SIZE);
-  if (respBuff == NULL) {
-    return 1;
+  for (int i = 0; i < 4 && !client->fail; i++) {
+    bodySize = 0;
+    client->fail |= testProxyRequest(socks[i % 2], getHello, strlen(getHello), resp, sizeof resp, &body, &bodySize) != 200 /* Flawfinder: ignore */ // literal
+      || bodySize != 11 || memcmp(body, "hello drive", 11) != 0;
   }
-  testRouteResponse->statusCode = 200;
-  testRouteResponse->reasonPhrase = "succ";
-  testRouteResponse->contentBuff = "Hai";
-  testRouteResponse->contentSize = 3;
-  craftResp(testRouteResponse, respBuff, WS_BUFF_SIZE, &err);
-
-  char craftedResponse[] = "HTTP/1.0 200 succ\r\n\
-Content-type: text/html, text, plain\r\n\
-Content-length: 3\r\n\
-\r\n\
-Hai";
-
-  if (strcmp(respBuff, craftedResponse) != 0) {
-    printf("NOT THE SAME \n");
-    return 1;
+  // the idle persistent connections are closed by the drain
+  wsStop(client->wserver, 0);
+  for (int i = 0; i < 2; i++) {
+    client->fail |= recv(socks[i], resp, sizeof resp, 0) != 0;
+    close(socks[i]);
   }
-  return 0;
+  return NULL;
 }
 
-int testParsing() {
-  int err = 0;
-
-  char parsingTestString[] = "GET /testPage HTTP/1.1\n\
-Host: localhost:8080\n\
-User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10.15; rv:95.0) Gecko/20100101 Firefox/95.0\n\
-Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\n\
-Accept-Language: de,en-US;q=0.7,en;q=0.3\n\
-Accept-Encoding: gzip, deflate\n\
-Connection: keep-alive\n\
-Upgrade-Insecure-Requests: 1\n\
-Sec-Fetch-Dest: document\n\
-Sec-Fetch-Mode: navigate\n\
-Sec-Fetch-Site: none\n\
-Sec-Fetch-User: ?1\n\
-Cache-Control: max-age=0\n\
-\n\
-";
+int testDrive() {
+  int err = errOk, fail = 0;
+  struct wsConfig config;
+  pthread_t clientThread;
 
-  struct httpRequest *httpReq = malloc(sizeof (struct httpRequest));
-  if (httpReq == NULL) {
+  webserver *wserver = createWs(&err);
+  if (err != errOk) {
     return 1;
   }
-  parseHttpRequest(httpReq, parsingTestString, 487, &err);
-  if (err != errOk){
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.driven = 1;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err);
+  wsInit(wserver, &config, &err);
+  addRouteToWs(wserver, createHandlerRoute("/hello/:name", httpGet, helloHandler, NULL, &err), &err);
+  if (err != errOk) {
     return 1;
   }
-
-  if (httpReq->httpVersion != 1.1 && httpReq->reqMethod != 0)  {
+  // driven servers don't listen on their own
+  wsListen(wserver, &err);
+  fail |= err != errInit;
+  wsStart(wserver, &err);
+  if (err != errOk || wsDriveFd(wserver) == -1) {
     return 1;
   }
+  fail |= wsDriveTimeout(wserver) != -1;
 
-  if (strcmp(httpReq->requestUri, "/testPage") != 0) {
+  // the event loop of the application, the server runs on this thread only
+  struct testDriveClient client = {.wserver = wserver, .fail = 0};
+  if (pthread_create(&clientThread, NULL, testDriveClientThread, &client) != 0) {
     return 1;
   }
+  struct pollfd pfd = {.fd = wsDriveFd(wserver), .events = POLLIN};
+  int nDrives = 0;
+  while (wsDrive(wserver, &err)) {
+    poll(&pfd, 1, wsDriveTimeout(wserver));
+    nDrives++;
+  }
+  pthread_join(clientThread, NULL);
+  fail |= err != errOk || client.fail || nDrives == 0 || wserver->loops[0].running || atomic_load(&wserver->loops[0].nCoroutines) != 0;
+  freeWs(wserver);
+  return fail;
+}
+
+#ifdef WS_ASSETS
+// the generated table is sorted & its headers are the ones serializeHeader writes
+int testAssets() {
+  char contentType[WS_BUFF_SIZE], header[WS_BUFF_SIZE];
+  int err;
+
+  for (int i = 0; i < WS_N_ASSETS; i++) {
+    const struct wsAsset *asset = &wsAssets[i];
+    if ((i > 0 && strcmp(wsAssets[i-1].path, asset->path) >= 0) || assetLookup(asset->path) != asset) {
+      return 1;
+    }
+    int contentTypeSize = snprintf(contentType, sizeof contentType, "Content-type: %s\r\n", asset->contentType);
+    for (int v = 0; v < assetNVariants; v++) {
+      const struct wsAssetVariant *variant = &asset->variants[v];
+      if (variant->header[0] == NULL) {
+        continue;
+      }
+      int notModified = variant->statusCode == 304;
+      for (int keepAlive = 0; keepAlive < 2; keepAlive++) {
+        int size = serializeHeader(variant->statusCode, notModified ? NULL : contentType, notModified ? 0 : contentTypeSize, notModified ? -1 : variant->bodySize,
+          keepAlive, NULL, variant->fields, variant->fieldsSize, header, sizeof header, &err);
+        if (err != errOk || size != variant->headerSize[keepAlive] || memcmp(header, variant->header[keepAlive], size) != 0) {
+          return 1;
+        }
+      }
+    }
+    if (asset->variants[assetGzip].header[0] == NULL) {
+      continue;
+    }
+    if ((uint8_t)asset->variants[assetGzip].body[0] != 0x1f || (uint8_t)asset->variants[assetGzip].body[1] != 0x8b
+      || asset->etag[assetGzip] == NULL || strcmp(asset->etag[assetIdentity], asset->etag[assetGzip]) == 0) {
+      return 1;
+    }
+    // the ETag of one coding doesn't validate the other
+    int headerSize = snprintf(header, sizeof header, "GET %s HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n", asset->path, asset->etag[assetGzip]);
+    if (assetVariant(asset, header, headerSize) != &asset->variants[assetIdentity]) {
+      return 1;
+    }
+    headerSize = snprintf(header, sizeof header, "GET %s HTTP/1.1\r\nAccept-Encoding: gzip\r\nIf-None-Match: %s\r\n\r\n", asset->path, asset->etag[assetGzip]);
+    if (assetVariant(asset, header, headerSize) != &asset->variants[assetGzipNotModified]) {
+      return 1;
+    }
+    headerSize = snprintf(header, sizeof header, "GET %s HTTP/1.1\r\nAccept-Encoding: gzip;q=0\r\nIf-None-Match: %s\r\n\r\n", asset->path, asset->etag[assetIdentity]);
+    if (assetVariant(asset, header, headerSize) != &asset->variants[assetNotModified]) {
+      return 1;
+    }
+  }
 
-  return 0;
+  // q=0 excludes a coding, an explicit entry takes precedence over *
+  char *accepted[] = {"gzip", "deflate, GZIP", "br;q=1, gzip;q=0.5", "*", "gzip; q=0.001", "*;q=0, gzip"};
+  char *refused[] = {"", "identity", "gzip;q=0", "gzip; q=0.000, br", "x-gzip", "*;q=0", "gzip;q=0, *", "br, *;q=0.0"};
+  for (int i = 0; i < 6; i++) {
+    if (!acceptsCoding(accepted[i], strlen(accepted[i]), "gzip")) { /* Flawfinder: ignore */ // literals
+      return 1;
+    }
+  }
+  for (int i = 0; i < 8; i++) {
+    if (acceptsCoding(refused[i], strlen(refused[i]), "gzip")) { /* Flawfinder: ignore */ // literals
+      return 1;
+    }
+  }
+  return assetLookup("/not/embedded") != NULL;
 }
+#endif
 
+#ifdef WS_TLS
+// writes a self-signed P-256 certificate & its key as pem to certFile & keyFile
+// returns 1 on success
+int testTlsWriteCert(const char *certFile, const char *keyFile) {
+  int ok = 0;
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  X509 *cert = X509_new();
+  if (key == NULL || cert == NULL) {
+    goto out;
+  }
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  X509_NAME *name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  if (X509_sign(cert, key, EVP_sha256()) == 0) {
+    goto out;
+  }
+  FILE *f = fopen(certFile, "w");
+  if (f == NULL) {
+    goto out;
+  }
+  ok = PEM_write_X509(f, cert);
+  fclose(f);
+  f = fopen(keyFile, "w");
+  if (f == NULL) {
+    ok = 0;
+    goto out;
+  }
+  ok &= PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL);
+  fclose(f);
+out:
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  return ok;
+}
 
-int testCreateRoute() {
-  int err = 0;
-  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
-  if (testRouteResponse == NULL) {
-    return 1;
+// requests "/" over a new tls connection, resuming session if given
+// returns the session of the connection (to be freed) if "ok" was replied, NULL otherwise
+SSL_SESSION *testTlsRequest(SSL_CTX *ctx, struct sockaddr_in *addr, SSL_SESSION *session, int *resumed) {
+  const char *req = "GET / HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n";
+  char resp[512];
+  int respSize = 0, readSize;
+  SSL_SESSION *newSession = NULL;
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  SSL *ssl = SSL_new(ctx);
+  if (sock == -1 || ssl == NULL || connect(sock, (struct sockaddr*)addr, sizeof *addr) != 0) {
+    goto out;
   }
-  testRouteResponse->statusCode = 200;
-  testRouteResponse->reasonPhrase = "test";
-  testRouteResponse->contentBuff = "test";
-  testRouteResponse->contentSize = 4;
-  struct httpRoute *testRoute = createRoute("/test", httpGet, testRouteResponse, &err);
-  if (err != errOk) {
-    return 1;
+  SSL_set_fd(ssl, sock);
+  if (session != NULL) {
+    SSL_set_session(ssl, session);
   }
-  free(testRoute->path);
-  free(testRoute);
-  free(testRouteResponse);
-  return 0;
+  if (SSL_connect(ssl) != 1 || SSL_write(ssl, req, strlen(req)) <= 0) { /* Flawfinder: ignore */ // constant
+    goto out;
+  }
+  // read until close, tls 1.3 session tickets arrive after the handshake
+  while ((readSize = SSL_read(ssl, resp + respSize, sizeof resp - 1 - respSize)) > 0) {
+    respSize += readSize;
+  }
+  resp[respSize] = 0;
+  *resumed = SSL_session_reused(ssl);
+  if (strncmp(resp, "HTTP/1.1 200", 12) == 0 && respSize >= 2 && memcmp(resp + respSize - 2, "ok", 2) == 0) {
+    newSession = SSL_get1_session(ssl);
+  }
+  // sessions of connections freed without shutdown are not resumable
+  SSL_shutdown(ssl);
+out:
+  SSL_free(ssl);
+  if (sock != -1) {
+    close(sock);
+  }
+  return newSession;
 }
 
-int testWsInitAndFree() {
-  int err = 0;
-  webserver *wserver = malloc(sizeof *wserver);
-  if (wserver == NULL) {
+int testTls() {
+  int err = errOk, resumed = 0;
+  struct wsConfig config;
+  pthread_t listenThread;
+  char certFile[64], keyFile[64];
+  snprintf(certFile, sizeof certFile, "/tmp/wsTest-%d-cert.pem", (int)getpid());
+  snprintf(keyFile, sizeof keyFile, "/tmp/wsTest-%d-key.pem", (int)getpid());
+  if (!testTlsWriteCert(certFile, keyFile)) {
     return 1;
   }
 
-  wsInit(wserver, 8080, &err);
+  webserver *wserver = malloc(sizeof *wserver);
+  struct httpResponse *resp = malloc(sizeof *resp);
+  if (wserver == NULL || resp == NULL) {
+    return 1;
+  }
+  wsDefaultConfig(&config, 0);
+  config.nListeners = 0;
+  config.tlsCertFile = certFile;
+  config.tlsKeyFile = keyFile;
+  wsConfigAddListener(&config, listenerTcp, "127.0.0.1", 0, &err)->tls = 1;
+  wsInit(wserver, &config, &err);
+  unlink(certFile);
+  unlink(keyFile);
   if (err != errOk) {
     return 1;
   }
+  *resp = (struct httpResponse){.statusCode = 200, .isFile = 0, .contentBuff = "ok", .contentSize = 2};
+  addRouteToWs(wserver, createRoute("/", httpGet, resp, &err), &err);
+  if (err != errOk || pthread_create(&listenThread, NULL, benchListenThread, wserver) != 0) {
+    return 1;
+  }
+  struct sockaddr_in addr;
+  socklen_t addrSize = sizeof addr;
+  getsockname(wserver->listeners[0].socket, (struct sockaddr*)&addr, &addrSize);
 
-  struct httpResponse *testRouteResponse = malloc(sizeof(struct httpResponse));
-  if (testRouteResponse == NULL) {
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  if (ctx == NULL) {
     return 1;
   }
-  testRouteResponse->statusCode = 200;
-  testRouteResponse->reasonPhrase = "test";
-  testRouteResponse->contentBuff = "test";
-  testRouteResponse->contentSize = 4;
-  struct httpRoute *mainRoute = createRoute("/", httpGet, testRouteResponse, &err);
-  if (err != errOk) {
+  // tls 1.3 session tickets are only kept by clients with a session cache
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+  // full handshake, then an abbreviated one resuming its session
+  SSL_SESSION *session = testTlsRequest(ctx, &addr, NULL, &resumed);
+  if (session == NULL || resumed) {
+    return 1;
+  }
+  SSL_SESSION *resumedSession = testTlsRequest(ctx, &addr, session, &resumed);
+  if (resumedSession == NULL || !resumed) {
     return 1;
   }
+  SSL_SESSION_free(session);
+  SSL_SESSION_free(resumedSession);
+  SSL_CTX_free(ctx);
 
-  addRouteToWs(wserver, mainRoute, &err);
-  if (err != errOk) {
+  // plain http on the tls listener fails the handshake
+  if (testListenerRequest((struct sockaddr*)&addr, sizeof addr)) {
     return 1;
   }
 
-  return 0;
+  wsStop(wserver, 0);
+  pthread_join(listenThread, NULL);
+  int fail = atomic_load(&wserver->tlsStats.handshakes) != 2 || atomic_load(&wserver->tlsStats.resumed) != 1
+    || atomic_load(&wserver->tlsStats.failed) != 1 || atomic_load(&wserver->tlsStats.cpuNs) == 0;
+  freeWs(wserver);
+  return fail;
 }
+#endif
+#endif
@@ -0,0 +1,221 @@
+// public api of the webserver, for applications embedding it (libbasicwebserver, see README "Library")
+// structs which are only declared here are opaque, everything else of webserver.c is internal (hidden in the library)
+
+#ifndef WEBSERVER_H
+#define WEBSERVER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* listener parameters */
+
+// max number of endpoints (tcp & unix sockets) the server listens on, all are handed over on upgrade
+#define WS_MAX_LISTENERS 8
+
+/* declarations */
+
+enum errReturnCode {
+  errOk,
+  errFailed,
+  errMemAlloc,
+  errSecCheck,
+  errInit,
+  errParse,
+  errNet,
+  errIO
+};
+
+enum httpMethod {
+  httpGet,
+  httpPost,
+  httpPut,
+  httpHead,
+  httpOptions,
+  httpDelete,
+  httpPatch,
+  httpNMethods
+};
+
+enum listenerType {
+  listenerTcp,
+  listenerUnix
+};
+
+// endpoint the server listens on
+struct wsListenerConfig {
+  int type;
+  // tcp: numeric IPv4/ IPv6 address, NULL for any IPv4 address
+  // unix: socket path, a leading '@' binds in the abstract namespace
+  // not copied, has to outlive wsInit
+  const char *address;
+  unsigned short port;
+  // unix: file mode of the socket path (e.g. 0660), 0 keeps the umask default
+  int mode;
+  // tcp IPv6: only IPv6 is accepted instead of dual-stack (IPv4 mapped addresses)
+  int v6Only;
+  // connections are TLS terminated with the certificate of the wsConfig (WS_TLS builds)
+  int tls;
+};
+
+struct wsConfig {
+  struct wsListenerConfig listeners[WS_MAX_LISTENERS];
+  int nListeners;
+  // PEM certificate (chain) & private key of tls listeners
+  const char *tlsCertFile;
+  const char *tlsKeyFile;
+  int listenBacklog;
+  int maxConns;
+  int maxQueued;
+  int queueTargetMs;
+  int queueIntervalMs;
+  int retryAfterSec;
+  int headerTimeoutMs;
+  int bodyTimeoutMs;
+  int keepAliveTimeoutMs;
+  int writeTimeoutMs;
+  int drainTimeoutMs;
+  int tcpNoDelay;
+  int tcpCork;
+  int deferAcceptSec;
+  int fastOpenQueue;
+  int reuseAddr;
+  int sndBufSize;
+  int rcvBufSize;
+  int http2;
+  // memory budget of the response cache in bytes, 0 disables it
+  long long cacheSize;
+  // event loop threads serving connections as coroutines, 0 for a client thread per connection
+  int nLoops;
+  // connections are served by coroutines of a single event loop driven by the application (wsStart & wsDrive) instead of
+  // wsListen, no thread is started (except the blocking pool if there are blocking routes), nLoops is ignored
+  int driven;
+  // pool running the handlers of blocking routes if nLoops > 0, 0 runs them on the loops
+  int nBlockingThreads;
+  int blockingQueueSize;
+  // token bucket of every client address (requests per second & burst), 0 disables it (routes can be limited on their own)
+  int rateLimit;
+  int rateBurst;
+  // 1 in traceSample http/1.x requests is traced (span per stage), 0 disables tracing
+  int traceSample;
+};
+
+// non owning, not \0 terminated string slice
+struct wsSlice {
+  char *data;
+  int size;
+};
+
+struct httpResponse {
+  int statusCode;
+  int isFile;
+  int contentSize;
+  char *contentBuff;
+  // status line & header fields serialized when the route is added, indexed by keepAlive
+  char *header[2];
+  int headerSize[2];
+};
+
+enum proxyBalance {
+  // the healthy upstream with the least requests in flight, ties are broken round robin
+  proxyBalanceLeast,
+  // consistent hashing of the key (header field or path) on a ring of WS_PROXY_RING_REPLICAS points per upstream
+  proxyBalanceHash
+};
+
+// unit of work of an executor, run once by a worker (or a worker joining its group)
+// tasks are owned by the submitter, e.g. on the stack of the task which forks & joins them
+struct wsTask {
+  void (*fn)(void *arg);
+  void *arg;
+  // group of the forked task, NULL for tasks submitted with execRun
+  struct wsTaskGroup *group;
+  // inject stack of the executor
+  struct wsTask *next;
+};
+
+// forked tasks which are joined together (execJoin), pending starts at 0
+struct wsTaskGroup {
+  atomic_int pending;
+};
+
+typedef struct webserver webserver;
+struct httpRoute;
+struct httpRequest;
+struct respBuilder;
+struct wsProxy;
+struct wsExecutor;
+
+// handler of dynamic routes, builds the response to req with the response builder
+typedef void (*wsHandler)(struct httpRequest *req, struct respBuilder *resp, void *ctx);
+
+// the declarations below are the symbols of the library, everything else is hidden (see CMakeLists.txt)
+#pragma GCC visibility push(default)
+
+/* server */
+
+void wsDefaultConfig(struct wsConfig *config, int port);
+struct wsListenerConfig *wsConfigAddListener(struct wsConfig *config, int type, const char *address, unsigned short port, int *err);
+webserver *createWs(int *err);
+void wsInit(webserver *wserver, struct wsConfig *config, int *err);
+// startup only, a previously loaded snapshot is unmapped while requests may still use it
+void wsLoadRoutes(webserver *wserver, const char *configFile, const char *snapshotFile, int *err);
+void wsHandleSignals(webserver *wserver, char **argv, int *err);
+void wsListen(webserver *wserver, int *err);
+void wsStop(webserver *wserver, int upgrade);
+void freeWs(webserver *wserver);
+void printErr(int err);
+
+/* event loop integration (wsConfig.driven) */
+
+void wsStart(webserver *wserver, int *err);
+int wsDriveFd(webserver *wserver);
+int wsDriveTimeout(webserver *wserver);
+int wsDrive(webserver *wserver, int *err);
+
+/* routes, to be configured before they're added */
+
+struct httpRoute *createRoute(char *path, int method, struct httpResponse *resp, int *err);
+struct httpRoute *createHandlerRoute(char *path, int method, wsHandler handler, void *ctx, int *err);
+struct httpRoute *createProxyRoute(char *path, int method, struct wsProxy *proxy, int *err);
+void addRouteToWs(webserver *ws, struct httpRoute *route, int *err);
+void routeSetMaxBodySize(struct httpRoute *route, long long size, int *err);
+void routeSetCache(struct httpRoute *route, int ttlMs, int staleMs, const char *vary, int *err);
+void routeSetBlocking(struct httpRoute *route, int *err);
+void routeSetAdmin(struct httpRoute *route, int *err);
+void routeSetRateLimit(struct httpRoute *route, int rate, int burst, int *err);
+struct wsProxy *createProxy(int balance, const char *hashHeader, int *err);
+void proxyAddUpstream(struct wsProxy *proxy, const char *host, unsigned short port, int *err);
+void freeProxy(struct wsProxy *proxy);
+
+/* handlers */
+
+int getRequestMethod(struct httpRequest *req);
+const char *getRequestPath(struct httpRequest *req);
+char *getRequestHeader(struct httpRequest *req, const char *name, int *valueSize);
+int getPathParam(struct httpRequest *req, const char *name, struct wsSlice *value);
+int getQueryParam(struct httpRequest *req, const char *key, struct wsSlice *value);
+int getFormParam(struct httpRequest *req, const char *key, struct wsSlice *value, int *err);
+int readBody(struct httpRequest *req, char *buff, int buffSize, int *err);
+void respSetStatus(struct respBuilder *rb, int statusCode);
+void respAddHeader(struct respBuilder *rb, const char *name, const char *value);
+void respAppendBody(struct respBuilder *rb, const char *data, int size);
+void respPrintf(struct respBuilder *rb, const char *format, ...);
+int coWait(int fd, uint32_t events, int timeoutMs);
+int coWaitIo(int fd, uint32_t events, int timeoutMs);
+// handlers of the /stats, /admin/trace & /admin/profile routes of the example binary, ctx is the webserver (none for profileHandler)
+void statsHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx);
+void traceHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx);
+void profileHandler(struct httpRequest *req, struct respBuilder *resp, void *ctx);
+
+/* executor, for cpu heavy handler work (a handler coroutine parks while it waits) */
+
+struct wsExecutor *createExecutor(int nWorkers, int *err);
+void execRun(struct wsExecutor *executor, void (*fn)(void *arg), void *arg);
+void execFork(struct wsExecutor *executor, struct wsTaskGroup *group, struct wsTask *task);
+void execJoin(struct wsExecutor *executor, struct wsTaskGroup *group);
+void execStats(struct wsExecutor *executor, unsigned long *executed, unsigned long *stolen);
+void freeExecutor(struct wsExecutor *executor);
+
+#pragma GCC visibility pop
+
+#endif